@@ -27,19 +27,16 @@ uint32_t to_grayscale( uint32_t pixel ) {
   uint32_t r = get_r(pixel);
   uint32_t g = get_g(pixel);
   uint32_t b = get_b(pixel);
-  uint32_t y = ( 79 * r + 128 * g + 49 * b ) / 256;
+  uint32_t y = imgproc_luma( r, g, b );
   return make_pixel( y, y, y, get_a(pixel) );
 }
 
 // Compute the gradient needed for pixel at index `x`
-int64_t gradient( int64_t x, int64_t max ) {
-  int64_t square = ((2000000000LL * x) / (1000000LL * max) - 1000);
-  return 1000000LL - square * square;
-}
+int64_t gradient( int64_t x, int64_t max ) { return imgproc_fade_gradient( x, max ); }
 
 // Compute the 1-dimensional index from column and row indices
-int32_t compute_index( struct Image *img, int32_t col, int32_t row ) {
-  return row * img->width + col;
+int64_t compute_index( struct Image *img, int32_t col, int32_t row ) {
+  return (int64_t) row * img->width + col;
 }
 
 // Convert input pixels to grayscale.
@@ -52,9 +49,9 @@ int32_t compute_index( struct Image *img, int32_t col, int32_t row ) {
 void imgproc_grayscale( struct Image *input_img, struct Image *output_img ) {
   for (int i=0;i<input_img->height;i++)
     for (int j=0;j<input_img->width;j++) {
-      int input_index = compute_index(input_img, j, i);
+      int64_t input_index = compute_index(input_img, j, i);
       uint32_t pixel = input_img->data[input_index];
-      int output_index = compute_index(output_img, j, i);
+      int64_t output_index = compute_index(output_img, j, i);
       output_img->data[output_index] = to_grayscale(pixel);
     }
 }
@@ -89,13 +86,13 @@ void imgproc_grayscale( struct Image *input_img, struct Image *output_img ) {
 void imgproc_rgb( struct Image *input_img, struct Image *output_img ) {
   for (int i=0;i<input_img->height;i++)
     for (int j=0;j<input_img->width;j++) {
-      int input_index = compute_index(input_img, j, i);
+      int64_t input_index = compute_index(input_img, j, i);
       uint32_t pixel = input_img->data[input_index];
 
-      int copy_index = compute_index( output_img, j,                      i                       );
-      int red_index  = compute_index( output_img, (input_img->width + j), i                       );
-      int green_index= compute_index( output_img, j,                      (input_img->height + i) );
-      int blue_index = compute_index( output_img, (input_img->width + j), (input_img->height + i) );
+      int64_t copy_index = compute_index( output_img, j,                      i                       );
+      int64_t red_index  = compute_index( output_img, (input_img->width + j), i                       );
+      int64_t green_index= compute_index( output_img, j,                      (input_img->height + i) );
+      int64_t blue_index = compute_index( output_img, (input_img->width + j), (input_img->height + i) );
       
       output_img->data[copy_index] =  pixel;
       output_img->data[red_index]  =  make_pixel( get_r(pixel), 0, 0, get_a(pixel) );
@@ -124,7 +121,7 @@ void imgproc_fade( struct Image *input_img, struct Image *output_img ) {
     for (int64_t col = 0; col < width; col++){
       int64_t col_fade = gradient(col, width);
 
-      int32_t idx = compute_index(input_img, col, row);
+      int64_t idx = compute_index(input_img, col, row);
       uint32_t pixel = input_img->data[idx];
 
       uint32_t r = get_r(pixel);
@@ -202,9 +199,9 @@ int imgproc_kaleidoscope( struct Image *input_img, struct Image *output_img ) {
   // top left  
   for (int32_t i = 0; i < half; i++){
     for (int32_t j = i; j < half; j++){
-      int32_t idx_original  = compute_index(input_img, j, i);
-      int32_t idx_copy      = compute_index(output_img, j, i);
-      int32_t idx_reflect   = compute_index(output_img, i, j);
+      int64_t idx_original  = compute_index(input_img, j, i);
+      int64_t idx_copy      = compute_index(output_img, j, i);
+      int64_t idx_reflect   = compute_index(output_img, i, j);
       output_img->data[idx_copy]    = input_img->data[idx_original];
       output_img->data[idx_reflect] = input_img->data[idx_original]; 
     }
@@ -212,17 +209,17 @@ int imgproc_kaleidoscope( struct Image *input_img, struct Image *output_img ) {
 
   for (int32_t i = 0; i < half; i++){
     for (int32_t j = 0; j < half; j++){
-      int32_t idx_original = compute_index(output_img, j, i);
+      int64_t idx_original = compute_index(output_img, j, i);
       if (even || j > 0) {
-        int32_t idx_top_right = compute_index(output_img, (width - 1 - j), i);
+        int64_t idx_top_right = compute_index(output_img, (width - 1 - j), i);
         output_img->data[idx_top_right] = output_img->data[idx_original];
       }
       if (even || i > 0) {
-        int32_t idx_bottom_left = compute_index(output_img, j, (height - 1 - i));
+        int64_t idx_bottom_left = compute_index(output_img, j, (height - 1 - i));
         output_img->data[idx_bottom_left] = output_img->data[idx_original];
       }
       if (even || (i > 0 && j > 0)) {
-        int32_t idx_bottom_right = compute_index(output_img, (width - 1 - j), (height - 1 - i));
+        int64_t idx_bottom_right = compute_index(output_img, (width - 1 - j), (height - 1 - i));
         output_img->data[idx_bottom_right] = output_img->data[idx_original];
       }
     }
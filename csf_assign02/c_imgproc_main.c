@@ -3,45 +3,233 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
 #include "imgproc.h"
 
+// Number of input files read ahead in batch (directory) mode
+#define DEFAULT_PREFETCH_DEPTH 4
+
 struct Transformation {
   const char *name;
   int (*apply)( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+  bool in_place; // true if each output pixel only depends on the input pixel at the same index
 };
 
 int apply_rgb( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_grayscale( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_fade( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_kaleidoscope( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_blur( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_gaussian( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_sobel( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_sharpen( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_resize( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_grayscale_linear( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_fade_linear( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_autolevels( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_transpose( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_rotate90( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_rotate180( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_rotate270( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_flip_h( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_flip_v( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_affine( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_composite( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 
 static const struct Transformation s_transformations[] = {
-  { "rgb", apply_rgb },
-  { "grayscale", apply_grayscale },
-  { "fade", apply_fade },
-  { "kaleidoscope", apply_kaleidoscope },
-  { NULL, NULL },
+  { "rgb", apply_rgb, false },
+  { "grayscale", apply_grayscale, true },
+  { "fade", apply_fade, true },
+  { "kaleidoscope", apply_kaleidoscope, false },
+  { "blur", apply_blur, false },
+  { "gaussian", apply_gaussian, false },
+  { "sobel", apply_sobel, false },
+  { "sharpen", apply_sharpen, false },
+  { "resize", apply_resize, false },
+  { "grayscale_linear", apply_grayscale_linear, true },
+  { "fade_linear", apply_fade_linear, true },
+  { "autolevels", apply_autolevels, true },
+  { "transpose", apply_transpose, false },
+  { "rotate90", apply_rotate90, false },
+  { "rotate180", apply_rotate180, false },
+  { "rotate270", apply_rotate270, false },
+  { "flip_h", apply_flip_h, false },
+  { "flip_v", apply_flip_v, false },
+  { "affine", apply_affine, false },
+  { "composite", apply_composite, true },
+  { NULL, NULL, false },
+};
+
+enum StatsFormat {
+  STATS_NONE,
+  STATS_TEXT,
+  STATS_JSON,
+};
+
+enum Stage {
+  STAGE_READ,
+  STAGE_TRANSFORM,
+  STAGE_WRITE,
+  NUM_STAGES,
+};
+
+static const char *const s_stage_names[NUM_STAGES] = { "read", "transform", "write" };
+
+// Timing and I/O counters of one stage of processing
+struct StageStats {
+  double wall_s;          // elapsed wall-clock time in seconds
+  double cpu_s;           // CPU time of all threads in seconds
+  int64_t pixels;         // pixels processed by the stage
+  struct ImgIoStats io;   // image library I/O done during the stage
+  bool ran;               // false if the stage was never reached
+};
+
+// Clock readings taken at the start of a stage
+struct StageClock {
+  struct timespec wall;
+  struct timespec cpu;
+  struct ImgIoStats io;
 };
 
 void usage( const char *progname ) {
   fprintf( stderr, "Error: invalid command-line arguments\n" );
-  fprintf( stderr, "Usage: %s <transform> <input img> <output img> [args...]\n", progname );
+  fprintf( stderr, "Usage: %s [--stats[=json]] [--prefetch=N] <transform> <input img> <output img> [args...]\n", progname );
+  fprintf( stderr, "       %s [--stats[=json]] [--prefetch=N] <transform> <input dir> <output dir> [args...]\n", progname );
   exit( 1 );
 }
 
+double timespec_diff( const struct timespec *begin, const struct timespec *end ) {
+  return (double) ( end->tv_sec - begin->tv_sec ) + ( end->tv_nsec - begin->tv_nsec ) * 1e-9;
+}
+
+// Record the clocks and I/O counters at the start of a stage
+void stage_begin( struct StageClock *clock ) {
+  clock_gettime( CLOCK_MONOTONIC, &clock->wall );
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &clock->cpu );
+  img_get_io_stats( &clock->io );
+}
+
+// Add the statistics of a stage that started at the given clock
+// reading (in batch mode, the stages of all images are summed)
+void stage_end( const struct StageClock *clock, struct StageStats *stats, int64_t pixels ) {
+  struct StageClock now;
+  stage_begin( &now );
+  stats->wall_s += timespec_diff( &clock->wall, &now.wall );
+  stats->cpu_s += timespec_diff( &clock->cpu, &now.cpu );
+  stats->pixels += pixels;
+  stats->io.bytes_read += now.io.bytes_read - clock->io.bytes_read;
+  stats->io.bytes_inflated += now.io.bytes_inflated - clock->io.bytes_inflated;
+  stats->io.bytes_deflated += now.io.bytes_deflated - clock->io.bytes_deflated;
+  stats->io.bytes_written += now.io.bytes_written - clock->io.bytes_written;
+  stats->ran = true;
+}
+
+double megapixels_per_sec( const struct StageStats *stats ) {
+  return stats->wall_s > 0.0 ? stats->pixels / stats->wall_s * 1e-6 : 0.0;
+}
+
+// Print a string as a JSON string literal
+void print_json_string( FILE *out, const char *s ) {
+  fputc( '"', out );
+  for ( ; *s != '\0'; s++ ) {
+    unsigned char c = (unsigned char) *s;
+    if ( c == '"' || c == '\\' )
+      fprintf( out, "\\%c", c );
+    else if ( c < 0x20 )
+      fprintf( out, "\\u%04x", c );
+    else
+      fputc( c, out );
+  }
+  fputc( '"', out );
+}
+
+// Print the per-stage statistics to stdout, as a table or a JSON object
+void print_stats( enum StatsFormat format, const char *transformation,
+                  const char *input_filename, const char *output_filename,
+                  const struct StageStats *stages, bool success ) {
+  struct rusage usage;
+  long peak_rss_kib = getrusage( RUSAGE_SELF, &usage ) == 0 ? usage.ru_maxrss : 0;
+
+  if ( format == STATS_JSON ) {
+    printf( "{\"transform\": " );
+    print_json_string( stdout, transformation );
+    printf( ", \"input\": " );
+    print_json_string( stdout, input_filename );
+    printf( ", \"output\": " );
+    print_json_string( stdout, output_filename );
+    printf( ", \"success\": %s, \"threads\": %d, \"stages\": {",
+            success ? "true" : "false", imgproc_get_num_threads() );
+    bool first = true;
+    for ( int i = 0; i < NUM_STAGES; i++ ) {
+      const struct StageStats *st = &stages[i];
+      if ( !st->ran )
+        continue;
+      printf( "%s\"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"pixels\": %lld, "
+              "\"mpix_per_s\": %.3f, \"bytes_read\": %llu, \"bytes_inflated\": %llu, "
+              "\"bytes_deflated\": %llu, \"bytes_written\": %llu}",
+              first ? "" : ", ", s_stage_names[i], st->wall_s, st->cpu_s,
+              (long long) st->pixels, megapixels_per_sec( st ),
+              (unsigned long long) st->io.bytes_read,
+              (unsigned long long) st->io.bytes_inflated,
+              (unsigned long long) st->io.bytes_deflated,
+              (unsigned long long) st->io.bytes_written );
+      first = false;
+    }
+    printf( "}, \"peak_rss_kib\": %ld}\n", peak_rss_kib );
+    return;
+  }
+
+  printf( "%s: %s -> %s (%s, %d threads)\n", transformation, input_filename, output_filename,
+          success ? "ok" : "failed", imgproc_get_num_threads() );
+  printf( "%-10s %10s %10s %10s %12s %12s\n", "stage", "wall ms", "cpu ms", "Mpix/s", "in bytes", "out bytes" );
+  for ( int i = 0; i < NUM_STAGES; i++ ) {
+    const struct StageStats *st = &stages[i];
+    if ( !st->ran )
+      continue;
+    // bytes in/out: compressed file bytes vs. decoded pixel bytes
+    unsigned long long in_bytes = st->io.bytes_read, out_bytes = st->io.bytes_inflated;
+    if ( i == STAGE_WRITE ) {
+      in_bytes = st->io.bytes_deflated;
+      out_bytes = st->io.bytes_written;
+    }
+    printf( "%-10s %10.3f %10.3f %10.2f %12llu %12llu\n", s_stage_names[i],
+            st->wall_s * 1e3, st->cpu_s * 1e3, megapixels_per_sec( st ), in_bytes, out_bytes );
+  }
+  printf( "peak RSS: %ld KiB\n", peak_rss_kib );
+}
+
 // Make a new empty image.
 // If transformation is "rgb", then the new image will
 // have width and height twice that of the input image,
-// otherwise the output image will be the same dimensions as
-// the input image.
-struct Image *create_output_img( struct Image *input_img, const char *transformation ) {
+// if it is "resize", the width and height are taken from the
+// transformation arguments, if it is "transpose", "rotate90" or
+// "rotate270" the width and height are swapped, otherwise the output
+// image will be the same dimensions as the input image.
+// If output_filename is not NULL and names a raw RGBA file, the new
+// image is a shared mapping of that file, so the transformation writes
+// its output directly to it.
+struct Image *create_output_img( struct Image *input_img, const char *transformation,
+                                 const char *output_filename, int argc, char **argv ) {
   struct Image *out_img;
   int32_t out_w = input_img->width, out_h = input_img->height;
 
   if ( strcmp( transformation, "rgb" ) == 0 ) {
     out_w *= 2;
     out_h *= 2;
+  } else if ( strcmp( transformation, "transpose" ) == 0 || strcmp( transformation, "rotate90" ) == 0
+              || strcmp( transformation, "rotate270" ) == 0 ) {
+    out_w = input_img->height;
+    out_h = input_img->width;
+  } else if ( strcmp( transformation, "resize" ) == 0 ) {
+    if ( argc < 6 || ( out_w = atoi( argv[4] ) ) <= 0 || ( out_h = atoi( argv[5] ) ) <= 0 ) {
+      fprintf( stderr, "Error: resize requires a positive width and height\n" );
+      return NULL;
+    }
   }
 
   // Allocate Image object
@@ -53,7 +241,11 @@ struct Image *create_output_img( struct Image *input_img, const char *transforma
   out_img->data = NULL;
 
   // Attempt to initialize the Image object by calling img_init
-  if ( img_init( out_img, out_w, out_h ) != IMG_SUCCESS ) {
+  // (or img_create_raw, to map the output file)
+  int rc = ( output_filename != NULL && img_is_raw_filename( output_filename ) )
+    ? img_create_raw( output_filename, out_img, out_w, out_h )
+    : img_init( out_img, out_w, out_h );
+  if ( rc != IMG_SUCCESS ) {
     free( out_img );
     return NULL;
   }
@@ -62,6 +254,14 @@ struct Image *create_output_img( struct Image *input_img, const char *transforma
   return out_img;
 }
 
+// Check whether two file names refer to the same existing file
+bool same_file( const char *a, const char *b ) {
+  struct stat st_a, st_b;
+  if ( stat( a, &st_a ) != 0 || stat( b, &st_b ) != 0 )
+    return false;
+  return st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino;
+}
+
 // Free memory allocated to given Image object
 void cleanup_image( struct Image *img ) {
   if ( img != NULL ) {
@@ -70,62 +270,226 @@ void cleanup_image( struct Image *img ) {
   }
 }
 
-int main( int argc, char **argv ) {
-  if ( argc < 4 )
-    usage( argv[0] );
+// Check whether a file name names an existing directory
+bool is_directory( const char *filename ) {
+  struct stat st;
+  return stat( filename, &st ) == 0 && S_ISDIR( st.st_mode );
+}
 
-  const char *transformation = argv[1];
-  const char *input_filename = argv[2];
-  const char *output_filename = argv[3];
+// Read, transform and write one image, adding the time spent in each
+// stage to stages. If pf is not NULL, the input file is taken from
+// the prefetcher (as file number index) instead of being read here.
+bool process_image( const struct Transformation *xform, const char *transformation,
+                    const char *input_filename, const char *output_filename,
+                    int argc, char **argv, struct StageStats stages[NUM_STAGES],
+                    struct ImgPrefetcher *pf, int index ) {
+  // A raw file transformed into itself by a transformation that
+  // can work in place is mapped shared and modified directly.
+  // Otherwise the output can't be mapped over its own input.
+  bool raw_output = img_is_raw_filename( output_filename );
+  bool overwrite_input = same_file( input_filename, output_filename );
+  bool in_place = xform != NULL && xform->in_place && raw_output && overwrite_input;
+  // the output is a mapping of the output file, rather than an image
+  // (on the heap or in a scratch file) that has to be written out
+  bool mapped_output = in_place || ( raw_output && !overwrite_input );
+
+  struct StageClock clock;
 
   // Allocate and read the input image
+  stage_begin( &clock );
   struct Image *input_img = (struct Image *) malloc( sizeof( struct Image ) );
   if ( input_img == NULL ) {
     fprintf( stderr, "Error: couldn't allocate input image\n" );
     exit( 1 );
   }
-  if ( img_read( input_filename, input_img ) != IMG_SUCCESS ) {
-    fprintf( stderr, "Error: couldn't read input image\n" );
+  int rc;
+  if ( pf != NULL ) {
+    // prefetched files are PNGs, decoded from memory
+    void *data = NULL;
+    size_t size = 0;
+    rc = img_prefetch_take( pf, index, &data, &size );
+    if ( rc == IMG_SUCCESS )
+      rc = img_read_memory( data, size, input_img );
+    free( data );
+  } else {
+    rc = in_place
+      ? img_map_raw( input_filename, input_img, 1 )
+      : img_read( input_filename, input_img );
+  }
+  if ( rc != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read input image %s\n", input_filename );
     free( input_img );
-    return 1;
+    return false;
   }
+  stage_end( &clock, &stages[STAGE_READ], (int64_t) input_img->width * input_img->height );
 
   // Create output Image object
-  struct Image *output_img = create_output_img( input_img, transformation );
+  struct Image *output_img = in_place
+    ? input_img
+    : create_output_img( input_img, transformation,
+                         overwrite_input ? NULL : output_filename, argc, argv );
   if ( output_img == NULL ) {
     fprintf( stderr, "Error: couldn't create output image object\n" );
     cleanup_image( input_img );
-    return 1;
+    return false;
   }
 
-  // find transformation
-  const struct Transformation *xform = NULL;
-  for ( int i = 0; s_transformations[i].name != NULL; ++i )
-    if ( strcmp( s_transformations[i].name, transformation ) == 0 ) {
-      xform = &s_transformations[i];
-      break;
-    }
-
-  int success;
+  bool success;
 
   if ( xform != NULL ) {
     // apply the transformation!
+    stage_begin( &clock );
     success = xform->apply( input_img, output_img, argc, argv ) != 0;
+    stage_end( &clock, &stages[STAGE_TRANSFORM], (int64_t) output_img->width * output_img->height );
   } else {
     fprintf( stderr, "Error: unknown transformation '%s'\n", transformation );
-    success = 0;
+    success = false;
   }
 
   if ( success ) {
-    // Write output image
-    if ( img_write( output_filename, output_img ) != IMG_SUCCESS ) {
-      fprintf( stderr, "Error: couldn't write output image\n" );
+    // Write output image (a mapped raw output only needs flushing)
+    stage_begin( &clock );
+    rc = mapped_output
+      ? img_sync( output_img )
+      : img_write( output_filename, output_img );
+    stage_end( &clock, &stages[STAGE_WRITE], (int64_t) output_img->width * output_img->height );
+    if ( rc != IMG_SUCCESS ) {
+      fprintf( stderr, "Error: couldn't write output image %s\n", output_filename );
       success = false;
     }
   }
 
+  if ( output_img != input_img )
+    cleanup_image( output_img );
   cleanup_image( input_img );
-  cleanup_image( output_img );
+  return success;
+}
+
+int compare_names( const void *a, const void *b ) {
+  return strcmp( *(char *const *) a, *(char *const *) b );
+}
+
+// Allocate the string "<dir>/<name>"
+char *join_path( const char *dir, const char *name ) {
+  size_t len = strlen( dir ) + strlen( name ) + 2;
+  char *path = (char *) malloc( len );
+  if ( path == NULL ) {
+    fprintf( stderr, "Error: out of memory\n" );
+    exit( 1 );
+  }
+  snprintf( path, len, "%s/%s", dir, name );
+  return path;
+}
+
+// Transform every PNG file in input_dir into a file of the same name
+// in output_dir. The next prefetch_depth input files are read into
+// memory in the background while the current one is processed.
+bool process_directory( const struct Transformation *xform, const char *transformation,
+                        const char *input_dir, const char *output_dir, int prefetch_depth,
+                        int argc, char **argv, struct StageStats stages[NUM_STAGES] ) {
+  if ( xform == NULL ) {
+    fprintf( stderr, "Error: unknown transformation '%s'\n", transformation );
+    return false;
+  }
+  if ( !is_directory( output_dir ) ) {
+    fprintf( stderr, "Error: output directory %s doesn't exist\n", output_dir );
+    return false;
+  }
+  DIR *dir = opendir( input_dir );
+  if ( dir == NULL ) {
+    fprintf( stderr, "Error: couldn't open input directory %s\n", input_dir );
+    return false;
+  }
+
+  // collect the names of the PNG files, in a deterministic order
+  char **names = NULL;
+  int num_files = 0, capacity = 0;
+  struct dirent *entry;
+  while ( ( entry = readdir( dir ) ) != NULL ) {
+    size_t len = strlen( entry->d_name );
+    if ( len < 5 || strcmp( entry->d_name + len - 4, ".png" ) != 0 )
+      continue;
+    if ( num_files == capacity ) {
+      capacity = capacity ? capacity * 2 : 16;
+      names = (char **) realloc( names, capacity * sizeof( char * ) );
+      if ( names == NULL ) {
+        fprintf( stderr, "Error: out of memory\n" );
+        exit( 1 );
+      }
+    }
+    names[num_files++] = join_path( input_dir, entry->d_name );
+  }
+  closedir( dir );
+  qsort( names, num_files, sizeof( char * ), compare_names );
+
+  // the readers only wait on I/O, so a few of them keep several reads
+  // in flight without competing with the transformation threads
+  struct ImgPrefetcher *pf = NULL;
+  if ( prefetch_depth > 0 && num_files > 0 ) {
+    int readers = prefetch_depth < 4 ? prefetch_depth : 4;
+    pf = img_prefetch_start( (const char *const *) names, num_files, prefetch_depth, readers );
+  }
+
+  bool success = true;
+  size_t dir_len = strlen( input_dir ) + 1;
+  for ( int i = 0; i < num_files; i++ ) {
+    char *output_path = join_path( output_dir, names[i] + dir_len );
+    if ( !process_image( xform, transformation, names[i], output_path, argc, argv, stages, pf, i ) )
+      success = false;
+    free( output_path );
+  }
+  img_prefetch_stop( pf );
+
+  for ( int i = 0; i < num_files; i++ )
+    free( names[i] );
+  free( names );
+  return success;
+}
+
+int main( int argc, char **argv ) {
+  // options must come first; they are removed so the transformation
+  // arguments keep their positions in argv
+  enum StatsFormat stats_format = STATS_NONE;
+  int prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+  while ( argc > 1 && strncmp( argv[1], "--", 2 ) == 0 ) {
+    if ( strcmp( argv[1], "--stats" ) == 0 || strcmp( argv[1], "--stats=text" ) == 0 )
+      stats_format = STATS_TEXT;
+    else if ( strcmp( argv[1], "--stats=json" ) == 0 )
+      stats_format = STATS_JSON;
+    else if ( strncmp( argv[1], "--prefetch=", 11 ) == 0 && isdigit( (unsigned char) argv[1][11] ) )
+      prefetch_depth = atoi( argv[1] + 11 );
+    else
+      usage( argv[0] );
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  if ( argc < 4 )
+    usage( argv[0] );
+
+  const char *transformation = argv[1];
+  const char *input_filename = argv[2];
+  const char *output_filename = argv[3];
+
+  // find transformation
+  const struct Transformation *xform = NULL;
+  for ( int i = 0; s_transformations[i].name != NULL; ++i )
+    if ( strcmp( s_transformations[i].name, transformation ) == 0 ) {
+      xform = &s_transformations[i];
+      break;
+    }
+
+  // a directory is processed in batch mode, file by file
+  struct StageStats stages[NUM_STAGES] = { { 0 } };
+  bool success = is_directory( input_filename )
+    ? process_directory( xform, transformation, input_filename, output_filename,
+                         prefetch_depth, argc, argv, stages )
+    : process_image( xform, transformation, input_filename, output_filename,
+                     argc, argv, stages, NULL, 0 );
+
+  if ( stats_format != STATS_NONE )
+    print_stats( stats_format, transformation, input_filename, output_filename, stages, success );
 
   return success ? 0 : 1;
 }
@@ -159,3 +523,219 @@ int apply_kaleidoscope( struct Image *input_img, struct Image *output_img, int a
     fprintf( stderr, "Error: kaleidoscope transformation failed\n" );
   return success;
 }
+
+int apply_blur( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc < 5 ) {
+    fprintf( stderr, "Error: blur requires a radius argument\n" );
+    return 0;
+  }
+  int success = imgproc_box_blur( input_img, output_img, atoi( argv[4] ) );
+  if ( !success )
+    fprintf( stderr, "Error: blur transformation failed\n" );
+  return success;
+}
+
+int apply_gaussian( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc < 5 ) {
+    fprintf( stderr, "Error: gaussian requires a sigma argument\n" );
+    return 0;
+  }
+  int success = imgproc_gaussian_blur( input_img, output_img, atof( argv[4] ) );
+  if ( !success )
+    fprintf( stderr, "Error: gaussian transformation failed\n" );
+  return success;
+}
+
+int apply_sobel( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_sobel( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: sobel transformation failed\n" );
+  return success;
+}
+
+int apply_sharpen( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc < 6 ) {
+    fprintf( stderr, "Error: sharpen requires sigma and amount (percent) arguments\n" );
+    return 0;
+  }
+  int success = imgproc_unsharp_mask( input_img, output_img, atof( argv[4] ), atoi( argv[5] ) );
+  if ( !success )
+    fprintf( stderr, "Error: sharpen transformation failed\n" );
+  return success;
+}
+
+int apply_resize( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  // output dimensions (argv[4] and argv[5]) were used to create output_img
+  enum ResizeFilter filter = RESIZE_LANCZOS3;
+  if ( argc >= 7 ) {
+    if ( strcmp( argv[6], "box" ) == 0 )
+      filter = RESIZE_BOX;
+    else if ( strcmp( argv[6], "bilinear" ) == 0 )
+      filter = RESIZE_BILINEAR;
+    else if ( strcmp( argv[6], "bicubic" ) == 0 )
+      filter = RESIZE_BICUBIC;
+    else if ( strcmp( argv[6], "lanczos3" ) == 0 )
+      filter = RESIZE_LANCZOS3;
+    else {
+      fprintf( stderr, "Error: unknown resize filter '%s'\n", argv[6] );
+      return 0;
+    }
+  }
+  int success = imgproc_resize( input_img, output_img, filter );
+  if ( !success )
+    fprintf( stderr, "Error: resize transformation failed\n" );
+  return success;
+}
+
+// Parse the optional precision argument (argv[4]) of the linear light
+// transformations: 12 (the default) or 16 bits
+int parse_color_precision( int argc, char **argv, enum ColorPrecision *precision ) {
+  *precision = COLOR_PRECISION_12;
+  if ( argc < 5 || strcmp( argv[4], "12" ) == 0 )
+    return 1;
+  if ( strcmp( argv[4], "16" ) == 0 ) {
+    *precision = COLOR_PRECISION_16;
+    return 1;
+  }
+  fprintf( stderr, "Error: precision must be 12 or 16 bits\n" );
+  return 0;
+}
+
+int apply_grayscale_linear( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  enum ColorPrecision precision;
+  if ( !parse_color_precision( argc, argv, &precision ) )
+    return 0;
+  int success = imgproc_grayscale_linear( input_img, output_img, precision );
+  if ( !success )
+    fprintf( stderr, "Error: grayscale_linear transformation failed\n" );
+  return success;
+}
+
+int apply_fade_linear( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  enum ColorPrecision precision;
+  if ( !parse_color_precision( argc, argv, &precision ) )
+    return 0;
+  int success = imgproc_fade_linear( input_img, output_img, precision );
+  if ( !success )
+    fprintf( stderr, "Error: fade_linear transformation failed\n" );
+  return success;
+}
+
+int apply_autolevels( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  // optional percentage of pixels to clip at each end of every channel
+  double clip_percent = argc >= 5 ? atof( argv[4] ) : 0.5;
+  int success = imgproc_autolevels( input_img, output_img, clip_percent );
+  if ( !success )
+    fprintf( stderr, "Error: autolevels transformation failed\n" );
+  return success;
+}
+
+int apply_transpose( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_transpose( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: transpose transformation failed\n" );
+  return success;
+}
+
+int apply_rotate90( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_rotate90( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: rotate90 transformation failed\n" );
+  return success;
+}
+
+int apply_rotate180( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_rotate180( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: rotate180 transformation failed\n" );
+  return success;
+}
+
+int apply_rotate270( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_rotate270( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: rotate270 transformation failed\n" );
+  return success;
+}
+
+int apply_flip_h( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_flip_horizontal( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: flip_h transformation failed\n" );
+  return success;
+}
+
+int apply_flip_v( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  int success = imgproc_flip_vertical( input_img, output_img );
+  if ( !success )
+    fprintf( stderr, "Error: flip_v transformation failed\n" );
+  return success;
+}
+
+int apply_affine( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc < 10 ) {
+    fprintf( stderr, "Error: affine requires 6 matrix arguments (a b c d e f)\n" );
+    return 0;
+  }
+  double matrix[6];
+  for ( int i = 0; i < 6; i++ )
+    matrix[i] = atof( argv[4 + i] );
+  int success = imgproc_affine( input_img, output_img, matrix );
+  if ( !success )
+    fprintf( stderr, "Error: affine transformation failed\n" );
+  return success;
+}
+
+// Parse the optional blend mode argument (argv[5]) of the composite
+// transformation, "over" by default
+int parse_blend_mode( int argc, char **argv, enum BlendMode *mode ) {
+  static const char *const names[] = { "over", "in", "out", "multiply", "screen" };
+  *mode = BLEND_OVER;
+  if ( argc < 6 )
+    return 1;
+  for ( int i = 0; i < (int) ( sizeof( names ) / sizeof( names[0] ) ); i++ )
+    if ( strcmp( argv[5], names[i] ) == 0 ) {
+      *mode = (enum BlendMode) i;
+      return 1;
+    }
+  fprintf( stderr, "Error: unknown blend mode '%s'\n", argv[5] );
+  return 0;
+}
+
+int apply_composite( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc < 5 ) {
+    fprintf( stderr, "Error: composite requires an overlay image argument\n" );
+    return 0;
+  }
+  enum BlendMode mode;
+  if ( !parse_blend_mode( argc, argv, &mode ) )
+    return 0;
+  // optional position of the overlay, at the top left corner by default
+  int32_t x = argc >= 8 ? atoi( argv[6] ) : 0;
+  int32_t y = argc >= 8 ? atoi( argv[7] ) : 0;
+
+  struct Image overlay_img;
+  if ( img_read( argv[4], &overlay_img ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read overlay image %s\n", argv[4] );
+    return 0;
+  }
+  int success = imgproc_composite( input_img, &overlay_img, output_img, mode, x, y );
+  img_cleanup( &overlay_img );
+  if ( !success )
+    fprintf( stderr, "Error: composite transformation failed\n" );
+  return success;
+}
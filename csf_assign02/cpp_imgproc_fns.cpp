@@ -0,0 +1,164 @@
+// C++ implementations of image processing functions. The
+// transformations are compile-time pipelines of inlined pixel ops (see
+// imgproc_pipeline.h), exported with C linkage so that this backend is
+// a drop-in replacement for c_imgproc_fns.c and asm_imgproc_fns.S.
+
+#include <stdlib.h>
+#include "imgproc_pipeline.h"
+
+using namespace imgproc;
+
+namespace {
+
+struct ImageJob {
+  const struct Image *input_img;
+  struct Image *output_img;
+};
+
+void rgb_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  ImageJob *job = (ImageJob *) arg;
+  int32_t w = job->input_img->width, h = job->input_img->height;
+  size_t out_w = (size_t) w * 2;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *src = job->input_img->data + (size_t) y * w;
+    uint32_t *top = job->output_img->data + (size_t) y * out_w;
+    uint32_t *bottom = job->output_img->data + (size_t) ( h + y ) * out_w;
+    map_row( chain(), src, top, w );
+    map_row( KeepChannels<0xFF0000FF>(), src, top + w, w );
+    map_row( KeepChannels<0x00FF00FF>(), src, bottom, w );
+    map_row( KeepChannels<0x0000FFFF>(), src, bottom + w, w );
+  }
+}
+
+// Output pixel (x, y) is the input pixel at row min(fx, fy) and
+// column max(fx, fy), where fx and fy are x and y folded into the top
+// left quadrant, i.e., wedge A or its reflection across the diagonal.
+// Odd sizes are folded as if padded to the next even size, so the
+// first row/column is not mirrored.
+void kaleidoscope_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  ImageJob *job = (ImageJob *) arg;
+  int32_t n = job->input_img->width;
+  int32_t padded = ( n & 1 ) ? n + 1 : n;
+  int32_t half = padded / 2;
+  const uint32_t *in = job->input_img->data;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    int32_t fy = y < half ? y : padded - 1 - y;
+    uint32_t *dst = job->output_img->data + (size_t) y * n;
+    for ( int32_t x = 0; x < fy; x++ )
+      dst[x] = in[(size_t) x * n + fy];
+    map_row( chain(), in + (size_t) fy * n + fy, dst + fy, half - fy );
+    for ( int32_t x = half; x < n; x++ )
+      dst[x] = dst[padded - 1 - x];
+  }
+}
+
+} // namespace
+
+extern "C" {
+
+// Get the red value from pixel
+uint32_t get_r( uint32_t pixel ) { return red( pixel ); }
+
+// Get the green value from pixel
+uint32_t get_g( uint32_t pixel ) { return green( pixel ); }
+
+// Get the blue value from pixel
+uint32_t get_b( uint32_t pixel ) { return blue( pixel ); }
+
+// Get the alpha value from pixel
+uint32_t get_a( uint32_t pixel ) { return alpha( pixel ); }
+
+// Make pixel from rgba components
+uint32_t make_pixel( uint32_t r, uint32_t g, uint32_t b, uint32_t a ) {
+  return imgproc::pixel( r, g, b, a );
+}
+
+// Convert pixel to grayscale
+uint32_t to_grayscale( uint32_t pixel ) { return Grayscale()( pixel, 0 ); }
+
+// Compute the gradient needed for pixel at index `x`
+int64_t gradient( int64_t x, int64_t max ) { return imgproc_fade_gradient( x, max ); }
+
+// Compute the 1-dimensional index from column and row indices
+int64_t compute_index( struct Image *img, int32_t col, int32_t row ) {
+  return (int64_t) row * img->width + col;
+}
+
+// Convert input pixels to grayscale.
+// This transformation always succeeds.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (in which the transformed
+//                pixels should be stored)
+void imgproc_grayscale( struct Image *input_img, struct Image *output_img ) {
+  map_pixels( input_img, output_img, Grayscale() );
+}
+
+// Render an output image containing 4 replicas of the original image:
+// an exact copy in the top left, and copies with only the red, green
+// and blue color components (and the original alpha values) in the top
+// right, bottom left and bottom right.
+// This transformation always succeeds.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image (which will have
+//                width and height twice the width/height of the
+//                input image)
+void imgproc_rgb( struct Image *input_img, struct Image *output_img ) {
+  ImageJob job = { input_img, output_img };
+  imgproc_parallel_rows( input_img->height, rgb_band, &job );
+}
+
+// Render a "faded" version of the input image.
+// This transformation always succeeds.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image
+void imgproc_fade( struct Image *input_img, struct Image *output_img ) {
+  double *col_fade = (double *) malloc( input_img->width * sizeof( double ) );
+  if ( col_fade == NULL ) {
+    // without the column table, fall back to the integer arithmetic of
+    // the C backend rather than failing
+    for ( int32_t y = 0; y < input_img->height; y++ ) {
+      int64_t row_fade = imgproc_fade_gradient( y, input_img->height );
+      for ( int32_t x = 0; x < input_img->width; x++ ) {
+        int64_t f = row_fade * imgproc_fade_gradient( x, input_img->width );
+        size_t i = (size_t) y * input_img->width + x;
+        uint32_t p = input_img->data[i];
+        output_img->data[i] = imgproc::pixel( f * red( p ) / 1000000000000LL, f * green( p ) / 1000000000000LL,
+                                              f * blue( p ) / 1000000000000LL, alpha( p ) );
+      }
+    }
+    return;
+  }
+  for ( int32_t x = 0; x < input_img->width; x++ )
+    col_fade[x] = (double) imgproc_fade_gradient( x, input_img->width );
+  map_pixels( input_img, output_img, Fade( col_fade, input_img->height ) );
+  free( col_fade );
+}
+
+// Render a "kaleidoscope" transformation of input_img in output_img:
+// wedge A (above the diagonal of the top left quadrant) is replicated
+// 8 times so that the image is symmetrical across the vertical,
+// horizontal and diagonal lines through its center.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (in which the transformed
+//                pixels should be stored)
+//
+// Returns:
+//   1 if successful, 0 if the transformation fails because the
+//   width and height of input_img are not the same.
+int imgproc_kaleidoscope( struct Image *input_img, struct Image *output_img ) {
+  if ( input_img->width != input_img->height )
+    return 0;
+  ImageJob job = { input_img, output_img };
+  imgproc_parallel_rows( input_img->height, kaleidoscope_band, &job );
+  return 1;
+}
+
+} // extern "C"
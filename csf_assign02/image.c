@@ -1,9 +1,61 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "pnglite.h"
 #include "image.h"
 
-int png_init_called;
+// Header of the raw RGBA container format. The header is padded to
+// a cache line so that the pixel data following it stays aligned.
+#define IMG_RAW_MAGIC        "CSFRGBA1"
+#define IMG_RAW_BYTE_ORDER   0x01020304U
+#define IMG_RAW_HEADER_SIZE  64
+
+struct RawHeader {
+  char magic[8];
+  uint32_t byte_order;   // IMG_RAW_BYTE_ORDER in the writer's byte order
+  uint32_t header_size;  // offset of the first pixel
+  uint64_t width;
+  uint64_t height;
+  uint8_t reserved[IMG_RAW_HEADER_SIZE - 32];
+};
+
+_Static_assert(sizeof(struct RawHeader) == IMG_RAW_HEADER_SIZE, "raw header size");
+
+// pnglite is initialized once, by whichever thread reads or writes a
+// PNG file first
+static pthread_once_t s_png_init_once = PTHREAD_ONCE_INIT;
+
+static void init_png(void) {
+  png_init(0, 0);
+}
+
+// Size of pixel data from which img_init uses a scratch file
+static uint64_t s_out_of_core_threshold = IMG_OUT_OF_CORE_DEFAULT_THRESHOLD;
+
+// I/O counters reported by img_get_io_stats
+static struct ImgIoStats s_io_stats;
+
+void count_io(uint64_t *counter, uint64_t bytes) {
+  __atomic_fetch_add(counter, bytes, __ATOMIC_RELAXED);
+}
+
+// Size of the named file, or 0 if it can't be determined
+uint64_t file_size(const char *filename) {
+  struct stat st;
+  return stat(filename, &st) == 0 ? (uint64_t) st.st_size : 0;
+}
+
+void img_get_io_stats(struct ImgIoStats *stats) {
+  stats->bytes_read = __atomic_load_n(&s_io_stats.bytes_read, __ATOMIC_RELAXED);
+  stats->bytes_inflated = __atomic_load_n(&s_io_stats.bytes_inflated, __ATOMIC_RELAXED);
+  stats->bytes_deflated = __atomic_load_n(&s_io_stats.bytes_deflated, __ATOMIC_RELAXED);
+  stats->bytes_written = __atomic_load_n(&s_io_stats.bytes_written, __ATOMIC_RELAXED);
+}
 
 int is_little_endian(void) {
   int32_t x = 1;
@@ -17,7 +69,14 @@ uint32_t byteswap(uint32_t val) {
 }
 
 int img_init(struct Image *img, int32_t width, int32_t height) {
-  int num_pixels = width * height;
+  if (width < 0 || height < 0) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  size_t num_pixels = (size_t) width * height;
+
+  if (s_out_of_core_threshold != 0 && num_pixels * sizeof(uint32_t) >= s_out_of_core_threshold) {
+    return img_init_scratch(img, width, height);
+  }
 
   uint32_t *pixel_data = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
   if (pixel_data == NULL) {
@@ -25,7 +84,7 @@ int img_init(struct Image *img, int32_t width, int32_t height) {
   }
 
   // initialize every pixel to opaque black
-  for (int32_t i = 0; i < num_pixels; i++) {
+  for (size_t i = 0; i < num_pixels; i++) {
     pixel_data[i] = 0x000000FFU;
   }
 
@@ -33,44 +92,225 @@ int img_init(struct Image *img, int32_t width, int32_t height) {
   img->width = width;
   img->height = height;
   img->data = pixel_data;
+  img->map_size = 0;
   return IMG_SUCCESS;
 }
 
-int img_read(const char *filename, struct Image *img) {
-  if (!png_init_called) {
-    png_init(0, 0);
-    png_init_called = 1;
+void img_set_out_of_core_threshold(uint64_t bytes) {
+  s_out_of_core_threshold = bytes;
+}
+
+void raw_init_header(struct RawHeader *hdr, int32_t width, int32_t height) {
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, IMG_RAW_MAGIC, sizeof(hdr->magic));
+  hdr->byte_order = IMG_RAW_BYTE_ORDER;
+  hdr->header_size = IMG_RAW_HEADER_SIZE;
+  hdr->width = (uint64_t) width;
+  hdr->height = (uint64_t) height;
+}
+
+int raw_header_valid(const struct RawHeader *hdr) {
+  return memcmp(hdr->magic, IMG_RAW_MAGIC, sizeof(hdr->magic)) == 0 &&
+         hdr->byte_order == IMG_RAW_BYTE_ORDER &&
+         hdr->header_size == IMG_RAW_HEADER_SIZE &&
+         hdr->width <= INT32_MAX && hdr->height <= INT32_MAX;
+}
+
+// Check whether the named file starts with a raw container header
+int raw_file_has_magic(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 0;
   }
+  char magic[8];
+  ssize_t n = read(fd, magic, sizeof(magic));
+  close(fd);
+  return n == (ssize_t) sizeof(magic) && memcmp(magic, IMG_RAW_MAGIC, sizeof(magic)) == 0;
+}
 
-  png_t png;
+int img_is_raw_filename(const char *filename) {
+  size_t len = strlen(filename);
+  size_t ext_len = strlen(IMG_RAW_EXTENSION);
+  return len >= ext_len && strcmp(filename + len - ext_len, IMG_RAW_EXTENSION) == 0;
+}
 
-  if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
+int img_map_raw(const char *filename, struct Image *img, int shared) {
+  int fd = open(filename, shared ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  struct stat st;
+  struct RawHeader hdr;
+  if (fstat(fd, &st) != 0 || pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr) ||
+      !raw_header_valid(&hdr)) {
+    close(fd);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  size_t map_size = IMG_RAW_HEADER_SIZE + (size_t) hdr.width * hdr.height * sizeof(uint32_t);
+  if ((size_t) st.st_size < map_size) {
+    close(fd);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  // a private mapping is still writable: pages are copied on write,
+  // so the caller may modify pixels without affecting the file
+  void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return IMG_ERR_COULD_NOT_MAP;
+  }
+
+  img->width = (int32_t) hdr.width;
+  img->height = (int32_t) hdr.height;
+  img->data = (uint32_t *) ((char *) base + IMG_RAW_HEADER_SIZE);
+  img->map_size = map_size;
+  count_io(&s_io_stats.bytes_read, map_size);
+  return IMG_SUCCESS;
+}
+
+int img_create_raw(const char *filename, struct Image *img, int32_t width, int32_t height) {
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  size_t num_pixels = (size_t) width * height;
+  size_t map_size = IMG_RAW_HEADER_SIZE + num_pixels * sizeof(uint32_t);
+  if (ftruncate(fd, (off_t) map_size) != 0) {
+    close(fd);
+    return IMG_ERR_COULD_NOT_WRITE;
+  }
+
+  void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return IMG_ERR_COULD_NOT_MAP;
+  }
+
+  raw_init_header((struct RawHeader *) base, width, height);
+
+  uint32_t *pixel_data = (uint32_t *) ((char *) base + IMG_RAW_HEADER_SIZE);
+
+  // initialize every pixel to opaque black
+  for (size_t i = 0; i < num_pixels; i++) {
+    pixel_data[i] = 0x000000FFU;
+  }
+
+  img->width = width;
+  img->height = height;
+  img->data = pixel_data;
+  img->map_size = map_size;
+  return IMG_SUCCESS;
+}
+
+int img_init_scratch(struct Image *img, int32_t width, int32_t height) {
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0') {
+    dir = "/tmp";
+  }
+  char path[4096];
+  if (snprintf(path, sizeof(path), "%s/img-scratch-XXXXXX", dir) >= (int) sizeof(path)) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+  int fd = mkstemp(path);
+  if (fd < 0) {
     return IMG_ERR_COULD_NOT_OPEN;
   }
+  close(fd);
 
+  // the mapping keeps the file alive after it is unlinked
+  int rc = img_create_raw(path, img, width, height);
+  unlink(path);
+  return rc;
+}
+
+int img_sync(struct Image *img) {
+  if (img->map_size == 0) {
+    return IMG_SUCCESS;
+  }
+  void *base = (char *) img->data - IMG_RAW_HEADER_SIZE;
+  if (msync(base, img->map_size, MS_SYNC) != 0) {
+    return IMG_ERR_COULD_NOT_WRITE;
+  }
+  count_io(&s_io_stats.bytes_written, img->map_size);
+  return IMG_SUCCESS;
+}
+
+// Write an image in the raw container format. The file is not truncated
+// before writing, so this is safe even if img is itself a shared mapping
+// of the same file (although img_sync is cheaper in that case).
+int raw_write(const char *filename, struct Image *img) {
+  int fd = open(filename, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  struct RawHeader hdr;
+  raw_init_header(&hdr, img->width, img->height);
+
+  size_t data_size = (size_t) img->width * img->height * sizeof(uint32_t);
+  int success = pwrite(fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr);
+
+  const char *p = (const char *) img->data;
+  size_t done = 0;
+  while (success && done < data_size) {
+    ssize_t n = pwrite(fd, p + done, data_size - done, IMG_RAW_HEADER_SIZE + done);
+    if (n <= 0) {
+      success = 0;
+    } else {
+      done += (size_t) n;
+    }
+  }
+
+  if (success && ftruncate(fd, (off_t) (IMG_RAW_HEADER_SIZE + data_size)) != 0) {
+    success = 0;
+  }
+
+  close(fd);
+  if (success) {
+    count_io(&s_io_stats.bytes_written, IMG_RAW_HEADER_SIZE + data_size);
+  }
+  return success ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+}
+
+// Decode the pixels of an opened PNG file into img. The caller
+// closes the png_t.
+int png_decode(png_t *png, struct Image *img) {
   // only allow truecolor 8bpp images
-  if (!(png.color_type == PNG_TRUECOLOR && png.bpp == 3) &&
-      !(png.color_type == PNG_TRUECOLOR_ALPHA && png.bpp == 4)) {
-    png_close_file(&png);
+  if (!(png->color_type == PNG_TRUECOLOR && png->bpp == 3) &&
+      !(png->color_type == PNG_TRUECOLOR_ALPHA && png->bpp == 4)) {
     return IMG_ERR_NOT_TRUECOLOR;
   }
   
-  int num_pixels = png.width * png.height;
+  // pnglite keeps the decoded pixels (plus a filter byte per row)
+  // in one buffer whose size must fit in an unsigned int
+  if (png->width > INT32_MAX || png->height > INT32_MAX ||
+      (uint64_t) png->width * png->height * 4 + png->height > UINT32_MAX) {
+    return IMG_ERR_TOO_LARGE;
+  }
+
+  size_t num_pixels = (size_t) png->width * png->height;
 
   // allocate buffer for pixel data in truecolor RGBA format
   uint32_t *pixel_data = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
+  if (pixel_data == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
 
-  if (png.color_type == PNG_TRUECOLOR) {
+  if (png->color_type == PNG_TRUECOLOR) {
     // PNG pixel data is in RGB form, expand it to add the alpha channel
 
     unsigned char *pixel_data_raw = (unsigned char *) malloc(num_pixels * 3);
-    if (png_get_data(&png, pixel_data_raw) != PNG_NO_ERROR) {
-      png_close_file(&png);
+    if (pixel_data_raw == NULL || png_get_data(png, pixel_data_raw) != PNG_NO_ERROR) {
+      free(pixel_data_raw);
       free(pixel_data);
       return IMG_ERR_MALLOC_FAILED;
     }
 
-    for (int i = 0; i < num_pixels; i++) {
+    for (size_t i = 0; i < num_pixels; i++) {
       unsigned char r = pixel_data_raw[i*3 + 0];
       unsigned char g = pixel_data_raw[i*3 + 1];
       unsigned char b = pixel_data_raw[i*3 + 2];
@@ -84,14 +324,13 @@ int img_read(const char *filename, struct Image *img) {
     // PNG pixel data is already in the correct format,
     // except that the RGBA data is in big-endian form, so we
     // need to byteswap if on a little endian system
-    if (png_get_data(&png, (unsigned char *) pixel_data) != PNG_NO_ERROR) {
-      png_close_file(&png);
+    if (png_get_data(png, (unsigned char *) pixel_data) != PNG_NO_ERROR) {
       free(pixel_data);
       return IMG_ERR_MALLOC_FAILED;
     }
 
     if (is_little_endian()) {
-      for (int i = 0; i < num_pixels; i++) {
+      for (size_t i = 0; i < num_pixels; i++) {
         pixel_data[i] = byteswap(pixel_data[i]);
       }
     }
@@ -99,18 +338,89 @@ int img_read(const char *filename, struct Image *img) {
 
   // communicate pixel data and image dimensions to caller
   img->data = pixel_data;
-  img->width = png.width;
-  img->height = png.height;
+  img->width = png->width;
+  img->height = png->height;
+  img->map_size = 0;
 
-  png_close_file(&png);
+  count_io(&s_io_stats.bytes_inflated, (uint64_t) png->width * png->height * png->bpp);
 
   return IMG_SUCCESS;
 }
 
+int img_read(const char *filename, struct Image *img) {
+  if (raw_file_has_magic(filename)) {
+    return img_map_raw(filename, img, 0);
+  }
+
+  pthread_once(&s_png_init_once, init_png);
+
+  png_t png;
+
+  if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  int rc = png_decode(&png, img);
+  png_close_file(&png);
+
+  if (rc == IMG_SUCCESS) {
+    count_io(&s_io_stats.bytes_read, file_size(filename));
+  }
+
+  return rc;
+}
+
+// Read position in a PNG file held in memory
+struct MemoryReader {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+};
+
+// pnglite read callback reading from a MemoryReader; a NULL output
+// skips the data
+unsigned memory_read(void *output, size_t size, size_t numel, void *user_pointer) {
+  struct MemoryReader *reader = (struct MemoryReader *) user_pointer;
+  size_t avail = (reader->size - reader->pos) / (size ? size : 1);
+  if (numel > avail) {
+    numel = avail;
+  }
+  if (output != NULL) {
+    memcpy(output, reader->data + reader->pos, size * numel);
+  }
+  reader->pos += size * numel;
+  return (unsigned) numel;
+}
+
+int img_read_memory(const void *data, size_t size, struct Image *img) {
+  pthread_once(&s_png_init_once, init_png);
+
+  struct MemoryReader reader = { (const unsigned char *) data, size, 0 };
+  png_t png;
+
+  if (png_open_read(&png, memory_read, &reader) != PNG_NO_ERROR) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  int rc = png_decode(&png, img);
+
+  if (rc == IMG_SUCCESS) {
+    count_io(&s_io_stats.bytes_read, size);
+  }
+
+  return rc;
+}
+
 int img_write(const char *filename, struct Image *img) {
-  if (!png_init_called) {
-    png_init(0, 0);
-    png_init_called = 1;
+  if (img_is_raw_filename(filename)) {
+    return raw_write(filename, img);
+  }
+
+  pthread_once(&s_png_init_once, init_png);
+
+  // same pnglite buffer size limit as in img_read
+  if ((uint64_t) img->width * img->height * 4 + img->height > UINT32_MAX) {
+    return IMG_ERR_TOO_LARGE;
   }
 
   png_t png;
@@ -127,14 +437,14 @@ int img_write(const char *filename, struct Image *img) {
   int need_byteswap = is_little_endian();
 
   if (need_byteswap) {
-    data_to_write = (uint32_t *) malloc(img->width * img->height * sizeof(uint32_t));
+    size_t num_pixels = (size_t) img->width * img->height;
+    data_to_write = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
     if (data_to_write == NULL) {
       png_close_file(&png);
       return IMG_ERR_MALLOC_FAILED;
     }
 
-    int32_t num_pixels = img->width * img->height;
-    for (int32_t i = 0; i < num_pixels; i++) {
+    for (size_t i = 0; i < num_pixels; i++) {
       data_to_write[i] = byteswap(img->data[i]);
     }
   }
@@ -147,11 +457,20 @@ int img_write(const char *filename, struct Image *img) {
     free(data_to_write);
   }
 
+  if (success) {
+    count_io(&s_io_stats.bytes_deflated, (uint64_t) img->width * img->height * sizeof(uint32_t));
+    count_io(&s_io_stats.bytes_written, file_size(filename));
+  }
+
   return success ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
 }
 
 void img_cleanup( struct Image *img ) {
   // The data array is the only dynamically-allocated
   // part of the representation of a struct Image
-  free( img->data );
+  if ( img->map_size != 0 ) {
+    munmap( (char *) img->data - IMG_RAW_HEADER_SIZE, img->map_size );
+  } else {
+    free( img->data );
+  }
 }
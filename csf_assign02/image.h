@@ -7,14 +7,34 @@
 #define IMG_ERR_NOT_TRUECOLOR    -2
 #define IMG_ERR_MALLOC_FAILED    -3
 #define IMG_ERR_COULD_NOT_WRITE  -4
+#define IMG_ERR_COULD_NOT_MAP    -5
+#define IMG_ERR_TOO_LARGE        -6
+
+// Default for img_set_out_of_core_threshold: images with at least
+// this many bytes of pixel data (1G pixels) are kept in scratch files
+#define IMG_OUT_OF_CORE_DEFAULT_THRESHOLD  (1ULL << 32)
+
+// File name extension selecting the raw RGBA container format
+// (see img_map_raw) instead of PNG in img_write
+#define IMG_RAW_EXTENSION        ".rgba"
 
 #ifndef ASM_SOURCE
+#include <stddef.h>
 #include <stdint.h>
 
 struct Image {
   int32_t width;
   int32_t height;
   uint32_t *data;
+  size_t map_size; // nonzero if data points into an mmap'd raw file
+};
+
+// Cumulative I/O counters of the image library
+struct ImgIoStats {
+  uint64_t bytes_read;      // bytes of image files read (or mapped)
+  uint64_t bytes_inflated;  // bytes of pixel data decoded from PNG files
+  uint64_t bytes_deflated;  // bytes of pixel data encoded into PNG files
+  uint64_t bytes_written;   // bytes of image files written
 };
 
 // Initialize an Image struct instance by creating a pixel
@@ -23,6 +43,8 @@ struct Image {
 // and initialzing all of the struct Image field values.
 // This function only needs to be called if the program
 // needs to create an "empty" image in memory.
+// Images at least as large as the out-of-core threshold are
+// created with img_init_scratch instead of on the heap.
 //
 // Parameters:
 //   img - pointer to Image instance to initialize
@@ -35,10 +57,13 @@ struct Image {
 int img_init(struct Image *img, int32_t width, int32_t height);
 
 // Read PNG image data from a file and initialize the specified
-// Image struct instance.
+// Image struct instance. If the file is a raw RGBA container
+// instead of a PNG, it is mapped privately with img_map_raw rather
+// than decoded. PNG files are limited to 4 GB of decoded pixel data;
+// larger images must use the raw format.
 //
 // Parameters:
-//   filename - name of PNG file to read
+//   filename - name of PNG (or raw) file to read
 //   img - pointer to Image struct to initialize with the loaded
 //         image data
 //
@@ -47,11 +72,28 @@ int img_init(struct Image *img, int32_t width, int32_t height);
 //   IMG_ERR_* values
 int img_read(const char *filename, struct Image *img);
 
+// Decode PNG image data held in memory (e.g. a file loaded by an
+// ImgPrefetcher) and initialize the specified Image struct instance.
+// Raw RGBA containers are not supported; use img_map_raw for those.
+//
+// Parameters:
+//   data - the contents of a PNG file
+//   size - number of bytes of data
+//   img - pointer to Image struct to initialize with the decoded
+//         image data
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_read_memory(const void *data, size_t size, struct Image *img);
+
 // Write pixel data from specified Image struct instance to the
-// named PNG output file.
+// named PNG output file. If the file name ends in IMG_RAW_EXTENSION,
+// the pixels are written uncompressed in the raw RGBA container
+// format instead.
 //
 // Parameters:
-//   filename - name of PNG file to write
+//   filename - name of PNG (or raw) file to write
 //   img - pointer to Image struct with the pixel data to write
 //         to a PNG file
 //
@@ -60,8 +102,140 @@ int img_read(const char *filename, struct Image *img);
 //   IMG_ERR_* values
 int img_write(const char *filename, struct Image *img);
 
+// Map a raw RGBA container file directly into memory and initialize
+// the specified Image struct instance so that its data field points
+// at the pixels inside the mapping. No decoding or copying is done.
+//
+// The raw container is a fixed-size header followed by packed RGBA
+// uint32_t pixels (in host byte order), one row after another.
+//
+// Parameters:
+//   filename - name of raw file to map
+//   img - pointer to Image struct to initialize
+//   shared - if nonzero, the mapping is MAP_SHARED and changes to the
+//            pixels are written back to the file; otherwise the
+//            mapping is private (copy-on-write)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_map_raw(const char *filename, struct Image *img, int shared);
+
+// Create (or truncate) a raw RGBA container file large enough for an
+// image of the specified dimensions and map it MAP_SHARED into the given
+// Image struct instance, so that a transformation can write its output
+// pixels straight into the file. As with img_init, every pixel is
+// initialized to opaque black.
+//
+// Parameters:
+//   filename - name of raw file to create
+//   img - pointer to Image instance to initialize
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_create_raw(const char *filename, struct Image *img, int32_t width, int32_t height);
+
+// Initialize an Image struct instance whose pixels live in an
+// unnamed scratch file (in $TMPDIR, or /tmp) mapped into memory, so
+// that images larger than the available RAM (or than any single heap
+// allocation) can be processed: the kernel pages pixels in and out
+// of the file as they are accessed. The file is removed when the
+// Image is cleaned up. As with img_init, every pixel is initialized
+// to opaque black.
+//
+// Parameters:
+//   img - pointer to Image instance to initialize
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_init_scratch(struct Image *img, int32_t width, int32_t height);
+
+// Set the size (in bytes of pixel data) from which img_init creates
+// images with img_init_scratch rather than on the heap.
+//
+// Parameters:
+//   bytes - the new threshold, or 0 to always use the heap
+void img_set_out_of_core_threshold(uint64_t bytes);
+
+// Flush the pixels of an Image created by img_map_raw (shared) or
+// img_create_raw back to its file. Does nothing for images that are
+// not backed by a mapping.
+//
+// Parameters:
+//   img - pointer to Image to flush
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_COULD_NOT_WRITE
+int img_sync(struct Image *img);
+
+// Check whether a file name selects the raw RGBA container format,
+// i.e., whether it ends in IMG_RAW_EXTENSION.
+//
+// Parameters:
+//   filename - file name to check
+//
+// Returns:
+//   1 if filename names a raw file, 0 otherwise
+int img_is_raw_filename(const char *filename);
+
+// Get the I/O counters accumulated by img_read, img_read_memory,
+// img_map_raw, img_write and img_sync since the program started.
+//
+// Parameters:
+//   stats - pointer to ImgIoStats struct to fill in
+void img_get_io_stats(struct ImgIoStats *stats);
+
+// Background loader reading a list of files into memory ahead of
+// their use (see img_prefetch_start)
+struct ImgPrefetcher;
+
+// Start loading files into memory on a pool of reader threads, so that
+// a program processing the files in order doesn't wait for each read.
+// At most depth files that haven't been taken yet are held in memory.
+//
+// Parameters:
+//   filenames - names of the files, in the order they will be taken
+//               (the array must remain valid until img_prefetch_stop)
+//   num_files - number of files
+//   depth - maximum number of files loaded ahead (at least 1)
+//   num_threads - number of reader threads (at least 1)
+//
+// Returns:
+//   the prefetcher, or NULL if it could not be started
+struct ImgPrefetcher *img_prefetch_start(const char *const *filenames, int num_files,
+                                         int depth, int num_threads);
+
+// Wait for a file to be loaded and take ownership of its contents.
+// Files must be taken in order; taking a file lets the readers move
+// on to the next ones.
+//
+// Parameters:
+//   pf - the prefetcher
+//   index - index of the file in the filenames array
+//   data - set to the file contents, which the caller must free()
+//   size - set to the number of bytes of data
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_COULD_NOT_OPEN (or
+//   IMG_ERR_MALLOC_FAILED) if the file couldn't be read
+int img_prefetch_take(struct ImgPrefetcher *pf, int index, void **data, size_t *size);
+
+// Stop the reader threads and free the prefetcher, including the
+// contents of any files that were loaded but not taken.
+//
+// Parameters:
+//   pf - the prefetcher
+void img_prefetch_stop(struct ImgPrefetcher *pf);
+
 // De-allocate the dynamically-allocated memory used in the internal
-// representation of the given Image struct. Note that this function
+// representation of the given Image struct (or unmap it, if the
+// Image is backed by a raw file mapping). Note that this function
 // does NOT de-allocate the struct Image instance itself (since allocating
 // Image objects is the responsibility of the program, not this library.)
 //
@@ -0,0 +1,215 @@
+// Background prefetching of image files into memory, so that reading
+// the next files of a batch overlaps decoding and transforming the
+// current one
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "image.h"
+
+// Hard upper limit on the number of reader threads
+#define MAX_PREFETCH_THREADS 16
+
+// Load state of one file
+enum PrefetchState {
+  PREFETCH_PENDING,
+  PREFETCH_READY,
+  PREFETCH_FAILED,
+  PREFETCH_TAKEN,
+};
+
+struct PrefetchSlot {
+  enum PrefetchState state;
+  int error;  // IMG_ERR_* value if the state is PREFETCH_FAILED
+  void *data;
+  size_t size;
+};
+
+struct ImgPrefetcher {
+  const char *const *filenames;
+  int num_files;
+  int depth;
+  struct PrefetchSlot *slots;
+
+  pthread_mutex_t lock;
+  pthread_cond_t loaded;    // signalled when a file has been loaded
+  pthread_cond_t taken;     // signalled when a file has been taken, or on stop
+  int next_to_load;
+  int next_to_take;
+  int stopping;
+
+  int num_threads;
+  pthread_t threads[MAX_PREFETCH_THREADS];
+};
+
+// Read a whole file into a malloc'd buffer
+static int read_file(const char *filename, void **data, size_t *size) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+  // the whole file is read front to back right away
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+  size_t n = (size_t) st.st_size;
+  unsigned char *buf = (unsigned char *) malloc(n ? n : 1);
+  if (buf == NULL) {
+    close(fd);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  size_t done = 0;
+  while (done < n) {
+    ssize_t rc = read(fd, buf + done, n - done);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      break;
+    }
+    done += (size_t) rc;
+  }
+  close(fd);
+
+  if (done < n) {
+    free(buf);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+  *data = buf;
+  *size = n;
+  return IMG_SUCCESS;
+}
+
+static void *prefetch_worker(void *arg) {
+  struct ImgPrefetcher *pf = (struct ImgPrefetcher *) arg;
+
+  pthread_mutex_lock(&pf->lock);
+  for (;;) {
+    // don't get more than depth files ahead of the consumer
+    while (!pf->stopping && pf->next_to_load < pf->num_files &&
+           pf->next_to_load >= pf->next_to_take + pf->depth) {
+      pthread_cond_wait(&pf->taken, &pf->lock);
+    }
+    if (pf->stopping || pf->next_to_load >= pf->num_files) {
+      break;
+    }
+    int index = pf->next_to_load++;
+    pthread_mutex_unlock(&pf->lock);
+
+    void *data = NULL;
+    size_t size = 0;
+    int rc = read_file(pf->filenames[index], &data, &size);
+
+    pthread_mutex_lock(&pf->lock);
+    struct PrefetchSlot *slot = &pf->slots[index];
+    slot->data = data;
+    slot->size = size;
+    slot->error = rc;
+    slot->state = rc == IMG_SUCCESS ? PREFETCH_READY : PREFETCH_FAILED;
+    pthread_cond_broadcast(&pf->loaded);
+  }
+  pthread_mutex_unlock(&pf->lock);
+  return NULL;
+}
+
+struct ImgPrefetcher *img_prefetch_start(const char *const *filenames, int num_files,
+                                         int depth, int num_threads) {
+  if (num_files < 0 || depth < 1 || num_threads < 1) {
+    return NULL;
+  }
+  if (num_threads > MAX_PREFETCH_THREADS) {
+    num_threads = MAX_PREFETCH_THREADS;
+  }
+
+  struct ImgPrefetcher *pf = (struct ImgPrefetcher *) calloc(1, sizeof(struct ImgPrefetcher));
+  if (pf == NULL) {
+    return NULL;
+  }
+  pf->slots = (struct PrefetchSlot *) calloc(num_files ? num_files : 1, sizeof(struct PrefetchSlot));
+  if (pf->slots == NULL) {
+    free(pf);
+    return NULL;
+  }
+  pf->filenames = filenames;
+  pf->num_files = num_files;
+  pf->depth = depth;
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->loaded, NULL);
+  pthread_cond_init(&pf->taken, NULL);
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&pf->threads[i], NULL, prefetch_worker, pf) != 0) {
+      break;
+    }
+    pf->num_threads++;
+  }
+  if (pf->num_threads == 0) {
+    img_prefetch_stop(pf);
+    return NULL;
+  }
+  return pf;
+}
+
+int img_prefetch_take(struct ImgPrefetcher *pf, int index, void **data, size_t *size) {
+  if (index < 0 || index >= pf->num_files) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  pthread_mutex_lock(&pf->lock);
+  // files skipped by the caller no longer hold the readers back
+  if (index > pf->next_to_take) {
+    pf->next_to_take = index;
+    pthread_cond_broadcast(&pf->taken);
+  }
+  struct PrefetchSlot *slot = &pf->slots[index];
+  while (slot->state == PREFETCH_PENDING) {
+    pthread_cond_wait(&pf->loaded, &pf->lock);
+  }
+  int rc = slot->state == PREFETCH_READY ? IMG_SUCCESS
+    : slot->state == PREFETCH_FAILED ? slot->error : IMG_ERR_COULD_NOT_OPEN;
+  if (slot->state == PREFETCH_READY) {
+    *data = slot->data;
+    *size = slot->size;
+  }
+  slot->data = NULL;
+  slot->state = PREFETCH_TAKEN;
+  if (index + 1 > pf->next_to_take) {
+    pf->next_to_take = index + 1;
+  }
+  pthread_cond_broadcast(&pf->taken);
+  pthread_mutex_unlock(&pf->lock);
+  return rc;
+}
+
+void img_prefetch_stop(struct ImgPrefetcher *pf) {
+  if (pf == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pf->lock);
+  pf->stopping = 1;
+  pthread_cond_broadcast(&pf->taken);
+  pthread_mutex_unlock(&pf->lock);
+  for (int i = 0; i < pf->num_threads; i++) {
+    pthread_join(pf->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pf->num_files; i++) {
+    free(pf->slots[i].data);
+  }
+  pthread_cond_destroy(&pf->loaded);
+  pthread_cond_destroy(&pf->taken);
+  pthread_mutex_destroy(&pf->lock);
+  free(pf->slots);
+  free(pf);
+}
@@ -97,6 +97,909 @@ void imgproc_fade( struct Image *input_img, struct Image *output_img );
 //   width and height of input_img are not the same.
 int imgproc_kaleidoscope( struct Image *input_img, struct Image *output_img );
 
+////////////////////////////////////////////////////////////////////////
+// Separable convolution filters (imgproc_filter.c)
+////////////////////////////////////////////////////////////////////////
+
+// Largest radius of a convolution kernel
+#define IMGPROC_KERNEL_MAX_RADIUS 32
+
+// One-dimensional integer fixed-point convolution kernel.
+// A pixel filtered with the kernel is the sum of taps[i] times
+// the pixel (i - radius) positions away, shifted right by shift
+// (so a normalized kernel's taps sum to 1 << shift). The sum of the
+// absolute tap values may not exceed 32767.
+struct Kernel {
+  int32_t radius;
+  int32_t shift;
+  int16_t taps[2 * IMGPROC_KERNEL_MAX_RADIUS + 1];
+};
+
+// Build a box (moving average) kernel.
+//
+// Parameters:
+//   k - pointer to the Kernel to initialize
+//   radius - kernel radius (the kernel has 2*radius+1 taps)
+//
+// Returns:
+//   1 if successful, 0 if the radius is out of range
+int imgproc_kernel_box( struct Kernel *k, int32_t radius );
+
+// Build a normalized Gaussian kernel with a radius of ceil(3*sigma).
+//
+// Parameters:
+//   k - pointer to the Kernel to initialize
+//   sigma - standard deviation of the Gaussian, in pixels
+//
+// Returns:
+//   1 if successful, 0 if sigma is not positive and finite or the
+//   kernel would exceed IMGPROC_KERNEL_MAX_RADIUS
+int imgproc_kernel_gaussian( struct Kernel *k, double sigma );
+
+// Convolve input_img with a separable kernel: each channel (including
+// alpha) is filtered horizontally with h, then vertically with v, with
+// the image edges extended by replicating the border pixels. The
+// horizontal pass keeps only 2*v->radius+1 filtered rows per thread,
+// and the image is split into bands of rows processed in parallel.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (same dimensions as the
+//                input, and not the same Image)
+//   h - horizontal kernel
+//   v - vertical kernel
+//
+// Returns:
+//   1 if successful, 0 if the kernels or images are invalid or
+//   memory could not be allocated
+int imgproc_convolve( struct Image *input_img, struct Image *output_img,
+                      const struct Kernel *h, const struct Kernel *v );
+
+// Blur an image with a (2*radius+1) x (2*radius+1) box filter.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   radius - blur radius in pixels
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_box_blur( struct Image *input_img, struct Image *output_img, int32_t radius );
+
+// Blur an image with a Gaussian filter.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   sigma - standard deviation of the Gaussian, in pixels
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_gaussian_blur( struct Image *input_img, struct Image *output_img, double sigma );
+
+// Render the Sobel edge magnitude of the input image's luminance as
+// a grayscale image. Alpha values are copied from the input.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_sobel( struct Image *input_img, struct Image *output_img );
+
+// Sharpen an image by adding back the difference between the image
+// and a Gaussian-blurred copy of it. Alpha values are copied from the
+// input.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   sigma - standard deviation of the Gaussian blur, in pixels
+//   amount - strength of the sharpening, in percent
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_unsharp_mask( struct Image *input_img, struct Image *output_img, double sigma, int32_t amount );
+
+////////////////////////////////////////////////////////////////////////
+// Resampling (imgproc_resize.c)
+////////////////////////////////////////////////////////////////////////
+
+// Resampling filters
+enum ResizeFilter {
+  RESIZE_BOX,
+  RESIZE_BILINEAR,
+  RESIZE_BICUBIC,
+  RESIZE_LANCZOS3,
+};
+
+// Fixed-point resampling weights for one axis: destination pixel i is
+// the sum of weights[i*taps + t] times source pixel start[i] + t,
+// with the weights of each destination pixel summing to 1 << 14
+struct ResizeAxis {
+  int32_t src_len;
+  int32_t dst_len;
+  int32_t taps;
+  int32_t *start;
+  int16_t *weights;
+};
+
+// Coefficient tables for resizing images of one size to another,
+// computed once and reusable for any number of images
+struct ResizePlan {
+  enum ResizeFilter filter;
+  struct ResizeAxis h;
+  struct ResizeAxis v;
+  int32_t box_factor;  // 2, 4 or 8 for integer-ratio box downscaling, else 0
+};
+
+// Prepare the coefficient tables for resizing src_w x src_h images to
+// dst_w x dst_h. The plan can be reused for any number of images with
+// those dimensions.
+//
+// Parameters:
+//   plan - pointer to the ResizePlan to initialize
+//   src_w, src_h - input image dimensions
+//   dst_w, dst_h - output image dimensions
+//   filter - resampling filter
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive or memory
+//   could not be allocated
+int imgproc_resize_plan_init( struct ResizePlan *plan, int32_t src_w, int32_t src_h,
+                              int32_t dst_w, int32_t dst_h, enum ResizeFilter filter );
+
+// Free the coefficient tables of a ResizePlan.
+//
+// Parameters:
+//   plan - pointer to the ResizePlan to clean up
+void imgproc_resize_plan_cleanup( struct ResizePlan *plan );
+
+// Resize input_img into output_img using a precomputed plan. The
+// input is resampled horizontally, then vertically, in bands of output
+// rows processed in parallel.
+//
+// Parameters:
+//   plan - plan created for the dimensions of input_img and output_img
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//
+// Returns:
+//   1 if successful, 0 if the image dimensions don't match the plan
+//   or memory could not be allocated
+int imgproc_resize_apply( const struct ResizePlan *plan, struct Image *input_img, struct Image *output_img );
+
+// Resize input_img to the dimensions of output_img.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                determine the size of the resized image)
+//   filter - resampling filter
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_resize( struct Image *input_img, struct Image *output_img, enum ResizeFilter filter );
+
+////////////////////////////////////////////////////////////////////////
+// Geometric transformations (imgproc_geometry.c)
+////////////////////////////////////////////////////////////////////////
+
+// Transpose an image: output row r is input column r.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_transpose( struct Image *input_img, struct Image *output_img );
+
+// Rotate an image 90 degrees clockwise.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_rotate90( struct Image *input_img, struct Image *output_img );
+
+// Rotate an image 270 degrees clockwise (90 degrees counterclockwise).
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_rotate270( struct Image *input_img, struct Image *output_img );
+
+// Rotate an image 180 degrees.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_rotate180( struct Image *input_img, struct Image *output_img );
+
+// Mirror an image left to right.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_flip_horizontal( struct Image *input_img, struct Image *output_img );
+
+// Mirror an image top to bottom.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_flip_vertical( struct Image *input_img, struct Image *output_img );
+
+// Warp an image by an affine transformation, with bilinear
+// interpolation. The matrix maps input coordinates (x, y) to output
+// coordinates (m[0]*x + m[1]*y + m[2], m[3]*x + m[4]*y + m[5]), where
+// (0, 0) is the top left corner of the top left pixel. Output pixels
+// that map to points outside the input image are transparent black.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (of any size)
+//   matrix - the 2x3 affine matrix, row by row
+//
+// Returns:
+//   1 if successful, 0 if the matrix has an entry that isn't finite,
+//   isn't invertible, or the output is the input image
+int imgproc_affine( struct Image *input_img, struct Image *output_img, const double matrix[6] );
+
+////////////////////////////////////////////////////////////////////////
+// Linear light color (imgproc_color.c)
+////////////////////////////////////////////////////////////////////////
+
+// Linear light values are 16-bit, with this value representing 1.0
+// (so that 12-bit values are the 16-bit ones shifted left by 4)
+#define IMGPROC_LINEAR_ONE 65520
+
+// Precision of the intermediate linear values of the linear light
+// transformations
+enum ColorPrecision {
+  COLOR_PRECISION_12,  // 12-bit linear values, nearest table entry on output
+  COLOR_PRECISION_16,  // 16-bit linear values, interpolated table entries on output
+};
+
+// Convert an sRGB channel value to linear light.
+//
+// Parameters:
+//   value - sRGB value
+//   precision - COLOR_PRECISION_12 to round the result to 12 bits
+//
+// Returns:
+//   the linear value, from 0 to IMGPROC_LINEAR_ONE
+uint16_t imgproc_srgb_to_linear( uint8_t value, enum ColorPrecision precision );
+
+// Convert a linear light value to an sRGB channel value.
+//
+// Parameters:
+//   lin - linear value, from 0 to IMGPROC_LINEAR_ONE
+//   precision - COLOR_PRECISION_16 to interpolate between table
+//               entries, COLOR_PRECISION_12 to use the nearest one
+//
+// Returns:
+//   the sRGB value
+uint8_t imgproc_linear_to_srgb( uint16_t lin, enum ColorPrecision precision );
+
+// Convert input pixels to grayscale using the luminance of their
+// linear light values, rather than a weighted sum of the gamma encoded
+// values as imgproc_grayscale does. Alpha values are copied from the
+// input. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   precision - precision of the intermediate linear values
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_grayscale_linear( struct Image *input_img, struct Image *output_img,
+                              enum ColorPrecision precision );
+
+// Render a "faded" version of the input image, with the fade applied
+// to linear light values rather than to the gamma encoded values as
+// imgproc_fade does. Alpha values are copied from the input. The input
+// and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   precision - precision of the intermediate linear values
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_fade_linear( struct Image *input_img, struct Image *output_img,
+                         enum ColorPrecision precision );
+
+////////////////////////////////////////////////////////////////////////
+// Histograms and statistics (imgproc_stats.c)
+////////////////////////////////////////////////////////////////////////
+
+// Color channels of a pixel
+enum Channel {
+  CHANNEL_R,
+  CHANNEL_G,
+  CHANNEL_B,
+  CHANNEL_A,
+  NUM_CHANNELS,
+};
+
+// Number of pixels with each value, per channel
+struct ImageHistogram {
+  uint64_t num_pixels;
+  uint64_t counts[NUM_CHANNELS][256];
+};
+
+// Summary statistics of every channel of an image
+struct ImageStats {
+  uint64_t num_pixels;
+  uint8_t min[NUM_CHANNELS];
+  uint8_t max[NUM_CHANNELS];
+  uint8_t median[NUM_CHANNELS];
+  double mean[NUM_CHANNELS];
+};
+
+// Compute the histogram of every channel of an image. Bands of rows
+// are counted in parallel into private histograms, which are merged at
+// the end.
+//
+// Parameters:
+//   img - pointer to the Image
+//   hist - pointer to the ImageHistogram to fill in
+void imgproc_histogram( struct Image *img, struct ImageHistogram *hist );
+
+// Find a percentile of one channel of a histogram.
+//
+// Parameters:
+//   hist - pointer to the ImageHistogram
+//   channel - the channel
+//   percent - the percentile, from 0 to 100
+//
+// Returns:
+//   the smallest value such that at least percent% of the pixels have
+//   a value less than or equal to it (0 for an empty image)
+uint8_t imgproc_histogram_percentile( const struct ImageHistogram *hist, enum Channel channel,
+                                      double percent );
+
+// Compute the minimum, maximum, mean and median of every channel from
+// a histogram.
+//
+// Parameters:
+//   hist - pointer to the ImageHistogram
+//   stats - pointer to the ImageStats to fill in
+void imgproc_histogram_stats( const struct ImageHistogram *hist, struct ImageStats *stats );
+
+// Stretch the contrast of every color channel so that its low and high
+// percentiles map to 0 and 255. Each channel is stretched separately,
+// which also corrects color casts. Alpha values are copied from the
+// input. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   clip_percent - percentage of pixels clipped to 0 and to 255 in
+//                  each channel (0 stretches the min/max range)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or clip_percent
+//   is not in [0, 50)
+int imgproc_autolevels( struct Image *input_img, struct Image *output_img, double clip_percent );
+
+////////////////////////////////////////////////////////////////////////
+// Planar images (imgproc_planar.c)
+////////////////////////////////////////////////////////////////////////
+
+// Image stored as one byte plane per channel, each plane holding
+// width * height values in row-major order. Channel-wise operations
+// on planar images work on plain byte vectors, without unpacking and
+// repacking pixels.
+struct PlanarImage {
+  int32_t width;
+  int32_t height;
+  uint8_t *r;
+  uint8_t *g;
+  uint8_t *b;
+  uint8_t *a;
+};
+
+// Allocate the planes of a planar image. The four planes share one
+// allocation.
+//
+// Parameters:
+//   img - pointer to the PlanarImage to initialize
+//   width - width of the image
+//   height - height of the image
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive or memory
+//   could not be allocated
+int imgproc_planar_init( struct PlanarImage *img, int32_t width, int32_t height );
+
+// Free the planes of a planar image.
+//
+// Parameters:
+//   img - pointer to the PlanarImage to clean up
+void imgproc_planar_cleanup( struct PlanarImage *img );
+
+// Split the channels of a packed image into the planes of a planar
+// image of the same dimensions.
+//
+// Parameters:
+//   input_img  - pointer to the packed input Image
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_from_packed( struct Image *input_img, struct PlanarImage *output_img );
+
+// Combine the planes of a planar image into a packed image of the
+// same dimensions.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the packed output Image
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_to_packed( struct PlanarImage *input_img, struct Image *output_img );
+
+// Planar version of imgproc_grayscale, with identical results.
+// The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_grayscale( struct PlanarImage *input_img, struct PlanarImage *output_img );
+
+// Planar version of imgproc_fade, with identical results.
+// The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_planar_fade( struct PlanarImage *input_img, struct PlanarImage *output_img );
+
+// Planar version of imgproc_rgb, with identical results.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage (which must have
+//                twice the width and height of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong
+int imgproc_planar_rgb( struct PlanarImage *input_img, struct PlanarImage *output_img );
+
+////////////////////////////////////////////////////////////////////////
+// Tiled out-of-core images (imgproc_tiles.c)
+////////////////////////////////////////////////////////////////////////
+
+struct TileSlot;
+
+// Image stored as square tiles in an unlinked scratch file. Tiles are
+// paged through an LRU cache bounded by a memory budget; modified
+// tiles are written back when they are evicted. Edge tiles are padded
+// to the full tile size.
+struct TileStore {
+  int32_t width;
+  int32_t height;
+  int32_t tile_size;
+  int32_t tiles_x;
+  int32_t tiles_y;
+  int fd;
+  int32_t num_slots;          // number of tiles the cache can hold
+  struct TileSlot *slots;
+  int32_t *slot_of_tile;      // cache slot of each tile, or -1
+  uint8_t *on_disk;           // whether each tile has been written to the scratch file
+  int32_t lru_head;           // most recently used slot
+  int32_t lru_tail;           // least recently used slot
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks;
+};
+
+// Create an empty (opaque black) tiled image in a scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore to initialize
+//   width, height - image dimensions
+//   tile_size - width and height of the square tiles, in pixels
+//   memory_budget - bytes of tile cache; at least one tile is cached
+//
+// Returns:
+//   1 if successful, 0 if a parameter is invalid, memory could not
+//   be allocated or the scratch file could not be created
+int imgproc_tile_store_init( struct TileStore *ts, int32_t width, int32_t height,
+                             int32_t tile_size, size_t memory_budget );
+
+// Free the tile cache of a TileStore and remove its scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore to clean up
+void imgproc_tile_store_cleanup( struct TileStore *ts );
+
+// Read one pixel of a tiled image.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//   x, y - column and row of the pixel
+//   pixel - where to store the pixel value
+//
+// Returns:
+//   1 if successful, 0 if the pixel is out of bounds or its tile
+//   could not be loaded
+int imgproc_tile_get_pixel( struct TileStore *ts, int32_t x, int32_t y, uint32_t *pixel );
+
+// Write one pixel of a tiled image.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//   x, y - column and row of the pixel
+//   pixel - the new pixel value
+//
+// Returns:
+//   1 if successful, 0 if the pixel is out of bounds or its tile
+//   could not be loaded
+int imgproc_tile_put_pixel( struct TileStore *ts, int32_t x, int32_t y, uint32_t pixel );
+
+// Copy the pixels of an Image into a TileStore of the same dimensions.
+//
+// Parameters:
+//   img - pointer to the source Image
+//   ts - pointer to the destination TileStore
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or tiles could
+//   not be written
+int imgproc_tile_store_from_image( struct Image *img, struct TileStore *ts );
+
+// Copy the pixels of a TileStore into an Image of the same dimensions.
+//
+// Parameters:
+//   ts - pointer to the source TileStore
+//   img - pointer to the destination Image
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or tiles could
+//   not be read
+int imgproc_tile_store_to_image( struct TileStore *ts, struct Image *img );
+
+// Write every modified cached tile back to the scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//
+// Returns:
+//   1 if successful, 0 if a tile could not be written
+int imgproc_tile_store_flush( struct TileStore *ts );
+
+// Tiled version of imgproc_rgb, with identical results. Output tiles
+// are produced grouped by the input tile they read, so each input
+// tile is normally loaded once and each output tile written once.
+// If the input width isn't a multiple of the tile size, the input
+// needs room for 4 tiles, or tiles are reread many times.
+//
+// Parameters:
+//   input_img - pointer to the input TileStore
+//   output_img - pointer to the output TileStore (which must have
+//                twice the width and height of the input image and
+//                the same tile size)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions or tile size are
+//   wrong or tiles could not be loaded or stored
+int imgproc_tiled_rgb( struct TileStore *input_img, struct TileStore *output_img );
+
+// Tiled version of imgproc_kaleidoscope, with identical results.
+// Each output tile reads its mirror image in wedge A, and output tiles
+// are produced grouped by that source tile, so the eight mirrored
+// copies of an input tile are written while it is cached.
+//
+// Parameters:
+//   input_img - pointer to the input TileStore (which must be square)
+//   output_img - pointer to the output TileStore (with the same
+//                dimensions and tile size)
+//
+// Returns:
+//   1 if successful, 0 if the image isn't square, the dimensions or
+//   tile sizes don't match or tiles could not be loaded or stored
+int imgproc_tiled_kaleidoscope( struct TileStore *input_img, struct TileStore *output_img );
+
+////////////////////////////////////////////////////////////////////////
+// Compositing (imgproc_composite.c)
+////////////////////////////////////////////////////////////////////////
+
+// How imgproc_composite combines an overlay pixel S with an input
+// pixel D (with premultiplied colors, and alpha values Sa and Da)
+enum BlendMode {
+  BLEND_OVER,      // S + D * (1 - Sa): S on top of D
+  BLEND_IN,        // S * Da: S where D is opaque
+  BLEND_OUT,       // S * (1 - Da): S where D is transparent
+  BLEND_MULTIPLY,  // S * D + S * (1 - Da) + D * (1 - Sa): darkens
+  BLEND_SCREEN,    // S + D - S * D: lightens
+};
+
+// Composite an overlay image with an input image. The overlay (the
+// source, in Porter-Duff terms) is placed with its top left corner at
+// (x, y) in the input image (the destination); input pixels it doesn't
+// cover are composited with a transparent pixel. Colors are
+// premultiplied by their alpha values and blended in 8-bit fixed
+// point. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   overlay_img - pointer to the overlay Image (of any size)
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//   mode - how the overlay and input pixels are combined
+//   x - column of the input image where the overlay starts
+//   y - row of the input image where the overlay starts
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match, the output is
+//   the overlay image or the mode is invalid
+int imgproc_composite( struct Image *input_img, struct Image *overlay_img, struct Image *output_img,
+                       enum BlendMode mode, int32_t x, int32_t y );
+
+////////////////////////////////////////////////////////////////////////
+// Image comparison and perceptual hashes (imgproc_compare.c)
+////////////////////////////////////////////////////////////////////////
+
+// Kinds of 64-bit perceptual hashes
+enum HashKind {
+  HASH_AVERAGE,     // aHash: 8x8 grayscale values above their mean
+  HASH_DIFFERENCE,  // dHash: 8x8 horizontal gradients of a 9x8 grayscale image
+  HASH_DCT,         // pHash: lowest 8x8 DCT frequencies of a 32x32 grayscale image
+  NUM_HASH_KINDS,
+};
+
+// Downscale an image to a grayscale image of the given size, where
+// every output value is the average luma (as computed by
+// imgproc_grayscale) of the input pixels covered by it. This is the
+// first step of all of the perceptual hashes.
+//
+// Parameters:
+//   img - pointer to the input Image
+//   width - width of the grayscale image
+//   height - height of the grayscale image
+//   out - array of width * height values, from 0 to 255, row by row
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive, the input
+//   image is empty or memory could not be allocated
+int imgproc_downscale_gray( struct Image *img, int32_t width, int32_t height, float *out );
+
+// Compute a 64-bit perceptual hash of an image. Similar images have
+// hashes that differ in few bits (see imgproc_hash_distance).
+//
+// Parameters:
+//   img - pointer to the Image
+//   kind - which hash to compute
+//   hash - set to the hash
+//
+// Returns:
+//   1 if successful, 0 if the image is empty or kind is invalid
+int imgproc_image_hash( struct Image *img, enum HashKind kind, uint64_t *hash );
+
+// Compute all of the perceptual hashes of an image, with the same
+// results as imgproc_image_hash. Images of at least 288x32 pixels are
+// read only once: their luma is summed over a grid that all of the
+// downscaled images are unions of cells of.
+//
+// Parameters:
+//   img - pointer to the Image
+//   hashes - set to the hash of every kind, indexed by HashKind
+//
+// Returns:
+//   1 if successful, 0 if the image is empty or memory could not be
+//   allocated
+int imgproc_image_hashes( struct Image *img, uint64_t hashes[NUM_HASH_KINDS] );
+
+// Count the bits in which two hashes differ.
+//
+// Parameters:
+//   a - a hash
+//   b - another hash of the same kind
+//
+// Returns:
+//   the Hamming distance, from 0 (identical) to 64
+int imgproc_hash_distance( uint64_t a, uint64_t b );
+
+// Compute the structural similarity (SSIM) of the luma of two images:
+// the mean SSIM of 8x8 windows spaced 4 pixels apart (one window as
+// large as the image, for images smaller than that). Window rows are
+// processed in parallel.
+//
+// Parameters:
+//   a - pointer to an Image
+//   b - pointer to an Image with the same dimensions
+//   ssim - set to the SSIM, 1.0 for identical images
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match, the images are
+//   empty or memory could not be allocated
+int imgproc_ssim( struct Image *a, struct Image *b, double *ssim );
+
+// Compute the peak signal-to-noise ratio of two images, over their
+// red, green and blue channels.
+//
+// Parameters:
+//   a - pointer to an Image
+//   b - pointer to an Image with the same dimensions
+//   psnr - set to the PSNR in decibels, INFINITY for identical images
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the images
+//   are empty
+int imgproc_psnr( struct Image *a, struct Image *b, double *psnr );
+
+////////////////////////////////////////////////////////////////////////
+// Perceptual hash index (imgproc_hash_index.c)
+////////////////////////////////////////////////////////////////////////
+
+// Hashes of a batch of image files
+struct HashIndex {
+  int32_t num_entries;
+  uint32_t names_size;                // bytes of name_data
+  uint64_t *hashes[NUM_HASH_KINDS];   // hashes[kind][entry]
+  char **names;                       // file name of every entry
+  char *name_data;                    // storage of the names
+};
+
+// Hash image files and build an index of them. Files are read and
+// hashed in parallel by imgproc_get_num_threads() threads. Files that
+// can't be read are left out of the index.
+//
+// Parameters:
+//   filenames - names of the PNG files
+//   num_files - number of files
+//   index - pointer to the HashIndex to initialize (it must be
+//           freed with imgproc_hash_index_cleanup)
+//
+// Returns:
+//   1 if successful, 0 if memory could not be allocated
+int imgproc_hash_index_build( const char *const *filenames, int32_t num_files, struct HashIndex *index );
+
+// Write an index to a file.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+//   filename - name of the index file
+//
+// Returns:
+//   1 if successful, 0 if the file could not be written
+int imgproc_hash_index_write( const struct HashIndex *index, const char *filename );
+
+// Read an index from a file written by imgproc_hash_index_write.
+//
+// Parameters:
+//   filename - name of the index file
+//   index - pointer to the HashIndex to initialize (it must be
+//           freed with imgproc_hash_index_cleanup)
+//
+// Returns:
+//   1 if successful, 0 if the file could not be read, is not a valid
+//   index or memory could not be allocated
+int imgproc_hash_index_read( const char *filename, struct HashIndex *index );
+
+// Free the memory of an index.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+void imgproc_hash_index_cleanup( struct HashIndex *index );
+
+// Find the entries of an index whose hash of one kind is within a
+// Hamming distance of a hash.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+//   kind - kind of the hash
+//   hash - the hash to look up
+//   max_distance - largest Hamming distance of a match
+//   matches - set to the entry numbers of up to max_matches matches,
+//             in index order
+//   max_matches - size of the matches array
+//
+// Returns:
+//   the number of matches, which may be larger than max_matches
+int32_t imgproc_hash_index_lookup( const struct HashIndex *index, enum HashKind kind, uint64_t hash,
+                                   int max_distance, int32_t *matches, int32_t max_matches );
+
+////////////////////////////////////////////////////////////////////////
+// Threading (imgproc_threads.c)
+////////////////////////////////////////////////////////////////////////
+
+// Set the number of threads used by the threaded transformations.
+//
+// Parameters:
+//   num_threads - number of threads, or 0 to use one per online CPU
+void imgproc_set_num_threads( int num_threads );
+
+// Get the number of threads used by the threaded transformations.
+//
+// Returns:
+//   the number of threads (at least 1)
+int imgproc_get_num_threads( void );
+
+// Split the rows [0, num_rows) into contiguous bands and call fn
+// once per band, each band on its own thread. The calling thread
+// processes the first band itself and waits for the others.
+//
+// Parameters:
+//   num_rows - total number of rows to process
+//   fn - function processing rows [row_begin, row_end)
+//   arg - argument passed through to fn
+void imgproc_parallel_rows( int32_t num_rows,
+                            void (*fn)( void *arg, int32_t row_begin, int32_t row_end ),
+                            void *arg );
+
+////////////////////////////////////////////////////////////////////////
+// Inline helpers shared by all of the modules
+////////////////////////////////////////////////////////////////////////
+
+// Weights of the color channels in the luma of imgproc_grayscale, in
+// 256ths (so they add up to 256)
+#define IMGPROC_LUMA_R 79
+#define IMGPROC_LUMA_G 128
+#define IMGPROC_LUMA_B 49
+
+// Luma of color channel values r, g and b: the weighted sum computed by
+// imgproc_grayscale. Values from 0 to 255 give a luma from 0 to 255.
+// Negative values (e.g. derivatives) are allowed, and the quotient is
+// truncated toward zero.
+static inline int32_t imgproc_luma( int32_t r, int32_t g, int32_t b ) {
+  return ( IMGPROC_LUMA_R * r + IMGPROC_LUMA_G * g + IMGPROC_LUMA_B * b ) / 256;
+}
+
+// Fade factor of row/column x of max computed by imgproc_fade, from 0
+// at the edges to 10^6 in the middle
+static inline int64_t imgproc_fade_gradient( int64_t x, int64_t max ) {
+  int64_t square = ( ( 2000000000LL * x ) / ( 1000000LL * max ) - 1000 );
+  return 1000000LL - square * square;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Helper functions
+////////////////////////////////////////////////////////////////////////
+
 // Get the red value from pixel
 uint32_t get_r( uint32_t pixel );
 
@@ -119,6 +1022,6 @@ uint32_t to_grayscale( uint32_t pixel );
 int64_t gradient( int64_t x, int64_t max );
 
 // Compute the 1-dimensional index from column and row indices
-int32_t compute_index( struct Image *img, int32_t col, int32_t row );
+int64_t compute_index( struct Image *img, int32_t col, int32_t row );
 
 #endif // IMGPROC_H
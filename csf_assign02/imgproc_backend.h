@@ -0,0 +1,34 @@
+// Renames the functions of an imgproc backend (c_imgproc_fns.c,
+// cpp_imgproc_fns.cpp or asm_imgproc_fns.S), so that several backends
+// can be linked into one program. A backend is compiled with
+// -DIMGPROC_BACKEND=<prefix> and -include imgproc_backend.h, which
+// turns e.g. imgproc_rgb into <prefix>_imgproc_rgb. This header must
+// stay usable from assembly sources, so it may only contain
+// preprocessor directives.
+
+#ifndef IMGPROC_BACKEND_H
+#define IMGPROC_BACKEND_H
+
+#ifdef IMGPROC_BACKEND
+
+#define IMGPROC_BACKEND_CAT2( prefix, name ) prefix ## _ ## name
+#define IMGPROC_BACKEND_CAT( prefix, name ) IMGPROC_BACKEND_CAT2( prefix, name )
+#define IMGPROC_BACKEND_NAME( name ) IMGPROC_BACKEND_CAT( IMGPROC_BACKEND, name )
+
+#define imgproc_grayscale IMGPROC_BACKEND_NAME( imgproc_grayscale )
+#define imgproc_rgb IMGPROC_BACKEND_NAME( imgproc_rgb )
+#define imgproc_fade IMGPROC_BACKEND_NAME( imgproc_fade )
+#define imgproc_kaleidoscope IMGPROC_BACKEND_NAME( imgproc_kaleidoscope )
+#define get_r IMGPROC_BACKEND_NAME( get_r )
+#define get_g IMGPROC_BACKEND_NAME( get_g )
+#define get_b IMGPROC_BACKEND_NAME( get_b )
+#define get_a IMGPROC_BACKEND_NAME( get_a )
+#define make_pixel IMGPROC_BACKEND_NAME( make_pixel )
+#define to_grayscale IMGPROC_BACKEND_NAME( to_grayscale )
+#define gradient IMGPROC_BACKEND_NAME( gradient )
+#define compute_index IMGPROC_BACKEND_NAME( compute_index )
+#define fade_pixel IMGPROC_BACKEND_NAME( fade_pixel )
+
+#endif // IMGPROC_BACKEND
+
+#endif // IMGPROC_BACKEND_H
@@ -0,0 +1,447 @@
+// Benchmark of the image transformations on synthetic images.
+//
+// Every backend (the C functions, the C functions compiled for
+// auto-vectorization, the assembly functions, the C++ pipelines of
+// cpp_imgproc_fns.cpp, and the planar transformations of
+// imgproc_planar.c) is linked into this program under its own prefix
+// (see imgproc_backend.h), so the backends can be timed against each
+// other and their outputs compared pixel-for-pixel. The transformations
+// shared by all backends are timed once, and their multi-threaded
+// output is compared against a single-threaded run. Throughput is reported in megapixels of input
+// per second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "imgproc.h"
+
+#define DECLARE_BACKEND( prefix ) \
+  void prefix ## _imgproc_grayscale( struct Image *input_img, struct Image *output_img ); \
+  void prefix ## _imgproc_rgb( struct Image *input_img, struct Image *output_img ); \
+  void prefix ## _imgproc_fade( struct Image *input_img, struct Image *output_img ); \
+  int prefix ## _imgproc_kaleidoscope( struct Image *input_img, struct Image *output_img );
+
+DECLARE_BACKEND( c )
+DECLARE_BACKEND( vec )
+DECLARE_BACKEND( asm )
+DECLARE_BACKEND( cpp )
+
+void planar_imgproc_grayscale( struct Image *input_img, struct Image *output_img );
+void planar_imgproc_rgb( struct Image *input_img, struct Image *output_img );
+void planar_imgproc_fade( struct Image *input_img, struct Image *output_img );
+
+// A backend's transformation function is NULL if it doesn't implement it
+struct Backend {
+  const char *name;
+  void (*grayscale)( struct Image *input_img, struct Image *output_img );
+  void (*rgb)( struct Image *input_img, struct Image *output_img );
+  void (*fade)( struct Image *input_img, struct Image *output_img );
+  int (*kaleidoscope)( struct Image *input_img, struct Image *output_img );
+};
+
+#define BACKEND( prefix ) \
+  { #prefix, prefix ## _imgproc_grayscale, prefix ## _imgproc_rgb, \
+    prefix ## _imgproc_fade, prefix ## _imgproc_kaleidoscope }
+
+// The first backend is the reference the others are compared against
+static const struct Backend s_backends[] = {
+  BACKEND( c ),
+  BACKEND( vec ),
+  BACKEND( asm ),
+  BACKEND( cpp ),
+  { "planar", planar_imgproc_grayscale, planar_imgproc_rgb, planar_imgproc_fade, NULL },
+};
+
+#define NUM_BACKENDS ( (int) ( sizeof( s_backends ) / sizeof( s_backends[0] ) ) )
+
+struct BenchTransform {
+  const char *name;
+  // returns 1 on success, 0 on failure, -1 if the backend doesn't
+  // implement the transformation; backend is NULL for shared transformations
+  int (*apply)( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+  // output dimensions are input dimensions * scale_num / scale_den
+  int32_t scale_num;
+  int32_t scale_den;
+  bool shared;
+};
+
+int bench_grayscale( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_rgb( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_fade( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_kaleidoscope( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_blur( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_gaussian( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_sobel( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_sharpen( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_resize( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+int bench_composite( const struct Backend *backend, struct Image *input_img, struct Image *output_img );
+
+static const struct BenchTransform s_bench_transforms[] = {
+  { "grayscale", bench_grayscale, 1, 1, false },
+  { "rgb", bench_rgb, 2, 1, false },
+  { "fade", bench_fade, 1, 1, false },
+  { "kaleidoscope", bench_kaleidoscope, 1, 1, false },
+  { "blur", bench_blur, 1, 1, true },
+  { "gaussian", bench_gaussian, 1, 1, true },
+  { "sobel", bench_sobel, 1, 1, true },
+  { "sharpen", bench_sharpen, 1, 1, true },
+  { "resize", bench_resize, 1, 2, true },
+  { "composite", bench_composite, 1, 1, true },
+  { NULL, NULL, 0, 0, false },
+};
+
+// Image sizes (width and height) to benchmark
+static const int32_t s_sizes[] = { 64, 256, 1024, 4096, 16384 };
+
+#define NUM_SIZES ( (int) ( sizeof( s_sizes ) / sizeof( s_sizes[0] ) ) )
+
+// Each measurement is repeated until it has taken at least this long
+#define MIN_BENCH_SECONDS 0.25
+
+void usage( const char *progname ) {
+  fprintf( stderr, "Usage: %s [-s max size] [-t threads] [transform...]\n", progname );
+  exit( 1 );
+}
+
+double now_seconds( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Bytes of pixel data currently allocated by new_img
+static uint64_t s_allocated;
+
+// Allocate an image, returning NULL if there isn't enough memory.
+// Images that would not fit in physical memory alongside what is
+// already allocated are refused, since with overcommit malloc would
+// succeed and the program would be killed while filling them.
+struct Image *new_img( int32_t width, int32_t height ) {
+  uint64_t bytes = (uint64_t) width * height * sizeof( uint32_t );
+  uint64_t phys = (uint64_t) sysconf( _SC_PHYS_PAGES ) * (uint64_t) sysconf( _SC_PAGESIZE );
+  if ( s_allocated + bytes > phys / 10 * 9 )
+    return NULL;
+
+  struct Image *img = (struct Image *) malloc( sizeof( struct Image ) );
+  if ( img == NULL )
+    return NULL;
+  if ( img_init( img, width, height ) != IMG_SUCCESS ) {
+    free( img );
+    return NULL;
+  }
+  s_allocated += bytes;
+  return img;
+}
+
+void destroy_img( struct Image *img ) {
+  if ( img != NULL ) {
+    s_allocated -= (uint64_t) img->width * img->height * sizeof( uint32_t );
+    img_cleanup( img );
+    free( img );
+  }
+}
+
+// Create an image of pseudo-random pixels (xorshift32)
+struct Image *random_img( int32_t width, int32_t height, uint32_t seed ) {
+  struct Image *img = new_img( width, height );
+  if ( img == NULL )
+    return NULL;
+  uint32_t x = seed | 1;
+  int64_t num_pixels = (int64_t) width * height;
+  for ( int64_t i = 0; i < num_pixels; i++ ) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    img->data[i] = x;
+  }
+  return img;
+}
+
+// Fill img with the complement of every pixel of ref, so that any pixel
+// a transformation leaves unwritten in img differs from the reference
+void fill_complement( struct Image *img, struct Image *ref ) {
+  int64_t num_pixels = (int64_t) img->width * img->height;
+  for ( int64_t i = 0; i < num_pixels; i++ )
+    img->data[i] = ~ref->data[i];
+}
+
+bool images_equal( struct Image *a, struct Image *b ) {
+  return a->width == b->width && a->height == b->height
+    && memcmp( a->data, b->data, (size_t) a->width * a->height * sizeof( uint32_t ) ) == 0;
+}
+
+// Time a transformation, repeating it until MIN_BENCH_SECONDS have passed.
+//
+// Returns:
+//   the fastest time of a single run in seconds, -1 if the transformation
+//   failed, or -2 if the backend doesn't implement it
+double time_transform( const struct BenchTransform *xform, const struct Backend *backend,
+                       struct Image *input_img, struct Image *output_img ) {
+  double best = -1.0, total = 0.0;
+  do {
+    double begin = now_seconds();
+    int rc = xform->apply( backend, input_img, output_img );
+    if ( rc != 1 )
+      return rc < 0 ? -2.0 : -1.0;
+    double elapsed = now_seconds() - begin;
+    if ( best < 0.0 || elapsed < best )
+      best = elapsed;
+    total += elapsed;
+  } while ( total < MIN_BENCH_SECONDS );
+  return best;
+}
+
+void print_result( const char *transform, int32_t size, const char *backend,
+                   double seconds, const char *exact ) {
+  if ( seconds < -1.5 ) {
+    printf( "%-13s %6d %-10s %12s\n", transform, size, backend, "n/a" );
+    return;
+  }
+  if ( seconds < 0.0 ) {
+    printf( "%-13s %6d %-10s %12s  %s\n", transform, size, backend, "failed", exact );
+    return;
+  }
+  printf( "%-13s %6d %-10s %12.2f  %s\n", transform, size, backend,
+          (double) size * size / seconds * 1e-6, exact );
+}
+
+// Benchmark a transformation implemented by every backend.
+//
+// Returns:
+//   the number of backends whose output differed from the reference
+int bench_backends( const struct BenchTransform *xform, struct Image *input_img ) {
+  int32_t size = input_img->width;
+  int32_t out_size = size * xform->scale_num / xform->scale_den;
+  int mismatches = 0;
+
+  struct Image *ref = new_img( out_size, out_size );
+  struct Image *out = new_img( out_size, out_size );
+  if ( ref == NULL || out == NULL ) {
+    printf( "%-13s %6d %-10s %12s\n", xform->name, size, "*", "skipped (out of memory)" );
+    destroy_img( ref );
+    destroy_img( out );
+    return 0;
+  }
+
+  for ( int i = 0; i < NUM_BACKENDS; i++ ) {
+    struct Image *dst = i == 0 ? ref : out;
+    if ( i > 0 )
+      fill_complement( out, ref );
+    double seconds = time_transform( xform, &s_backends[i], input_img, dst );
+    const char *exact = "reference";
+    if ( i > 0 && seconds > -1.5 ) {
+      bool equal = images_equal( ref, out );
+      exact = equal ? "bit-exact" : "MISMATCH";
+      mismatches += !equal;
+    }
+    print_result( xform->name, size, s_backends[i].name, seconds, exact );
+  }
+
+  destroy_img( ref );
+  destroy_img( out );
+  return mismatches;
+}
+
+// Benchmark a transformation shared by all backends, single-threaded
+// and with the requested number of threads.
+//
+// Returns:
+//   1 if the multi-threaded output differed from the single-threaded one,
+//   0 otherwise
+int bench_shared( const struct BenchTransform *xform, struct Image *input_img, int num_threads ) {
+  int32_t size = input_img->width;
+  int32_t out_size = size * xform->scale_num / xform->scale_den;
+  int mismatch = 0;
+
+  struct Image *ref = new_img( out_size, out_size );
+  struct Image *out = new_img( out_size, out_size );
+  if ( ref == NULL || out == NULL ) {
+    printf( "%-13s %6d %-10s %12s\n", xform->name, size, "*", "skipped (out of memory)" );
+    destroy_img( ref );
+    destroy_img( out );
+    return 0;
+  }
+
+  imgproc_set_num_threads( 1 );
+  double seconds = time_transform( xform, NULL, input_img, ref );
+  print_result( xform->name, size, "shared/1", seconds, "reference" );
+
+  imgproc_set_num_threads( num_threads );
+  int threads = imgproc_get_num_threads();
+  if ( threads > 1 ) {
+    char label[32];
+    snprintf( label, sizeof( label ), "shared/%d", threads );
+    fill_complement( out, ref );
+    seconds = time_transform( xform, NULL, input_img, out );
+    mismatch = !images_equal( ref, out );
+    print_result( xform->name, size, label, seconds, mismatch ? "MISMATCH" : "bit-exact" );
+  }
+
+  destroy_img( ref );
+  destroy_img( out );
+  return mismatch;
+}
+
+bool transform_selected( const char *name, int num_names, char **names ) {
+  if ( num_names == 0 )
+    return true;
+  for ( int i = 0; i < num_names; i++ )
+    if ( strcmp( names[i], name ) == 0 )
+      return true;
+  return false;
+}
+
+int main( int argc, char **argv ) {
+  int32_t max_size = s_sizes[NUM_SIZES - 1];
+  int num_threads = 0;
+
+  int opt;
+  while ( ( opt = getopt( argc, argv, "s:t:" ) ) != -1 ) {
+    switch ( opt ) {
+    case 's':
+      max_size = atoi( optarg );
+      break;
+    case 't':
+      num_threads = atoi( optarg );
+      break;
+    default:
+      usage( argv[0] );
+    }
+  }
+  int num_names = argc - optind;
+  char **names = argv + optind;
+
+  for ( int i = 0; i < num_names; i++ ) {
+    bool known = false;
+    for ( int j = 0; s_bench_transforms[j].name != NULL; j++ )
+      known = known || strcmp( s_bench_transforms[j].name, names[i] ) == 0;
+    if ( !known ) {
+      fprintf( stderr, "Error: unknown transformation '%s'\n", names[i] );
+      return 1;
+    }
+  }
+
+  printf( "%-13s %6s %-10s %12s  %s\n", "transform", "size", "backend", "Mpix/s", "output" );
+
+  int mismatches = 0;
+  for ( int s = 0; s < NUM_SIZES && s_sizes[s] <= max_size; s++ ) {
+    struct Image *input_img = random_img( s_sizes[s], s_sizes[s], 0x12345678 );
+    if ( input_img == NULL ) {
+      printf( "%-13s %6d %-10s %12s\n", "*", s_sizes[s], "*", "skipped (out of memory)" );
+      continue;
+    }
+
+    for ( int i = 0; s_bench_transforms[i].name != NULL; i++ ) {
+      const struct BenchTransform *xform = &s_bench_transforms[i];
+      if ( !transform_selected( xform->name, num_names, names ) )
+        continue;
+      mismatches += xform->shared
+        ? bench_shared( xform, input_img, num_threads )
+        : bench_backends( xform, input_img );
+      fflush( stdout );
+    }
+
+    destroy_img( input_img );
+  }
+
+  if ( mismatches > 0 ) {
+    fprintf( stderr, "Error: %d output(s) differed from the reference\n", mismatches );
+    return 1;
+  }
+  return 0;
+}
+
+int bench_grayscale( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  if ( backend->grayscale == NULL )
+    return -1;
+  backend->grayscale( input_img, output_img );
+  return 1;
+}
+
+int bench_rgb( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  if ( backend->rgb == NULL )
+    return -1;
+  backend->rgb( input_img, output_img );
+  return 1;
+}
+
+int bench_fade( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  if ( backend->fade == NULL )
+    return -1;
+  backend->fade( input_img, output_img );
+  return 1;
+}
+
+int bench_kaleidoscope( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  if ( backend->kaleidoscope == NULL )
+    return -1;
+  return backend->kaleidoscope( input_img, output_img );
+}
+
+// Run a planar transformation on packed images. The timings of the
+// planar backend include the conversions to and from planar form.
+// On failure the output is left unchanged. The benchmark fills it with
+// the complement of the reference first, so the failure shows up as a
+// mismatch.
+void planar_apply( int (*fn)( struct PlanarImage *input_img, struct PlanarImage *output_img ),
+                   struct Image *input_img, struct Image *output_img ) {
+  struct PlanarImage in, out;
+  if ( !imgproc_planar_init( &in, input_img->width, input_img->height ) )
+    return;
+  if ( !imgproc_planar_init( &out, output_img->width, output_img->height ) ) {
+    imgproc_planar_cleanup( &in );
+    return;
+  }
+  if ( imgproc_planar_from_packed( input_img, &in ) && fn( &in, &out ) )
+    imgproc_planar_to_packed( &out, output_img );
+  imgproc_planar_cleanup( &in );
+  imgproc_planar_cleanup( &out );
+}
+
+void planar_imgproc_grayscale( struct Image *input_img, struct Image *output_img ) {
+  planar_apply( imgproc_planar_grayscale, input_img, output_img );
+}
+
+void planar_imgproc_rgb( struct Image *input_img, struct Image *output_img ) {
+  planar_apply( imgproc_planar_rgb, input_img, output_img );
+}
+
+void planar_imgproc_fade( struct Image *input_img, struct Image *output_img ) {
+  planar_apply( imgproc_planar_fade, input_img, output_img );
+}
+
+int bench_blur( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_box_blur( input_img, output_img, 3 );
+}
+
+int bench_gaussian( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_gaussian_blur( input_img, output_img, 2.0 );
+}
+
+int bench_sobel( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_sobel( input_img, output_img );
+}
+
+int bench_sharpen( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_unsharp_mask( input_img, output_img, 1.5, 80 );
+}
+
+int bench_resize( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_resize( input_img, output_img, RESIZE_LANCZOS3 );
+}
+
+// The input image over itself, shifted so that a quarter of the rows
+// and columns are not covered
+int bench_composite( const struct Backend *backend, struct Image *input_img, struct Image *output_img ) {
+  (void) backend;
+  return imgproc_composite( input_img, input_img, output_img, BLEND_OVER,
+                            input_img->width / 4, input_img->height / 4 );
+}
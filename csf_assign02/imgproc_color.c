@@ -0,0 +1,252 @@
+// Gamma-correct (linear light) versions of the grayscale and fade
+// transformations, using lookup tables to convert between sRGB and
+// linear values
+
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Number of entries of the linear-to-sRGB table
+#define LINEAR_TABLE_SIZE 4096
+
+// Rec. 709 luminance weights in 0.16 fixed point (summing to 65536)
+#define LUMA_R 13933
+#define LUMA_G 46871
+#define LUMA_B 4732
+
+struct ColorJob {
+  struct Image *input_img;
+  struct Image *output_img;
+  enum ColorPrecision precision;
+  const uint16_t *col_fade;  // fade only: 0.16 fixed point fade factor of every column
+  int failed;
+};
+
+static pthread_once_t s_tables_once = PTHREAD_ONCE_INIT;
+
+// sRGB value to linear value (scaled to IMGPROC_LINEAR_ONE), at 16-bit
+// precision and rounded to 12 bits
+static uint16_t s_to_linear16[256];
+static uint16_t s_to_linear12[256];
+
+// Linear value i / (LINEAR_TABLE_SIZE - 1) to sRGB value in 8.8 fixed
+// point, so that the 16-bit path can interpolate between entries
+static uint16_t s_to_srgb[LINEAR_TABLE_SIZE];
+
+static void init_tables( void ) {
+  for ( int v = 0; v < 256; v++ ) {
+    double s = v / 255.0;
+    double lin = s <= 0.04045 ? s / 12.92 : pow( ( s + 0.055 ) / 1.055, 2.4 );
+    s_to_linear16[v] = (uint16_t) lround( lin * IMGPROC_LINEAR_ONE );
+    s_to_linear12[v] = (uint16_t) ( lround( lin * ( LINEAR_TABLE_SIZE - 1 ) ) << 4 );
+  }
+  for ( int i = 0; i < LINEAR_TABLE_SIZE; i++ ) {
+    double lin = (double) i / ( LINEAR_TABLE_SIZE - 1 );
+    double s = lin <= 0.0031308 ? lin * 12.92 : 1.055 * pow( lin, 1.0 / 2.4 ) - 0.055;
+    s_to_srgb[i] = (uint16_t) lround( s * 255.0 * 256.0 );
+  }
+}
+
+static const uint16_t *linear_table( enum ColorPrecision precision ) {
+  return precision == COLOR_PRECISION_16 ? s_to_linear16 : s_to_linear12;
+}
+
+static uint8_t encode( uint32_t lin, enum ColorPrecision precision ) {
+  if ( precision == COLOR_PRECISION_16 ) {
+    // interpolate between the two nearest entries
+    uint32_t idx = lin >> 4, frac = lin & 15;
+    uint32_t lo = s_to_srgb[idx];
+    uint32_t hi = idx + 1 < LINEAR_TABLE_SIZE ? s_to_srgb[idx + 1] : lo;
+    return (uint8_t) ( ( lo + ( ( ( hi - lo ) * frac ) >> 4 ) + 128 ) >> 8 );
+  }
+  return (uint8_t) ( ( s_to_srgb[( lin + 8 ) >> 4] + 128 ) >> 8 );
+}
+
+// Convert an sRGB channel value to linear light.
+//
+// Parameters:
+//   value - sRGB value
+//   precision - COLOR_PRECISION_12 to round the result to 12 bits
+//
+// Returns:
+//   the linear value, from 0 to IMGPROC_LINEAR_ONE
+uint16_t imgproc_srgb_to_linear( uint8_t value, enum ColorPrecision precision ) {
+  pthread_once( &s_tables_once, init_tables );
+  return linear_table( precision )[value];
+}
+
+// Convert a linear light value to an sRGB channel value.
+//
+// Parameters:
+//   lin - linear value, from 0 to IMGPROC_LINEAR_ONE
+//   precision - COLOR_PRECISION_16 to interpolate between table
+//               entries, COLOR_PRECISION_12 to use the nearest one
+//
+// Returns:
+//   the sRGB value
+uint8_t imgproc_linear_to_srgb( uint16_t lin, enum ColorPrecision precision ) {
+  pthread_once( &s_tables_once, init_tables );
+  if ( lin > IMGPROC_LINEAR_ONE )
+    lin = IMGPROC_LINEAR_ONE;
+  return encode( lin, precision );
+}
+
+// Decode the color channels of a row of pixels into planar rows of
+// linear values. The lookups stay scalar: SSE2 has no gather, and the
+// results must be exactly the table entries, which an arithmetic
+// approximation could only match with a lookup to correct it. The
+// arithmetic on the decoded rows is vectorized.
+static void decode_row( const uint32_t *src, uint16_t *r, uint16_t *g, uint16_t *b,
+                        int32_t n, const uint16_t *table ) {
+  for ( int32_t x = 0; x < n; x++ ) {
+    uint32_t p = src[x];
+    r[x] = table[p >> 24];
+    g[x] = table[( p >> 16 ) & 0xFF];
+    b[x] = table[( p >> 8 ) & 0xFF];
+  }
+}
+
+// Y = (r * LUMA_R >> 16) + (g * LUMA_G >> 16) + (b * LUMA_B >> 16)
+static void luminance_row( const uint16_t *r, const uint16_t *g, const uint16_t *b,
+                           uint16_t *y, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  const __m128i wr = _mm_set1_epi16( (short) LUMA_R );
+  const __m128i wg = _mm_set1_epi16( (short) LUMA_G );
+  const __m128i wb = _mm_set1_epi16( (short) LUMA_B );
+  for ( ; x + 8 <= n; x += 8 ) {
+    __m128i vr = _mm_mulhi_epu16( _mm_loadu_si128( (const __m128i *) ( r + x ) ), wr );
+    __m128i vg = _mm_mulhi_epu16( _mm_loadu_si128( (const __m128i *) ( g + x ) ), wg );
+    __m128i vb = _mm_mulhi_epu16( _mm_loadu_si128( (const __m128i *) ( b + x ) ), wb );
+    _mm_storeu_si128( (__m128i *) ( y + x ), _mm_add_epi16( _mm_add_epi16( vr, vg ), vb ) );
+  }
+#endif
+  for ( ; x < n; x++ )
+    y[x] = (uint16_t) ( ( ( r[x] * (uint32_t) LUMA_R ) >> 16 ) + ( ( g[x] * (uint32_t) LUMA_G ) >> 16 )
+                        + ( ( b[x] * (uint32_t) LUMA_B ) >> 16 ) );
+}
+
+// v = v * (row_fade * col_fade[x] >> 16) >> 16, for each of the planar rows
+static void fade_rows( uint16_t *rows[3], const uint16_t *col_fade, uint16_t row_fade, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  const __m128i rf = _mm_set1_epi16( (short) row_fade );
+  for ( ; x + 8 <= n; x += 8 ) {
+    __m128i f = _mm_mulhi_epu16( rf, _mm_loadu_si128( (const __m128i *) ( col_fade + x ) ) );
+    for ( int c = 0; c < 3; c++ ) {
+      __m128i *p = (__m128i *) ( rows[c] + x );
+      _mm_storeu_si128( p, _mm_mulhi_epu16( _mm_loadu_si128( p ), f ) );
+    }
+  }
+#endif
+  for ( ; x < n; x++ ) {
+    uint32_t f = ( (uint32_t) row_fade * col_fade[x] ) >> 16;
+    for ( int c = 0; c < 3; c++ )
+      rows[c][x] = (uint16_t) ( ( rows[c][x] * f ) >> 16 );
+  }
+}
+
+// imgproc_fade_gradient of row/column x of max in 0.16 fixed point,
+// clamped to the largest 16-bit value
+static uint16_t fade_factor( int64_t x, int64_t max ) {
+  int64_t f = ( imgproc_fade_gradient( x, max ) * 65536 ) / 1000000LL;
+  return (uint16_t) ( f > 65535 ? 65535 : f );
+}
+
+static void color_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct ColorJob *job = (struct ColorJob *) arg;
+  struct Image *in = job->input_img, *out = job->output_img;
+  int32_t w = in->width;
+  const uint16_t *table = linear_table( job->precision );
+
+  uint16_t *buf = (uint16_t *) malloc( (size_t) w * 4 * sizeof( uint16_t ) );
+  if ( buf == NULL ) {
+    __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+    return;
+  }
+  uint16_t *rows[3] = { buf, buf + w, buf + (size_t) w * 2 };
+  uint16_t *lum = buf + (size_t) w * 3;
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *src = in->data + (size_t) y * w;
+    uint32_t *dst = out->data + (size_t) y * w;
+    decode_row( src, rows[0], rows[1], rows[2], w, table );
+    if ( job->col_fade == NULL ) {
+      luminance_row( rows[0], rows[1], rows[2], lum, w );
+      for ( int32_t x = 0; x < w; x++ ) {
+        uint32_t v = encode( lum[x], job->precision );
+        dst[x] = ( v << 24 ) | ( v << 16 ) | ( v << 8 ) | ( src[x] & 0xFF );
+      }
+    } else {
+      fade_rows( rows, job->col_fade, fade_factor( y, in->height ), w );
+      for ( int32_t x = 0; x < w; x++ ) {
+        dst[x] = ( (uint32_t) encode( rows[0][x], job->precision ) << 24 )
+          | ( (uint32_t) encode( rows[1][x], job->precision ) << 16 )
+          | ( (uint32_t) encode( rows[2][x], job->precision ) << 8 )
+          | ( src[x] & 0xFF );
+      }
+    }
+  }
+  free( buf );
+}
+
+static int run_color( struct Image *input_img, struct Image *output_img,
+                      enum ColorPrecision precision, const uint16_t *col_fade ) {
+  pthread_once( &s_tables_once, init_tables );
+  struct ColorJob job = { input_img, output_img, precision, col_fade, 0 };
+  imgproc_parallel_rows( input_img->height, color_band, &job );
+  return !job.failed;
+}
+
+// Convert input pixels to grayscale using the luminance of their
+// linear light values, rather than a weighted sum of the gamma encoded
+// values as imgproc_grayscale does. Alpha values are copied from the
+// input. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   precision - precision of the intermediate linear values
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_grayscale_linear( struct Image *input_img, struct Image *output_img,
+                              enum ColorPrecision precision ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  return run_color( input_img, output_img, precision, NULL );
+}
+
+// Render a "faded" version of the input image, with the fade applied
+// to linear light values rather than to the gamma encoded values as
+// imgproc_fade does. Alpha values are copied from the input. The input
+// and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   precision - precision of the intermediate linear values
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_fade_linear( struct Image *input_img, struct Image *output_img,
+                         enum ColorPrecision precision ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  uint16_t *col_fade = (uint16_t *) malloc( input_img->width * sizeof( uint16_t ) );
+  if ( col_fade == NULL )
+    return 0;
+  for ( int32_t x = 0; x < input_img->width; x++ )
+    col_fade[x] = fade_factor( x, input_img->width );
+
+  int ok = run_color( input_img, output_img, precision, col_fade );
+  free( col_fade );
+  return ok;
+}
@@ -0,0 +1,449 @@
+// Comparison of images: perceptual hashes (average, difference and
+// DCT hashes) for finding near-duplicates, and the SSIM and PSNR
+// similarity measures
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "imgproc.h"
+
+// Side of the square windows of SSIM, and the distance between them
+#define SSIM_WINDOW 8
+#define SSIM_STRIDE 4
+
+// Side of the grayscale image the DCT hash is computed from, and of
+// the block of its lowest frequencies that make up the hash
+#define PHASH_SIZE 32
+#define PHASH_LOW 8
+
+// Grid that the grayscale images of all of the hashes (8x8, 9x8 and
+// 32x32) are unions of cells of, when the image is at least this large
+#define SHARED_GRID_W 288
+#define SHARED_GRID_H 32
+
+struct LumaJob {
+  struct Image *img;
+  uint8_t *luma;
+};
+
+struct SsimJob {
+  const uint8_t *a;
+  const uint8_t *b;
+  int32_t width;
+  int32_t height;
+  int32_t window_w;
+  int32_t window_h;
+  int32_t windows_x;
+  double *row_sums;  // sum of the SSIM of the windows of each window row
+  int failed;
+};
+
+struct PsnrJob {
+  struct Image *a;
+  struct Image *b;
+  uint64_t sum;  // sum of squared differences
+  pthread_mutex_t lock;
+};
+
+// The luma of imgproc_grayscale (the same weights, so that hashes of
+// an image and of its grayscale version agree)
+static inline uint32_t luma( uint32_t p ) {
+  return (uint32_t) imgproc_luma( p >> 24, ( p >> 16 ) & 0xFF, ( p >> 8 ) & 0xFF );
+}
+
+// Start of cell i of n cells covering size pixels. Every cell covers at
+// least one pixel; cells of an upscaled image share pixels.
+static inline int32_t cell_begin( int32_t i, int32_t n, int32_t size ) {
+  return (int32_t) ( (int64_t) i * size / n );
+}
+
+static inline int32_t cell_end( int32_t i, int32_t n, int32_t size ) {
+  int32_t begin = cell_begin( i, n, size ), end = cell_begin( i + 1, n, size );
+  return end > begin ? end : begin + 1;
+}
+
+// Sum the luma of the pixels of each cell of a width x height grid
+// over the image, and count them
+static void downscale_sums( struct Image *img, int32_t width, int32_t height,
+                            uint64_t *sums, uint32_t *counts ) {
+  int32_t w = img->width, h = img->height;
+  for ( int32_t cy = 0; cy < height; cy++ ) {
+    int32_t y0 = cell_begin( cy, height, h ), y1 = cell_end( cy, height, h );
+    for ( int32_t cx = 0; cx < width; cx++ ) {
+      int32_t x0 = cell_begin( cx, width, w ), x1 = cell_end( cx, width, w );
+      uint64_t sum = 0;
+      for ( int32_t y = y0; y < y1; y++ ) {
+        const uint32_t *row = img->data + (size_t) y * w;
+        for ( int32_t x = x0; x < x1; x++ )
+          sum += luma( row[x] );
+      }
+      sums[(size_t) cy * width + cx] = sum;
+      counts[(size_t) cy * width + cx] = (uint32_t) ( ( y1 - y0 ) * ( x1 - x0 ) );
+    }
+  }
+}
+
+// Average a grid of sums down to a width x height grid, whose
+// dimensions divide the grid's
+static void reduce_sums( const uint64_t *sums, const uint32_t *counts, int32_t grid_w, int32_t grid_h,
+                         int32_t width, int32_t height, float *out ) {
+  int32_t fx = grid_w / width, fy = grid_h / height;
+  for ( int32_t cy = 0; cy < height; cy++ )
+    for ( int32_t cx = 0; cx < width; cx++ ) {
+      uint64_t sum = 0, count = 0;
+      for ( int32_t y = cy * fy; y < ( cy + 1 ) * fy; y++ )
+        for ( int32_t x = cx * fx; x < ( cx + 1 ) * fx; x++ ) {
+          sum += sums[(size_t) y * grid_w + x];
+          count += counts[(size_t) y * grid_w + x];
+        }
+      out[(size_t) cy * width + cx] = (float) sum / (float) count;
+    }
+}
+
+// Downscale an image to a grayscale image of the given size, where
+// every output value is the average luma (as computed by
+// imgproc_grayscale) of the input pixels covered by it. This is the
+// first step of all of the perceptual hashes.
+//
+// Parameters:
+//   img - pointer to the input Image
+//   width - width of the grayscale image
+//   height - height of the grayscale image
+//   out - array of width * height values, from 0 to 255, row by row
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive, the input
+//   image is empty or memory could not be allocated
+int imgproc_downscale_gray( struct Image *img, int32_t width, int32_t height, float *out ) {
+  if ( width <= 0 || height <= 0 || img->width <= 0 || img->height <= 0 )
+    return 0;
+  // the hashes downscale to a few rows, and batches of images are
+  // hashed in parallel, so this isn't split into row bands
+  size_t n = (size_t) width * height;
+  uint64_t *sums = (uint64_t *) malloc( n * ( sizeof( uint64_t ) + sizeof( uint32_t ) ) );
+  if ( sums == NULL )
+    return 0;
+  uint32_t *counts = (uint32_t *) ( sums + n );
+  downscale_sums( img, width, height, sums, counts );
+  reduce_sums( sums, counts, width, height, width, height, out );
+  free( sums );
+  return 1;
+}
+
+// Average hash: bit set where the 8x8 grayscale image is brighter
+// than its mean
+static uint64_t average_hash( const float gray[64] ) {
+  float mean = 0.0f;
+  for ( int i = 0; i < 64; i++ )
+    mean += gray[i];
+  mean /= 64.0f;
+  uint64_t h = 0;
+  for ( int i = 0; i < 64; i++ )
+    h = ( h << 1 ) | ( gray[i] > mean );
+  return h;
+}
+
+// Difference hash: bit set where a value of the 9x8 grayscale image is
+// brighter than its right neighbour
+static uint64_t difference_hash( const float gray[72] ) {
+  uint64_t h = 0;
+  for ( int y = 0; y < 8; y++ )
+    for ( int x = 0; x < 8; x++ )
+      h = ( h << 1 ) | ( gray[y * 9 + x] > gray[y * 9 + x + 1] );
+  return h;
+}
+
+static int compare_doubles( const void *a, const void *b ) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return ( x > y ) - ( x < y );
+}
+
+// DCT hash: bit set where a coefficient of the lowest 8x8 frequencies
+// of the DCT of the 32x32 grayscale image is above their median (the
+// DC coefficient, which only depends on the brightness, is left out
+// of the median)
+static uint64_t dct_hash( const float gray[PHASH_SIZE * PHASH_SIZE] ) {
+  double basis[PHASH_LOW][PHASH_SIZE];
+  for ( int k = 0; k < PHASH_LOW; k++ )
+    for ( int n = 0; n < PHASH_SIZE; n++ )
+      basis[k][n] = cos( M_PI * ( 2 * n + 1 ) * k / ( 2.0 * PHASH_SIZE ) );
+
+  // separable DCT-II, only computing the low frequencies: rows, then
+  // columns
+  double rows[PHASH_SIZE][PHASH_LOW], coeffs[PHASH_LOW * PHASH_LOW];
+  for ( int y = 0; y < PHASH_SIZE; y++ )
+    for ( int k = 0; k < PHASH_LOW; k++ ) {
+      double sum = 0.0;
+      for ( int n = 0; n < PHASH_SIZE; n++ )
+        sum += gray[y * PHASH_SIZE + n] * basis[k][n];
+      rows[y][k] = sum;
+    }
+  for ( int ky = 0; ky < PHASH_LOW; ky++ )
+    for ( int kx = 0; kx < PHASH_LOW; kx++ ) {
+      double sum = 0.0;
+      for ( int n = 0; n < PHASH_SIZE; n++ )
+        sum += rows[n][kx] * basis[ky][n];
+      coeffs[ky * PHASH_LOW + kx] = sum;
+    }
+
+  double sorted[PHASH_LOW * PHASH_LOW - 1];
+  memcpy( sorted, coeffs + 1, sizeof( sorted ) );
+  qsort( sorted, PHASH_LOW * PHASH_LOW - 1, sizeof( double ), compare_doubles );
+  double median = sorted[( PHASH_LOW * PHASH_LOW - 1 ) / 2];
+
+  uint64_t h = 0;
+  for ( int i = 0; i < PHASH_LOW * PHASH_LOW; i++ )
+    h = ( h << 1 ) | ( coeffs[i] > median );
+  return h;
+}
+
+// Compute a 64-bit perceptual hash of an image. Similar images have
+// hashes that differ in few bits (see imgproc_hash_distance).
+//
+// Parameters:
+//   img - pointer to the Image
+//   kind - which hash to compute
+//   hash - set to the hash
+//
+// Returns:
+//   1 if successful, 0 if the image is empty or kind is invalid
+int imgproc_image_hash( struct Image *img, enum HashKind kind, uint64_t *hash ) {
+  float gray[PHASH_SIZE * PHASH_SIZE];
+  switch ( kind ) {
+  case HASH_AVERAGE:
+    if ( !imgproc_downscale_gray( img, 8, 8, gray ) )
+      return 0;
+    *hash = average_hash( gray );
+    return 1;
+  case HASH_DIFFERENCE:
+    if ( !imgproc_downscale_gray( img, 9, 8, gray ) )
+      return 0;
+    *hash = difference_hash( gray );
+    return 1;
+  case HASH_DCT:
+    if ( !imgproc_downscale_gray( img, PHASH_SIZE, PHASH_SIZE, gray ) )
+      return 0;
+    *hash = dct_hash( gray );
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Compute all of the perceptual hashes of an image, with the same
+// results as imgproc_image_hash. Images of at least 288x32 pixels are
+// read only once: their luma is summed over a grid that all of the
+// downscaled images are unions of cells of.
+//
+// Parameters:
+//   img - pointer to the Image
+//   hashes - set to the hash of every kind, indexed by HashKind
+//
+// Returns:
+//   1 if successful, 0 if the image is empty or memory could not be
+//   allocated
+int imgproc_image_hashes( struct Image *img, uint64_t hashes[NUM_HASH_KINDS] ) {
+  if ( img->width < SHARED_GRID_W || img->height < SHARED_GRID_H ) {
+    // the cells of smaller images overlap, so aren't unions of the
+    // grid's cells
+    for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+      if ( !imgproc_image_hash( img, (enum HashKind) k, &hashes[k] ) )
+        return 0;
+    return 1;
+  }
+
+  size_t n = (size_t) SHARED_GRID_W * SHARED_GRID_H;
+  uint64_t *sums = (uint64_t *) malloc( n * ( sizeof( uint64_t ) + sizeof( uint32_t ) ) );
+  if ( sums == NULL )
+    return 0;
+  uint32_t *counts = (uint32_t *) ( sums + n );
+  downscale_sums( img, SHARED_GRID_W, SHARED_GRID_H, sums, counts );
+
+  float gray[PHASH_SIZE * PHASH_SIZE];
+  reduce_sums( sums, counts, SHARED_GRID_W, SHARED_GRID_H, 8, 8, gray );
+  hashes[HASH_AVERAGE] = average_hash( gray );
+  reduce_sums( sums, counts, SHARED_GRID_W, SHARED_GRID_H, 9, 8, gray );
+  hashes[HASH_DIFFERENCE] = difference_hash( gray );
+  reduce_sums( sums, counts, SHARED_GRID_W, SHARED_GRID_H, PHASH_SIZE, PHASH_SIZE, gray );
+  hashes[HASH_DCT] = dct_hash( gray );
+  free( sums );
+  return 1;
+}
+
+// Count the bits in which two hashes differ.
+//
+// Parameters:
+//   a - a hash
+//   b - another hash of the same kind
+//
+// Returns:
+//   the Hamming distance, from 0 (identical) to 64
+int imgproc_hash_distance( uint64_t a, uint64_t b ) {
+  return __builtin_popcountll( a ^ b );
+}
+
+static void luma_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct LumaJob *job = (struct LumaJob *) arg;
+  int32_t w = job->img->width;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *src = job->img->data + (size_t) y * w;
+    uint8_t *dst = job->luma + (size_t) y * w;
+    for ( int32_t x = 0; x < w; x++ )
+      dst[x] = (uint8_t) luma( src[x] );
+  }
+}
+
+// Compute the sums of every window of a window row from the per-column
+// sums over its rows, and add up the SSIM of the windows
+static void ssim_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct SsimJob *job = (struct SsimJob *) arg;
+  const double c1 = ( 0.01 * 255 ) * ( 0.01 * 255 ), c2 = ( 0.03 * 255 ) * ( 0.03 * 255 );
+  const double n = (double) job->window_w * job->window_h;
+  int32_t w = job->width;
+
+  // per column: sum of a, b, a^2, b^2 and a*b over the window's rows
+  uint32_t *cols = (uint32_t *) malloc( (size_t) w * 5 * sizeof( uint32_t ) );
+  if ( cols == NULL ) {
+    __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+    return;
+  }
+  uint32_t *sa = cols, *sb = cols + w, *saa = cols + (size_t) w * 2;
+  uint32_t *sbb = cols + (size_t) w * 3, *sab = cols + (size_t) w * 4;
+
+  for ( int32_t wy = row_begin; wy < row_end; wy++ ) {
+    memset( cols, 0, (size_t) w * 5 * sizeof( uint32_t ) );
+    for ( int32_t y = wy * SSIM_STRIDE; y < wy * SSIM_STRIDE + job->window_h; y++ ) {
+      const uint8_t *a = job->a + (size_t) y * w, *b = job->b + (size_t) y * w;
+      for ( int32_t x = 0; x < w; x++ ) {
+        uint32_t va = a[x], vb = b[x];
+        sa[x] += va;
+        sb[x] += vb;
+        saa[x] += va * va;
+        sbb[x] += vb * vb;
+        sab[x] += va * vb;
+      }
+    }
+
+    double row_sum = 0.0;
+    for ( int32_t wx = 0; wx < job->windows_x; wx++ ) {
+      uint64_t ta = 0, tb = 0, taa = 0, tbb = 0, tab = 0;
+      for ( int32_t x = wx * SSIM_STRIDE; x < wx * SSIM_STRIDE + job->window_w; x++ ) {
+        ta += sa[x];
+        tb += sb[x];
+        taa += saa[x];
+        tbb += sbb[x];
+        tab += sab[x];
+      }
+      double mean_a = ta / n, mean_b = tb / n;
+      double var_a = taa / n - mean_a * mean_a, var_b = tbb / n - mean_b * mean_b;
+      double cov = tab / n - mean_a * mean_b;
+      row_sum += ( ( 2 * mean_a * mean_b + c1 ) * ( 2 * cov + c2 ) )
+        / ( ( mean_a * mean_a + mean_b * mean_b + c1 ) * ( var_a + var_b + c2 ) );
+    }
+    job->row_sums[wy] = row_sum;
+  }
+  free( cols );
+}
+
+// Compute the structural similarity (SSIM) of the luma of two images:
+// the mean SSIM of 8x8 windows spaced 4 pixels apart (one window as
+// large as the image, for images smaller than that). Window rows are
+// processed in parallel.
+//
+// Parameters:
+//   a - pointer to an Image
+//   b - pointer to an Image with the same dimensions
+//   ssim - set to the SSIM, 1.0 for identical images
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match, the images are
+//   empty or memory could not be allocated
+int imgproc_ssim( struct Image *a, struct Image *b, double *ssim ) {
+  if ( a->width != b->width || a->height != b->height || a->width <= 0 || a->height <= 0 )
+    return 0;
+  int32_t w = a->width, h = a->height;
+  uint8_t *luma_a = (uint8_t *) malloc( (size_t) w * h * 2 );
+  if ( luma_a == NULL )
+    return 0;
+  uint8_t *luma_b = luma_a + (size_t) w * h;
+  struct LumaJob luma_jobs[2] = { { a, luma_a }, { b, luma_b } };
+  imgproc_parallel_rows( h, luma_band, &luma_jobs[0] );
+  imgproc_parallel_rows( h, luma_band, &luma_jobs[1] );
+
+  struct SsimJob job;
+  job.a = luma_a;
+  job.b = luma_b;
+  job.width = w;
+  job.height = h;
+  job.window_w = w < SSIM_WINDOW ? w : SSIM_WINDOW;
+  job.window_h = h < SSIM_WINDOW ? h : SSIM_WINDOW;
+  job.windows_x = ( w - job.window_w ) / SSIM_STRIDE + 1;
+  int32_t windows_y = ( h - job.window_h ) / SSIM_STRIDE + 1;
+  job.failed = 0;
+  // the window rows are summed in order afterwards, so that the result
+  // doesn't depend on the number of threads
+  job.row_sums = (double *) malloc( windows_y * sizeof( double ) );
+  if ( job.row_sums == NULL ) {
+    free( luma_a );
+    return 0;
+  }
+  imgproc_parallel_rows( windows_y, ssim_band, &job );
+
+  double sum = 0.0;
+  for ( int32_t i = 0; i < windows_y; i++ )
+    sum += job.row_sums[i];
+  *ssim = sum / ( (double) job.windows_x * windows_y );
+  free( job.row_sums );
+  free( luma_a );
+  return !job.failed;
+}
+
+static void psnr_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct PsnrJob *job = (struct PsnrJob *) arg;
+  int32_t w = job->a->width;
+  uint64_t sum = 0;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *a = job->a->data + (size_t) y * w, *b = job->b->data + (size_t) y * w;
+    for ( int32_t x = 0; x < w; x++ ) {
+      for ( int shift = 8; shift < 32; shift += 8 ) {
+        int32_t d = (int32_t) ( ( a[x] >> shift ) & 0xFF ) - (int32_t) ( ( b[x] >> shift ) & 0xFF );
+        sum += (uint64_t) ( d * d );
+      }
+    }
+  }
+  pthread_mutex_lock( &job->lock );
+  job->sum += sum;
+  pthread_mutex_unlock( &job->lock );
+}
+
+// Compute the peak signal-to-noise ratio of two images, over their
+// red, green and blue channels.
+//
+// Parameters:
+//   a - pointer to an Image
+//   b - pointer to an Image with the same dimensions
+//   psnr - set to the PSNR in decibels, INFINITY for identical images
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the images
+//   are empty
+int imgproc_psnr( struct Image *a, struct Image *b, double *psnr ) {
+  if ( a->width != b->width || a->height != b->height || a->width <= 0 || a->height <= 0 )
+    return 0;
+  struct PsnrJob job;
+  job.a = a;
+  job.b = b;
+  job.sum = 0;
+  pthread_mutex_init( &job.lock, NULL );
+  imgproc_parallel_rows( a->height, psnr_band, &job );
+  pthread_mutex_destroy( &job.lock );
+
+  if ( job.sum == 0 ) {
+    *psnr = INFINITY;
+    return 1;
+  }
+  double mse = (double) job.sum / ( 3.0 * a->width * a->height );
+  *psnr = 10.0 * log10( 255.0 * 255.0 / mse );
+  return 1;
+}
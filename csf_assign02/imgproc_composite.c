@@ -0,0 +1,230 @@
+// Alpha compositing of one image over another: the Porter-Duff over,
+// in and out operators and the multiply and screen blend modes, using
+// premultiplied alpha in 8-bit fixed point
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct CompositeJob {
+  struct Image *input_img;
+  struct Image *overlay_img;
+  struct Image *output_img;
+  enum BlendMode mode;
+  int32_t x;  // position of the overlay in the input image
+  int32_t y;
+};
+
+static pthread_once_t s_tables_once = PTHREAD_ONCE_INIT;
+
+// ceil(2^32 / (2 * a)), so that (c * 510 + a) * s_unpremultiply[a] >> 32
+// is c * 255 / a rounded to the nearest integer, for all c and a up to
+// 255 (the numerator has at most 17 bits, and the error of the
+// reciprocal is less than 2^-32 * 2a)
+static uint32_t s_unpremultiply[256];
+
+static void init_tables( void ) {
+  for ( uint64_t a = 1; a < 256; a++ )
+    s_unpremultiply[a] = (uint32_t) ( ( ( 1ULL << 32 ) + 2 * a - 1 ) / ( 2 * a ) );
+}
+
+// x * a / 255, rounded to the nearest integer (exact for x, a <= 255)
+static inline uint32_t mul255( uint32_t x, uint32_t a ) {
+  uint32_t t = x * a + 128;
+  return ( t + ( t >> 8 ) ) >> 8;
+}
+
+// Blend one premultiplied channel (or the alpha, as a channel whose
+// premultiplied value is itself) of the overlay s with the input d.
+// sa and da are the alpha values of the overlay and input pixels.
+static inline uint32_t blend_channel( uint32_t s, uint32_t d, uint32_t sa, uint32_t da,
+                                      enum BlendMode mode ) {
+  uint32_t v;
+  switch ( mode ) {
+  case BLEND_IN:
+    v = mul255( s, da );
+    break;
+  case BLEND_OUT:
+    v = mul255( s, 255 - da );
+    break;
+  case BLEND_MULTIPLY:
+    v = mul255( s, d ) + mul255( s, 255 - da ) + mul255( d, 255 - sa );
+    break;
+  case BLEND_SCREEN:
+    v = s + d - mul255( s, d );
+    break;
+  default:
+    v = s + mul255( d, 255 - sa );
+    break;
+  }
+  return v > 255 ? 255 : v;
+}
+
+// Premultiply the color channels of a straight alpha pixel
+static inline uint32_t premultiply( uint32_t p ) {
+  uint32_t a = p & 0xFF;
+  return ( mul255( p >> 24, a ) << 24 ) | ( mul255( ( p >> 16 ) & 0xFF, a ) << 16 )
+    | ( mul255( ( p >> 8 ) & 0xFF, a ) << 8 ) | a;
+}
+
+static inline uint32_t unpremultiply_channel( uint32_t c, uint32_t a ) {
+  uint32_t v = (uint32_t) ( ( (uint64_t) ( c * 510 + a ) * s_unpremultiply[a] ) >> 32 );
+  return v > 255 ? 255 : v;
+}
+
+// Convert premultiplied pixels back to straight alpha, in place. The
+// division is a table lookup, which SSE2 can't vectorize.
+static void unpremultiply_row( uint32_t *row, int32_t n ) {
+  for ( int32_t x = 0; x < n; x++ ) {
+    uint32_t p = row[x], a = p & 0xFF;
+    if ( a == 255 )
+      continue;
+    if ( a == 0 ) {
+      row[x] = 0;
+      continue;
+    }
+    row[x] = ( unpremultiply_channel( p >> 24, a ) << 24 )
+      | ( unpremultiply_channel( ( p >> 16 ) & 0xFF, a ) << 16 )
+      | ( unpremultiply_channel( ( p >> 8 ) & 0xFF, a ) << 8 ) | a;
+  }
+}
+
+#ifdef __SSE2__
+// mul255 of 8 16-bit lanes
+static inline __m128i mul255_epi16( __m128i x, __m128i a ) {
+  __m128i t = _mm_add_epi16( _mm_mullo_epi16( x, a ), _mm_set1_epi16( 128 ) );
+  return _mm_srli_epi16( _mm_add_epi16( t, _mm_srli_epi16( t, 8 ) ), 8 );
+}
+
+// Alpha of each of 2 unpacked pixels in all 4 of its lanes, except for
+// 255 in the alpha lanes (lane 0 of each pixel), so that multiplying by
+// it premultiplies the color channels and keeps the alpha
+static inline __m128i premultiply_factors( __m128i p ) {
+  __m128i a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( p, 0 ), 0 );
+  return _mm_or_si128( _mm_and_si128( a, _mm_set_epi16( -1, -1, -1, 0, -1, -1, -1, 0 ) ),
+                       _mm_set_epi16( 0, 0, 0, 255, 0, 0, 0, 255 ) );
+}
+
+// Blend 2 unpacked premultiplied pixels of each image: the vector
+// version of blend_channel, with the saturation done by the final pack
+static inline __m128i blend_2( __m128i s, __m128i d, enum BlendMode mode ) {
+  const __m128i ones = _mm_set1_epi16( 255 );
+  __m128i sa = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s, 0 ), 0 );
+  __m128i da = _mm_shufflehi_epi16( _mm_shufflelo_epi16( d, 0 ), 0 );
+  switch ( mode ) {
+  case BLEND_IN:
+    return mul255_epi16( s, da );
+  case BLEND_OUT:
+    return mul255_epi16( s, _mm_sub_epi16( ones, da ) );
+  case BLEND_MULTIPLY:
+    return _mm_add_epi16( _mm_add_epi16( mul255_epi16( s, d ), mul255_epi16( s, _mm_sub_epi16( ones, da ) ) ),
+                          mul255_epi16( d, _mm_sub_epi16( ones, sa ) ) );
+  case BLEND_SCREEN:
+    return _mm_sub_epi16( _mm_add_epi16( s, d ), mul255_epi16( s, d ) );
+  default:
+    return _mm_add_epi16( s, mul255_epi16( d, _mm_sub_epi16( ones, sa ) ) );
+  }
+}
+#endif
+
+// Composite n overlay pixels over n input pixels, leaving premultiplied
+// results in dst (which may be src)
+static void blend_row( const uint32_t *src, const uint32_t *ovl, uint32_t *dst, int32_t n,
+                       enum BlendMode mode ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  for ( ; x + 4 <= n; x += 4 ) {
+    __m128i d = _mm_loadu_si128( (const __m128i *) ( src + x ) );
+    __m128i s = _mm_loadu_si128( (const __m128i *) ( ovl + x ) );
+    __m128i r[2];
+    for ( int h = 0; h < 2; h++ ) {
+      __m128i d16 = h ? _mm_unpackhi_epi8( d, zero ) : _mm_unpacklo_epi8( d, zero );
+      __m128i s16 = h ? _mm_unpackhi_epi8( s, zero ) : _mm_unpacklo_epi8( s, zero );
+      d16 = mul255_epi16( d16, premultiply_factors( d16 ) );
+      s16 = mul255_epi16( s16, premultiply_factors( s16 ) );
+      r[h] = blend_2( s16, d16, mode );
+    }
+    _mm_storeu_si128( (__m128i *) ( dst + x ), _mm_packus_epi16( r[0], r[1] ) );
+  }
+#endif
+  for ( ; x < n; x++ ) {
+    uint32_t d = premultiply( src[x] ), s = premultiply( ovl[x] );
+    uint32_t sa = s & 0xFF, da = d & 0xFF;
+    uint32_t p = 0;
+    for ( int shift = 0; shift < 32; shift += 8 )
+      p |= blend_channel( ( s >> shift ) & 0xFF, ( d >> shift ) & 0xFF, sa, da, mode ) << shift;
+    dst[x] = p;
+  }
+}
+
+// Pixels not covered by the overlay are composited with a transparent
+// overlay pixel, which keeps them for over, multiply and screen, and
+// clears them for in and out
+static void blend_uncovered( const uint32_t *src, uint32_t *dst, int32_t n, enum BlendMode mode ) {
+  for ( int32_t x = 0; x < n; x++ )
+    dst[x] = ( mode == BLEND_IN || mode == BLEND_OUT ) ? 0 : src[x];
+}
+
+static void composite_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct CompositeJob *job = (struct CompositeJob *) arg;
+  int32_t w = job->input_img->width;
+  int32_t ow = job->overlay_img->width, oh = job->overlay_img->height;
+
+  // columns [x_begin, x_end) of the input are covered by the overlay
+  int32_t x_begin = job->x < 0 ? 0 : ( job->x > w ? w : job->x );
+  int64_t x_end64 = (int64_t) job->x + ow;
+  int32_t x_end = x_end64 < x_begin ? x_begin : ( x_end64 > w ? w : (int32_t) x_end64 );
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *src = job->input_img->data + (size_t) y * w;
+    uint32_t *dst = job->output_img->data + (size_t) y * w;
+    int64_t oy = (int64_t) y - job->y;
+    if ( oy < 0 || oy >= oh || x_begin == x_end ) {
+      blend_uncovered( src, dst, w, job->mode );
+      continue;
+    }
+    const uint32_t *ovl = job->overlay_img->data + (size_t) oy * ow + ( x_begin - (int64_t) job->x );
+    blend_uncovered( src, dst, x_begin, job->mode );
+    blend_row( src + x_begin, ovl, dst + x_begin, x_end - x_begin, job->mode );
+    unpremultiply_row( dst + x_begin, x_end - x_begin );
+    blend_uncovered( src + x_end, dst + x_end, w - x_end, job->mode );
+  }
+}
+
+// Composite an overlay image with an input image. The overlay (the
+// source, in Porter-Duff terms) is placed with its top left corner at
+// (x, y) in the input image (the destination); input pixels it doesn't
+// cover are composited with a transparent pixel. Colors are
+// premultiplied by their alpha values and blended in 8-bit fixed
+// point. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   overlay_img - pointer to the overlay Image (of any size)
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//   mode - how the overlay and input pixels are combined
+//   x - column of the input image where the overlay starts
+//   y - row of the input image where the overlay starts
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match, the output is
+//   the overlay image or the mode is invalid
+int imgproc_composite( struct Image *input_img, struct Image *overlay_img, struct Image *output_img,
+                       enum BlendMode mode, int32_t x, int32_t y ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  if ( output_img == overlay_img )
+    return 0;
+  if ( mode < BLEND_OVER || mode > BLEND_SCREEN )
+    return 0;
+  pthread_once( &s_tables_once, init_tables );
+  struct CompositeJob job = { input_img, overlay_img, output_img, mode, x, y };
+  imgproc_parallel_rows( input_img->height, composite_band, &job );
+  return 1;
+}
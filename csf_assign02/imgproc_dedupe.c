@@ -0,0 +1,217 @@
+// Finding near-duplicate images with perceptual hashes.
+//
+//   index <input dir> <index file>
+//     hash every PNG file in a directory (in parallel) into an index
+//   query <index file> <image> [max distance] [ahash|dhash|phash]
+//     list the indexed files whose hash is within a Hamming distance
+//     (10 by default) of the image's hash (pHash by default)
+//   compare <image a> <image b>
+//     print the hash distances, SSIM and PSNR of two images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "imgproc.h"
+
+#define DEFAULT_MAX_DISTANCE 10
+
+static const char *const s_hash_names[NUM_HASH_KINDS] = { "ahash", "dhash", "phash" };
+
+void usage( const char *progname ) {
+  fprintf( stderr, "Error: invalid command-line arguments\n" );
+  fprintf( stderr, "Usage: %s [-t threads] index <input dir> <index file>\n", progname );
+  fprintf( stderr, "       %s [-t threads] query <index file> <image> [max distance] [ahash|dhash|phash]\n", progname );
+  fprintf( stderr, "       %s [-t threads] compare <image a> <image b>\n", progname );
+  exit( 1 );
+}
+
+int compare_names( const void *a, const void *b ) {
+  return strcmp( *(char *const *) a, *(char *const *) b );
+}
+
+// Collect the full names of the PNG files of a directory, sorted
+char **list_png_files( const char *dir_name, int *num_files ) {
+  DIR *dir = opendir( dir_name );
+  if ( dir == NULL )
+    return NULL;
+  char **names = NULL;
+  int n = 0, capacity = 0;
+  struct dirent *entry;
+  while ( ( entry = readdir( dir ) ) != NULL ) {
+    size_t len = strlen( entry->d_name );
+    if ( len < 5 || strcmp( entry->d_name + len - 4, ".png" ) != 0 )
+      continue;
+    if ( n == capacity ) {
+      capacity = capacity ? capacity * 2 : 16;
+      names = (char **) realloc( names, capacity * sizeof( char * ) );
+    }
+    size_t path_len = strlen( dir_name ) + len + 2;
+    char *path = (char *) malloc( path_len );
+    if ( names == NULL || path == NULL ) {
+      fprintf( stderr, "Error: out of memory\n" );
+      exit( 1 );
+    }
+    snprintf( path, path_len, "%s/%s", dir_name, entry->d_name );
+    names[n++] = path;
+  }
+  closedir( dir );
+  qsort( names, n, sizeof( char * ), compare_names );
+  *num_files = n;
+  return names != NULL ? names : (char **) calloc( 1, sizeof( char * ) );
+}
+
+int cmd_index( const char *input_dir, const char *index_filename ) {
+  int num_files;
+  char **names = list_png_files( input_dir, &num_files );
+  if ( names == NULL ) {
+    fprintf( stderr, "Error: couldn't open input directory %s\n", input_dir );
+    return 1;
+  }
+
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  struct HashIndex index;
+  int ok = imgproc_hash_index_build( (const char *const *) names, num_files, &index );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  for ( int i = 0; i < num_files; i++ )
+    free( names[i] );
+  free( names );
+  if ( !ok ) {
+    fprintf( stderr, "Error: out of memory\n" );
+    return 1;
+  }
+
+  double seconds = (double) ( end.tv_sec - begin.tv_sec ) + ( end.tv_nsec - begin.tv_nsec ) * 1e-9;
+  printf( "hashed %d of %d files in %.3f s (%d threads)\n", index.num_entries, num_files, seconds,
+          imgproc_get_num_threads() );
+  if ( index.num_entries < num_files )
+    fprintf( stderr, "Warning: %d file(s) couldn't be read\n", num_files - index.num_entries );
+
+  ok = imgproc_hash_index_write( &index, index_filename );
+  imgproc_hash_index_cleanup( &index );
+  if ( !ok ) {
+    fprintf( stderr, "Error: couldn't write index %s\n", index_filename );
+    return 1;
+  }
+  return 0;
+}
+
+int cmd_query( const char *index_filename, const char *image_filename, int max_distance,
+               enum HashKind kind ) {
+  struct HashIndex index;
+  if ( !imgproc_hash_index_read( index_filename, &index ) ) {
+    fprintf( stderr, "Error: couldn't read index %s\n", index_filename );
+    return 1;
+  }
+  struct Image img;
+  if ( img_read( image_filename, &img ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read image %s\n", image_filename );
+    imgproc_hash_index_cleanup( &index );
+    return 1;
+  }
+  uint64_t hash;
+  int ok = imgproc_image_hash( &img, kind, &hash );
+  img_cleanup( &img );
+  if ( !ok ) {
+    fprintf( stderr, "Error: couldn't hash image %s\n", image_filename );
+    imgproc_hash_index_cleanup( &index );
+    return 1;
+  }
+
+  int32_t *matches = (int32_t *) malloc( ( index.num_entries > 0 ? index.num_entries : 1 ) * sizeof( int32_t ) );
+  if ( matches == NULL ) {
+    fprintf( stderr, "Error: out of memory\n" );
+    imgproc_hash_index_cleanup( &index );
+    return 1;
+  }
+  int32_t n = imgproc_hash_index_lookup( &index, kind, hash, max_distance, matches, index.num_entries );
+  for ( int32_t i = 0; i < n; i++ )
+    printf( "%2d %s\n", imgproc_hash_distance( hash, index.hashes[kind][matches[i]] ),
+            index.names[matches[i]] );
+  free( matches );
+  imgproc_hash_index_cleanup( &index );
+  return 0;
+}
+
+int cmd_compare( const char *filename_a, const char *filename_b ) {
+  struct Image a, b;
+  if ( img_read( filename_a, &a ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read image %s\n", filename_a );
+    return 1;
+  }
+  if ( img_read( filename_b, &b ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read image %s\n", filename_b );
+    img_cleanup( &a );
+    return 1;
+  }
+
+  int status = 0;
+  uint64_t hashes_a[NUM_HASH_KINDS], hashes_b[NUM_HASH_KINDS];
+  if ( imgproc_image_hashes( &a, hashes_a ) && imgproc_image_hashes( &b, hashes_b ) ) {
+    for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+      printf( "%-6s %016llx %016llx distance %d\n", s_hash_names[k], (unsigned long long) hashes_a[k],
+              (unsigned long long) hashes_b[k], imgproc_hash_distance( hashes_a[k], hashes_b[k] ) );
+  } else {
+    fprintf( stderr, "Error: couldn't hash the images\n" );
+    status = 1;
+  }
+
+  double ssim, psnr;
+  if ( a.width != b.width || a.height != b.height ) {
+    printf( "ssim/psnr: n/a (dimensions differ)\n" );
+  } else if ( imgproc_ssim( &a, &b, &ssim ) && imgproc_psnr( &a, &b, &psnr ) ) {
+    printf( "ssim   %.6f\n", ssim );
+    printf( "psnr   %.3f dB\n", psnr );
+  } else {
+    fprintf( stderr, "Error: couldn't compare the images\n" );
+    status = 1;
+  }
+  img_cleanup( &a );
+  img_cleanup( &b );
+  return status;
+}
+
+int main( int argc, char **argv ) {
+  int opt;
+  while ( ( opt = getopt( argc, argv, "t:" ) ) != -1 ) {
+    switch ( opt ) {
+    case 't':
+      imgproc_set_num_threads( atoi( optarg ) );
+      break;
+    default:
+      usage( argv[0] );
+    }
+  }
+  int nargs = argc - optind;
+  char **args = argv + optind;
+  if ( nargs < 1 )
+    usage( argv[0] );
+
+  if ( strcmp( args[0], "index" ) == 0 && nargs == 3 )
+    return cmd_index( args[1], args[2] );
+
+  if ( strcmp( args[0], "query" ) == 0 && nargs >= 3 && nargs <= 5 ) {
+    int max_distance = nargs >= 4 ? atoi( args[3] ) : DEFAULT_MAX_DISTANCE;
+    enum HashKind kind = HASH_DCT;
+    if ( nargs == 5 ) {
+      int k = 0;
+      while ( k < NUM_HASH_KINDS && strcmp( args[4], s_hash_names[k] ) != 0 )
+        k++;
+      if ( k == NUM_HASH_KINDS ) {
+        fprintf( stderr, "Error: unknown hash '%s'\n", args[4] );
+        return 1;
+      }
+      kind = (enum HashKind) k;
+    }
+    return cmd_query( args[1], args[2], max_distance, kind );
+  }
+
+  if ( strcmp( args[0], "compare" ) == 0 && nargs == 3 )
+    return cmd_compare( args[1], args[2] );
+
+  usage( argv[0] );
+  return 1;
+}
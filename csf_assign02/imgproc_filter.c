@@ -0,0 +1,516 @@
+// Separable convolution engine and the filters built on it
+// (box blur, Gaussian blur, Sobel edges and unsharp mask)
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fractional bits kept in the intermediate (horizontally filtered)
+// rows and in the rows produced by the engine
+#define FILTER_FRAC_BITS 4
+
+// Largest allowed sum of absolute tap values, which keeps every
+// intermediate product sum within 32 bits
+#define FILTER_MAX_TAP_SUM 32767
+
+// Filters computed by a FilterJob
+enum FilterMode {
+  FILTER_CONVOLVE,
+  FILTER_SOBEL,
+  FILTER_UNSHARP,
+};
+
+// Rolling state of the convolution of one band of rows. Only
+// 2*radius+1 horizontally filtered rows are kept, in a ring indexed
+// by (unclamped) source row, so the engine never needs a full
+// intermediate copy of the image.
+struct ConvRows {
+  const struct Image *img;
+  const struct Kernel *h;
+  const struct Kernel *v;
+  int32_t ring_rows;
+  int32_t row_len;    // int16 values per row, i.e., width * 4
+  int16_t *padded;    // input row widened to int16, with clamped edges
+  int16_t *ring;      // ring_rows rows of horizontally filtered values
+  int16_t *zero_row;  // pairs with the last tap of odd-length kernels
+  int32_t next_row;   // next source row to filter into the ring
+};
+
+// Parameters shared by all bands of a threaded filter
+struct FilterJob {
+  enum FilterMode mode;
+  struct Image *input_img;
+  struct Image *output_img;
+  const struct Kernel *h;
+  const struct Kernel *v;
+  const struct Kernel *h2;   // second kernel pair (Sobel y gradient)
+  const struct Kernel *v2;
+  int32_t amount;            // unsharp mask amount in percent
+  int failed;
+};
+
+static int32_t clamp_i32( int32_t x, int32_t lo, int32_t hi ) {
+  return x < lo ? lo : ( x > hi ? hi : x );
+}
+
+// Round an accumulated sum down by `down` bits (or scale it
+// up if `down` is negative)
+static int32_t round_shift( int32_t x, int32_t down ) {
+  if ( down > 0 )
+    return ( x + ( 1 << ( down - 1 ) ) ) >> down;
+  return x * ( 1 << -down );
+}
+
+// Check that a kernel is within the limits of the engine
+static int kernel_valid( const struct Kernel *k ) {
+  if ( k->radius < 0 || k->radius > IMGPROC_KERNEL_MAX_RADIUS || k->shift < 0 || k->shift > 24 )
+    return 0;
+  int32_t sum = 0;
+  for ( int32_t i = 0; i < 2 * k->radius + 1; i++ )
+    sum += abs( k->taps[i] );
+  return sum <= FILTER_MAX_TAP_SUM;
+}
+
+// Build a box (moving average) kernel.
+//
+// Parameters:
+//   k - pointer to the Kernel to initialize
+//   radius - kernel radius (the kernel has 2*radius+1 taps)
+//
+// Returns:
+//   1 if successful, 0 if the radius is out of range
+int imgproc_kernel_box( struct Kernel *k, int32_t radius ) {
+  if ( radius < 0 || radius > IMGPROC_KERNEL_MAX_RADIUS )
+    return 0;
+  int32_t n = 2 * radius + 1;
+  k->radius = radius;
+  k->shift = 12;
+
+  // spread the rounding error over the taps so they sum to 1 << shift
+  int32_t total = 1 << k->shift;
+  for ( int32_t i = 0; i < n; i++ )
+    k->taps[i] = (int16_t) ( total * ( i + 1 ) / n - total * i / n );
+  return 1;
+}
+
+// Build a normalized Gaussian kernel with a radius of ceil(3*sigma).
+//
+// Parameters:
+//   k - pointer to the Kernel to initialize
+//   sigma - standard deviation of the Gaussian, in pixels
+//
+// Returns:
+//   1 if successful, 0 if sigma is not positive and finite or the
+//   kernel would exceed IMGPROC_KERNEL_MAX_RADIUS
+int imgproc_kernel_gaussian( struct Kernel *k, double sigma ) {
+  if ( !( sigma > 0.0 ) || !isfinite( sigma ) )
+    return 0;
+  // check the range before converting: a huge double doesn't fit
+  double reach = ceil( 3.0 * sigma );
+  if ( reach > IMGPROC_KERNEL_MAX_RADIUS )
+    return 0;
+  int32_t radius = (int32_t) reach;
+
+  double weights[2 * IMGPROC_KERNEL_MAX_RADIUS + 1];
+  double wsum = 0.0;
+  for ( int32_t i = -radius; i <= radius; i++ ) {
+    weights[i + radius] = exp( -( i * i ) / ( 2.0 * sigma * sigma ) );
+    wsum += weights[i + radius];
+  }
+
+  k->radius = radius;
+  k->shift = 12;
+  int32_t total = 0;
+  for ( int32_t i = 0; i < 2 * radius + 1; i++ ) {
+    k->taps[i] = (int16_t) lround( weights[i] / wsum * ( 1 << k->shift ) );
+    total += k->taps[i];
+  }
+
+  // fold the rounding error into the center tap
+  k->taps[radius] += (int16_t) ( ( 1 << k->shift ) - total );
+  return 1;
+}
+
+// Widen one source row to int16 channel values, replicating the edge
+// pixels `radius` times on each side. Channels keep their in-memory
+// byte order.
+static void widen_row( const uint32_t *src, int32_t width, int32_t radius, int16_t *padded ) {
+  const uint8_t *bytes = (const uint8_t *) src;
+  int16_t *dst = padded + radius * 4;
+  int32_t x = 0;
+
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  for ( ; x + 4 <= width; x += 4 ) {
+    __m128i px = _mm_loadu_si128( (const __m128i *) ( bytes + x * 4 ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x * 4 ), _mm_unpacklo_epi8( px, zero ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x * 4 + 8 ), _mm_unpackhi_epi8( px, zero ) );
+  }
+#endif
+  for ( ; x < width; x++ )
+    for ( int c = 0; c < 4; c++ )
+      dst[x * 4 + c] = bytes[x * 4 + c];
+
+  for ( int32_t i = 0; i < radius; i++ ) {
+    memcpy( padded + i * 4, dst, 4 * sizeof( int16_t ) );
+    memcpy( dst + ( width + i ) * 4, dst + ( width - 1 ) * 4, 4 * sizeof( int16_t ) );
+  }
+}
+
+// Horizontal pass: filter one widened row into FILTER_FRAC_BITS
+// fixed point, saturating to int16
+static void filter_row_h( const int16_t *padded, int32_t width, const struct Kernel *k, int16_t *dst ) {
+  int32_t n = 2 * k->radius + 1;
+  int32_t down = k->shift - FILTER_FRAC_BITS;
+  int32_t x = 0;
+
+#ifdef __SSE2__
+  // Taps are applied in pairs with pmaddwd: interleaving the channels
+  // of pixels x+t and x+t+1 lets one multiply-add cover two taps
+  __m128i tap_pairs[IMGPROC_KERNEL_MAX_RADIUS + 1];
+  for ( int32_t t = 0; t < n; t += 2 ) {
+    int16_t t1 = t + 1 < n ? k->taps[t + 1] : 0;
+    tap_pairs[t / 2] = _mm_set1_epi32( (int32_t) ( ( (uint32_t) (uint16_t) t1 << 16 ) | (uint16_t) k->taps[t] ) );
+  }
+
+  for ( ; x + 2 <= width; x += 2 ) {
+    __m128i acc0 = _mm_setzero_si128();   // pixel x
+    __m128i acc1 = _mm_setzero_si128();   // pixel x+1
+    for ( int32_t t = 0; t < n; t += 2 ) {
+      __m128i a = _mm_loadu_si128( (const __m128i *) ( padded + ( x + t ) * 4 ) );
+      __m128i b = _mm_loadu_si128( (const __m128i *) ( padded + ( x + t + 1 ) * 4 ) );
+      acc0 = _mm_add_epi32( acc0, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), tap_pairs[t / 2] ) );
+      acc1 = _mm_add_epi32( acc1, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), tap_pairs[t / 2] ) );
+    }
+    if ( down > 0 ) {
+      __m128i half = _mm_set1_epi32( 1 << ( down - 1 ) );
+      acc0 = _mm_srai_epi32( _mm_add_epi32( acc0, half ), down );
+      acc1 = _mm_srai_epi32( _mm_add_epi32( acc1, half ), down );
+    } else if ( down < 0 ) {
+      acc0 = _mm_slli_epi32( acc0, -down );
+      acc1 = _mm_slli_epi32( acc1, -down );
+    }
+    _mm_storeu_si128( (__m128i *) ( dst + x * 4 ), _mm_packs_epi32( acc0, acc1 ) );
+  }
+#endif
+  for ( ; x < width; x++ ) {
+    for ( int c = 0; c < 4; c++ ) {
+      int32_t sum = 0;
+      for ( int32_t t = 0; t < n; t++ )
+        sum += k->taps[t] * padded[( x + t ) * 4 + c];
+      dst[x * 4 + c] = (int16_t) clamp_i32( round_shift( sum, down ), INT16_MIN, INT16_MAX );
+    }
+  }
+}
+
+// Vertical pass: combine the 2*radius+1 ring rows `rows` into one
+// int32 output row (still with FILTER_FRAC_BITS fractional bits)
+static void filter_rows_v( const int16_t **rows, const int16_t *zero_row, int32_t len,
+                    const struct Kernel *k, int32_t *dst ) {
+  int32_t n = 2 * k->radius + 1;
+  int32_t down = k->shift;
+  int32_t i = 0;
+
+#ifdef __SSE2__
+  __m128i tap_pairs[IMGPROC_KERNEL_MAX_RADIUS + 1];
+  for ( int32_t t = 0; t < n; t += 2 ) {
+    int16_t t1 = t + 1 < n ? k->taps[t + 1] : 0;
+    tap_pairs[t / 2] = _mm_set1_epi32( (int32_t) ( ( (uint32_t) (uint16_t) t1 << 16 ) | (uint16_t) k->taps[t] ) );
+  }
+  __m128i half = _mm_set1_epi32( down > 0 ? 1 << ( down - 1 ) : 0 );
+
+  for ( ; i + 8 <= len; i += 8 ) {
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+    for ( int32_t t = 0; t < n; t += 2 ) {
+      const int16_t *r1 = t + 1 < n ? rows[t + 1] : zero_row;
+      __m128i a = _mm_loadu_si128( (const __m128i *) ( rows[t] + i ) );
+      __m128i b = _mm_loadu_si128( (const __m128i *) ( r1 + i ) );
+      acc_lo = _mm_add_epi32( acc_lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), tap_pairs[t / 2] ) );
+      acc_hi = _mm_add_epi32( acc_hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), tap_pairs[t / 2] ) );
+    }
+    acc_lo = _mm_srai_epi32( _mm_add_epi32( acc_lo, half ), down );
+    acc_hi = _mm_srai_epi32( _mm_add_epi32( acc_hi, half ), down );
+    _mm_storeu_si128( (__m128i *) ( dst + i ), acc_lo );
+    _mm_storeu_si128( (__m128i *) ( dst + i + 4 ), acc_hi );
+  }
+#else
+  (void) zero_row;
+#endif
+  for ( ; i < len; i++ ) {
+    int32_t sum = 0;
+    for ( int32_t t = 0; t < n; t++ )
+      sum += k->taps[t] * rows[t][i];
+    dst[i] = round_shift( sum, down );
+  }
+}
+
+static void conv_rows_cleanup( struct ConvRows *cr ) {
+  free( cr->padded );
+  free( cr->ring );
+  free( cr->zero_row );
+}
+
+// Prepare to produce output rows starting at first_row
+static int conv_rows_init( struct ConvRows *cr, const struct Image *img,
+                    const struct Kernel *h, const struct Kernel *v, int32_t first_row ) {
+  cr->img = img;
+  cr->h = h;
+  cr->v = v;
+  cr->ring_rows = 2 * v->radius + 1;
+  cr->row_len = img->width * 4;
+
+  // a few spare pixels keep the paired-tap loads in bounds
+  size_t padded_len = (size_t) ( img->width + 2 * h->radius + 4 ) * 4;
+  cr->padded = (int16_t *) calloc( padded_len, sizeof( int16_t ) );
+  cr->ring = (int16_t *) malloc( (size_t) cr->ring_rows * cr->row_len * sizeof( int16_t ) );
+  cr->zero_row = (int16_t *) calloc( (size_t) cr->row_len, sizeof( int16_t ) );
+  if ( cr->padded == NULL || cr->ring == NULL || cr->zero_row == NULL ) {
+    conv_rows_cleanup( cr );
+    return 0;
+  }
+
+  cr->next_row = first_row - v->radius;
+  return 1;
+}
+
+static int16_t *conv_ring_row( struct ConvRows *cr, int32_t row ) {
+  int32_t slot = row % cr->ring_rows;
+  if ( slot < 0 ) slot += cr->ring_rows;
+  return cr->ring + (size_t) slot * cr->row_len;
+}
+
+// Produce output row `row` (rows must be requested in order)
+static void conv_rows_next( struct ConvRows *cr, int32_t row, int32_t *dst ) {
+  const struct Image *img = cr->img;
+  int32_t radius = cr->v->radius;
+
+  // filter any source rows not yet in the ring, clamping at the edges
+  for ( ; cr->next_row <= row + radius; cr->next_row++ ) {
+    int32_t src_row = clamp_i32( cr->next_row, 0, img->height - 1 );
+    widen_row( img->data + (size_t) src_row * img->width, img->width, cr->h->radius, cr->padded );
+    filter_row_h( cr->padded, img->width, cr->h, conv_ring_row( cr, cr->next_row ) );
+  }
+
+  const int16_t *rows[2 * IMGPROC_KERNEL_MAX_RADIUS + 1];
+  for ( int32_t t = 0; t < cr->ring_rows; t++ )
+    rows[t] = conv_ring_row( cr, row - radius + t );
+  filter_rows_v( rows, cr->zero_row, cr->row_len, cr->v, dst );
+}
+
+// Convert one engine output row back to pixels
+static void store_row( const int32_t *src, int32_t width, uint32_t *dst ) {
+  uint8_t *bytes = (uint8_t *) dst;
+  int32_t i = 0;
+  int32_t len = width * 4;
+
+#ifdef __SSE2__
+  __m128i half = _mm_set1_epi32( 1 << ( FILTER_FRAC_BITS - 1 ) );
+  for ( ; i + 16 <= len; i += 16 ) {
+    __m128i v0 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *) ( src + i ) ), half ), FILTER_FRAC_BITS );
+    __m128i v1 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *) ( src + i + 4 ) ), half ), FILTER_FRAC_BITS );
+    __m128i v2 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *) ( src + i + 8 ) ), half ), FILTER_FRAC_BITS );
+    __m128i v3 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *) ( src + i + 12 ) ), half ), FILTER_FRAC_BITS );
+    __m128i packed = _mm_packus_epi16( _mm_packs_epi32( v0, v1 ), _mm_packs_epi32( v2, v3 ) );
+    _mm_storeu_si128( (__m128i *) ( bytes + i ), packed );
+  }
+#endif
+  for ( ; i < len; i++ )
+    bytes[i] = (uint8_t) clamp_i32( round_shift( src[i], FILTER_FRAC_BITS ), 0, 255 );
+}
+
+// Byte offsets of the channels within an in-memory pixel, which holds
+// red in its most significant byte and alpha in its least significant
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BYTE_A 0
+#define BYTE_B 1
+#define BYTE_G 2
+#define BYTE_R 3
+#elif defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BYTE_R 0
+#define BYTE_G 1
+#define BYTE_B 2
+#define BYTE_A 3
+#else
+#error "unknown byte order: define the BYTE_* offsets of a pixel for this host"
+#endif
+
+// Combine Sobel x/y gradients into the gradient magnitude of
+// the luminance, keeping the source alpha
+static void sobel_row( const int32_t *gx, const int32_t *gy, const uint32_t *src, int32_t width, uint32_t *dst ) {
+  for ( int32_t x = 0; x < width; x++ ) {
+    int32_t lx = imgproc_luma( gx[x * 4 + BYTE_R], gx[x * 4 + BYTE_G], gx[x * 4 + BYTE_B] );
+    int32_t ly = imgproc_luma( gy[x * 4 + BYTE_R], gy[x * 4 + BYTE_G], gy[x * 4 + BYTE_B] );
+    int64_t mag2 = (int64_t) lx * lx + (int64_t) ly * ly;
+    uint8_t y = (uint8_t) clamp_i32( round_shift( (int32_t) sqrt( (double) mag2 ), FILTER_FRAC_BITS ), 0, 255 );
+    uint8_t *px = (uint8_t *) &dst[x];
+    px[BYTE_R] = px[BYTE_G] = px[BYTE_B] = y;
+    px[BYTE_A] = ( (const uint8_t *) &src[x] )[BYTE_A];
+  }
+}
+
+// out = src + amount% * (src - blurred), keeping the source alpha
+static void unsharp_row( const int32_t *blurred, const uint32_t *src, int32_t width, int32_t amount, uint32_t *dst ) {
+  const uint8_t *src_bytes = (const uint8_t *) src;
+  uint8_t *dst_bytes = (uint8_t *) dst;
+  for ( int32_t i = 0; i < width * 4; i++ ) {
+    if ( i % 4 == BYTE_A ) {
+      dst_bytes[i] = src_bytes[i];
+      continue;
+    }
+    int32_t orig = src_bytes[i] << FILTER_FRAC_BITS;
+    int32_t sharp = orig + ( orig - blurred[i] ) * amount / 100;
+    dst_bytes[i] = (uint8_t) clamp_i32( round_shift( sharp, FILTER_FRAC_BITS ), 0, 255 );
+  }
+}
+
+static void filter_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct FilterJob *job = (struct FilterJob *) arg;
+  struct Image *in = job->input_img;
+  struct Image *out = job->output_img;
+  int32_t width = in->width;
+
+  struct ConvRows cr, cr2;
+  int32_t *row = (int32_t *) malloc( (size_t) width * 4 * sizeof( int32_t ) );
+  int32_t *row2 = (int32_t *) malloc( (size_t) width * 4 * sizeof( int32_t ) );
+  int ok = row != NULL && row2 != NULL && conv_rows_init( &cr, in, job->h, job->v, row_begin );
+  int ok2 = ok && ( job->mode != FILTER_SOBEL || conv_rows_init( &cr2, in, job->h2, job->v2, row_begin ) );
+
+  if ( ok2 ) {
+    for ( int32_t y = row_begin; y < row_end; y++ ) {
+      const uint32_t *src = in->data + (size_t) y * width;
+      uint32_t *dst = out->data + (size_t) y * width;
+      conv_rows_next( &cr, y, row );
+      switch ( job->mode ) {
+      case FILTER_CONVOLVE:
+        store_row( row, width, dst );
+        break;
+      case FILTER_SOBEL:
+        conv_rows_next( &cr2, y, row2 );
+        sobel_row( row, row2, src, width, dst );
+        break;
+      case FILTER_UNSHARP:
+        unsharp_row( row, src, width, job->amount, dst );
+        break;
+      }
+    }
+  } else {
+    __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+  }
+
+  if ( ok2 && job->mode == FILTER_SOBEL )
+    conv_rows_cleanup( &cr2 );
+  if ( ok )
+    conv_rows_cleanup( &cr );
+  free( row );
+  free( row2 );
+}
+
+static int run_filter( struct FilterJob *job ) {
+  struct Image *in = job->input_img;
+  struct Image *out = job->output_img;
+  if ( in == out || in->width != out->width || in->height != out->height ||
+       in->width <= 0 || in->height <= 0 )
+    return 0;
+  job->failed = 0;
+  imgproc_parallel_rows( in->height, filter_band, job );
+  return !job->failed;
+}
+
+// Convolve input_img with a separable kernel: each channel (including
+// alpha) is filtered horizontally with h, then vertically with v, with
+// the image edges extended by replicating the border pixels. The
+// horizontal pass keeps only 2*v->radius+1 filtered rows per thread,
+// and the image is split into bands of rows processed in parallel.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (same dimensions as the
+//                input, and not the same Image)
+//   h - horizontal kernel
+//   v - vertical kernel
+//
+// Returns:
+//   1 if successful, 0 if the kernels or images are invalid or
+//   memory could not be allocated
+int imgproc_convolve( struct Image *input_img, struct Image *output_img,
+                      const struct Kernel *h, const struct Kernel *v ) {
+  if ( !kernel_valid( h ) || !kernel_valid( v ) )
+    return 0;
+  struct FilterJob job = { FILTER_CONVOLVE, input_img, output_img, h, v, NULL, NULL, 0, 0 };
+  return run_filter( &job );
+}
+
+// Blur an image with a (2*radius+1) x (2*radius+1) box filter.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   radius - blur radius in pixels
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_box_blur( struct Image *input_img, struct Image *output_img, int32_t radius ) {
+  struct Kernel k;
+  if ( !imgproc_kernel_box( &k, radius ) )
+    return 0;
+  return imgproc_convolve( input_img, output_img, &k, &k );
+}
+
+// Blur an image with a Gaussian filter.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   sigma - standard deviation of the Gaussian, in pixels
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_gaussian_blur( struct Image *input_img, struct Image *output_img, double sigma ) {
+  struct Kernel k;
+  if ( !imgproc_kernel_gaussian( &k, sigma ) )
+    return 0;
+  return imgproc_convolve( input_img, output_img, &k, &k );
+}
+
+// Render the Sobel edge magnitude of the input image's luminance as
+// a grayscale image. Alpha values are copied from the input.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_sobel( struct Image *input_img, struct Image *output_img ) {
+  // Gx = [1 2 1]^T * [-1 0 1], Gy = [-1 0 1]^T * [1 2 1]
+  struct Kernel smooth = { 1, 0, { 1, 2, 1 } };
+  struct Kernel diff = { 1, 0, { -1, 0, 1 } };
+  struct FilterJob job = { FILTER_SOBEL, input_img, output_img, &diff, &smooth, &smooth, &diff, 0, 0 };
+  return run_filter( &job );
+}
+
+// Sharpen an image by adding back the difference between the image
+// and a Gaussian-blurred copy of it. Alpha values are copied from the
+// input.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   sigma - standard deviation of the Gaussian blur, in pixels
+//   amount - strength of the sharpening, in percent
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_unsharp_mask( struct Image *input_img, struct Image *output_img, double sigma, int32_t amount ) {
+  struct Kernel k;
+  if ( !imgproc_kernel_gaussian( &k, sigma ) || amount < 0 )
+    return 0;
+  struct FilterJob job = { FILTER_UNSHARP, input_img, output_img, &k, &k, NULL, NULL, amount, 0 };
+  return run_filter( &job );
+}
@@ -0,0 +1,345 @@
+// Geometric transformations: transposes, rotations by multiples of 90
+// degrees, flips and affine warps
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Side of the square blocks the transposes are done in, and width of
+// the column strips of the warps. Two blocks of pixels (one read, one
+// written) fit in L1 cache.
+#define GEOMETRY_BLOCK 64
+
+// Transpose with signed strides: output row r, column c is the source
+// pixel at src[c * src_stride + r]. Negative strides (with base
+// pointers at the last row) turn the transpose into a rotation.
+struct TransposeJob {
+  const uint32_t *src;
+  ptrdiff_t src_stride;
+  uint32_t *dst;
+  ptrdiff_t dst_stride;
+  int32_t dst_cols;
+};
+
+// Flip: output row y is input row y (or h - 1 - y if reverse_rows is
+// set), with its pixels in reverse order if reverse_cols is set
+struct FlipJob {
+  struct Image *input_img;
+  struct Image *output_img;
+  int reverse_rows;
+  int reverse_cols;
+};
+
+struct AffineJob {
+  struct Image *input_img;
+  struct Image *output_img;
+  double inv[6];  // output pixel center to input coordinates
+};
+
+#ifdef __SSE2__
+// Transpose the 4x4 block of pixels at src into dst, in registers
+static inline void transpose_4x4( const uint32_t *src, ptrdiff_t src_stride,
+                                  uint32_t *dst, ptrdiff_t dst_stride ) {
+  __m128i r0 = _mm_loadu_si128( (const __m128i *) ( src ) );
+  __m128i r1 = _mm_loadu_si128( (const __m128i *) ( src + src_stride ) );
+  __m128i r2 = _mm_loadu_si128( (const __m128i *) ( src + src_stride * 2 ) );
+  __m128i r3 = _mm_loadu_si128( (const __m128i *) ( src + src_stride * 3 ) );
+  __m128i t0 = _mm_unpacklo_epi32( r0, r1 );  // a0 b0 a1 b1
+  __m128i t1 = _mm_unpacklo_epi32( r2, r3 );  // c0 d0 c1 d1
+  __m128i t2 = _mm_unpackhi_epi32( r0, r1 );  // a2 b2 a3 b3
+  __m128i t3 = _mm_unpackhi_epi32( r2, r3 );  // c2 d2 c3 d3
+  _mm_storeu_si128( (__m128i *) ( dst ), _mm_unpacklo_epi64( t0, t1 ) );
+  _mm_storeu_si128( (__m128i *) ( dst + dst_stride ), _mm_unpackhi_epi64( t0, t1 ) );
+  _mm_storeu_si128( (__m128i *) ( dst + dst_stride * 2 ), _mm_unpacklo_epi64( t2, t3 ) );
+  _mm_storeu_si128( (__m128i *) ( dst + dst_stride * 3 ), _mm_unpackhi_epi64( t2, t3 ) );
+}
+#endif
+
+// Transpose the output rows [row_begin, row_end) block by block, so
+// that both the rows read and the rows written stay in cache
+static void transpose_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct TransposeJob *job = (struct TransposeJob *) arg;
+  const uint32_t *src = job->src;
+  uint32_t *dst = job->dst;
+  ptrdiff_t ss = job->src_stride, ds = job->dst_stride;
+
+  for ( int32_t r0 = row_begin; r0 < row_end; r0 += GEOMETRY_BLOCK ) {
+    int32_t r1 = r0 + GEOMETRY_BLOCK < row_end ? r0 + GEOMETRY_BLOCK : row_end;
+    for ( int32_t c0 = 0; c0 < job->dst_cols; c0 += GEOMETRY_BLOCK ) {
+      int32_t c1 = c0 + GEOMETRY_BLOCK < job->dst_cols ? c0 + GEOMETRY_BLOCK : job->dst_cols;
+      int32_t r = r0;
+#ifdef __SSE2__
+      for ( ; r + 4 <= r1; r += 4 ) {
+        int32_t c = c0;
+        for ( ; c + 4 <= c1; c += 4 )
+          transpose_4x4( src + c * ss + r, ss, dst + r * ds + c, ds );
+        for ( ; c < c1; c++ )
+          for ( int32_t k = 0; k < 4; k++ )
+            dst[( r + k ) * ds + c] = src[c * ss + r + k];
+      }
+#endif
+      for ( ; r < r1; r++ )
+        for ( int32_t c = c0; c < c1; c++ )
+          dst[r * ds + c] = src[c * ss + r];
+    }
+  }
+}
+
+static int check_distinct( struct Image *input_img, struct Image *output_img ) {
+  return input_img != output_img && input_img->data != output_img->data;
+}
+
+// Run a transpose of input_img into output_img, whose width and height
+// must be the height and width of the input. reverse_src reverses the
+// order of the source rows, reverse_dst that of the output rows.
+static int run_transpose( struct Image *input_img, struct Image *output_img,
+                          int reverse_src, int reverse_dst ) {
+  if ( output_img->width != input_img->height || output_img->height != input_img->width
+       || !check_distinct( input_img, output_img ) )
+    return 0;
+
+  struct TransposeJob job;
+  job.src_stride = input_img->width;
+  job.src = input_img->data;
+  if ( reverse_src ) {
+    job.src += (ptrdiff_t) ( input_img->height - 1 ) * input_img->width;
+    job.src_stride = -job.src_stride;
+  }
+  job.dst_stride = output_img->width;
+  job.dst = output_img->data;
+  if ( reverse_dst ) {
+    job.dst += (ptrdiff_t) ( output_img->height - 1 ) * output_img->width;
+    job.dst_stride = -job.dst_stride;
+  }
+  job.dst_cols = output_img->width;
+  imgproc_parallel_rows( output_img->height, transpose_band, &job );
+  return 1;
+}
+
+// Transpose an image: output row r is input column r.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_transpose( struct Image *input_img, struct Image *output_img ) {
+  return run_transpose( input_img, output_img, 0, 0 );
+}
+
+// Rotate an image 90 degrees clockwise.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_rotate90( struct Image *input_img, struct Image *output_img ) {
+  return run_transpose( input_img, output_img, 1, 0 );
+}
+
+// Rotate an image 270 degrees clockwise (90 degrees counterclockwise).
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                must be the height and width of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong or the
+//   output is the input image
+int imgproc_rotate270( struct Image *input_img, struct Image *output_img ) {
+  return run_transpose( input_img, output_img, 0, 1 );
+}
+
+// Copy n pixels from src to dst in reverse order
+static void reverse_row( const uint32_t *src, uint32_t *dst, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  for ( ; x + 4 <= n; x += 4 ) {
+    __m128i v = _mm_loadu_si128( (const __m128i *) ( src + n - 4 - x ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x ), _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+  }
+#endif
+  for ( ; x < n; x++ )
+    dst[x] = src[n - 1 - x];
+}
+
+static void flip_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct FlipJob *job = (struct FlipJob *) arg;
+  int32_t w = job->input_img->width, h = job->input_img->height;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    int32_t src_y = job->reverse_rows ? h - 1 - y : y;
+    const uint32_t *src = job->input_img->data + (size_t) src_y * w;
+    uint32_t *dst = job->output_img->data + (size_t) y * w;
+    if ( job->reverse_cols )
+      reverse_row( src, dst, w );
+    else
+      memcpy( dst, src, w * sizeof( uint32_t ) );
+  }
+}
+
+static int run_flip( struct Image *input_img, struct Image *output_img,
+                     int reverse_rows, int reverse_cols ) {
+  if ( output_img->width != input_img->width || output_img->height != input_img->height
+       || !check_distinct( input_img, output_img ) )
+    return 0;
+  struct FlipJob job = { input_img, output_img, reverse_rows, reverse_cols };
+  imgproc_parallel_rows( output_img->height, flip_band, &job );
+  return 1;
+}
+
+// Rotate an image 180 degrees.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_rotate180( struct Image *input_img, struct Image *output_img ) {
+  return run_flip( input_img, output_img, 1, 1 );
+}
+
+// Mirror an image left to right.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_flip_horizontal( struct Image *input_img, struct Image *output_img ) {
+  return run_flip( input_img, output_img, 0, 1 );
+}
+
+// Mirror an image top to bottom.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (with the same
+//                dimensions as the input image)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or the output
+//   is the input image
+int imgproc_flip_vertical( struct Image *input_img, struct Image *output_img ) {
+  return run_flip( input_img, output_img, 1, 0 );
+}
+
+// Input pixel at (x, y), or transparent black outside the image
+static inline uint32_t pixel_or_clear( const struct Image *img, int32_t x, int32_t y ) {
+  if ( x < 0 || y < 0 || x >= img->width || y >= img->height )
+    return 0;
+  return img->data[(size_t) y * img->width + x];
+}
+
+// Bilinear interpolation of four pixels with 8-bit weights fx, fy
+static inline uint32_t bilinear( uint32_t p00, uint32_t p10, uint32_t p01, uint32_t p11,
+                                 uint32_t fx, uint32_t fy ) {
+  uint32_t w00 = ( 256 - fx ) * ( 256 - fy ), w10 = fx * ( 256 - fy );
+  uint32_t w01 = ( 256 - fx ) * fy, w11 = fx * fy;
+  uint32_t result = 0;
+  for ( int shift = 0; shift < 32; shift += 8 ) {
+    uint32_t v = ( ( p00 >> shift ) & 0xFF ) * w00 + ( ( p10 >> shift ) & 0xFF ) * w10
+      + ( ( p01 >> shift ) & 0xFF ) * w01 + ( ( p11 >> shift ) & 0xFF ) * w11;
+    result |= ( ( v + 32768 ) >> 16 ) << shift;
+  }
+  return result;
+}
+
+// Warp output rows [row_begin, row_end) in strips GEOMETRY_BLOCK
+// columns wide, each walked over the whole band, so that successive
+// rows of a strip read source pixels close to the ones just read
+// however the warp rotates the image
+static void affine_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct AffineJob *job = (struct AffineJob *) arg;
+  struct Image *in = job->input_img, *out = job->output_img;
+  const double *m = job->inv;
+
+  for ( int32_t x0 = 0; x0 < out->width; x0 += GEOMETRY_BLOCK ) {
+    int32_t x1 = x0 + GEOMETRY_BLOCK < out->width ? x0 + GEOMETRY_BLOCK : out->width;
+    for ( int32_t y = row_begin; y < row_end; y++ ) {
+      uint32_t *dst = out->data + (size_t) y * out->width;
+      // source coordinates of the first pixel center of the row,
+      // relative to the source pixel centers
+      double sx = m[0] * ( x0 + 0.5 ) + m[1] * ( y + 0.5 ) + m[2] - 0.5;
+      double sy = m[3] * ( x0 + 0.5 ) + m[4] * ( y + 0.5 ) + m[5] - 0.5;
+      for ( int32_t x = x0; x < x1; x++, sx += m[0], sy += m[3] ) {
+        // (written to be false for NaN too, before any conversion)
+        if ( !( sx > -1.0 && sy > -1.0 && sx < in->width && sy < in->height ) ) {
+          dst[x] = 0;
+          continue;
+        }
+        double fx0 = floor( sx ), fy0 = floor( sy );
+        int32_t ix = (int32_t) fx0, iy = (int32_t) fy0;
+        uint32_t fx = (uint32_t) ( ( sx - fx0 ) * 256.0 + 0.5 );
+        uint32_t fy = (uint32_t) ( ( sy - fy0 ) * 256.0 + 0.5 );
+        if ( ix >= 0 && iy >= 0 && ix + 1 < in->width && iy + 1 < in->height ) {
+          const uint32_t *p = in->data + (size_t) iy * in->width + ix;
+          dst[x] = bilinear( p[0], p[1], p[in->width], p[in->width + 1], fx, fy );
+        } else {
+          dst[x] = bilinear( pixel_or_clear( in, ix, iy ), pixel_or_clear( in, ix + 1, iy ),
+                             pixel_or_clear( in, ix, iy + 1 ), pixel_or_clear( in, ix + 1, iy + 1 ),
+                             fx, fy );
+        }
+      }
+    }
+  }
+}
+
+// Warp an image by an affine transformation, with bilinear
+// interpolation. The matrix maps input coordinates (x, y) to output
+// coordinates (m[0]*x + m[1]*y + m[2], m[3]*x + m[4]*y + m[5]), where
+// (0, 0) is the top left corner of the top left pixel. Output pixels
+// that map to points outside the input image are transparent black.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (of any size)
+//   matrix - the 2x3 affine matrix, row by row
+//
+// Returns:
+//   1 if successful, 0 if the matrix has an entry that isn't finite,
+//   isn't invertible, or the output is the input image
+int imgproc_affine( struct Image *input_img, struct Image *output_img, const double matrix[6] ) {
+  if ( !check_distinct( input_img, output_img ) )
+    return 0;
+  for ( int i = 0; i < 6; i++ )
+    if ( !isfinite( matrix[i] ) )
+      return 0;
+  double det = matrix[0] * matrix[4] - matrix[1] * matrix[3];
+  if ( !isfinite( det ) || fabs( det ) < 1e-12 )
+    return 0;
+
+  // invert [a b c; d e f] to map output coordinates to input ones
+  struct AffineJob job;
+  job.input_img = input_img;
+  job.output_img = output_img;
+  job.inv[0] = matrix[4] / det;
+  job.inv[1] = -matrix[1] / det;
+  job.inv[3] = -matrix[3] / det;
+  job.inv[4] = matrix[0] / det;
+  job.inv[2] = -( job.inv[0] * matrix[2] + job.inv[1] * matrix[5] );
+  job.inv[5] = -( job.inv[3] * matrix[2] + job.inv[4] * matrix[5] );
+  for ( int i = 0; i < 6; i++ )
+    if ( !isfinite( job.inv[i] ) )
+      return 0;
+  imgproc_parallel_rows( output_img->height, affine_band, &job );
+  return 1;
+}
@@ -0,0 +1,270 @@
+// Index of the perceptual hashes of a batch of image files, built in
+// parallel, stored in a compact binary file and searched by Hamming
+// distance
+//
+// The index file consists of a header (the magic bytes "IPHX", then
+// the version, the number of entries and the size of the names as
+// 32-bit integers), an array of the 64-bit hashes of every entry for
+// each HashKind, and the file names of the entries, each terminated
+// by a NUL byte. Integers are stored in the byte order of the host.
+// Keeping the hashes of a kind contiguous makes a lookup a linear
+// scan of 8 bytes per entry.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "imgproc.h"
+
+#define HASH_INDEX_MAGIC "IPHX"
+#define HASH_INDEX_VERSION 1
+
+// Hard upper limit on the number of hashing threads
+#define MAX_HASH_THREADS 64
+
+struct HashIndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t names_size;
+};
+
+struct HashBuildJob {
+  const char *const *filenames;
+  int32_t num_files;
+  uint64_t (*hashes)[NUM_HASH_KINDS];
+  char *ok;  // whether each file could be read and hashed
+  int32_t next;  // next file to hash, taken atomically by the workers
+};
+
+static void *hash_worker( void *arg ) {
+  struct HashBuildJob *job = (struct HashBuildJob *) arg;
+  for ( ;; ) {
+    int32_t i = __atomic_fetch_add( &job->next, 1, __ATOMIC_RELAXED );
+    if ( i >= job->num_files )
+      break;
+    struct Image img;
+    if ( img_read( job->filenames[i], &img ) != IMG_SUCCESS )
+      continue;
+    job->ok[i] = (char) imgproc_image_hashes( &img, job->hashes[i] );
+    img_cleanup( &img );
+  }
+  return NULL;
+}
+
+// Allocate the arrays of an index, and its name storage
+static int alloc_index( struct HashIndex *index, int32_t num_entries, uint32_t names_size ) {
+  memset( index, 0, sizeof( *index ) );
+  size_t n = num_entries > 0 ? (size_t) num_entries : 1;
+  uint64_t *hashes = (uint64_t *) malloc( n * NUM_HASH_KINDS * sizeof( uint64_t ) );
+  index->names = (char **) malloc( n * sizeof( char * ) );
+  index->name_data = (char *) malloc( names_size > 0 ? names_size : 1 );
+  if ( hashes == NULL || index->names == NULL || index->name_data == NULL ) {
+    free( hashes );
+    free( index->names );
+    free( index->name_data );
+    memset( index, 0, sizeof( *index ) );
+    return 0;
+  }
+  for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+    index->hashes[k] = hashes + n * k;
+  index->num_entries = num_entries;
+  index->names_size = names_size;
+  return 1;
+}
+
+// Hash image files and build an index of them. Files are read and
+// hashed in parallel by imgproc_get_num_threads() threads. Files that
+// can't be read are left out of the index.
+//
+// Parameters:
+//   filenames - names of the PNG files
+//   num_files - number of files
+//   index - pointer to the HashIndex to initialize (it must be
+//           freed with imgproc_hash_index_cleanup)
+//
+// Returns:
+//   1 if successful, 0 if memory could not be allocated
+int imgproc_hash_index_build( const char *const *filenames, int32_t num_files, struct HashIndex *index ) {
+  struct HashBuildJob job;
+  job.filenames = filenames;
+  job.num_files = num_files;
+  job.next = 0;
+  job.hashes = (uint64_t (*)[NUM_HASH_KINDS]) malloc( ( num_files > 0 ? num_files : 1 ) * sizeof( *job.hashes ) );
+  job.ok = (char *) calloc( num_files > 0 ? num_files : 1, 1 );
+  if ( job.hashes == NULL || job.ok == NULL ) {
+    free( job.hashes );
+    free( job.ok );
+    return 0;
+  }
+
+  int num_threads = imgproc_get_num_threads();
+  if ( num_threads > num_files ) num_threads = num_files;
+  if ( num_threads > MAX_HASH_THREADS ) num_threads = MAX_HASH_THREADS;
+  pthread_t threads[MAX_HASH_THREADS];
+  int started = 0;
+  // the calling thread is one of the workers
+  for ( int i = 1; i < num_threads; i++ ) {
+    if ( pthread_create( &threads[started], NULL, hash_worker, &job ) != 0 )
+      break;
+    started++;
+  }
+  hash_worker( &job );
+  for ( int i = 0; i < started; i++ )
+    pthread_join( threads[i], NULL );
+
+  int32_t num_entries = 0;
+  size_t names_size = 0;
+  for ( int32_t i = 0; i < num_files; i++ )
+    if ( job.ok[i] ) {
+      num_entries++;
+      names_size += strlen( filenames[i] ) + 1;
+    }
+  int success = names_size <= UINT32_MAX && alloc_index( index, num_entries, (uint32_t) names_size );
+  if ( success ) {
+    char *name = index->name_data;
+    int32_t e = 0;
+    for ( int32_t i = 0; i < num_files; i++ ) {
+      if ( !job.ok[i] )
+        continue;
+      for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+        index->hashes[k][e] = job.hashes[i][k];
+      size_t len = strlen( filenames[i] ) + 1;
+      memcpy( name, filenames[i], len );
+      index->names[e++] = name;
+      name += len;
+    }
+  }
+  free( job.hashes );
+  free( job.ok );
+  return success;
+}
+
+// Write an index to a file.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+//   filename - name of the index file
+//
+// Returns:
+//   1 if successful, 0 if the file could not be written
+int imgproc_hash_index_write( const struct HashIndex *index, const char *filename ) {
+  FILE *out = fopen( filename, "wb" );
+  if ( out == NULL )
+    return 0;
+  struct HashIndexHeader header;
+  memcpy( header.magic, HASH_INDEX_MAGIC, 4 );
+  header.version = HASH_INDEX_VERSION;
+  header.num_entries = (uint32_t) index->num_entries;
+  header.names_size = index->names_size;
+  size_t n = (size_t) index->num_entries;
+  int success = fwrite( &header, sizeof( header ), 1, out ) == 1;
+  for ( int k = 0; k < NUM_HASH_KINDS && success; k++ )
+    success = fwrite( index->hashes[k], sizeof( uint64_t ), n, out ) == n;
+  if ( success && index->names_size > 0 )
+    success = fwrite( index->name_data, 1, index->names_size, out ) == index->names_size;
+  if ( fclose( out ) != 0 )
+    success = 0;
+  return success;
+}
+
+// Read an index from a file written by imgproc_hash_index_write.
+//
+// Parameters:
+//   filename - name of the index file
+//   index - pointer to the HashIndex to initialize (it must be
+//           freed with imgproc_hash_index_cleanup)
+//
+// Returns:
+//   1 if successful, 0 if the file could not be read, is not a valid
+//   index or memory could not be allocated
+int imgproc_hash_index_read( const char *filename, struct HashIndex *index ) {
+  FILE *in = fopen( filename, "rb" );
+  if ( in == NULL )
+    return 0;
+  struct HashIndexHeader header;
+  if ( fread( &header, sizeof( header ), 1, in ) != 1 || memcmp( header.magic, HASH_INDEX_MAGIC, 4 ) != 0
+       || header.version != HASH_INDEX_VERSION || header.num_entries > INT32_MAX ) {
+    fclose( in );
+    return 0;
+  }
+  // the counts must describe the file exactly (with a name of at least
+  // a NUL per entry) before anything is allocated for them, so that a
+  // truncated or corrupt index can't ask for huge allocations
+  long file_size = -1;
+  if ( fseek( in, 0, SEEK_END ) == 0 )
+    file_size = ftell( in );
+  uint64_t expected_size = sizeof( header )
+    + (uint64_t) NUM_HASH_KINDS * sizeof( uint64_t ) * header.num_entries + header.names_size;
+  if ( file_size < 0 || (uint64_t) file_size != expected_size || header.names_size < header.num_entries
+       || fseek( in, (long) sizeof( header ), SEEK_SET ) != 0
+       || !alloc_index( index, (int32_t) header.num_entries, header.names_size ) ) {
+    fclose( in );
+    return 0;
+  }
+
+  size_t n = header.num_entries;
+  int success = 1;
+  for ( int k = 0; k < NUM_HASH_KINDS && success; k++ )
+    success = fread( index->hashes[k], sizeof( uint64_t ), n, in ) == n;
+  if ( success && header.names_size > 0 )
+    success = fread( index->name_data, 1, header.names_size, in ) == header.names_size;
+  // exactly one NUL terminated name per entry, and nothing after them
+  success = success && fgetc( in ) == EOF;
+  fclose( in );
+
+  char *name = index->name_data, *end = index->name_data + header.names_size;
+  for ( size_t i = 0; i < n && success; i++ ) {
+    char *nul = (char *) memchr( name, '\0', end - name );
+    if ( nul == NULL ) {
+      success = 0;
+      break;
+    }
+    index->names[i] = name;
+    name = nul + 1;
+  }
+  if ( !success || name != end ) {
+    imgproc_hash_index_cleanup( index );
+    return 0;
+  }
+  return 1;
+}
+
+// Free the memory of an index.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+void imgproc_hash_index_cleanup( struct HashIndex *index ) {
+  free( index->hashes[0] );
+  free( index->names );
+  free( index->name_data );
+  memset( index, 0, sizeof( *index ) );
+}
+
+// Find the entries of an index whose hash of one kind is within a
+// Hamming distance of a hash.
+//
+// Parameters:
+//   index - pointer to the HashIndex
+//   kind - kind of the hash
+//   hash - the hash to look up
+//   max_distance - largest Hamming distance of a match
+//   matches - set to the entry numbers of up to max_matches matches,
+//             in index order
+//   max_matches - size of the matches array
+//
+// Returns:
+//   the number of matches, which may be larger than max_matches
+int32_t imgproc_hash_index_lookup( const struct HashIndex *index, enum HashKind kind, uint64_t hash,
+                                   int max_distance, int32_t *matches, int32_t max_matches ) {
+  const uint64_t *hashes = index->hashes[kind];
+  int32_t count = 0;
+  for ( int32_t i = 0; i < index->num_entries; i++ ) {
+    if ( __builtin_popcountll( hashes[i] ^ hash ) > max_distance )
+      continue;
+    if ( count < max_matches )
+      matches[count] = i;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,164 @@
+// Compile-time pixel pipelines for the C++ backend (cpp_imgproc_fns.cpp).
+//
+// Each per-pixel transformation is a small functor, and a Chain of
+// functors is composed at compile time, so that applying a whole chain
+// to a row is a single loop with every step inlined into it, which the
+// compiler can then vectorize. The C backend calls its helpers
+// (get_r, make_pixel, compute_index, ...) through separate translation
+// units once per pixel, and none of them can be inlined.
+//
+// A pixel op is any type with
+//
+//   void begin_row( int32_t y );                 // called before each row
+//   uint32_t operator()( uint32_t p, int32_t x ) const;
+//
+// where x is the column of pixel p. Ops with no per-row state derive
+// from PixelOp to get an empty begin_row.
+
+#ifndef IMGPROC_PIPELINE_H
+#define IMGPROC_PIPELINE_H
+
+#include <stdint.h>
+#include <tuple>
+#include <utility>
+
+extern "C" {
+#include "imgproc.h"
+}
+
+namespace imgproc {
+
+////////////////////////////////////////////////////////////////////////
+// Pixel accessors
+////////////////////////////////////////////////////////////////////////
+
+inline uint32_t red( uint32_t p ) { return p >> 24; }
+inline uint32_t green( uint32_t p ) { return ( p >> 16 ) & 0xFF; }
+inline uint32_t blue( uint32_t p ) { return ( p >> 8 ) & 0xFF; }
+inline uint32_t alpha( uint32_t p ) { return p & 0xFF; }
+
+inline uint32_t pixel( uint32_t r, uint32_t g, uint32_t b, uint32_t a ) {
+  return ( r << 24 ) | ( g << 16 ) | ( b << 8 ) | a;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Pixel ops
+////////////////////////////////////////////////////////////////////////
+
+struct PixelOp {
+  void begin_row( int32_t ) {}
+};
+
+// Weighted sum of the color channels, alpha unchanged
+struct Grayscale : PixelOp {
+  uint32_t operator()( uint32_t p, int32_t ) const {
+    uint32_t y = imgproc_luma( red( p ), green( p ), blue( p ) );
+    return pixel( y, y, y, alpha( p ) );
+  }
+};
+
+// Keep only the bits of Mask (e.g. 0xFF0000FF keeps red and alpha)
+template <uint32_t Mask>
+struct KeepChannels : PixelOp {
+  uint32_t operator()( uint32_t p, int32_t ) const { return p & Mask; }
+};
+
+// Scale the color channels by row_fade * col_fade / 10^12 in double
+// precision, so that the loop stays vectorizable. Truncating the
+// quotient gives the same result as the integer division of the other
+// backends (see fade_16 in imgproc_planar.c for why).
+class Fade {
+public:
+  // col_fade holds the gradient of every column
+  Fade( const double *col_fade, int32_t height )
+    : m_col_fade( col_fade ), m_height( height ), m_row_fade( 0.0 ) {}
+
+  void begin_row( int32_t y ) { m_row_fade = (double) imgproc_fade_gradient( y, m_height ); }
+
+  uint32_t operator()( uint32_t p, int32_t x ) const {
+    double f = m_row_fade * m_col_fade[x];
+    return pixel( scale( red( p ), f ), scale( green( p ), f ), scale( blue( p ), f ), alpha( p ) );
+  }
+
+private:
+  static uint32_t scale( uint32_t c, double f ) {
+    uint32_t v = (uint32_t) ( (double) c * f / 1e12 );
+    return v > 255 ? 255 : v;
+  }
+
+  const double *m_col_fade;
+  int32_t m_height;
+  double m_row_fade;
+};
+
+// Apply Ops left to right
+template <typename... Ops>
+class Chain {
+public:
+  explicit Chain( Ops... ops ) : m_ops( ops... ) {}
+
+  void begin_row( int32_t y ) {
+    std::apply( [y]( auto &... op ) { ( op.begin_row( y ), ... ); }, m_ops );
+  }
+
+  uint32_t operator()( uint32_t p, int32_t x ) const {
+    return apply_from<0>( p, x );
+  }
+
+private:
+  template <size_t I>
+  uint32_t apply_from( uint32_t p, int32_t x ) const {
+    if constexpr ( I == sizeof...( Ops ) )
+      return p;
+    else
+      return apply_from<I + 1>( std::get<I>( m_ops )( p, x ), x );
+  }
+
+  std::tuple<Ops...> m_ops;
+};
+
+template <typename... Ops>
+Chain<Ops...> chain( Ops... ops ) { return Chain<Ops...>( ops... ); }
+
+////////////////////////////////////////////////////////////////////////
+// Drivers
+////////////////////////////////////////////////////////////////////////
+
+// Apply op to n pixels of a row. src and dst may be the same row.
+template <typename Op>
+inline void map_row( const Op &op, const uint32_t *src, uint32_t *dst, int32_t n ) {
+  for ( int32_t x = 0; x < n; x++ )
+    dst[x] = op( src[x], x );
+}
+
+template <typename Op>
+struct MapJob {
+  const struct Image *input_img;
+  struct Image *output_img;
+  Op op;
+};
+
+template <typename Op>
+void map_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  MapJob<Op> *job = (MapJob<Op> *) arg;
+  Op op = job->op;  // each band has its own per-row state
+  int32_t w = job->input_img->width;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    op.begin_row( y );
+    map_row( op, job->input_img->data + (size_t) y * w, job->output_img->data + (size_t) y * w, w );
+  }
+}
+
+// Apply op to every pixel of input_img, storing the results in the
+// same positions of output_img, with bands of rows processed in
+// parallel. The images must have the same dimensions, and may be the
+// same image.
+template <typename Op>
+void map_pixels( const struct Image *input_img, struct Image *output_img, const Op &op ) {
+  MapJob<Op> job = { input_img, output_img, op };
+  imgproc_parallel_rows( input_img->height, map_band<Op>, &job );
+}
+
+} // namespace imgproc
+
+#endif // IMGPROC_PIPELINE_H
@@ -0,0 +1,377 @@
+// Planar (one byte plane per channel) images: conversion to and from
+// packed RGBA, and planar versions of the grayscale, fade and rgb
+// transformations
+
+#include <stdlib.h>
+#include <string.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Denominator of the fade factor row_fade * col_fade
+#define FADE_SCALE 1000000000000LL
+
+// Which conversion a ConvertJob performs
+enum ConvertDir {
+  CONVERT_TO_PLANAR,
+  CONVERT_TO_PACKED,
+};
+
+struct ConvertJob {
+  enum ConvertDir dir;
+  struct Image *packed;
+  struct PlanarImage *planar;
+};
+
+struct PlanarJob {
+  struct PlanarImage *input_img;
+  struct PlanarImage *output_img;
+  const double *col_fade;  // fade only: gradient of every column
+};
+
+// Allocate the planes of a planar image. The four planes share one
+// allocation.
+//
+// Parameters:
+//   img - pointer to the PlanarImage to initialize
+//   width - width of the image
+//   height - height of the image
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive or memory
+//   could not be allocated
+int imgproc_planar_init( struct PlanarImage *img, int32_t width, int32_t height ) {
+  if ( width <= 0 || height <= 0 )
+    return 0;
+  size_t plane_size = (size_t) width * height;
+  uint8_t *buf = (uint8_t *) malloc( plane_size * 4 );
+  if ( buf == NULL )
+    return 0;
+
+  img->width = width;
+  img->height = height;
+  img->r = buf;
+  img->g = buf + plane_size;
+  img->b = buf + plane_size * 2;
+  img->a = buf + plane_size * 3;
+  return 1;
+}
+
+// Free the planes of a planar image.
+//
+// Parameters:
+//   img - pointer to the PlanarImage to clean up
+void imgproc_planar_cleanup( struct PlanarImage *img ) {
+  free( img->r );
+  img->r = img->g = img->b = img->a = NULL;
+}
+
+static void convert_row_to_planar( const uint32_t *src, uint8_t *r, uint8_t *g,
+                                   uint8_t *b, uint8_t *a, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  // Bytes of each pixel are A, B, G, R in memory. Three rounds of byte
+  // interleaving turn 16 pixels into 8-byte runs of one channel.
+  for ( ; x + 16 <= n; x += 16 ) {
+    __m128i v0 = _mm_loadu_si128( (const __m128i *) ( src + x ) );
+    __m128i v1 = _mm_loadu_si128( (const __m128i *) ( src + x + 4 ) );
+    __m128i v2 = _mm_loadu_si128( (const __m128i *) ( src + x + 8 ) );
+    __m128i v3 = _mm_loadu_si128( (const __m128i *) ( src + x + 12 ) );
+    __m128i t0 = _mm_unpacklo_epi8( v0, v1 );
+    __m128i t1 = _mm_unpackhi_epi8( v0, v1 );
+    __m128i t2 = _mm_unpacklo_epi8( v2, v3 );
+    __m128i t3 = _mm_unpackhi_epi8( v2, v3 );
+    __m128i u0 = _mm_unpacklo_epi8( t0, t1 );
+    __m128i u1 = _mm_unpackhi_epi8( t0, t1 );
+    __m128i u2 = _mm_unpacklo_epi8( t2, t3 );
+    __m128i u3 = _mm_unpackhi_epi8( t2, t3 );
+    __m128i ab_lo = _mm_unpacklo_epi8( u0, u1 );  // a0..a7 b0..b7
+    __m128i gr_lo = _mm_unpackhi_epi8( u0, u1 );  // g0..g7 r0..r7
+    __m128i ab_hi = _mm_unpacklo_epi8( u2, u3 );  // a8..a15 b8..b15
+    __m128i gr_hi = _mm_unpackhi_epi8( u2, u3 );  // g8..g15 r8..r15
+    _mm_storeu_si128( (__m128i *) ( a + x ), _mm_unpacklo_epi64( ab_lo, ab_hi ) );
+    _mm_storeu_si128( (__m128i *) ( b + x ), _mm_unpackhi_epi64( ab_lo, ab_hi ) );
+    _mm_storeu_si128( (__m128i *) ( g + x ), _mm_unpacklo_epi64( gr_lo, gr_hi ) );
+    _mm_storeu_si128( (__m128i *) ( r + x ), _mm_unpackhi_epi64( gr_lo, gr_hi ) );
+  }
+#endif
+  for ( ; x < n; x++ ) {
+    uint32_t px = src[x];
+    r[x] = (uint8_t) ( px >> 24 );
+    g[x] = (uint8_t) ( px >> 16 );
+    b[x] = (uint8_t) ( px >> 8 );
+    a[x] = (uint8_t) px;
+  }
+}
+
+static void convert_row_to_packed( const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                                   const uint8_t *a, uint32_t *dst, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  for ( ; x + 16 <= n; x += 16 ) {
+    __m128i va = _mm_loadu_si128( (const __m128i *) ( a + x ) );
+    __m128i vb = _mm_loadu_si128( (const __m128i *) ( b + x ) );
+    __m128i vg = _mm_loadu_si128( (const __m128i *) ( g + x ) );
+    __m128i vr = _mm_loadu_si128( (const __m128i *) ( r + x ) );
+    __m128i ab_lo = _mm_unpacklo_epi8( va, vb );
+    __m128i ab_hi = _mm_unpackhi_epi8( va, vb );
+    __m128i gr_lo = _mm_unpacklo_epi8( vg, vr );
+    __m128i gr_hi = _mm_unpackhi_epi8( vg, vr );
+    _mm_storeu_si128( (__m128i *) ( dst + x ), _mm_unpacklo_epi16( ab_lo, gr_lo ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x + 4 ), _mm_unpackhi_epi16( ab_lo, gr_lo ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x + 8 ), _mm_unpacklo_epi16( ab_hi, gr_hi ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x + 12 ), _mm_unpackhi_epi16( ab_hi, gr_hi ) );
+  }
+#endif
+  for ( ; x < n; x++ )
+    dst[x] = ( (uint32_t) r[x] << 24 ) | ( (uint32_t) g[x] << 16 ) | ( (uint32_t) b[x] << 8 ) | a[x];
+}
+
+static void convert_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct ConvertJob *job = (struct ConvertJob *) arg;
+  int32_t w = job->packed->width;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    size_t off = (size_t) y * w;
+    if ( job->dir == CONVERT_TO_PLANAR )
+      convert_row_to_planar( job->packed->data + off, job->planar->r + off, job->planar->g + off,
+                             job->planar->b + off, job->planar->a + off, w );
+    else
+      convert_row_to_packed( job->planar->r + off, job->planar->g + off, job->planar->b + off,
+                             job->planar->a + off, job->packed->data + off, w );
+  }
+}
+
+static int run_convert( enum ConvertDir dir, struct Image *packed, struct PlanarImage *planar ) {
+  if ( packed->width != planar->width || packed->height != planar->height )
+    return 0;
+  struct ConvertJob job = { dir, packed, planar };
+  imgproc_parallel_rows( packed->height, convert_band, &job );
+  return 1;
+}
+
+// Split the channels of a packed image into the planes of a planar
+// image of the same dimensions.
+//
+// Parameters:
+//   input_img  - pointer to the packed input Image
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_from_packed( struct Image *input_img, struct PlanarImage *output_img ) {
+  return run_convert( CONVERT_TO_PLANAR, input_img, output_img );
+}
+
+// Combine the planes of a planar image into a packed image of the
+// same dimensions.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the packed output Image
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_to_packed( struct PlanarImage *input_img, struct Image *output_img ) {
+  return run_convert( CONVERT_TO_PACKED, output_img, input_img );
+}
+
+static void grayscale_row( const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                           uint8_t *y_out, int32_t n ) {
+  int32_t x = 0;
+#ifdef __SSE2__
+  // imgproc_luma in 16-bit lanes: the weights add up to 256, so the
+  // weighted sum of 8-bit values fits
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wr = _mm_set1_epi16( IMGPROC_LUMA_R );
+  const __m128i wg = _mm_set1_epi16( IMGPROC_LUMA_G );
+  const __m128i wb = _mm_set1_epi16( IMGPROC_LUMA_B );
+  for ( ; x + 16 <= n; x += 16 ) {
+    __m128i vr = _mm_loadu_si128( (const __m128i *) ( r + x ) );
+    __m128i vg = _mm_loadu_si128( (const __m128i *) ( g + x ) );
+    __m128i vb = _mm_loadu_si128( (const __m128i *) ( b + x ) );
+    __m128i lo = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( vr, zero ), wr ),
+                                               _mm_mullo_epi16( _mm_unpacklo_epi8( vg, zero ), wg ) ),
+                                _mm_mullo_epi16( _mm_unpacklo_epi8( vb, zero ), wb ) );
+    __m128i hi = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( vr, zero ), wr ),
+                                               _mm_mullo_epi16( _mm_unpackhi_epi8( vg, zero ), wg ) ),
+                                _mm_mullo_epi16( _mm_unpackhi_epi8( vb, zero ), wb ) );
+    __m128i y = _mm_packus_epi16( _mm_srli_epi16( lo, 8 ), _mm_srli_epi16( hi, 8 ) );
+    _mm_storeu_si128( (__m128i *) ( y_out + x ), y );
+  }
+#endif
+  for ( ; x < n; x++ )
+    y_out[x] = (uint8_t) imgproc_luma( r[x], g[x], b[x] );
+}
+
+static void grayscale_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct PlanarJob *job = (struct PlanarJob *) arg;
+  struct PlanarImage *in = job->input_img, *out = job->output_img;
+  int32_t w = in->width;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    size_t off = (size_t) y * w;
+    grayscale_row( in->r + off, in->g + off, in->b + off, out->r + off, w );
+    memcpy( out->g + off, out->r + off, w );
+    memcpy( out->b + off, out->r + off, w );
+    memmove( out->a + off, in->a + off, w );
+  }
+}
+
+// Planar version of imgproc_grayscale, with identical results.
+// The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match
+int imgproc_planar_grayscale( struct PlanarImage *input_img, struct PlanarImage *output_img ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  struct PlanarJob job = { input_img, output_img, NULL };
+  imgproc_parallel_rows( input_img->height, grayscale_band, &job );
+  return 1;
+}
+
+#ifdef __SSE2__
+// Fade 16 values of one channel: floor(v * w / FADE_SCALE), where w
+// holds the 16 exact (at most 10^12) fade factors. The products are
+// exact in double precision, and a correctly rounded quotient of at
+// most 255 that isn't an integer is at least 10^-12 away from the next
+// integer, far more than its rounding error, so truncating it gives the
+// same result as the integer division of the packed transformation.
+static __m128i fade_16( __m128i v, const __m128d w[8], __m128d scale ) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v16[2] = { _mm_unpacklo_epi8( v, zero ), _mm_unpackhi_epi8( v, zero ) };
+  __m128i q16[2];
+  for ( int h = 0; h < 2; h++ ) {
+    __m128i v32[2] = { _mm_unpacklo_epi16( v16[h], zero ), _mm_unpackhi_epi16( v16[h], zero ) };
+    __m128i q32[2];
+    for ( int k = 0; k < 2; k++ ) {
+      const __m128d *wk = w + h * 4 + k * 2;
+      __m128d lo = _mm_div_pd( _mm_mul_pd( _mm_cvtepi32_pd( v32[k] ), wk[0] ), scale );
+      __m128d hi = _mm_div_pd( _mm_mul_pd( _mm_cvtepi32_pd( _mm_srli_si128( v32[k], 8 ) ), wk[1] ), scale );
+      q32[k] = _mm_unpacklo_epi64( _mm_cvttpd_epi32( lo ), _mm_cvttpd_epi32( hi ) );
+    }
+    q16[h] = _mm_packs_epi32( q32[0], q32[1] );
+  }
+  return _mm_packus_epi16( q16[0], q16[1] );
+}
+#endif
+
+static void fade_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct PlanarJob *job = (struct PlanarJob *) arg;
+  struct PlanarImage *in = job->input_img, *out = job->output_img;
+  int32_t w = in->width;
+  const uint8_t *src[3];
+  uint8_t *dst[3];
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    size_t off = (size_t) y * w;
+    int64_t row_fade = imgproc_fade_gradient( y, in->height );
+    src[0] = in->r + off; src[1] = in->g + off; src[2] = in->b + off;
+    dst[0] = out->r + off; dst[1] = out->g + off; dst[2] = out->b + off;
+
+    int32_t x = 0;
+#ifdef __SSE2__
+    const __m128d scale = _mm_set1_pd( (double) FADE_SCALE );
+    const __m128d rf = _mm_set1_pd( (double) row_fade );
+    for ( ; x + 16 <= w; x += 16 ) {
+      // row_fade * col_fade is an integer of at most 10^12, so exact
+      __m128d wts[8];
+      for ( int k = 0; k < 8; k++ )
+        wts[k] = _mm_mul_pd( rf, _mm_loadu_pd( job->col_fade + x + k * 2 ) );
+      for ( int c = 0; c < 3; c++ ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *) ( src[c] + x ) );
+        _mm_storeu_si128( (__m128i *) ( dst[c] + x ), fade_16( v, wts, scale ) );
+      }
+    }
+#endif
+    for ( ; x < w; x++ ) {
+      int64_t f = row_fade * (int64_t) job->col_fade[x];
+      for ( int c = 0; c < 3; c++ )
+        dst[c][x] = (uint8_t) ( f * src[c][x] / FADE_SCALE );
+    }
+    memmove( out->a + off, in->a + off, w );
+  }
+}
+
+// Planar version of imgproc_fade, with identical results.
+// The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or memory
+//   could not be allocated
+int imgproc_planar_fade( struct PlanarImage *input_img, struct PlanarImage *output_img ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  double *col_fade = (double *) malloc( input_img->width * sizeof( double ) );
+  if ( col_fade == NULL )
+    return 0;
+  for ( int32_t x = 0; x < input_img->width; x++ )
+    col_fade[x] = (double) imgproc_fade_gradient( x, input_img->width );
+
+  struct PlanarJob job = { input_img, output_img, col_fade };
+  imgproc_parallel_rows( input_img->height, fade_band, &job );
+  free( col_fade );
+  return 1;
+}
+
+static void rgb_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct PlanarJob *job = (struct PlanarJob *) arg;
+  struct PlanarImage *in = job->input_img, *out = job->output_img;
+  int32_t w = in->width, h = in->height;
+  const uint8_t *src[4];
+  uint8_t *dst[4];
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    size_t in_off = (size_t) y * w;
+    src[0] = in->r + in_off; src[1] = in->g + in_off;
+    src[2] = in->b + in_off; src[3] = in->a + in_off;
+
+    // top half: copy | red only; bottom half: green only | blue only
+    for ( int32_t half = 0; half < 2; half++ ) {
+      size_t out_off = (size_t) ( y + half * h ) * out->width;
+      dst[0] = out->r + out_off; dst[1] = out->g + out_off;
+      dst[2] = out->b + out_off; dst[3] = out->a + out_off;
+      for ( int c = 0; c < 3; c++ ) {
+        int left = half == 0 ? 1 : c == 1;
+        int right = half == 0 ? c == 0 : c == 2;
+        if ( left )
+          memcpy( dst[c], src[c], w );
+        else
+          memset( dst[c], 0, w );
+        if ( right )
+          memcpy( dst[c] + w, src[c], w );
+        else
+          memset( dst[c] + w, 0, w );
+      }
+      memcpy( dst[3], src[3], w );
+      memcpy( dst[3] + w, src[3], w );
+    }
+  }
+}
+
+// Planar version of imgproc_rgb, with identical results.
+//
+// Parameters:
+//   input_img  - pointer to the input PlanarImage
+//   output_img - pointer to the output PlanarImage (which must have
+//                twice the width and height of the input image)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions are wrong
+int imgproc_planar_rgb( struct PlanarImage *input_img, struct PlanarImage *output_img ) {
+  if ( input_img == output_img || output_img->width != input_img->width * 2
+       || output_img->height != input_img->height * 2 )
+    return 0;
+  struct PlanarJob job = { input_img, output_img, NULL };
+  imgproc_parallel_rows( input_img->height, rgb_band, &job );
+  return 1;
+}
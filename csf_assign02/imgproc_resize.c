@@ -0,0 +1,426 @@
+// Image resampling: separable resize with precomputed filter weights
+// and an integer-ratio fast path for box downscaling
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imgproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fractional bits of the fixed-point filter weights
+#define RESIZE_WEIGHT_BITS 14
+
+// Fractional bits kept in the horizontally resampled rows
+#define RESIZE_FRAC_BITS 6
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Rolling state of the vertical pass over one band of output rows.
+// The horizontally resampled source rows covered by the current
+// output row's window are kept in a ring of plan->v.taps rows.
+struct ResizeRows {
+  const struct ResizePlan *plan;
+  const struct Image *img;
+  int16_t *padded;    // widened source row
+  int16_t *ring;      // v.taps horizontally resampled rows
+  int32_t row_len;    // int16 values per ring row, i.e., dst width * 4
+  int32_t next_row;   // next source row to resample into the ring
+};
+
+struct ResizeJob {
+  const struct ResizePlan *plan;
+  struct Image *input_img;
+  struct Image *output_img;
+  int failed;
+};
+
+static int32_t clamp_i32( int32_t x, int32_t lo, int32_t hi ) {
+  return x < lo ? lo : ( x > hi ? hi : x );
+}
+
+static double sinc( double x ) {
+  if ( x == 0.0 )
+    return 1.0;
+  x *= M_PI;
+  return sin( x ) / x;
+}
+
+// Filter support (half-width) in source pixels at scale 1
+static double filter_support( enum ResizeFilter filter ) {
+  switch ( filter ) {
+  case RESIZE_BOX: return 0.5;
+  case RESIZE_BILINEAR: return 1.0;
+  case RESIZE_BICUBIC: return 2.0;
+  case RESIZE_LANCZOS3: return 3.0;
+  }
+  return 0.0;
+}
+
+static double filter_eval( enum ResizeFilter filter, double x ) {
+  double ax = fabs( x );
+  switch ( filter ) {
+  case RESIZE_BOX:
+    return ( x >= -0.5 && x < 0.5 ) ? 1.0 : 0.0;
+  case RESIZE_BILINEAR:
+    return ax < 1.0 ? 1.0 - ax : 0.0;
+  case RESIZE_BICUBIC: {
+    // Keys cubic with a = -0.5
+    const double a = -0.5;
+    if ( ax < 1.0 )
+      return ( ( a + 2.0 ) * ax - ( a + 3.0 ) ) * ax * ax + 1.0;
+    if ( ax < 2.0 )
+      return ( ( ( ax - 5.0 ) * ax + 8.0 ) * ax - 4.0 ) * a;
+    return 0.0;
+  }
+  case RESIZE_LANCZOS3:
+    return ax < 3.0 ? sinc( x ) * sinc( x / 3.0 ) : 0.0;
+  }
+  return 0.0;
+}
+
+// Compute the fixed-point weights mapping src_len pixels onto dst_len
+// pixels along one axis. Every destination pixel gets the same number
+// of taps (unused taps have zero weight), so the inner loops are
+// branch-free.
+static int resize_axis_init( struct ResizeAxis *axis, int32_t src_len, int32_t dst_len,
+                             enum ResizeFilter filter ) {
+  double scale = (double) src_len / dst_len;
+  double filter_scale = scale > 1.0 ? scale : 1.0;
+  double support = filter_support( filter ) * filter_scale;
+
+  // taps is kept even so the SIMD loops can always use tap pairs
+  int32_t taps = (int32_t) ceil( support ) * 2 + 1;
+  taps += taps & 1;
+
+  axis->src_len = src_len;
+  axis->dst_len = dst_len;
+  axis->taps = taps;
+  axis->start = (int32_t *) malloc( (size_t) dst_len * sizeof( int32_t ) );
+  axis->weights = (int16_t *) calloc( (size_t) dst_len * taps, sizeof( int16_t ) );
+  double *w = (double *) malloc( (size_t) taps * sizeof( double ) );
+  if ( axis->start == NULL || axis->weights == NULL || w == NULL ) {
+    free( w );
+    return 0;
+  }
+
+  for ( int32_t i = 0; i < dst_len; i++ ) {
+    double center = ( i + 0.5 ) * scale;
+    int32_t lo = (int32_t) floor( center - support + 0.5 );
+    int32_t hi = (int32_t) floor( center + support + 0.5 );
+    if ( lo < 0 ) lo = 0;
+    if ( hi > src_len ) hi = src_len;
+    if ( hi - lo > taps ) hi = lo + taps;
+
+    double wsum = 0.0;
+    for ( int32_t t = 0; t < hi - lo; t++ ) {
+      w[t] = filter_eval( filter, ( lo + t - center + 0.5 ) / filter_scale );
+      wsum += w[t];
+    }
+
+    int16_t *iw = axis->weights + (size_t) i * taps;
+    int32_t total = 0;
+    int32_t largest = 0;
+    for ( int32_t t = 0; t < hi - lo; t++ ) {
+      iw[t] = (int16_t) lround( wsum != 0.0 ? w[t] / wsum * ( 1 << RESIZE_WEIGHT_BITS ) : 0.0 );
+      total += iw[t];
+      if ( iw[t] > iw[largest] )
+        largest = t;
+    }
+
+    // fold the rounding error into the largest weight
+    iw[largest] += (int16_t) ( ( 1 << RESIZE_WEIGHT_BITS ) - total );
+    axis->start[i] = lo;
+  }
+
+  free( w );
+  return 1;
+}
+
+static void resize_axis_cleanup( struct ResizeAxis *axis ) {
+  free( axis->start );
+  free( axis->weights );
+  axis->start = NULL;
+  axis->weights = NULL;
+}
+
+// Prepare the coefficient tables for resizing src_w x src_h images to
+// dst_w x dst_h. The plan can be reused for any number of images with
+// those dimensions.
+//
+// Parameters:
+//   plan - pointer to the ResizePlan to initialize
+//   src_w, src_h - input image dimensions
+//   dst_w, dst_h - output image dimensions
+//   filter - resampling filter
+//
+// Returns:
+//   1 if successful, 0 if a dimension is not positive or memory
+//   could not be allocated
+int imgproc_resize_plan_init( struct ResizePlan *plan, int32_t src_w, int32_t src_h,
+                              int32_t dst_w, int32_t dst_h, enum ResizeFilter filter ) {
+  memset( plan, 0, sizeof( *plan ) );
+  if ( src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0 )
+    return 0;
+  plan->filter = filter;
+
+  // box downscaling by 2, 4 or 8 in both directions just averages
+  // blocks of pixels, and doesn't need any weights
+  for ( int32_t f = 2; f <= 8; f *= 2 )
+    if ( filter == RESIZE_BOX && src_w == dst_w * f && src_h == dst_h * f )
+      plan->box_factor = f;
+
+  if ( !resize_axis_init( &plan->h, src_w, dst_w, filter ) ||
+       !resize_axis_init( &plan->v, src_h, dst_h, filter ) ) {
+    imgproc_resize_plan_cleanup( plan );
+    return 0;
+  }
+  return 1;
+}
+
+// Free the coefficient tables of a ResizePlan.
+//
+// Parameters:
+//   plan - pointer to the ResizePlan to clean up
+void imgproc_resize_plan_cleanup( struct ResizePlan *plan ) {
+  resize_axis_cleanup( &plan->h );
+  resize_axis_cleanup( &plan->v );
+}
+
+// Widen one source row to int16 channel values, followed by `extra`
+// zero pixels so that taps past the end of the row read zeros
+static void widen_row( const uint32_t *src, int32_t width, int32_t extra, int16_t *dst ) {
+  const uint8_t *bytes = (const uint8_t *) src;
+  int32_t x = 0;
+
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  for ( ; x + 4 <= width; x += 4 ) {
+    __m128i px = _mm_loadu_si128( (const __m128i *) ( bytes + x * 4 ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x * 4 ), _mm_unpacklo_epi8( px, zero ) );
+    _mm_storeu_si128( (__m128i *) ( dst + x * 4 + 8 ), _mm_unpackhi_epi8( px, zero ) );
+  }
+#endif
+  for ( ; x < width; x++ )
+    for ( int c = 0; c < 4; c++ )
+      dst[x * 4 + c] = bytes[x * 4 + c];
+  memset( dst + width * 4, 0, (size_t) extra * 4 * sizeof( int16_t ) );
+}
+
+// Horizontal pass: resample one widened source row
+static void resample_row_h( const int16_t *padded, const struct ResizeAxis *axis, int16_t *dst ) {
+  const int32_t down = RESIZE_WEIGHT_BITS - RESIZE_FRAC_BITS;
+  for ( int32_t x = 0; x < axis->dst_len; x++ ) {
+    const int16_t *w = axis->weights + (size_t) x * axis->taps;
+    const int16_t *src = padded + (size_t) axis->start[x] * 4;
+
+#ifdef __SSE2__
+    // one load covers pixels t and t+1; interleaving their channels
+    // lets pmaddwd apply both weights at once
+    __m128i acc = _mm_setzero_si128();
+    for ( int32_t t = 0; t < axis->taps; t += 2 ) {
+      __m128i px = _mm_loadu_si128( (const __m128i *) ( src + t * 4 ) );
+      int32_t pair;
+      memcpy( &pair, w + t, sizeof( pair ) );
+      acc = _mm_add_epi32( acc, _mm_madd_epi16( _mm_unpacklo_epi16( px, _mm_srli_si128( px, 8 ) ),
+                                                _mm_set1_epi32( pair ) ) );
+    }
+    acc = _mm_srai_epi32( _mm_add_epi32( acc, _mm_set1_epi32( 1 << ( down - 1 ) ) ), down );
+    _mm_storel_epi64( (__m128i *) ( dst + x * 4 ), _mm_packs_epi32( acc, acc ) );
+#else
+    for ( int c = 0; c < 4; c++ ) {
+      int32_t sum = 0;
+      for ( int32_t t = 0; t < axis->taps; t++ )
+        sum += w[t] * src[t * 4 + c];
+      dst[x * 4 + c] = (int16_t) clamp_i32( ( sum + ( 1 << ( down - 1 ) ) ) >> down, INT16_MIN, INT16_MAX );
+    }
+#endif
+  }
+}
+
+// Vertical pass: combine the taps rows of one output row's window
+// and convert the result back to pixels
+static void resample_rows_v( const int16_t **rows, const int16_t *w, int32_t taps, int32_t len, uint32_t *dst ) {
+  const int32_t down = RESIZE_WEIGHT_BITS + RESIZE_FRAC_BITS;
+  uint8_t *bytes = (uint8_t *) dst;
+  int32_t i = 0;
+
+#ifdef __SSE2__
+  __m128i half = _mm_set1_epi32( 1 << ( down - 1 ) );
+  for ( ; i + 8 <= len; i += 8 ) {
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+    for ( int32_t t = 0; t < taps; t += 2 ) {
+      __m128i a = _mm_loadu_si128( (const __m128i *) ( rows[t] + i ) );
+      __m128i b = _mm_loadu_si128( (const __m128i *) ( rows[t + 1] + i ) );
+      int32_t pair;
+      memcpy( &pair, w + t, sizeof( pair ) );
+      __m128i wp = _mm_set1_epi32( pair );
+      acc_lo = _mm_add_epi32( acc_lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), wp ) );
+      acc_hi = _mm_add_epi32( acc_hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), wp ) );
+    }
+    acc_lo = _mm_srai_epi32( _mm_add_epi32( acc_lo, half ), down );
+    acc_hi = _mm_srai_epi32( _mm_add_epi32( acc_hi, half ), down );
+    __m128i packed = _mm_packs_epi32( acc_lo, acc_hi );
+    _mm_storel_epi64( (__m128i *) ( bytes + i ), _mm_packus_epi16( packed, packed ) );
+  }
+#endif
+  for ( ; i < len; i++ ) {
+    int32_t sum = 0;
+    for ( int32_t t = 0; t < taps; t++ )
+      sum += w[t] * rows[t][i];
+    bytes[i] = (uint8_t) clamp_i32( ( sum + ( 1 << ( down - 1 ) ) ) >> down, 0, 255 );
+  }
+}
+
+static int16_t *resize_ring_row( struct ResizeRows *rr, int32_t row ) {
+  return rr->ring + (size_t) ( row % rr->plan->v.taps ) * rr->row_len;
+}
+
+// Resample output rows [row_begin, row_end) with the separable filter
+static int resize_band_general( struct ResizeJob *job, int32_t row_begin, int32_t row_end ) {
+  const struct ResizePlan *plan = job->plan;
+  const struct Image *in = job->input_img;
+  struct Image *out = job->output_img;
+  int32_t taps = plan->v.taps;
+
+  struct ResizeRows rr;
+  rr.plan = plan;
+  rr.img = in;
+  rr.row_len = out->width * 4;
+  rr.padded = (int16_t *) malloc( (size_t) ( in->width + plan->h.taps ) * 4 * sizeof( int16_t ) );
+  rr.ring = (int16_t *) malloc( (size_t) taps * rr.row_len * sizeof( int16_t ) );
+  const int16_t **window = (const int16_t **) malloc( (size_t) taps * sizeof( *window ) );
+  if ( rr.padded == NULL || rr.ring == NULL || window == NULL ) {
+    free( rr.padded );
+    free( rr.ring );
+    free( window );
+    return 0;
+  }
+  rr.next_row = plan->v.start[row_begin];
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    int32_t start = plan->v.start[y];
+    if ( rr.next_row < start )
+      rr.next_row = start;
+
+    // resample the source rows entering the window; rows past the
+    // bottom edge only ever get zero weights
+    for ( ; rr.next_row < start + taps; rr.next_row++ ) {
+      int32_t src_row = rr.next_row < in->height ? rr.next_row : in->height - 1;
+      widen_row( in->data + (size_t) src_row * in->width, in->width, plan->h.taps, rr.padded );
+      resample_row_h( rr.padded, &plan->h, resize_ring_row( &rr, rr.next_row ) );
+    }
+
+    for ( int32_t t = 0; t < taps; t++ )
+      window[t] = resize_ring_row( &rr, start + t );
+    resample_rows_v( window, plan->v.weights + (size_t) y * taps, taps, rr.row_len,
+                     out->data + (size_t) y * out->width );
+  }
+
+  free( window );
+  free( rr.padded );
+  free( rr.ring );
+  return 1;
+}
+
+// Average f x f blocks for output rows [row_begin, row_end)
+static void resize_band_box( struct ResizeJob *job, int32_t row_begin, int32_t row_end ) {
+  const struct Image *in = job->input_img;
+  struct Image *out = job->output_img;
+  int32_t f = job->plan->box_factor;
+  int32_t shift = f == 2 ? 2 : ( f == 4 ? 4 : 6 );   // log2(f * f)
+
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    uint8_t *dst = (uint8_t *) ( out->data + (size_t) y * out->width );
+    for ( int32_t x = 0; x < out->width; x++ ) {
+      const uint8_t *block = (const uint8_t *) ( in->data + (size_t) y * f * in->width + (size_t) x * f );
+
+#ifdef __SSE2__
+      // 16-bit lanes hold the channel sums of two pixel columns,
+      // which can't exceed 8 * 4 * 255 before they are folded
+      __m128i zero = _mm_setzero_si128();
+      __m128i acc = _mm_setzero_si128();
+      for ( int32_t r = 0; r < f; r++ ) {
+        const uint8_t *row = block + (size_t) r * in->width * 4;
+        if ( f == 2 ) {
+          acc = _mm_add_epi16( acc, _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) row ), zero ) );
+        } else {
+          for ( int32_t c = 0; c < f; c += 4 ) {
+            __m128i px = _mm_loadu_si128( (const __m128i *) ( row + c * 4 ) );
+            acc = _mm_add_epi16( acc, _mm_unpacklo_epi8( px, zero ) );
+            acc = _mm_add_epi16( acc, _mm_unpackhi_epi8( px, zero ) );
+          }
+        }
+      }
+      __m128i sum = _mm_unpacklo_epi16( _mm_add_epi16( acc, _mm_srli_si128( acc, 8 ) ), zero );
+      sum = _mm_srli_epi32( _mm_add_epi32( sum, _mm_set1_epi32( 1 << ( shift - 1 ) ) ), shift );
+      sum = _mm_packs_epi32( sum, sum );
+      uint32_t px = (uint32_t) _mm_cvtsi128_si32( _mm_packus_epi16( sum, sum ) );
+      memcpy( dst + x * 4, &px, sizeof( px ) );
+#else
+      for ( int c = 0; c < 4; c++ ) {
+        uint32_t sum = 0;
+        for ( int32_t r = 0; r < f; r++ )
+          for ( int32_t i = 0; i < f; i++ )
+            sum += block[( (size_t) r * in->width + i ) * 4 + c];
+        dst[x * 4 + c] = (uint8_t) ( ( sum + ( 1u << ( shift - 1 ) ) ) >> shift );
+      }
+#endif
+    }
+  }
+}
+
+static void resize_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct ResizeJob *job = (struct ResizeJob *) arg;
+  if ( job->plan->box_factor != 0 ) {
+    resize_band_box( job, row_begin, row_end );
+  } else if ( !resize_band_general( job, row_begin, row_end ) ) {
+    __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+  }
+}
+
+// Resize input_img into output_img using a precomputed plan. The
+// input is resampled horizontally, then vertically, in bands of output
+// rows processed in parallel.
+//
+// Parameters:
+//   plan - plan created for the dimensions of input_img and output_img
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//
+// Returns:
+//   1 if successful, 0 if the image dimensions don't match the plan
+//   or memory could not be allocated
+int imgproc_resize_apply( const struct ResizePlan *plan, struct Image *input_img, struct Image *output_img ) {
+  if ( input_img->width != plan->h.src_len || input_img->height != plan->v.src_len ||
+       output_img->width != plan->h.dst_len || output_img->height != plan->v.dst_len )
+    return 0;
+  struct ResizeJob job = { plan, input_img, output_img, 0 };
+  imgproc_parallel_rows( output_img->height, resize_band, &job );
+  return !job.failed;
+}
+
+// Resize input_img to the dimensions of output_img.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image (whose width and height
+//                determine the size of the resized image)
+//   filter - resampling filter
+//
+// Returns:
+//   1 if successful, 0 otherwise
+int imgproc_resize( struct Image *input_img, struct Image *output_img, enum ResizeFilter filter ) {
+  struct ResizePlan plan;
+  if ( !imgproc_resize_plan_init( &plan, input_img->width, input_img->height,
+                                  output_img->width, output_img->height, filter ) )
+    return 0;
+  int success = imgproc_resize_apply( &plan, input_img, output_img );
+  imgproc_resize_plan_cleanup( &plan );
+  return success;
+}
@@ -0,0 +1,212 @@
+// Per-channel histograms and statistics of images, and the auto-levels
+// (contrast stretch) transformation built on them
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "imgproc.h"
+
+// Number of interleaved sub-histograms per band. Consecutive pixels
+// usually have equal values, and counting them into the same counters
+// would serialize the increments on store-to-load forwarding.
+#define NUM_SUB_HISTOGRAMS 4
+
+// Sub-histogram counters are 32-bit, so bands flush them into the
+// 64-bit counts at least this often (in pixels)
+#define FLUSH_PIXELS ( 1U << 30 )
+
+struct HistogramJob {
+  struct Image *img;
+  struct ImageHistogram *hist;
+  pthread_mutex_t lock;
+};
+
+struct LevelsJob {
+  struct Image *input_img;
+  struct Image *output_img;
+  uint8_t lut[NUM_CHANNELS][256];
+};
+
+static void flush_counts( uint64_t counts[NUM_CHANNELS][256],
+                          uint32_t sub[NUM_SUB_HISTOGRAMS][NUM_CHANNELS][256] ) {
+  for ( int k = 0; k < NUM_SUB_HISTOGRAMS; k++ )
+    for ( int c = 0; c < NUM_CHANNELS; c++ )
+      for ( int v = 0; v < 256; v++ )
+        counts[c][v] += sub[k][c][v];
+  memset( sub, 0, sizeof( uint32_t ) * NUM_SUB_HISTOGRAMS * NUM_CHANNELS * 256 );
+}
+
+// Count a band of rows into a private histogram, then merge it into
+// the shared one
+static void histogram_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct HistogramJob *job = (struct HistogramJob *) arg;
+  int32_t w = job->img->width;
+  uint32_t sub[NUM_SUB_HISTOGRAMS][NUM_CHANNELS][256];
+  uint64_t counts[NUM_CHANNELS][256];
+  memset( sub, 0, sizeof( sub ) );
+  memset( counts, 0, sizeof( counts ) );
+
+  uint64_t pending = 0;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *row = job->img->data + (size_t) y * w;
+    int32_t x = 0;
+    for ( ; x + NUM_SUB_HISTOGRAMS <= w; x += NUM_SUB_HISTOGRAMS ) {
+      for ( int k = 0; k < NUM_SUB_HISTOGRAMS; k++ ) {
+        uint32_t p = row[x + k];
+        sub[k][CHANNEL_R][p >> 24]++;
+        sub[k][CHANNEL_G][( p >> 16 ) & 0xFF]++;
+        sub[k][CHANNEL_B][( p >> 8 ) & 0xFF]++;
+        sub[k][CHANNEL_A][p & 0xFF]++;
+      }
+    }
+    for ( ; x < w; x++ ) {
+      uint32_t p = row[x];
+      sub[0][CHANNEL_R][p >> 24]++;
+      sub[0][CHANNEL_G][( p >> 16 ) & 0xFF]++;
+      sub[0][CHANNEL_B][( p >> 8 ) & 0xFF]++;
+      sub[0][CHANNEL_A][p & 0xFF]++;
+    }
+    pending += (uint64_t) w;
+    if ( pending >= FLUSH_PIXELS ) {
+      flush_counts( counts, sub );
+      pending = 0;
+    }
+  }
+  flush_counts( counts, sub );
+
+  pthread_mutex_lock( &job->lock );
+  for ( int c = 0; c < NUM_CHANNELS; c++ )
+    for ( int v = 0; v < 256; v++ )
+      job->hist->counts[c][v] += counts[c][v];
+  pthread_mutex_unlock( &job->lock );
+}
+
+// Compute the histogram of every channel of an image. Bands of rows
+// are counted in parallel into private histograms, which are merged at
+// the end.
+//
+// Parameters:
+//   img - pointer to the Image
+//   hist - pointer to the ImageHistogram to fill in
+void imgproc_histogram( struct Image *img, struct ImageHistogram *hist ) {
+  memset( hist, 0, sizeof( *hist ) );
+  hist->num_pixels = (uint64_t) img->width * img->height;
+  struct HistogramJob job;
+  job.img = img;
+  job.hist = hist;
+  pthread_mutex_init( &job.lock, NULL );
+  imgproc_parallel_rows( img->height, histogram_band, &job );
+  pthread_mutex_destroy( &job.lock );
+}
+
+// Find a percentile of one channel of a histogram.
+//
+// Parameters:
+//   hist - pointer to the ImageHistogram
+//   channel - the channel
+//   percent - the percentile, from 0 to 100
+//
+// Returns:
+//   the smallest value such that at least percent% of the pixels have
+//   a value less than or equal to it (0 for an empty image)
+uint8_t imgproc_histogram_percentile( const struct ImageHistogram *hist, enum Channel channel,
+                                      double percent ) {
+  if ( percent < 0.0 ) percent = 0.0;
+  if ( percent > 100.0 ) percent = 100.0;
+  double target = hist->num_pixels * percent / 100.0;
+  uint64_t seen = 0;
+  for ( int v = 0; v < 256; v++ ) {
+    seen += hist->counts[channel][v];
+    if ( seen > 0 && (double) seen >= target )
+      return (uint8_t) v;
+  }
+  return 0;
+}
+
+// Compute the minimum, maximum, mean and median of every channel from
+// a histogram.
+//
+// Parameters:
+//   hist - pointer to the ImageHistogram
+//   stats - pointer to the ImageStats to fill in
+void imgproc_histogram_stats( const struct ImageHistogram *hist, struct ImageStats *stats ) {
+  memset( stats, 0, sizeof( *stats ) );
+  stats->num_pixels = hist->num_pixels;
+  for ( int c = 0; c < NUM_CHANNELS; c++ ) {
+    uint64_t sum = 0;
+    int min = -1, max = 0;
+    for ( int v = 0; v < 256; v++ ) {
+      uint64_t n = hist->counts[c][v];
+      if ( n == 0 )
+        continue;
+      if ( min < 0 )
+        min = v;
+      max = v;
+      sum += n * v;
+    }
+    stats->min[c] = (uint8_t) ( min < 0 ? 0 : min );
+    stats->max[c] = (uint8_t) max;
+    stats->mean[c] = hist->num_pixels > 0 ? (double) sum / hist->num_pixels : 0.0;
+    stats->median[c] = imgproc_histogram_percentile( hist, (enum Channel) c, 50.0 );
+  }
+}
+
+static void levels_band( void *arg, int32_t row_begin, int32_t row_end ) {
+  struct LevelsJob *job = (struct LevelsJob *) arg;
+  int32_t w = job->input_img->width;
+  for ( int32_t y = row_begin; y < row_end; y++ ) {
+    const uint32_t *src = job->input_img->data + (size_t) y * w;
+    uint32_t *dst = job->output_img->data + (size_t) y * w;
+    for ( int32_t x = 0; x < w; x++ ) {
+      uint32_t p = src[x];
+      dst[x] = ( (uint32_t) job->lut[CHANNEL_R][p >> 24] << 24 )
+        | ( (uint32_t) job->lut[CHANNEL_G][( p >> 16 ) & 0xFF] << 16 )
+        | ( (uint32_t) job->lut[CHANNEL_B][( p >> 8 ) & 0xFF] << 8 )
+        | ( p & 0xFF );
+    }
+  }
+}
+
+// Stretch the contrast of every color channel so that its low and high
+// percentiles map to 0 and 255. Each channel is stretched separately,
+// which also corrects color casts. Alpha values are copied from the
+// input. The input and output may be the same image.
+//
+// Parameters:
+//   input_img  - pointer to the input Image
+//   output_img - pointer to the output Image
+//   clip_percent - percentage of pixels clipped to 0 and to 255 in
+//                  each channel (0 stretches the min/max range)
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or clip_percent
+//   is not in [0, 50)
+int imgproc_autolevels( struct Image *input_img, struct Image *output_img, double clip_percent ) {
+  if ( input_img->width != output_img->width || input_img->height != output_img->height )
+    return 0;
+  if ( !( clip_percent >= 0.0 && clip_percent < 50.0 ) )
+    return 0;
+
+  struct ImageHistogram hist;
+  imgproc_histogram( input_img, &hist );
+
+  struct LevelsJob job;
+  job.input_img = input_img;
+  job.output_img = output_img;
+  for ( int c = 0; c < NUM_CHANNELS; c++ ) {
+    int low = imgproc_histogram_percentile( &hist, (enum Channel) c, clip_percent );
+    int high = imgproc_histogram_percentile( &hist, (enum Channel) c, 100.0 - clip_percent );
+    for ( int v = 0; v < 256; v++ ) {
+      if ( c == CHANNEL_A || high <= low )
+        job.lut[c][v] = (uint8_t) v;
+      else if ( v <= low )
+        job.lut[c][v] = 0;
+      else if ( v >= high )
+        job.lut[c][v] = 255;
+      else
+        job.lut[c][v] = (uint8_t) ( ( ( v - low ) * 255 + ( high - low ) / 2 ) / ( high - low ) );
+    }
+  }
+  imgproc_parallel_rows( input_img->height, levels_band, &job );
+  return 1;
+}
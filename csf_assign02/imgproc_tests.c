@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "tctest.h"
 #include "imgproc.h"
 
@@ -110,6 +112,9 @@ void test_with_png( const char *input_name,
                     int output_hscale,
                     int(*imgproc)(struct Image*, struct Image*) );
 int exec_valgrind(const char *cmd);
+struct Image *random_img( int32_t width, int32_t height, uint32_t seed );
+struct Image *solid_img( int32_t width, int32_t height, uint32_t color );
+uint32_t composite_pixel( uint32_t input, uint32_t overlay, enum BlendMode mode );
 
 // Test functions
 void test_rgb_basic( TestObjs *objs );
@@ -122,6 +127,35 @@ void test_grayscale( TestObjs *objs );
 void test_fade( TestObjs *objs );
 void test_kaleidoscope( TestObjs *objs );
 void test_memory_leak( TestObjs *objs );
+void test_raw_roundtrip( TestObjs *objs );
+void test_raw_in_place( TestObjs *objs );
+void test_io_stats( TestObjs *objs );
+void test_out_of_core( TestObjs *objs );
+void test_read_memory( TestObjs *objs );
+void test_prefetch( TestObjs *objs );
+void test_blur_solid( TestObjs *objs );
+void test_convolve_reference( TestObjs *objs );
+void test_convolve_threads( TestObjs *objs );
+void test_sobel( TestObjs *objs );
+void test_resize_solid( TestObjs *objs );
+void test_resize_box_fast_path( TestObjs *objs );
+void test_resize_identity( TestObjs *objs );
+void test_resize_plan_reuse( TestObjs *objs );
+void test_planar_roundtrip( TestObjs *objs );
+void test_planar_transforms( TestObjs *objs );
+void test_tile_store( TestObjs *objs );
+void test_tiled_transforms( TestObjs *objs );
+void test_color_tables( TestObjs *objs );
+void test_linear_transforms( TestObjs *objs );
+void test_histogram( TestObjs *objs );
+void test_autolevels( TestObjs *objs );
+void test_rotations( TestObjs *objs );
+void test_affine( TestObjs *objs );
+void test_composite_modes( TestObjs *objs );
+void test_composite_overlay( TestObjs *objs );
+void test_image_hashes( TestObjs *objs );
+void test_ssim_psnr( TestObjs *objs );
+void test_hash_index( TestObjs *objs );
 
 // Test helper functions
 void test_get_r( TestObjs *objs );
@@ -154,6 +188,35 @@ int main( int argc, char **argv ) {
   TEST( test_fade );
   TEST( test_kaleidoscope );
   // TEST( test_memory_leak );
+  TEST( test_raw_roundtrip );
+  TEST( test_raw_in_place );
+  TEST( test_io_stats );
+  TEST( test_out_of_core );
+  TEST( test_read_memory );
+  TEST( test_prefetch );
+  TEST( test_blur_solid );
+  TEST( test_convolve_reference );
+  TEST( test_convolve_threads );
+  TEST( test_sobel );
+  TEST( test_resize_solid );
+  TEST( test_resize_box_fast_path );
+  TEST( test_resize_identity );
+  TEST( test_resize_plan_reuse );
+  TEST( test_planar_roundtrip );
+  TEST( test_planar_transforms );
+  TEST( test_tile_store );
+  TEST( test_tiled_transforms );
+  TEST( test_color_tables );
+  TEST( test_linear_transforms );
+  TEST( test_histogram );
+  TEST( test_autolevels );
+  TEST( test_rotations );
+  TEST( test_affine );
+  TEST( test_composite_modes );
+  TEST( test_composite_overlay );
+  TEST( test_image_hashes );
+  TEST( test_ssim_psnr );
+  TEST( test_hash_index );
   
   TEST( test_get_r );
   TEST( test_get_g );
@@ -333,6 +396,30 @@ int exec_valgrind(const char *cmd) {
   return ret;
 }
 
+// Create an image filled with pseudo-random pixels
+struct Image *random_img( int32_t width, int32_t height, uint32_t seed ) {
+  struct Image *img = (struct Image *) malloc( sizeof( struct Image ) );
+  img_init( img, width, height );
+  uint32_t x = seed | 1;
+  for ( int32_t i = 0; i < width * height; i++ ) {
+    // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    img->data[i] = x;
+  }
+  return img;
+}
+
+// Create an image in which every pixel has the same color
+struct Image *solid_img( int32_t width, int32_t height, uint32_t color ) {
+  struct Image *img = (struct Image *) malloc( sizeof( struct Image ) );
+  img_init( img, width, height );
+  for ( int32_t i = 0; i < width * height; i++ )
+    img->data[i] = color;
+  return img;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Test functions
 ////////////////////////////////////////////////////////////////////////
@@ -586,6 +673,1085 @@ void test_memory_leak( TestObjs *objs ) {
   ASSERT( 0 == exec_valgrind("./asm_imgproc kaleidoscope ./input/ingo.png ./output/ingo_kaleidoscope.png") );
 }
 
+void test_raw_roundtrip( TestObjs *objs ) {
+  ASSERT( img_is_raw_filename( "./output/smiley.rgba" ) );
+  ASSERT( !img_is_raw_filename( "./output/smiley.png" ) );
+
+  // malloc'ed image written as raw and read back as a private mapping
+  ASSERT( IMG_SUCCESS == img_write( "./output/smiley.rgba", objs->smiley ) );
+  struct Image *mapped = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_read( "./output/smiley.rgba", mapped ) );
+  ASSERT( mapped->map_size != 0 );
+  ASSERT( images_equal( objs->smiley, mapped ) );
+
+  // transform directly into a newly created shared mapping
+  struct Image *out = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_create_raw( "./output/smiley_grayscale.rgba", out, mapped->width, mapped->height ) );
+  imgproc_grayscale( mapped, out );
+  ASSERT( IMG_SUCCESS == img_sync( out ) );
+  destroy_img( out );
+
+  imgproc_grayscale( objs->smiley, objs->smiley_out );
+  struct Image *reread = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_read( "./output/smiley_grayscale.rgba", reread ) );
+  ASSERT( images_equal( objs->smiley_out, reread ) );
+
+  destroy_img( mapped );
+  destroy_img( reread );
+}
+
+void test_raw_in_place( TestObjs *objs ) {
+  ASSERT( IMG_SUCCESS == img_write( "./output/smiley_in_place.rgba", objs->smiley ) );
+
+  // a shared mapping transformed into itself updates the file
+  struct Image *shared = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_map_raw( "./output/smiley_in_place.rgba", shared, 1 ) );
+  imgproc_fade( shared, shared );
+  destroy_img( shared );
+
+  // a private mapping does not
+  struct Image *priv = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_map_raw( "./output/smiley_in_place.rgba", priv, 0 ) );
+  imgproc_grayscale( priv, priv );
+  destroy_img( priv );
+
+  imgproc_fade( objs->smiley, objs->smiley_out );
+  struct Image *reread = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_read( "./output/smiley_in_place.rgba", reread ) );
+  ASSERT( images_equal( objs->smiley_out, reread ) );
+  destroy_img( reread );
+}
+
+void test_io_stats( TestObjs *objs ) {
+  struct ImgIoStats before, after;
+  uint64_t pixel_bytes = (uint64_t) objs->smiley->width * objs->smiley->height * 4;
+
+  // reading a PNG file inflates its pixel data
+  img_get_io_stats( &before );
+  struct Image *png = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_read( "./input/ingo.png", png ) );
+  img_get_io_stats( &after );
+  ASSERT( after.bytes_read - before.bytes_read > 0 );
+  ASSERT( after.bytes_inflated - before.bytes_inflated >= (uint64_t) png->width * png->height * 3 );
+  ASSERT( after.bytes_deflated == before.bytes_deflated );
+  destroy_img( png );
+
+  // raw files are neither inflated nor deflated
+  img_get_io_stats( &before );
+  ASSERT( IMG_SUCCESS == img_write( "./output/smiley_stats.rgba", objs->smiley ) );
+  struct Image *raw = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_read( "./output/smiley_stats.rgba", raw ) );
+  img_get_io_stats( &after );
+  ASSERT( after.bytes_inflated == before.bytes_inflated );
+  ASSERT( after.bytes_deflated == before.bytes_deflated );
+  ASSERT( after.bytes_written - before.bytes_written == 64 + pixel_bytes );
+  ASSERT( after.bytes_read - before.bytes_read == 64 + pixel_bytes );
+  destroy_img( raw );
+}
+
+void test_out_of_core( TestObjs *objs ) {
+  // with a tiny threshold every image is created in a scratch file
+  img_set_out_of_core_threshold( 1 );
+  struct Image *scratch = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_init( scratch, objs->smiley->width, objs->smiley->height ) );
+  img_set_out_of_core_threshold( IMG_OUT_OF_CORE_DEFAULT_THRESHOLD );
+  ASSERT( scratch->map_size != 0 );
+  ASSERT( scratch->data[0] == 0x000000FFU );
+
+  imgproc_grayscale( objs->smiley, scratch );
+  imgproc_grayscale( objs->smiley, objs->smiley_out );
+  ASSERT( images_equal( objs->smiley_out, scratch ) );
+  destroy_img( scratch );
+
+  // below the threshold images stay on the heap
+  struct Image *heap = (struct Image *) malloc( sizeof( struct Image ) );
+  ASSERT( IMG_SUCCESS == img_init( heap, 4, 4 ) );
+  ASSERT( heap->map_size == 0 );
+  destroy_img( heap );
+}
+
+void test_read_memory( TestObjs *objs ) {
+  (void) objs;
+  FILE *fp = fopen( "./input/ingo.png", "rb" );
+  ASSERT( fp != NULL );
+  fseek( fp, 0, SEEK_END );
+  long size = ftell( fp );
+  fseek( fp, 0, SEEK_SET );
+  unsigned char *data = (unsigned char *) malloc( size );
+  ASSERT( fread( data, 1, size, fp ) == (size_t) size );
+  fclose( fp );
+
+  struct Image from_file, from_memory;
+  ASSERT( IMG_SUCCESS == img_read( "./input/ingo.png", &from_file ) );
+  ASSERT( IMG_SUCCESS == img_read_memory( data, size, &from_memory ) );
+  ASSERT( images_equal( &from_file, &from_memory ) );
+  img_cleanup( &from_memory );
+
+  // truncated and corrupt data
+  ASSERT( IMG_SUCCESS != img_read_memory( data, 20, &from_memory ) );
+  data[0] = 'x';
+  ASSERT( IMG_ERR_COULD_NOT_OPEN == img_read_memory( data, size, &from_memory ) );
+  img_cleanup( &from_file );
+  free( data );
+}
+
+void test_prefetch( TestObjs *objs ) {
+  (void) objs;
+  const char *files[] = {
+    "./input/ingo.png", "./input/kittens.png", "./input/no_such_file.png",
+    "./input/ingo.png", "./input/landscape.png",
+  };
+  int depths[] = { 1, 2, 8 };
+  for ( int d = 0; d < 3; d++ ) {
+    struct ImgPrefetcher *pf = img_prefetch_start( files, 5, depths[d], 2 );
+    ASSERT( pf != NULL );
+    for ( int i = 0; i < 5; i++ ) {
+      void *data = NULL;
+      size_t size = 0;
+      int rc = img_prefetch_take( pf, i, &data, &size );
+      if ( i == 2 ) {
+        ASSERT( rc == IMG_ERR_COULD_NOT_OPEN && data == NULL );
+        continue;
+      }
+      ASSERT( rc == IMG_SUCCESS );
+      struct Image expected, actual;
+      ASSERT( IMG_SUCCESS == img_read( files[i], &expected ) );
+      ASSERT( IMG_SUCCESS == img_read_memory( data, size, &actual ) );
+      ASSERT( images_equal( &expected, &actual ) );
+      img_cleanup( &expected );
+      img_cleanup( &actual );
+      free( data );
+    }
+    img_prefetch_stop( pf );
+  }
+
+  // stopping with files not taken frees them
+  struct ImgPrefetcher *pf = img_prefetch_start( files, 5, 3, 1 );
+  ASSERT( pf != NULL );
+  img_prefetch_stop( pf );
+  ASSERT( img_prefetch_start( files, 5, 0, 1 ) == NULL );
+}
+
+void test_blur_solid( TestObjs *objs ) {
+  struct Image *in = solid_img( 21, 19, 0x336699C0 );
+  struct Image *out = solid_img( 21, 19, 0 );
+
+  ASSERT( imgproc_box_blur( in, out, 3 ) );
+  ASSERT( images_equal( in, out ) );
+  ASSERT( imgproc_gaussian_blur( in, out, 2.0 ) );
+  ASSERT( images_equal( in, out ) );
+  ASSERT( imgproc_unsharp_mask( in, out, 1.0, 150 ) );
+  ASSERT( images_equal( in, out ) );
+
+  // invalid parameters and in-place filtering are rejected
+  ASSERT( !imgproc_box_blur( in, out, IMGPROC_KERNEL_MAX_RADIUS + 1 ) );
+  ASSERT( !imgproc_gaussian_blur( in, out, 0.0 ) );
+  ASSERT( !imgproc_box_blur( in, in, 1 ) );
+
+  destroy_img( in );
+  destroy_img( out );
+}
+
+// Compute one channel of a separable convolution directly, using the
+// same fixed-point rounding as the engine
+uint32_t reference_convolve( struct Image *img, const struct Kernel *k, int32_t col, int32_t row,
+                             uint32_t (*get)( uint32_t ) ) {
+  int64_t vsum = 0;
+  for ( int32_t i = -k->radius; i <= k->radius; i++ ) {
+    int32_t y = row + i < 0 ? 0 : ( row + i >= img->height ? img->height - 1 : row + i );
+    int32_t hsum = 0;
+    for ( int32_t j = -k->radius; j <= k->radius; j++ ) {
+      int32_t x = col + j < 0 ? 0 : ( col + j >= img->width ? img->width - 1 : col + j );
+      hsum += k->taps[j + k->radius] * (int32_t) get( img->data[y * img->width + x] );
+    }
+    int32_t h = ( hsum + ( 1 << ( k->shift - 5 ) ) ) >> ( k->shift - 4 );
+    vsum += k->taps[i + k->radius] * h;
+  }
+  int32_t v = (int32_t) ( ( vsum + ( 1 << ( k->shift - 1 ) ) ) >> k->shift );
+  v = ( v + 8 ) >> 4;
+  return v < 0 ? 0 : ( v > 255 ? 255 : (uint32_t) v );
+}
+
+void test_convolve_reference( TestObjs *objs ) {
+  struct Image *in = random_img( 37, 23, 12345 );
+  struct Image *out = solid_img( 37, 23, 0 );
+  struct Kernel k;
+
+  ASSERT( imgproc_kernel_gaussian( &k, 1.5 ) );
+  ASSERT( k.radius == 5 );
+  ASSERT( !imgproc_kernel_gaussian( &k, 1e10 ) );
+  ASSERT( !imgproc_kernel_gaussian( &k, INFINITY ) );
+  ASSERT( !imgproc_kernel_gaussian( &k, NAN ) );
+  int32_t sum = 0;
+  for ( int32_t i = 0; i < 2 * k.radius + 1; i++ )
+    sum += k.taps[i];
+  ASSERT( sum == 1 << k.shift );
+
+  ASSERT( imgproc_convolve( in, out, &k, &k ) );
+  for ( int32_t row = 0; row < in->height; row++ )
+    for ( int32_t col = 0; col < in->width; col++ ) {
+      uint32_t expected = make_pixel( reference_convolve( in, &k, col, row, get_r ),
+                                      reference_convolve( in, &k, col, row, get_g ),
+                                      reference_convolve( in, &k, col, row, get_b ),
+                                      reference_convolve( in, &k, col, row, get_a ) );
+      ASSERT( out->data[row * out->width + col] == expected );
+    }
+
+  destroy_img( in );
+  destroy_img( out );
+}
+
+void test_convolve_threads( TestObjs *objs ) {
+  struct Image *in = random_img( 67, 203, 777 );
+  struct Image *single = solid_img( 67, 203, 0 );
+  struct Image *multi = solid_img( 67, 203, 0 );
+
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_gaussian_blur( in, single, 3.0 ) );
+  imgproc_set_num_threads( 4 );
+  ASSERT( imgproc_gaussian_blur( in, multi, 3.0 ) );
+  ASSERT( images_equal( single, multi ) );
+
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_sobel( in, single ) );
+  imgproc_set_num_threads( 4 );
+  ASSERT( imgproc_sobel( in, multi ) );
+  ASSERT( images_equal( single, multi ) );
+
+  imgproc_set_num_threads( 0 );
+  destroy_img( in );
+  destroy_img( single );
+  destroy_img( multi );
+}
+
+void test_sobel( TestObjs *objs ) {
+  // no edges in a solid image
+  struct Image *in = solid_img( 8, 8, 0x808080A0 );
+  struct Image *out = solid_img( 8, 8, 0 );
+  ASSERT( imgproc_sobel( in, out ) );
+  for ( int32_t i = 0; i < 64; i++ )
+    ASSERT( out->data[i] == 0x000000A0 );
+
+  // a vertical white/black edge between columns 3 and 4
+  for ( int32_t i = 0; i < 64; i++ )
+    in->data[i] = ( i % 8 ) < 4 ? 0xFFFFFFFF : 0x000000FF;
+  ASSERT( imgproc_sobel( in, out ) );
+  for ( int32_t row = 0; row < 8; row++ ) {
+    ASSERT( out->data[row * 8 + 0] == 0x000000FF );
+    ASSERT( out->data[row * 8 + 3] == 0xFFFFFFFF );
+    ASSERT( out->data[row * 8 + 4] == 0xFFFFFFFF );
+    ASSERT( out->data[row * 8 + 7] == 0x000000FF );
+  }
+
+  destroy_img( in );
+  destroy_img( out );
+}
+
+void test_resize_solid( TestObjs *objs ) {
+  enum ResizeFilter filters[] = { RESIZE_BOX, RESIZE_BILINEAR, RESIZE_BICUBIC, RESIZE_LANCZOS3 };
+  struct Image *in = solid_img( 45, 31, 0x20C0FF80 );
+
+  for ( int i = 0; i < 4; i++ ) {
+    struct Image *down = solid_img( 13, 7, 0 );
+    struct Image *up = solid_img( 101, 64, 0 );
+    struct Image *down_expected = solid_img( 13, 7, 0x20C0FF80 );
+    struct Image *up_expected = solid_img( 101, 64, 0x20C0FF80 );
+
+    ASSERT( imgproc_resize( in, down, filters[i] ) );
+    ASSERT( images_equal( down, down_expected ) );
+    ASSERT( imgproc_resize( in, up, filters[i] ) );
+    ASSERT( images_equal( up, up_expected ) );
+
+    destroy_img( down );
+    destroy_img( up );
+    destroy_img( down_expected );
+    destroy_img( up_expected );
+  }
+
+  destroy_img( in );
+}
+
+void test_resize_box_fast_path( TestObjs *objs ) {
+  struct Image *in = random_img( 64, 48, 4242 );
+
+  for ( int32_t f = 2; f <= 8; f *= 2 ) {
+    struct ResizePlan plan;
+    ASSERT( imgproc_resize_plan_init( &plan, 64, 48, 64 / f, 48 / f, RESIZE_BOX ) );
+    ASSERT( plan.box_factor == f );
+
+    struct Image *out = solid_img( 64 / f, 48 / f, 0 );
+    ASSERT( imgproc_resize_apply( &plan, in, out ) );
+
+    // every output pixel is the rounded average of an f x f block
+    for ( int32_t row = 0; row < out->height; row++ )
+      for ( int32_t col = 0; col < out->width; col++ ) {
+        uint32_t sum[4] = { 0, 0, 0, 0 };
+        for ( int32_t i = 0; i < f; i++ )
+          for ( int32_t j = 0; j < f; j++ ) {
+            uint32_t px = in->data[( row * f + i ) * in->width + col * f + j];
+            sum[0] += get_r( px );
+            sum[1] += get_g( px );
+            sum[2] += get_b( px );
+            sum[3] += get_a( px );
+          }
+        uint32_t n = f * f;
+        uint32_t expected = make_pixel( ( sum[0] + n / 2 ) / n, ( sum[1] + n / 2 ) / n,
+                                        ( sum[2] + n / 2 ) / n, ( sum[3] + n / 2 ) / n );
+        ASSERT( out->data[row * out->width + col] == expected );
+      }
+
+    // the general separable path computes the same averages
+    struct Image *general = solid_img( 64 / f, 48 / f, 0 );
+    plan.box_factor = 0;
+    ASSERT( imgproc_resize_apply( &plan, in, general ) );
+    ASSERT( images_equal( out, general ) );
+
+    imgproc_resize_plan_cleanup( &plan );
+    destroy_img( out );
+    destroy_img( general );
+  }
+
+  destroy_img( in );
+}
+
+void test_resize_identity( TestObjs *objs ) {
+  // resizing to the same size reproduces the input exactly
+  enum ResizeFilter filters[] = { RESIZE_BOX, RESIZE_BILINEAR, RESIZE_BICUBIC, RESIZE_LANCZOS3 };
+  struct Image *in = random_img( 29, 17, 99 );
+  struct Image *out = solid_img( 29, 17, 0 );
+  for ( int i = 0; i < 4; i++ ) {
+    ASSERT( imgproc_resize( in, out, filters[i] ) );
+    ASSERT( images_equal( in, out ) );
+  }
+  destroy_img( in );
+  destroy_img( out );
+}
+
+void test_resize_plan_reuse( TestObjs *objs ) {
+  struct Image *a = random_img( 80, 120, 1 );
+  struct Image *b = random_img( 80, 120, 2 );
+  struct Image *a_out = solid_img( 30, 40, 0 );
+  struct Image *b_out = solid_img( 30, 40, 0 );
+  struct Image *wrong_size = solid_img( 31, 40, 0 );
+  struct Image *expected = solid_img( 30, 40, 0 );
+
+  struct ResizePlan plan;
+  ASSERT( imgproc_resize_plan_init( &plan, 80, 120, 30, 40, RESIZE_LANCZOS3 ) );
+  imgproc_set_num_threads( 3 );
+  ASSERT( imgproc_resize_apply( &plan, a, a_out ) );
+  ASSERT( imgproc_resize_apply( &plan, b, b_out ) );
+  ASSERT( !imgproc_resize_apply( &plan, a, wrong_size ) );
+
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_resize( a, expected, RESIZE_LANCZOS3 ) );
+  ASSERT( images_equal( a_out, expected ) );
+  ASSERT( imgproc_resize( b, expected, RESIZE_LANCZOS3 ) );
+  ASSERT( images_equal( b_out, expected ) );
+
+  imgproc_set_num_threads( 0 );
+  imgproc_resize_plan_cleanup( &plan );
+  destroy_img( a );
+  destroy_img( b );
+  destroy_img( a_out );
+  destroy_img( b_out );
+  destroy_img( wrong_size );
+  destroy_img( expected );
+}
+
+void test_planar_roundtrip( TestObjs *objs ) {
+  // widths around the 16-pixel vector width
+  int32_t widths[] = { 1, 15, 16, 17, 50 };
+  for ( int i = 0; i < 5; i++ ) {
+    struct Image *img = random_img( widths[i], 3, 1000 + i );
+    struct Image *back = solid_img( widths[i], 3, 0 );
+    struct PlanarImage planar;
+    ASSERT( imgproc_planar_init( &planar, widths[i], 3 ) );
+    ASSERT( imgproc_planar_from_packed( img, &planar ) );
+    ASSERT( planar.r[0] == get_r( img->data[0] ) );
+    ASSERT( planar.g[widths[i] - 1] == get_g( img->data[widths[i] - 1] ) );
+    ASSERT( planar.b[widths[i]] == get_b( img->data[widths[i]] ) );
+    ASSERT( planar.a[widths[i] * 3 - 1] == get_a( img->data[widths[i] * 3 - 1] ) );
+    ASSERT( imgproc_planar_to_packed( &planar, back ) );
+    ASSERT( images_equal( img, back ) );
+    imgproc_planar_cleanup( &planar );
+    destroy_img( img );
+    destroy_img( back );
+  }
+
+  // dimensions must match
+  struct PlanarImage planar;
+  ASSERT( imgproc_planar_init( &planar, 4, 4 ) );
+  ASSERT( !imgproc_planar_from_packed( objs->smiley, &planar ) );
+  ASSERT( !imgproc_planar_to_packed( &planar, objs->smiley ) );
+  ASSERT( !imgproc_planar_init( &planar, 0, 4 ) );
+  imgproc_planar_cleanup( &planar );
+}
+
+void test_planar_transforms( TestObjs *objs ) {
+  (void) objs;
+  struct Image *in = random_img( 53, 37, 4242 );
+  struct Image *expected = solid_img( 53, 37, 0 );
+  struct Image *actual = solid_img( 53, 37, 0 );
+  struct Image *expected_rgb = solid_img( 106, 74, 0 );
+  struct Image *actual_rgb = solid_img( 106, 74, 0 );
+  struct PlanarImage planar, planar_out, planar_rgb;
+  ASSERT( imgproc_planar_init( &planar, 53, 37 ) );
+  ASSERT( imgproc_planar_init( &planar_out, 53, 37 ) );
+  ASSERT( imgproc_planar_init( &planar_rgb, 106, 74 ) );
+  ASSERT( imgproc_planar_from_packed( in, &planar ) );
+
+  imgproc_grayscale( in, expected );
+  ASSERT( imgproc_planar_grayscale( &planar, &planar_out ) );
+  ASSERT( imgproc_planar_to_packed( &planar_out, actual ) );
+  ASSERT( images_equal( expected, actual ) );
+
+  imgproc_fade( in, expected );
+  ASSERT( imgproc_planar_fade( &planar, &planar_out ) );
+  ASSERT( imgproc_planar_to_packed( &planar_out, actual ) );
+  ASSERT( images_equal( expected, actual ) );
+
+  imgproc_rgb( in, expected_rgb );
+  ASSERT( imgproc_planar_rgb( &planar, &planar_rgb ) );
+  ASSERT( imgproc_planar_to_packed( &planar_rgb, actual_rgb ) );
+  ASSERT( images_equal( expected_rgb, actual_rgb ) );
+  ASSERT( !imgproc_planar_rgb( &planar, &planar_out ) );
+
+  // in place
+  ASSERT( imgproc_planar_fade( &planar, &planar ) );
+  ASSERT( imgproc_planar_to_packed( &planar, actual ) );
+  ASSERT( images_equal( expected, actual ) );
+
+  imgproc_planar_cleanup( &planar );
+  imgproc_planar_cleanup( &planar_out );
+  imgproc_planar_cleanup( &planar_rgb );
+  destroy_img( in );
+  destroy_img( expected );
+  destroy_img( actual );
+  destroy_img( expected_rgb );
+  destroy_img( actual_rgb );
+}
+
+void test_tile_store( TestObjs *objs ) {
+  (void) objs;
+  struct Image *in = random_img( 45, 30, 777 );
+  struct Image *back = solid_img( 45, 30, 0 );
+  struct TileStore ts;
+  // room for 2 of the 4x3 tiles, so most accesses evict
+  ASSERT( imgproc_tile_store_init( &ts, 45, 30, 16, 2 * 16 * 16 * 4 ) );
+  ASSERT( ts.tiles_x == 3 && ts.tiles_y == 2 && ts.num_slots == 2 );
+
+  uint32_t pixel;
+  ASSERT( imgproc_tile_get_pixel( &ts, 44, 29, &pixel ) && pixel == 0x000000FFU );
+  ASSERT( imgproc_tile_store_from_image( in, &ts ) );
+  ASSERT( ts.writebacks > 0 );
+  ASSERT( imgproc_tile_store_to_image( &ts, back ) );
+  ASSERT( images_equal( in, back ) );
+
+  ASSERT( imgproc_tile_put_pixel( &ts, 17, 20, 0x12345678U ) );
+  ASSERT( imgproc_tile_get_pixel( &ts, 0, 0, &pixel ) && pixel == in->data[0] );
+  ASSERT( imgproc_tile_get_pixel( &ts, 44, 0, &pixel ) && pixel == in->data[44] );
+  ASSERT( imgproc_tile_get_pixel( &ts, 17, 20, &pixel ) && pixel == 0x12345678U );
+  ASSERT( !imgproc_tile_get_pixel( &ts, 45, 0, &pixel ) );
+  ASSERT( !imgproc_tile_put_pixel( &ts, 0, -1, 0 ) );
+  ASSERT( imgproc_tile_store_flush( &ts ) );
+  ASSERT( !imgproc_tile_store_to_image( &ts, objs->smiley ) );
+  imgproc_tile_store_cleanup( &ts );
+
+  ASSERT( !imgproc_tile_store_init( &ts, 0, 30, 16, 1 << 20 ) );
+  ASSERT( !imgproc_tile_store_init( &ts, 45, 30, 0, 1 << 20 ) );
+  destroy_img( in );
+  destroy_img( back );
+}
+
+void test_tiled_transforms( TestObjs *objs ) {
+  (void) objs;
+  // aligned and unaligned tiles, even and odd kaleidoscope sizes
+  int32_t sizes[] = { 64, 45, 37 };
+  for ( int i = 0; i < 3; i++ ) {
+    int32_t n = sizes[i];
+    struct Image *in = random_img( n, n, 99 + i );
+    struct Image *expected = solid_img( n, n, 0 );
+    struct Image *actual = solid_img( n, n, 0 );
+    struct Image *expected_rgb = solid_img( n * 2, n * 2, 0 );
+    struct Image *actual_rgb = solid_img( n * 2, n * 2, 0 );
+    struct TileStore tin, tout, trgb;
+    size_t budget = 3 * 8 * 8 * 4;
+    ASSERT( imgproc_tile_store_init( &tin, n, n, 8, budget ) );
+    ASSERT( imgproc_tile_store_init( &tout, n, n, 8, budget ) );
+    ASSERT( imgproc_tile_store_init( &trgb, n * 2, n * 2, 8, budget ) );
+    ASSERT( imgproc_tile_store_from_image( in, &tin ) );
+
+    imgproc_kaleidoscope( in, expected );
+    tin.misses = 0;
+    ASSERT( imgproc_tiled_kaleidoscope( &tin, &tout ) );
+    ASSERT( imgproc_tile_store_to_image( &tout, actual ) );
+    ASSERT( images_equal( expected, actual ) );
+    // only the 10 tiles holding wedge A are read, once each
+    if ( n == 64 )
+      ASSERT( tin.misses == 4 * 5 / 2 );
+
+    imgproc_rgb( in, expected_rgb );
+    tin.misses = 0;
+    ASSERT( imgproc_tiled_rgb( &tin, &trgb ) );
+    ASSERT( imgproc_tile_store_to_image( &trgb, actual_rgb ) );
+    ASSERT( images_equal( expected_rgb, actual_rgb ) );
+    // with aligned tiles, each input tile is loaded once for all four copies
+    if ( n == 64 )
+      ASSERT( tin.misses == 8 * 8 );
+
+    ASSERT( !imgproc_tiled_rgb( &tin, &tout ) );
+    ASSERT( !imgproc_tiled_kaleidoscope( &tin, &trgb ) );
+    imgproc_tile_store_cleanup( &tin );
+    imgproc_tile_store_cleanup( &tout );
+    imgproc_tile_store_cleanup( &trgb );
+    destroy_img( in );
+    destroy_img( expected );
+    destroy_img( actual );
+    destroy_img( expected_rgb );
+    destroy_img( actual_rgb );
+  }
+}
+
+void test_color_tables( TestObjs *objs ) {
+  (void) objs;
+  enum ColorPrecision precisions[] = { COLOR_PRECISION_12, COLOR_PRECISION_16 };
+  for ( int p = 0; p < 2; p++ ) {
+    ASSERT( imgproc_srgb_to_linear( 0, precisions[p] ) == 0 );
+    ASSERT( imgproc_srgb_to_linear( 255, precisions[p] ) == IMGPROC_LINEAR_ONE );
+    ASSERT( imgproc_linear_to_srgb( IMGPROC_LINEAR_ONE, precisions[p] ) == 255 );
+    ASSERT( imgproc_linear_to_srgb( 65535, precisions[p] ) == 255 );
+    // middle gray is about 21.6% linear light
+    ASSERT( imgproc_srgb_to_linear( 128, precisions[p] ) / (double) IMGPROC_LINEAR_ONE > 0.21 );
+    ASSERT( imgproc_srgb_to_linear( 128, precisions[p] ) / (double) IMGPROC_LINEAR_ONE < 0.22 );
+    for ( int v = 0; v < 256; v++ ) {
+      uint16_t lin = imgproc_srgb_to_linear( (uint8_t) v, precisions[p] );
+      ASSERT( imgproc_linear_to_srgb( lin, precisions[p] ) == v );
+      if ( v > 0 )
+        ASSERT( lin > imgproc_srgb_to_linear( (uint8_t) ( v - 1 ), precisions[p] ) );
+    }
+  }
+  ASSERT( imgproc_srgb_to_linear( 1, COLOR_PRECISION_12 ) % 16 == 0 );
+}
+
+void test_linear_transforms( TestObjs *objs ) {
+  (void) objs;
+  enum ColorPrecision precisions[] = { COLOR_PRECISION_12, COLOR_PRECISION_16 };
+  for ( int p = 0; p < 2; p++ ) {
+    // grays (in every lane of the vectorized loop and the scalar tail) stay the same
+    struct Image *in = solid_img( 19, 16, 0 );
+    struct Image *out = solid_img( 19, 16, 0 );
+    for ( int i = 0; i < 19 * 16; i++ ) {
+      uint32_t v = (uint32_t) ( i % 256 );
+      in->data[i] = ( v << 24 ) | ( v << 16 ) | ( v << 8 ) | ( i & 0xFF );
+    }
+    ASSERT( imgproc_grayscale_linear( in, out, precisions[p] ) );
+    ASSERT( images_equal( in, out ) );
+
+    // the luminance of pure red is 21.26%, i.e. sRGB 127
+    in->data[3] = 0xFF000080;
+    in->data[18] = 0x0000FF40;
+    ASSERT( imgproc_grayscale_linear( in, out, precisions[p] ) );
+    ASSERT( out->data[3] == 0x7F7F7F80 );
+    ASSERT( out->data[18] == 0x4C4C4C40 );
+    destroy_img( in );
+    destroy_img( out );
+
+    in = random_img( 37, 23, 555 + p );
+    out = solid_img( 37, 23, 0 );
+    ASSERT( imgproc_fade_linear( in, out, precisions[p] ) );
+    for ( int i = 0; i < 37 * 23; i++ )
+      ASSERT( get_a( out->data[i] ) == get_a( in->data[i] ) );
+    // the edges fade to black, and the center barely fades
+    ASSERT( ( out->data[0] & 0xFFFFFF00 ) == 0 );
+    int64_t center = compute_index( in, 18, 11 );
+    ASSERT( abs( (int) get_g( out->data[center] ) - (int) get_g( in->data[center] ) ) <= 1 );
+    // in place
+    ASSERT( imgproc_fade_linear( in, in, precisions[p] ) );
+    ASSERT( images_equal( in, out ) );
+    ASSERT( !imgproc_fade_linear( in, objs->smiley, precisions[p] ) );
+    ASSERT( !imgproc_grayscale_linear( in, objs->smiley, precisions[p] ) );
+    destroy_img( in );
+    destroy_img( out );
+  }
+}
+
+void test_histogram( TestObjs *objs ) {
+  (void) objs;
+  struct Image *img = random_img( 83, 71, 2024 );
+  uint64_t expected[NUM_CHANNELS][256] = { { 0 } };
+  for ( int i = 0; i < 83 * 71; i++ ) {
+    expected[CHANNEL_R][get_r( img->data[i] )]++;
+    expected[CHANNEL_G][get_g( img->data[i] )]++;
+    expected[CHANNEL_B][get_b( img->data[i] )]++;
+    expected[CHANNEL_A][get_a( img->data[i] )]++;
+  }
+
+  struct ImageHistogram hist;
+  int threads[] = { 1, 4 };
+  for ( int t = 0; t < 2; t++ ) {
+    imgproc_set_num_threads( threads[t] );
+    imgproc_histogram( img, &hist );
+    ASSERT( hist.num_pixels == 83 * 71 );
+    ASSERT( memcmp( hist.counts, expected, sizeof( expected ) ) == 0 );
+  }
+  imgproc_set_num_threads( 0 );
+  destroy_img( img );
+
+  // values 10, 20, ..., 100 in the red channel, alpha 0xFF
+  img = solid_img( 5, 2, 0 );
+  for ( int i = 0; i < 10; i++ )
+    img->data[i] = ( (uint32_t) ( i + 1 ) * 10 << 24 ) | 0xFF;
+  imgproc_histogram( img, &hist );
+  struct ImageStats stats;
+  imgproc_histogram_stats( &hist, &stats );
+  ASSERT( stats.num_pixels == 10 );
+  ASSERT( stats.min[CHANNEL_R] == 10 && stats.max[CHANNEL_R] == 100 );
+  ASSERT( stats.mean[CHANNEL_R] == 55.0 );
+  ASSERT( stats.median[CHANNEL_R] == 50 );
+  ASSERT( stats.min[CHANNEL_G] == 0 && stats.max[CHANNEL_G] == 0 );
+  ASSERT( stats.min[CHANNEL_A] == 255 && stats.mean[CHANNEL_A] == 255.0 );
+  ASSERT( imgproc_histogram_percentile( &hist, CHANNEL_R, 0.0 ) == 10 );
+  ASSERT( imgproc_histogram_percentile( &hist, CHANNEL_R, 90.0 ) == 90 );
+  ASSERT( imgproc_histogram_percentile( &hist, CHANNEL_R, 91.0 ) == 100 );
+  ASSERT( imgproc_histogram_percentile( &hist, CHANNEL_R, 100.0 ) == 100 );
+  destroy_img( img );
+}
+
+void test_autolevels( TestObjs *objs ) {
+  // red spans 50..150, green is constant, blue spans 0..255
+  struct Image *img = solid_img( 101, 3, 0 );
+  for ( int i = 0; i < 101 * 3; i++ ) {
+    uint32_t x = (uint32_t) ( i % 101 );
+    img->data[i] = ( ( 50 + x ) << 24 ) | ( 77 << 16 ) | ( ( x * 255 / 100 ) << 8 ) | ( i & 0xFF );
+  }
+  struct Image *out = solid_img( 101, 3, 0 );
+  ASSERT( imgproc_autolevels( img, out, 0.0 ) );
+  for ( int i = 0; i < 101 * 3; i++ ) {
+    uint32_t x = (uint32_t) ( i % 101 );
+    ASSERT( get_r( out->data[i] ) == ( x * 255 + 50 ) / 100 );
+    ASSERT( get_g( out->data[i] ) == 77 );
+    ASSERT( get_b( out->data[i] ) == get_b( img->data[i] ) );
+    ASSERT( get_a( out->data[i] ) == get_a( img->data[i] ) );
+  }
+
+  // clipping 10% at each end maps red 60 to 0 and 140 to 255
+  ASSERT( imgproc_autolevels( img, out, 10.0 ) );
+  ASSERT( get_r( out->data[5] ) == 0 && get_r( out->data[10] ) == 0 );
+  ASSERT( get_r( out->data[90] ) == 255 && get_r( out->data[100] ) == 255 );
+
+  // in place
+  ASSERT( imgproc_autolevels( img, img, 10.0 ) );
+  ASSERT( images_equal( img, out ) );
+  ASSERT( !imgproc_autolevels( img, out, 50.0 ) );
+  ASSERT( !imgproc_autolevels( img, objs->smiley, 1.0 ) );
+  destroy_img( img );
+  destroy_img( out );
+}
+
+void test_rotations( TestObjs *objs ) {
+  (void) objs;
+  int32_t dims[][2] = { { 37, 23 }, { 5, 9 }, { 64, 130 }, { 1, 1 } };
+  for ( int d = 0; d < 4; d++ ) {
+    int32_t w = dims[d][0], h = dims[d][1];
+    struct Image *in = random_img( w, h, 31 + d );
+    struct Image *tr = solid_img( h, w, 0 );
+    struct Image *r90 = solid_img( h, w, 0 );
+    struct Image *r270 = solid_img( h, w, 0 );
+    struct Image *same = solid_img( w, h, 0 );
+    struct Image *back = solid_img( w, h, 0 );
+
+    ASSERT( imgproc_transpose( in, tr ) );
+    ASSERT( imgproc_rotate90( in, r90 ) );
+    ASSERT( imgproc_rotate270( in, r270 ) );
+    for ( int32_t y = 0; y < h; y++ ) {
+      for ( int32_t x = 0; x < w; x++ ) {
+        uint32_t p = in->data[compute_index( in, x, y )];
+        ASSERT( tr->data[compute_index( tr, y, x )] == p );
+        ASSERT( r90->data[compute_index( r90, h - 1 - y, x )] == p );
+        ASSERT( r270->data[compute_index( r270, y, w - 1 - x )] == p );
+      }
+    }
+    ASSERT( imgproc_rotate270( r90, back ) );
+    ASSERT( images_equal( in, back ) );
+
+    ASSERT( imgproc_rotate180( in, same ) );
+    ASSERT( imgproc_rotate180( same, back ) );
+    ASSERT( images_equal( in, back ) );
+    ASSERT( imgproc_flip_horizontal( in, same ) );
+    ASSERT( imgproc_flip_vertical( same, back ) );
+    ASSERT( imgproc_rotate180( in, same ) );
+    ASSERT( images_equal( same, back ) );
+    ASSERT( imgproc_flip_horizontal( in, same ) );
+    for ( int32_t y = 0; y < h; y++ )
+      for ( int32_t x = 0; x < w; x++ )
+        ASSERT( same->data[compute_index( same, w - 1 - x, y )] == in->data[compute_index( in, x, y )] );
+
+    if ( w != h ) {
+      ASSERT( !imgproc_rotate90( in, same ) );
+      ASSERT( !imgproc_flip_vertical( in, tr ) );
+    }
+    ASSERT( !imgproc_rotate180( in, in ) );
+    destroy_img( in );
+    destroy_img( tr );
+    destroy_img( r90 );
+    destroy_img( r270 );
+    destroy_img( same );
+    destroy_img( back );
+  }
+
+  // row bands of the output on several threads
+  struct Image *in = random_img( 150, 70, 5150 );
+  struct Image *expected = solid_img( 70, 150, 0 );
+  struct Image *actual = solid_img( 70, 150, 0 );
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_rotate90( in, expected ) );
+  imgproc_set_num_threads( 3 );
+  ASSERT( imgproc_rotate90( in, actual ) );
+  imgproc_set_num_threads( 0 );
+  ASSERT( images_equal( expected, actual ) );
+  destroy_img( in );
+  destroy_img( expected );
+  destroy_img( actual );
+}
+
+void test_affine( TestObjs *objs ) {
+  (void) objs;
+  struct Image *in = random_img( 41, 29, 8080 );
+  struct Image *out = solid_img( 41, 29, 0 );
+
+  const double identity[6] = { 1, 0, 0, 0, 1, 0 };
+  ASSERT( imgproc_affine( in, out, identity ) );
+  ASSERT( images_equal( in, out ) );
+
+  // whole-pixel translation; uncovered pixels are transparent black
+  const double shift[6] = { 1, 0, 3, 0, 1, -2 };
+  ASSERT( imgproc_affine( in, out, shift ) );
+  for ( int32_t y = 0; y < 29; y++ ) {
+    for ( int32_t x = 0; x < 41; x++ ) {
+      uint32_t expected = ( x >= 3 && y < 27 ) ? in->data[compute_index( in, x - 3, y + 2 )] : 0;
+      ASSERT( out->data[compute_index( out, x, y )] == expected );
+    }
+  }
+
+  // a warp that swaps the axes is a transpose
+  struct Image *square = random_img( 33, 33, 99 );
+  struct Image *warped = solid_img( 33, 33, 0 );
+  struct Image *transposed = solid_img( 33, 33, 0 );
+  const double swap[6] = { 0, 1, 0, 1, 0, 0 };
+  ASSERT( imgproc_affine( square, warped, swap ) );
+  ASSERT( imgproc_transpose( square, transposed ) );
+  ASSERT( images_equal( warped, transposed ) );
+
+  // half-pixel shifts average neighbours
+  struct Image *two = solid_img( 2, 1, 0x000000FF );
+  struct Image *avg = solid_img( 1, 1, 0 );
+  two->data[1] = 0xFF8040FF;
+  const double half[6] = { 1, 0, -0.5, 0, 1, 0 };
+  ASSERT( imgproc_affine( two, avg, half ) );
+  ASSERT( avg->data[0] == 0x804020FF );
+
+  const double singular[6] = { 1, 2, 0, 2, 4, 0 };
+  ASSERT( !imgproc_affine( in, out, singular ) );
+  ASSERT( !imgproc_affine( in, in, identity ) );
+  const double shift_nan[6] = { 1, 0, NAN, 0, 1, 0 };
+  ASSERT( !imgproc_affine( in, out, shift_nan ) );
+  const double scale_inf[6] = { INFINITY, 0, 0, 0, 1, 0 };
+  ASSERT( !imgproc_affine( in, out, scale_inf ) );
+  destroy_img( in );
+  destroy_img( out );
+  destroy_img( square );
+  destroy_img( warped );
+  destroy_img( transposed );
+  destroy_img( two );
+  destroy_img( avg );
+}
+
+// Composite two 1x1 images (which only use the scalar code)
+uint32_t composite_pixel( uint32_t input, uint32_t overlay, enum BlendMode mode ) {
+  struct Image *in = solid_img( 1, 1, input );
+  struct Image *ovl = solid_img( 1, 1, overlay );
+  struct Image *out = solid_img( 1, 1, 0 );
+  uint32_t result = imgproc_composite( in, ovl, out, mode, 0, 0 ) ? out->data[0] : 0xDEADBEEF;
+  destroy_img( in );
+  destroy_img( ovl );
+  destroy_img( out );
+  return result;
+}
+
+void test_composite_modes( TestObjs *objs ) {
+  (void) objs;
+  ASSERT( composite_pixel( 0x80402080, 0x102030FF, BLEND_OVER ) == 0x102030FF );
+  ASSERT( composite_pixel( 0x80402080, 0x12345600, BLEND_OVER ) == 0x80402080 );
+  ASSERT( composite_pixel( 0x000000FF, 0xFFFFFF80, BLEND_OVER ) == 0x808080FF );
+  ASSERT( composite_pixel( 0x80402080, 0xFF0000FF, BLEND_IN ) == 0xFF000080 );
+  ASSERT( composite_pixel( 0x80402080, 0xFF0000FF, BLEND_OUT ) == 0xFF00007F );
+  ASSERT( composite_pixel( 0x808080FF, 0xFF4000FF, BLEND_MULTIPLY ) == 0x802000FF );
+  ASSERT( composite_pixel( 0x808080FF, 0xFF4000FF, BLEND_SCREEN ) == 0xFFA080FF );
+
+  // every mode against a floating point reference, on premultiplied
+  // values (each rounding to 8 bits adds up to half a unit of error),
+  // and the vectorized rows against the scalar pixels
+  struct Image *in = random_img( 67, 5, 3901 );
+  struct Image *ovl = random_img( 67, 5, 3902 );
+  struct Image *out = solid_img( 67, 5, 0 );
+  for ( int m = BLEND_OVER; m <= BLEND_SCREEN; m++ ) {
+    enum BlendMode mode = (enum BlendMode) m;
+    ASSERT( imgproc_composite( in, ovl, out, mode, 0, 0 ) );
+    for ( int32_t i = 0; i < 67 * 5; i++ ) {
+      uint32_t d = in->data[i], s = ovl->data[i], r = out->data[i];
+      ASSERT( r == composite_pixel( d, s, mode ) );
+      double sa = get_a( s ) / 255.0, da = get_a( d ) / 255.0, ra;
+      switch ( mode ) {
+      case BLEND_IN: ra = sa * da; break;
+      case BLEND_OUT: ra = sa * ( 1 - da ); break;
+      default: ra = sa + da - sa * da; break;
+      }
+      ASSERT( fabs( get_a( r ) - ra * 255 ) <= 1.0 );
+      for ( int shift = 8; shift < 32; shift += 8 ) {
+        double sc = ( ( s >> shift ) & 0xFF ) / 255.0 * sa, dc = ( ( d >> shift ) & 0xFF ) / 255.0 * da, rc;
+        switch ( mode ) {
+        case BLEND_IN: rc = sc * da; break;
+        case BLEND_OUT: rc = sc * ( 1 - da ); break;
+        case BLEND_MULTIPLY: rc = sc * dc + sc * ( 1 - da ) + dc * ( 1 - sa ); break;
+        case BLEND_SCREEN: rc = sc + dc - sc * dc; break;
+        default: rc = sc + dc * ( 1 - sa ); break;
+        }
+        double actual = ( ( r >> shift ) & 0xFF ) * get_a( r ) / 255.0;
+        ASSERT( fabs( actual - rc * 255 ) <= 3.0 );
+      }
+    }
+  }
+
+  ASSERT( !imgproc_composite( in, ovl, ovl, BLEND_OVER, 0, 0 ) );
+  struct Image *small = solid_img( 3, 3, 0 );
+  ASSERT( !imgproc_composite( in, ovl, small, BLEND_OVER, 0, 0 ) );
+  destroy_img( in );
+  destroy_img( ovl );
+  destroy_img( out );
+  destroy_img( small );
+}
+
+void test_composite_overlay( TestObjs *objs ) {
+  (void) objs;
+  // an overlay partly outside the input, composited in place
+  struct Image *in = random_img( 19, 8, 4711 );
+  struct Image *ovl = random_img( 6, 4, 4712 );
+  struct Image *orig = random_img( 19, 8, 4711 );
+  for ( int m = BLEND_OVER; m <= BLEND_SCREEN; m++ ) {
+    enum BlendMode mode = (enum BlendMode) m;
+    ASSERT( imgproc_composite( in, ovl, in, mode, -2, 5 ) );
+    for ( int32_t y = 0; y < 8; y++ ) {
+      for ( int32_t x = 0; x < 19; x++ ) {
+        uint32_t d = orig->data[compute_index( orig, x, y )];
+        uint32_t expected = ( mode == BLEND_IN || mode == BLEND_OUT ) ? 0 : d;
+        if ( x < 4 && y >= 5 )
+          expected = composite_pixel( d, ovl->data[compute_index( ovl, x + 2, y - 5 )], mode );
+        ASSERT( in->data[compute_index( in, x, y )] == expected );
+      }
+    }
+    memcpy( in->data, orig->data, 19 * 8 * sizeof( uint32_t ) );
+  }
+  // entirely outside
+  ASSERT( imgproc_composite( in, ovl, in, BLEND_OVER, 19, 0 ) );
+  ASSERT( images_equal( in, orig ) );
+
+  // row bands on several threads
+  struct Image *big = random_img( 101, 90, 777 );
+  struct Image *big_ovl = random_img( 101, 90, 778 );
+  struct Image *expected = solid_img( 101, 90, 0 );
+  struct Image *actual = solid_img( 101, 90, 0 );
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_composite( big, big_ovl, expected, BLEND_MULTIPLY, 0, 0 ) );
+  imgproc_set_num_threads( 3 );
+  ASSERT( imgproc_composite( big, big_ovl, actual, BLEND_MULTIPLY, 0, 0 ) );
+  imgproc_set_num_threads( 0 );
+  ASSERT( images_equal( expected, actual ) );
+
+  destroy_img( in );
+  destroy_img( ovl );
+  destroy_img( orig );
+  destroy_img( big );
+  destroy_img( big_ovl );
+  destroy_img( expected );
+  destroy_img( actual );
+}
+
+void test_image_hashes( TestObjs *objs ) {
+  // the shared downscale (at least 288x32) and the fallback for small
+  // images give the same hashes as hashing each kind separately
+  struct Image *big = random_img( 301, 47, 99 );
+  struct Image *small = random_img( 20, 13, 98 );
+  struct Image *imgs[2] = { big, small };
+  for ( int i = 0; i < 2; i++ ) {
+    uint64_t hashes[NUM_HASH_KINDS], hash;
+    ASSERT( imgproc_image_hashes( imgs[i], hashes ) );
+    for ( int k = 0; k < NUM_HASH_KINDS; k++ ) {
+      ASSERT( imgproc_image_hash( imgs[i], (enum HashKind) k, &hash ) );
+      ASSERT( hash == hashes[k] );
+    }
+  }
+
+  // hashes barely change with a grayscale conversion or a slight
+  // change of brightness, but differ for unrelated images
+  struct Image *gray = solid_img( 301, 47, 0 );
+  imgproc_grayscale( objs->smiley, objs->smiley_out );
+  uint64_t a[NUM_HASH_KINDS], b[NUM_HASH_KINDS], c[NUM_HASH_KINDS];
+  ASSERT( imgproc_image_hashes( objs->smiley, a ) );
+  ASSERT( imgproc_image_hashes( objs->smiley_out, b ) );
+  for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+    ASSERT( imgproc_hash_distance( a[k], b[k] ) <= 4 );
+  for ( int32_t i = 0; i < 301 * 47; i++ ) {
+    uint32_t g = ( big->data[i] >> 24 ) * 3 / 4;
+    gray->data[i] = make_pixel( g, g, g, 255 );
+  }
+  ASSERT( imgproc_image_hashes( gray, a ) );
+  for ( int32_t i = 0; i < 301 * 47; i++ ) {
+    uint32_t g = ( gray->data[i] >> 24 ) + 4;
+    gray->data[i] = make_pixel( g, g, g, 255 );
+  }
+  ASSERT( imgproc_image_hashes( gray, b ) );
+  ASSERT( imgproc_image_hashes( small, c ) );
+  ASSERT( imgproc_hash_distance( a[HASH_DCT], b[HASH_DCT] ) <= 6 );
+  ASSERT( imgproc_hash_distance( a[HASH_DCT], c[HASH_DCT] ) > 10 );
+
+  ASSERT( imgproc_hash_distance( 0, 0 ) == 0 );
+  ASSERT( imgproc_hash_distance( 0, UINT64_MAX ) == 64 );
+  ASSERT( imgproc_hash_distance( 0x8000000000000001ULL, 1 ) == 1 );
+
+  destroy_img( big );
+  destroy_img( small );
+  destroy_img( gray );
+}
+
+void test_ssim_psnr( TestObjs *objs ) {
+  (void) objs;
+  struct Image *a = random_img( 53, 41, 31 );
+  struct Image *b = random_img( 53, 41, 31 );
+  double ssim, psnr;
+  ASSERT( imgproc_ssim( a, b, &ssim ) );
+  ASSERT( fabs( ssim - 1.0 ) < 1e-9 );
+  ASSERT( imgproc_psnr( a, b, &psnr ) );
+  ASSERT( isinf( psnr ) );
+
+  // changing each color channel by 1 gives an MSE of 1
+  for ( int32_t i = 0; i < 53 * 41; i++ )
+    b->data[i] ^= 0x01010100;
+  ASSERT( imgproc_psnr( a, b, &psnr ) );
+  ASSERT( fabs( psnr - 20.0 * log10( 255.0 ) ) < 1e-9 );
+  // the alpha channel is ignored
+  for ( int32_t i = 0; i < 53 * 41; i++ )
+    b->data[i] ^= 0x000000FF;
+  double psnr_alpha;
+  ASSERT( imgproc_psnr( a, b, &psnr_alpha ) );
+  ASSERT( psnr_alpha == psnr );
+
+  // an unrelated image is much less similar than a slightly changed one
+  double ssim_noise;
+  struct Image *noise = random_img( 53, 41, 32 );
+  ASSERT( imgproc_ssim( a, b, &ssim ) );
+  ASSERT( imgproc_ssim( a, noise, &ssim_noise ) );
+  ASSERT( ssim < 1.0 && ssim > 0.9 );
+  ASSERT( ssim_noise < 0.5 );
+
+  // results don't depend on the number of threads
+  double ssim_threads, psnr_threads;
+  imgproc_set_num_threads( 1 );
+  ASSERT( imgproc_ssim( a, noise, &ssim ) );
+  ASSERT( imgproc_psnr( a, noise, &psnr ) );
+  imgproc_set_num_threads( 3 );
+  ASSERT( imgproc_ssim( a, noise, &ssim_threads ) );
+  ASSERT( imgproc_psnr( a, noise, &psnr_threads ) );
+  imgproc_set_num_threads( 0 );
+  ASSERT( ssim == ssim_threads );
+  ASSERT( psnr == psnr_threads );
+
+  // the dimensions must match
+  struct Image *other = random_img( 41, 53, 31 );
+  ASSERT( !imgproc_ssim( a, other, &ssim ) );
+  ASSERT( !imgproc_psnr( a, other, &psnr ) );
+
+  destroy_img( a );
+  destroy_img( b );
+  destroy_img( noise );
+  destroy_img( other );
+}
+
+void test_hash_index( TestObjs *objs ) {
+  (void) objs;
+  struct Image *imgs[3] = { random_img( 40, 30, 1 ), random_img( 40, 30, 2 ), random_img( 40, 30, 1 ) };
+  const char *filenames[4] = { "./output/hash_a.rgba", "./output/missing.rgba", "./output/hash_b.rgba",
+                               "./output/hash_c.rgba" };
+  remove( filenames[1] );
+  ASSERT( IMG_SUCCESS == img_write( filenames[0], imgs[0] ) );
+  ASSERT( IMG_SUCCESS == img_write( filenames[2], imgs[1] ) );
+  ASSERT( IMG_SUCCESS == img_write( filenames[3], imgs[2] ) );
+
+  // the file that can't be read is left out
+  struct HashIndex index, reread;
+  imgproc_set_num_threads( 3 );
+  ASSERT( imgproc_hash_index_build( filenames, 4, &index ) );
+  imgproc_set_num_threads( 0 );
+  ASSERT( index.num_entries == 3 );
+  ASSERT( strcmp( index.names[0], filenames[0] ) == 0 );
+  ASSERT( strcmp( index.names[1], filenames[2] ) == 0 );
+  ASSERT( strcmp( index.names[2], filenames[3] ) == 0 );
+  for ( int i = 0; i < 3; i++ ) {
+    uint64_t hashes[NUM_HASH_KINDS];
+    ASSERT( imgproc_image_hashes( imgs[i], hashes ) );
+    for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+      ASSERT( index.hashes[k][i] == hashes[k] );
+  }
+
+  ASSERT( imgproc_hash_index_write( &index, "./output/hash.idx" ) );
+  ASSERT( imgproc_hash_index_read( "./output/hash.idx", &reread ) );
+  ASSERT( reread.num_entries == index.num_entries );
+  ASSERT( reread.names_size == index.names_size );
+  for ( int i = 0; i < 3; i++ ) {
+    ASSERT( strcmp( reread.names[i], index.names[i] ) == 0 );
+    for ( int k = 0; k < NUM_HASH_KINDS; k++ )
+      ASSERT( reread.hashes[k][i] == index.hashes[k][i] );
+  }
+  // not an index, or not a file
+  imgproc_hash_index_cleanup( &index );
+  ASSERT( !imgproc_hash_index_read( filenames[0], &index ) );
+  ASSERT( !imgproc_hash_index_read( filenames[1], &index ) );
+
+  // counts that don't match the file are rejected before allocating
+  unsigned char header[16];
+  FILE *fp = fopen( "./output/hash.idx", "rb" );
+  ASSERT( fp != NULL );
+  ASSERT( fread( header, 1, sizeof( header ), fp ) == sizeof( header ) );
+  fclose( fp );
+  uint32_t huge = 0x7FFFFFFF;
+  for ( int field = 8; field <= 12; field += 4 ) {
+    unsigned char bad[sizeof( header )];
+    memcpy( bad, header, sizeof( header ) );
+    memcpy( bad + field, &huge, sizeof( huge ) );  // entries, names size
+    fp = fopen( "./output/hash_bad.idx", "wb" );
+    ASSERT( fp != NULL );
+    ASSERT( fwrite( bad, 1, sizeof( bad ), fp ) == sizeof( bad ) );
+    fclose( fp );
+    ASSERT( !imgproc_hash_index_read( "./output/hash_bad.idx", &index ) );
+  }
+  remove( "./output/hash_bad.idx" );
+
+  // the duplicates match exactly; lookups count every match even if
+  // only some of them fit
+  int32_t matches[3];
+  uint64_t hash = reread.hashes[HASH_DCT][0];
+  int32_t n = imgproc_hash_index_lookup( &reread, HASH_DCT, hash, 0, matches, 3 );
+  ASSERT( n >= 2 );
+  ASSERT( matches[0] == 0 );
+  ASSERT( matches[n - 1] == 2 );
+  ASSERT( imgproc_hash_index_lookup( &reread, HASH_DCT, hash, 64, matches, 1 ) == 3 );
+  ASSERT( matches[0] == 0 );
+  ASSERT( imgproc_hash_index_lookup( &reread, HASH_DCT, ~hash, 0, matches, 3 ) == 0 );
+  imgproc_hash_index_cleanup( &reread );
+
+  for ( int i = 0; i < 3; i++ )
+    destroy_img( imgs[i] );
+}
+
 void test_get_r( TestObjs *objs ) {
   uint32_t pixel_1 = 0x8B3D2A7D;
   uint32_t pixel_2 = 0xC4E91F93;
@@ -683,4 +1849,12 @@ void test_compute_index( TestObjs *objs ) {
 
   img = (struct Image){ 12304, 1203, NULL };
   ASSERT( compute_index(&img, 12303, 1202) == 14801711 );
+
+  // indices beyond 2^31 and 2^32
+  img = (struct Image){ 100000, 100000, NULL };
+  ASSERT( compute_index(&img, 99999, 30000) == 3000099999LL );
+  ASSERT( compute_index(&img, 99999, 99999) == 9999999999LL );
+
+  img = (struct Image){ INT32_MAX, 4, NULL };
+  ASSERT( compute_index(&img, 7, 3) == 3LL * INT32_MAX + 7 );
 }
@@ -0,0 +1,95 @@
+// Row-band threading shared by the multi-threaded image transformations
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "imgproc.h"
+
+// Bands smaller than this aren't worth a thread of their own
+#define MIN_ROWS_PER_BAND 16
+
+// Hard upper limit on the number of worker threads
+#define MAX_THREADS 64
+
+// 0 means "not set yet", i.e., use the number of online CPUs
+static int s_num_threads;
+
+struct RowBand {
+  void (*fn)( void *arg, int32_t row_begin, int32_t row_end );
+  void *arg;
+  int32_t row_begin;
+  int32_t row_end;
+};
+
+static void *run_row_band( void *arg ) {
+  struct RowBand *band = (struct RowBand *) arg;
+  band->fn( band->arg, band->row_begin, band->row_end );
+  return NULL;
+}
+
+// Set the number of threads used by the threaded transformations.
+//
+// Parameters:
+//   num_threads - number of threads, or 0 to use one per online CPU
+void imgproc_set_num_threads( int num_threads ) {
+  if ( num_threads < 0 ) num_threads = 0;
+  if ( num_threads > MAX_THREADS ) num_threads = MAX_THREADS;
+  s_num_threads = num_threads;
+}
+
+// Get the number of threads used by the threaded transformations.
+//
+// Returns:
+//   the number of threads (at least 1)
+int imgproc_get_num_threads( void ) {
+  if ( s_num_threads > 0 )
+    return s_num_threads;
+  long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+  if ( ncpu < 1 ) return 1;
+  return ncpu > MAX_THREADS ? MAX_THREADS : (int) ncpu;
+}
+
+// Split the rows [0, num_rows) into contiguous bands and call fn
+// once per band, each band on its own thread. The calling thread
+// processes the first band itself and waits for the others.
+//
+// Parameters:
+//   num_rows - total number of rows to process
+//   fn - function processing rows [row_begin, row_end)
+//   arg - argument passed through to fn
+void imgproc_parallel_rows( int32_t num_rows,
+                            void (*fn)( void *arg, int32_t row_begin, int32_t row_end ),
+                            void *arg ) {
+  if ( num_rows <= 0 )
+    return;
+
+  int32_t num_bands = imgproc_get_num_threads();
+  if ( num_bands > num_rows / MIN_ROWS_PER_BAND )
+    num_bands = num_rows / MIN_ROWS_PER_BAND;
+  if ( num_bands < 1 )
+    num_bands = 1;
+
+  struct RowBand bands[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  int started[MAX_THREADS];
+
+  for ( int32_t i = 0; i < num_bands; i++ ) {
+    bands[i].fn = fn;
+    bands[i].arg = arg;
+    bands[i].row_begin = (int32_t) ( (int64_t) num_rows * i / num_bands );
+    bands[i].row_end = (int32_t) ( (int64_t) num_rows * ( i + 1 ) / num_bands );
+  }
+
+  // if a thread can't be created, its band is run on the calling thread
+  for ( int32_t i = 1; i < num_bands; i++ )
+    started[i] = pthread_create( &threads[i], NULL, run_row_band, &bands[i] ) == 0;
+
+  run_row_band( &bands[0] );
+
+  for ( int32_t i = 1; i < num_bands; i++ ) {
+    if ( started[i] )
+      pthread_join( threads[i], NULL );
+    else
+      run_row_band( &bands[i] );
+  }
+}
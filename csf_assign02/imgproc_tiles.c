@@ -0,0 +1,504 @@
+// Tiled out-of-core images: a scratch file of square tiles paged
+// through a bounded LRU cache, and tile-ordered versions of the rgb
+// and kaleidoscope transformations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "imgproc.h"
+
+// Flags for tile_acquire
+#define TILE_DIRTY      1  // the caller will modify the tile
+#define TILE_OVERWRITE  2  // the caller will overwrite every pixel, so don't load it
+
+// A cached tile
+struct TileSlot {
+  int64_t tile;      // index of the cached tile, or -1 if the slot is free
+  int32_t pins;      // number of outstanding tile_acquire calls
+  int dirty;         // modified since it was loaded
+  int32_t prev;      // neighbours in the LRU list (-1 at the ends)
+  int32_t next;
+  uint32_t *pixels;
+};
+
+// Maps an output pixel to the input pixel it is computed from. The
+// output pixel is the input pixel ANDed with *mask.
+typedef void (*TileMapFn)( const struct TileStore *in, const struct TileStore *out,
+                           int32_t x, int32_t y, int32_t *sx, int32_t *sy, uint32_t *mask );
+
+// Output tile with the input tile its first pixel is read from, so
+// output tiles can be processed grouped by input tile
+struct TileOrder {
+  int64_t src_tile;
+  int64_t out_tile;
+};
+
+static size_t tile_bytes( const struct TileStore *ts ) {
+  return (size_t) ts->tile_size * ts->tile_size * sizeof( uint32_t );
+}
+
+static void lru_unlink( struct TileStore *ts, int32_t s ) {
+  struct TileSlot *slot = &ts->slots[s];
+  if ( slot->prev >= 0 )
+    ts->slots[slot->prev].next = slot->next;
+  else
+    ts->lru_head = slot->next;
+  if ( slot->next >= 0 )
+    ts->slots[slot->next].prev = slot->prev;
+  else
+    ts->lru_tail = slot->prev;
+  slot->prev = slot->next = -1;
+}
+
+// Insert a slot at the most recently used end of the LRU list
+static void lru_push_front( struct TileStore *ts, int32_t s ) {
+  struct TileSlot *slot = &ts->slots[s];
+  slot->prev = -1;
+  slot->next = ts->lru_head;
+  if ( ts->lru_head >= 0 )
+    ts->slots[ts->lru_head].prev = s;
+  ts->lru_head = s;
+  if ( ts->lru_tail < 0 )
+    ts->lru_tail = s;
+}
+
+static int write_tile( struct TileStore *ts, struct TileSlot *slot ) {
+  size_t n = tile_bytes( ts );
+  off_t off = (off_t) slot->tile * (off_t) n;
+  size_t done = 0;
+  while ( done < n ) {
+    ssize_t rc = pwrite( ts->fd, (char *) slot->pixels + done, n - done, off + done );
+    if ( rc <= 0 )
+      return 0;
+    done += (size_t) rc;
+  }
+  ts->on_disk[slot->tile] = 1;
+  ts->writebacks++;
+  return 1;
+}
+
+static int read_tile( struct TileStore *ts, struct TileSlot *slot ) {
+  size_t n = tile_bytes( ts );
+  if ( !ts->on_disk[slot->tile] ) {
+    // never written: opaque black, as with img_init
+    size_t num_pixels = n / sizeof( uint32_t );
+    for ( size_t i = 0; i < num_pixels; i++ )
+      slot->pixels[i] = 0x000000FFU;
+    return 1;
+  }
+  off_t off = (off_t) slot->tile * (off_t) n;
+  size_t done = 0;
+  while ( done < n ) {
+    ssize_t rc = pread( ts->fd, (char *) slot->pixels + done, n - done, off + done );
+    if ( rc <= 0 )
+      return 0;
+    done += (size_t) rc;
+  }
+  return 1;
+}
+
+// Get a pinned pointer to the pixels of a tile, loading it (and
+// evicting the least recently used unpinned tile) if necessary.
+// Returns NULL if every slot is pinned or the scratch file can't be
+// accessed.
+static uint32_t *tile_acquire( struct TileStore *ts, int64_t tile, int flags ) {
+  int32_t s = ts->slot_of_tile[tile];
+  if ( s >= 0 ) {
+    ts->hits++;
+  } else {
+    ts->misses++;
+    s = ts->lru_tail;
+    while ( s >= 0 && ts->slots[s].pins > 0 )
+      s = ts->slots[s].prev;
+    if ( s < 0 )
+      return NULL;
+
+    struct TileSlot *victim = &ts->slots[s];
+    if ( victim->tile >= 0 ) {
+      if ( victim->dirty && !write_tile( ts, victim ) )
+        return NULL;
+      ts->slot_of_tile[victim->tile] = -1;
+    }
+    victim->tile = tile;
+    victim->dirty = 0;
+    if ( !( flags & TILE_OVERWRITE ) && !read_tile( ts, victim ) ) {
+      victim->tile = -1;
+      return NULL;
+    }
+    ts->slot_of_tile[tile] = s;
+  }
+
+  struct TileSlot *slot = &ts->slots[s];
+  lru_unlink( ts, s );
+  lru_push_front( ts, s );
+  slot->pins++;
+  if ( flags & ( TILE_DIRTY | TILE_OVERWRITE ) )
+    slot->dirty = 1;
+  return slot->pixels;
+}
+
+static void tile_release( struct TileStore *ts, int64_t tile ) {
+  int32_t s = ts->slot_of_tile[tile];
+  if ( s >= 0 && ts->slots[s].pins > 0 )
+    ts->slots[s].pins--;
+}
+
+// Create an empty (opaque black) tiled image in a scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore to initialize
+//   width, height - image dimensions
+//   tile_size - width and height of the square tiles, in pixels
+//   memory_budget - bytes of tile cache; at least one tile is cached
+//
+// Returns:
+//   1 if successful, 0 if a parameter is invalid, memory could not
+//   be allocated or the scratch file could not be created
+int imgproc_tile_store_init( struct TileStore *ts, int32_t width, int32_t height,
+                             int32_t tile_size, size_t memory_budget ) {
+  if ( width <= 0 || height <= 0 || tile_size <= 0 || tile_size > 4096 )
+    return 0;
+
+  memset( ts, 0, sizeof( *ts ) );
+  ts->width = width;
+  ts->height = height;
+  ts->tile_size = tile_size;
+  ts->tiles_x = ( width + tile_size - 1 ) / tile_size;
+  ts->tiles_y = ( height + tile_size - 1 ) / tile_size;
+  ts->fd = -1;
+  ts->lru_head = ts->lru_tail = -1;
+
+  int64_t num_tiles = (int64_t) ts->tiles_x * ts->tiles_y;
+  size_t num_slots = memory_budget / tile_bytes( ts );
+  if ( num_slots < 1 )
+    num_slots = 1;
+  if ( (int64_t) num_slots > num_tiles )
+    num_slots = (size_t) num_tiles;
+  ts->num_slots = (int32_t) num_slots;
+
+  const char *dir = getenv( "TMPDIR" );
+  if ( dir == NULL || *dir == '\0' )
+    dir = "/tmp";
+  char path[4096];
+  if ( snprintf( path, sizeof( path ), "%s/img-tiles-XXXXXX", dir ) >= (int) sizeof( path ) )
+    return 0;
+  ts->fd = mkstemp( path );
+  if ( ts->fd < 0 )
+    return 0;
+  unlink( path );
+
+  ts->slots = (struct TileSlot *) calloc( num_slots, sizeof( struct TileSlot ) );
+  ts->slot_of_tile = (int32_t *) malloc( num_tiles * sizeof( int32_t ) );
+  ts->on_disk = (uint8_t *) calloc( num_tiles, 1 );
+  if ( ts->slots == NULL || ts->slot_of_tile == NULL || ts->on_disk == NULL ) {
+    imgproc_tile_store_cleanup( ts );
+    return 0;
+  }
+  for ( int64_t t = 0; t < num_tiles; t++ )
+    ts->slot_of_tile[t] = -1;
+  for ( int32_t s = 0; s < ts->num_slots; s++ ) {
+    ts->slots[s].tile = -1;
+    ts->slots[s].prev = ts->slots[s].next = -1;
+    ts->slots[s].pixels = (uint32_t *) malloc( tile_bytes( ts ) );
+    if ( ts->slots[s].pixels == NULL ) {
+      imgproc_tile_store_cleanup( ts );
+      return 0;
+    }
+    lru_push_front( ts, s );
+  }
+  return 1;
+}
+
+// Free the tile cache of a TileStore and remove its scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore to clean up
+void imgproc_tile_store_cleanup( struct TileStore *ts ) {
+  if ( ts->slots != NULL ) {
+    for ( int32_t s = 0; s < ts->num_slots; s++ )
+      free( ts->slots[s].pixels );
+  }
+  free( ts->slots );
+  free( ts->slot_of_tile );
+  free( ts->on_disk );
+  if ( ts->fd >= 0 )
+    close( ts->fd );
+  ts->slots = NULL;
+  ts->slot_of_tile = NULL;
+  ts->on_disk = NULL;
+  ts->fd = -1;
+}
+
+// Read one pixel of a tiled image.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//   x, y - column and row of the pixel
+//   pixel - where to store the pixel value
+//
+// Returns:
+//   1 if successful, 0 if the pixel is out of bounds or its tile
+//   could not be loaded
+int imgproc_tile_get_pixel( struct TileStore *ts, int32_t x, int32_t y, uint32_t *pixel ) {
+  if ( x < 0 || y < 0 || x >= ts->width || y >= ts->height )
+    return 0;
+  int64_t tile = (int64_t) ( y / ts->tile_size ) * ts->tiles_x + x / ts->tile_size;
+  uint32_t *px = tile_acquire( ts, tile, 0 );
+  if ( px == NULL )
+    return 0;
+  *pixel = px[( y % ts->tile_size ) * ts->tile_size + x % ts->tile_size];
+  tile_release( ts, tile );
+  return 1;
+}
+
+// Write one pixel of a tiled image.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//   x, y - column and row of the pixel
+//   pixel - the new pixel value
+//
+// Returns:
+//   1 if successful, 0 if the pixel is out of bounds or its tile
+//   could not be loaded
+int imgproc_tile_put_pixel( struct TileStore *ts, int32_t x, int32_t y, uint32_t pixel ) {
+  if ( x < 0 || y < 0 || x >= ts->width || y >= ts->height )
+    return 0;
+  int64_t tile = (int64_t) ( y / ts->tile_size ) * ts->tiles_x + x / ts->tile_size;
+  uint32_t *px = tile_acquire( ts, tile, TILE_DIRTY );
+  if ( px == NULL )
+    return 0;
+  px[( y % ts->tile_size ) * ts->tile_size + x % ts->tile_size] = pixel;
+  tile_release( ts, tile );
+  return 1;
+}
+
+// Copy rows between an Image and the tiles of a TileStore of the same
+// dimensions, one row of tiles at a time
+static int copy_tiles( struct TileStore *ts, struct Image *img, int to_tiles ) {
+  if ( img->width != ts->width || img->height != ts->height )
+    return 0;
+  int32_t t = ts->tile_size;
+  for ( int32_t ty = 0; ty < ts->tiles_y; ty++ ) {
+    for ( int32_t tx = 0; tx < ts->tiles_x; tx++ ) {
+      int64_t tile = (int64_t) ty * ts->tiles_x + tx;
+      int32_t x0 = tx * t, y0 = ty * t;
+      int32_t w = ts->width - x0 < t ? ts->width - x0 : t;
+      int32_t h = ts->height - y0 < t ? ts->height - y0 : t;
+      uint32_t *px = tile_acquire( ts, tile, to_tiles ? ( w == t && h == t ? TILE_OVERWRITE : TILE_DIRTY ) : 0 );
+      if ( px == NULL )
+        return 0;
+      for ( int32_t r = 0; r < h; r++ ) {
+        uint32_t *row = img->data + (size_t) ( y0 + r ) * img->width + x0;
+        if ( to_tiles )
+          memcpy( px + (size_t) r * t, row, w * sizeof( uint32_t ) );
+        else
+          memcpy( row, px + (size_t) r * t, w * sizeof( uint32_t ) );
+      }
+      tile_release( ts, tile );
+    }
+  }
+  return 1;
+}
+
+// Copy the pixels of an Image into a TileStore of the same dimensions.
+//
+// Parameters:
+//   img - pointer to the source Image
+//   ts - pointer to the destination TileStore
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or tiles could
+//   not be written
+int imgproc_tile_store_from_image( struct Image *img, struct TileStore *ts ) {
+  return copy_tiles( ts, img, 1 );
+}
+
+// Copy the pixels of a TileStore into an Image of the same dimensions.
+//
+// Parameters:
+//   ts - pointer to the source TileStore
+//   img - pointer to the destination Image
+//
+// Returns:
+//   1 if successful, 0 if the dimensions don't match or tiles could
+//   not be read
+int imgproc_tile_store_to_image( struct TileStore *ts, struct Image *img ) {
+  return copy_tiles( ts, img, 0 );
+}
+
+// Write every modified cached tile back to the scratch file.
+//
+// Parameters:
+//   ts - pointer to the TileStore
+//
+// Returns:
+//   1 if successful, 0 if a tile could not be written
+int imgproc_tile_store_flush( struct TileStore *ts ) {
+  for ( int32_t s = 0; s < ts->num_slots; s++ ) {
+    struct TileSlot *slot = &ts->slots[s];
+    if ( slot->tile >= 0 && slot->dirty ) {
+      if ( !write_tile( ts, slot ) )
+        return 0;
+      slot->dirty = 0;
+    }
+  }
+  return 1;
+}
+
+static int compare_tile_order( const void *a, const void *b ) {
+  const struct TileOrder *x = (const struct TileOrder *) a, *y = (const struct TileOrder *) b;
+  if ( x->src_tile != y->src_tile )
+    return x->src_tile < y->src_tile ? -1 : 1;
+  return x->out_tile < y->out_tile ? -1 : ( x->out_tile > y->out_tile );
+}
+
+// Compute every output tile from the input pixels given by map. The
+// output tiles are visited grouped by the input tile they (mostly)
+// read, so each input tile is typically loaded once while all of the
+// output tiles that need it are produced, and each output tile is
+// written exactly once. Only one input and one output tile are pinned
+// at a time, so the result is correct with any memory budget. It is not
+// fast with any budget, though. When the mapping isn't tile-aligned, an
+// output tile reads pixels from several input tiles (2x2 for the shift
+// of imgproc_tiled_rgb), and the input tile is reacquired whenever
+// consecutive pixels come from different ones. With fewer input slots
+// than that, these switches keep evicting a tile that is needed again a
+// few pixels later, and every switch can reread a tile from the scratch
+// file.
+static int tiled_transform( struct TileStore *in, struct TileStore *out, TileMapFn map ) {
+  if ( in == out || in->tile_size != out->tile_size )
+    return 0;
+
+  int32_t t = out->tile_size;
+  int64_t num_out = (int64_t) out->tiles_x * out->tiles_y;
+  struct TileOrder *order = (struct TileOrder *) malloc( num_out * sizeof( struct TileOrder ) );
+  if ( order == NULL )
+    return 0;
+
+  // key each output tile by the input tile of its center pixel
+  for ( int64_t i = 0; i < num_out; i++ ) {
+    int32_t x = (int32_t) ( i % out->tiles_x ) * t + t / 2;
+    int32_t y = (int32_t) ( i / out->tiles_x ) * t + t / 2;
+    if ( x >= out->width ) x = out->width - 1;
+    if ( y >= out->height ) y = out->height - 1;
+    int32_t sx, sy;
+    uint32_t mask;
+    map( in, out, x, y, &sx, &sy, &mask );
+    order[i].src_tile = (int64_t) ( sy / t ) * in->tiles_x + sx / t;
+    order[i].out_tile = i;
+  }
+  qsort( order, num_out, sizeof( struct TileOrder ), compare_tile_order );
+
+  int ok = 1;
+  int64_t cur_src = -1;
+  uint32_t *src_px = NULL;
+  for ( int64_t i = 0; ok && i < num_out; i++ ) {
+    int64_t tile = order[i].out_tile;
+    int32_t x0 = (int32_t) ( tile % out->tiles_x ) * t;
+    int32_t y0 = (int32_t) ( tile / out->tiles_x ) * t;
+    int32_t w = out->width - x0 < t ? out->width - x0 : t;
+    int32_t h = out->height - y0 < t ? out->height - y0 : t;
+    uint32_t *dst = tile_acquire( out, tile, TILE_OVERWRITE );
+    if ( dst == NULL ) {
+      ok = 0;
+      break;
+    }
+
+    for ( int32_t r = 0; ok && r < h; r++ ) {
+      for ( int32_t c = 0; c < w; c++ ) {
+        int32_t sx, sy;
+        uint32_t mask;
+        map( in, out, x0 + c, y0 + r, &sx, &sy, &mask );
+        int64_t src = (int64_t) ( sy / t ) * in->tiles_x + sx / t;
+        if ( src != cur_src ) {
+          if ( cur_src >= 0 )
+            tile_release( in, cur_src );
+          cur_src = -1;
+          src_px = tile_acquire( in, src, 0 );
+          if ( src_px == NULL ) {
+            ok = 0;
+            break;
+          }
+          cur_src = src;
+        }
+        dst[r * t + c] = src_px[( sy % t ) * t + sx % t] & mask;
+      }
+    }
+    tile_release( out, tile );
+  }
+
+  if ( cur_src >= 0 )
+    tile_release( in, cur_src );
+  free( order );
+  return ok;
+}
+
+static void rgb_map( const struct TileStore *in, const struct TileStore *out,
+                     int32_t x, int32_t y, int32_t *sx, int32_t *sy, uint32_t *mask ) {
+  (void) out;
+  static const uint32_t masks[4] = { 0xFFFFFFFFU, 0xFF0000FFU, 0x00FF00FFU, 0x0000FFFFU };
+  int right = x >= in->width, bottom = y >= in->height;
+  *sx = right ? x - in->width : x;
+  *sy = bottom ? y - in->height : y;
+  *mask = masks[bottom * 2 + right];
+}
+
+// Mirror a coordinate into the top left quadrant the way
+// imgproc_kaleidoscope does (for odd sizes, the mirror axis is
+// between the middle two of n + 1 columns, and column 0 is unpaired)
+static int32_t kaleidoscope_fold( int32_t v, int32_t n ) {
+  int32_t padded = ( n & 1 ) ? n + 1 : n;
+  return v < padded / 2 ? v : padded - 1 - v;
+}
+
+static void kaleidoscope_map( const struct TileStore *in, const struct TileStore *out,
+                              int32_t x, int32_t y, int32_t *sx, int32_t *sy, uint32_t *mask ) {
+  (void) out;
+  int32_t fx = kaleidoscope_fold( x, in->width ), fy = kaleidoscope_fold( y, in->height );
+  // wedge A: the row is at most the column
+  *sx = fx > fy ? fx : fy;
+  *sy = fx > fy ? fy : fx;
+  *mask = 0xFFFFFFFFU;
+}
+
+// Tiled version of imgproc_rgb, with identical results. Output tiles
+// are produced grouped by the input tile they read, so each input
+// tile is normally loaded once and each output tile written once.
+//
+// Parameters:
+//   input_img - pointer to the input TileStore
+//   output_img - pointer to the output TileStore (which must have
+//                twice the width and height of the input image and
+//                the same tile size)
+//
+// Returns:
+//   1 if successful, 0 if the output dimensions or tile size are
+//   wrong or tiles could not be loaded or stored
+int imgproc_tiled_rgb( struct TileStore *input_img, struct TileStore *output_img ) {
+  if ( output_img->width != input_img->width * 2 || output_img->height != input_img->height * 2 )
+    return 0;
+  return tiled_transform( input_img, output_img, rgb_map );
+}
+
+// Tiled version of imgproc_kaleidoscope, with identical results.
+// Each output tile reads its mirror image in wedge A, and output tiles
+// are produced grouped by that source tile, so the eight mirrored
+// copies of an input tile are written while it is cached.
+//
+// Parameters:
+//   input_img - pointer to the input TileStore (which must be square)
+//   output_img - pointer to the output TileStore (with the same
+//                dimensions and tile size)
+//
+// Returns:
+//   1 if successful, 0 if the image isn't square, the dimensions or
+//   tile sizes don't match or tiles could not be loaded or stored
+int imgproc_tiled_kaleidoscope( struct TileStore *input_img, struct TileStore *output_img ) {
+  if ( input_img->width != input_img->height || output_img->width != input_img->width
+       || output_img->height != input_img->height )
+    return 0;
+  return tiled_transform( input_img, output_img, kaleidoscope_map );
+}
@@ -1,6 +1,6 @@
 #! /usr/bin/env bash
 
-# Run c_imgproc or asm_imgproc on test input and check whether
+# Run c_imgproc, asm_imgproc or cpp_imgproc on test input and check whether
 # the correct output images are produced.
 
 error_count="0"
@@ -22,7 +22,7 @@ run_test() {
 
 if [[ $# != 1 ]]; then
   >&2 echo "Usage: ./run_all.sh <exe version>"
-  >&2 echo "  <exe version> is 'c' or 'asm'"
+  >&2 echo "  <exe version> is 'c', 'asm' or 'cpp'"
   exit 1
 fi
 
@@ -1,7 +1,7 @@
 #! /usr/bin/env ruby
 
-# Execute a transformation on a test image using either c_imgproc
-# or asm_imgproc and check whether the transformation succeeds,
+# Execute a transformation on a test image using c_imgproc,
+# asm_imgproc or cpp_imgproc and check whether the transformation succeeds,
 # and whether the output image matches the expected output image
 # exactly.
 
@@ -26,7 +26,7 @@ end
 
 if ARGV.length < 3
   STDERR.puts "Usage: ./run_test.rb <exe version> <image stem> <transformation> [<transformation arg> ...]"
-  STDERR.puts "   <exe version> is 'c' or 'asm'"
+  STDERR.puts "   <exe version> is 'c', 'asm' or 'cpp'"
   exit 1
 end
 
@@ -1,19 +1,44 @@
 #include "args.h"
 
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
 /*
  * Check if a number is a power of 2.
  */
 bool is_power_of_2(int n) { return n > 0 && (n & (n - 1)) == 0; }
 
+/*
+ * Parse an optional "--name=value" setting that follows the
+ * positional arguments.
+ */
+static bool parse_option(const std::string &option, CacheConfig &config) {
+  if (option == "--layout=auto") {
+    config.layout = SetLayout::Auto;
+  } else if (option == "--layout=linear") {
+    config.layout = SetLayout::Linear;
+  } else if (option == "--layout=indexed") {
+    config.layout = SetLayout::Indexed;
+  } else if (option == "--layout=flat") {
+    config.layout = SetLayout::Flat;
+  } else {
+    std::cerr << "Error: Invalid option " << option << std::endl;
+    return false;
+  }
+  return true;
+}
+
 /*
  * Parse command line arguments and validate them.
  */
 bool parse_args(int argc, std::vector<std::string> argv, CacheConfig &config) {
-  if (argc != 7) {
+  if (argc < 7) {
     std::cerr
         << "Usage: " << argv[0]
         << " <sets> <blocks> <blocksize> <write-allocate|no-write-allocate> "
-           "<write-through|write-back> <lru|fifo>"
+           "<write-through|write-back> "
+           "<lru|fifo|plru|srrip|brrip|lfu|random|opt>"
         << std::endl;
     return false;
   }
@@ -63,16 +88,228 @@ bool parse_args(int argc, std::vector<std::string> argv, CacheConfig &config) {
     return false;
   }
 
-  // parse LRU/FIFO arg
+  // parse replacement policy arg
   std::string replacementStr = argv[6];
   if (replacementStr == "lru") {
-    config.is_lru = true;
+    config.policy = Policy::Lru;
   } else if (replacementStr == "fifo") {
-    config.is_lru = false;
+    config.policy = Policy::Fifo;
+  } else if (replacementStr == "plru") {
+    config.policy = Policy::TreePlru;
+  } else if (replacementStr == "srrip") {
+    config.policy = Policy::Srrip;
+  } else if (replacementStr == "brrip") {
+    config.policy = Policy::Brrip;
+  } else if (replacementStr == "lfu") {
+    config.policy = Policy::Lfu;
+  } else if (replacementStr == "random") {
+    config.policy = Policy::Random;
+  } else if (replacementStr == "opt") {
+    config.policy = Policy::Opt;
   } else {
     std::cerr << "Error: Invalid replacement policy" << std::endl;
     return false;
   }
+  config.is_lru = config.policy == Policy::Lru;
 
+  config.layout = SetLayout::Auto;
+  for (int i = 7; i < argc; i++) {
+    if (!parse_option(argv[i], config)) return false;
+  }
+  if ((config.layout == SetLayout::Indexed ||
+       config.layout == SetLayout::Flat) &&
+      config.policy != Policy::Lru && config.policy != Policy::Fifo) {
+    std::cerr << "Error: The "
+              << (config.layout == SetLayout::Flat ? "flat" : "indexed")
+              << " layout supports only lru and fifo" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Parse the command line of a sweep: --sweep=<file> [--threads=<n>].
+ */
+bool parse_sweep_args(int argc, std::vector<std::string> argv,
+                      std::string &sweep_path, unsigned &num_threads) {
+  sweep_path = "";
+  num_threads = std::thread::hardware_concurrency();
+  for (int i = 1; i < argc; i++) {
+    if (argv[i].compare(0, 8, "--sweep=") == 0) {
+      sweep_path = argv[i].substr(8);
+    } else if (argv[i].compare(0, 10, "--threads=") == 0 &&
+               std::atoi(argv[i].c_str() + 10) > 0) {
+      num_threads = std::atoi(argv[i].c_str() + 10);
+    } else {
+      std::cerr << "Error: Invalid option " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  if (sweep_path.empty()) {
+    std::cerr << "Usage: " << argv[0] << " --sweep=<file> [--threads=<n>]"
+              << std::endl;
+    return false;
+  }
+  if (num_threads == 0) num_threads = 1;
+  return true;
+}
+
+/*
+ * Parse the command line of a stack-distance analysis:
+ * --stack-distance=<block size> [--sets=<n>,<n>,...] [--max-ways=<n>]
+ * [--threads=<n>].
+ */
+bool parse_stack_distance_args(int argc, std::vector<std::string> argv,
+                               StackDistanceArgs &args) {
+  args.block_size = 0;
+  args.set_counts.clear();
+  args.max_ways = 1024;
+  args.num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++) {
+    const std::string &arg = argv[i];
+    if (arg.compare(0, 17, "--stack-distance=") == 0) {
+      args.block_size = std::atoi(arg.c_str() + 17);
+    } else if (arg.compare(0, 7, "--sets=") == 0) {
+      std::istringstream list(arg.substr(7));
+      std::string count;
+      while (std::getline(list, count, ','))
+        args.set_counts.push_back(std::atoi(count.c_str()));
+    } else if (arg.compare(0, 11, "--max-ways=") == 0) {
+      args.max_ways = std::atoi(arg.c_str() + 11);
+    } else if (arg.compare(0, 10, "--threads=") == 0 &&
+               std::atoi(arg.c_str() + 10) > 0) {
+      args.num_threads = std::atoi(arg.c_str() + 10);
+    } else {
+      std::cerr << "Error: Invalid option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  if (args.set_counts.empty()) {
+    for (uint32_t sets = 1; sets <= 1024; sets *= 2)
+      args.set_counts.push_back(sets);
+  }
+  bool valid = is_power_of_2(args.block_size) && args.block_size >= 4 &&
+               is_power_of_2(args.max_ways);
+  for (uint32_t sets : args.set_counts) valid = valid && is_power_of_2(sets);
+  if (!valid) {
+    std::cerr << "Error: Sets, ways, and block size must be powers of 2, "
+                 "and block size must be at least 4 bytes"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Parse the command line of a set-partitioned simulation:
+ * --threads=<n> followed by the arguments of csim.
+ */
+bool parse_partition_args(int argc, std::vector<std::string> argv,
+                          CacheConfig &config, unsigned &num_threads) {
+  if (argc < 2 || argv[1].compare(0, 10, "--threads=") != 0 ||
+      std::atoi(argv[1].c_str() + 10) <= 0) {
+    std::cerr << "Error: Invalid option " << (argc < 2 ? "" : argv[1])
+              << std::endl;
+    return false;
+  }
+  num_threads = std::atoi(argv[1].c_str() + 10);
+
+  // the rest are the arguments of the cache
+  argv.erase(argv.begin() + 1);
+  if (!parse_args(argc - 1, argv, config)) return false;
+  if (config.policy == Policy::Opt) {
+    std::cerr << "Error: opt can't be run on several threads" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Parse the command line of a simulation with a prefetcher:
+ * --prefetch=<next-line|stride|stream> followed by the arguments of csim.
+ */
+bool parse_prefetch_args(int argc, std::vector<std::string> argv,
+                         CacheConfig &config, Prefetcher &prefetcher) {
+  std::string option = argc < 2 ? "" : argv[1];
+  if (option == "--prefetch=next-line") {
+    prefetcher = Prefetcher::NextLine;
+  } else if (option == "--prefetch=stride") {
+    prefetcher = Prefetcher::Stride;
+  } else if (option == "--prefetch=stream") {
+    prefetcher = Prefetcher::Stream;
+  } else {
+    std::cerr << "Error: Invalid option " << option << std::endl;
+    return false;
+  }
+
+  // the rest are the arguments of the cache
+  argv.erase(argv.begin() + 1);
+  if (!parse_args(argc - 1, argv, config)) return false;
+  if (config.policy == Policy::Opt) {
+    // the next uses would have to include the prefetches
+    std::cerr << "Error: opt can't be run with a prefetcher" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Parse the command line of a multicore simulation:
+ * --coherence=<mesi|moesi> <--cores=<n>|--traces=<file>,<file>,...>
+ * followed by the arguments of csim for each core's cache.
+ */
+bool parse_coherence_args(int argc, std::vector<std::string> argv,
+                          CoherenceArgs &args) {
+  args.protocol = Protocol::Mesi;
+  args.num_cores = 0;
+  args.trace_paths.clear();
+  int i = 1;
+  for (; i < argc && argv[i].compare(0, 2, "--") == 0; i++) {
+    const std::string &arg = argv[i];
+    if (arg == "--coherence=mesi") {
+      args.protocol = Protocol::Mesi;
+    } else if (arg == "--coherence=moesi") {
+      args.protocol = Protocol::Moesi;
+    } else if (arg.compare(0, 8, "--cores=") == 0 &&
+               std::atoi(arg.c_str() + 8) > 0) {
+      args.num_cores = std::atoi(arg.c_str() + 8);
+    } else if (arg.compare(0, 9, "--traces=") == 0) {
+      std::istringstream list(arg.substr(9));
+      std::string path;
+      while (std::getline(list, path, ',')) args.trace_paths.push_back(path);
+      args.num_cores = args.trace_paths.size();
+    } else {
+      std::cerr << "Error: Invalid option " << arg << std::endl;
+      return false;
+    }
+  }
+  if (!args.trace_paths.empty() &&
+      args.num_cores != args.trace_paths.size()) {
+    std::cerr << "Error: --cores must match the number of --traces"
+              << std::endl;
+    return false;
+  }
+  if (args.num_cores == 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " --coherence=<mesi|moesi> "
+                 "<--cores=<n>|--traces=<file>,<file>,...> <sets> <blocks> "
+                 "<blocksize> write-allocate write-back <policy>"
+              << std::endl;
+    return false;
+  }
+
+  // the rest are the arguments of each core's cache
+  std::vector<std::string> cache_args = {argv[0]};
+  cache_args.insert(cache_args.end(), argv.begin() + i, argv.begin() + argc);
+  if (!parse_args(cache_args.size(), cache_args, args.config)) return false;
+  if (!args.config.write_allocate || args.config.write_through ||
+      args.config.policy == Policy::Opt) {
+    std::cerr << "Error: Coherent caches must be write-allocate and "
+                 "write-back, and can't use opt"
+              << std::endl;
+    return false;
+  }
   return true;
-}
\ No newline at end of file
+}
@@ -2,6 +2,24 @@
 #define ARGS_H
 
 #include "cache.h"
+#include "coherence.h"
+#include "prefetch.h"
+
+// Settings of a stack-distance analysis
+struct StackDistanceArgs {
+  uint32_t block_size;
+  std::vector<uint32_t> set_counts;
+  uint32_t max_ways;
+  unsigned num_threads;
+};
+
+// Settings of a multicore coherence simulation
+struct CoherenceArgs {
+  Protocol protocol;
+  size_t num_cores;
+  std::vector<std::string> trace_paths;  // one per core, or empty
+  CacheConfig config;                    // of each core's cache
+};
 
 /*
  * Check if a number is a power of 2.
@@ -13,4 +31,40 @@ bool is_power_of_2(int n);
  */
 bool parse_args(int argc, std::vector<std::string> argv, CacheConfig &config);
 
+/*
+ * Parse the command line of a sweep: --sweep=<file> [--threads=<n>].
+ */
+bool parse_sweep_args(int argc, std::vector<std::string> argv,
+                      std::string &sweep_path, unsigned &num_threads);
+
+/*
+ * Parse the command line of a stack-distance analysis:
+ * --stack-distance=<block size> [--sets=<n>,<n>,...] [--max-ways=<n>]
+ * [--threads=<n>].
+ */
+bool parse_stack_distance_args(int argc, std::vector<std::string> argv,
+                               StackDistanceArgs &args);
+
+/*
+ * Parse the command line of a set-partitioned simulation:
+ * --threads=<n> followed by the arguments of csim.
+ */
+bool parse_partition_args(int argc, std::vector<std::string> argv,
+                          CacheConfig &config, unsigned &num_threads);
+
+/*
+ * Parse the command line of a simulation with a prefetcher:
+ * --prefetch=<next-line|stride|stream> followed by the arguments of csim.
+ */
+bool parse_prefetch_args(int argc, std::vector<std::string> argv,
+                         CacheConfig &config, Prefetcher &prefetcher);
+
+/*
+ * Parse the command line of a multicore simulation:
+ * --coherence=<mesi|moesi> <--cores=<n>|--traces=<file>,<file>,...>
+ * followed by the arguments of csim for each core's cache.
+ */
+bool parse_coherence_args(int argc, std::vector<std::string> argv,
+                          CoherenceArgs &args);
+
 #endif
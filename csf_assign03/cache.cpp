@@ -1,5 +1,13 @@
 #include "cache.h"
 
+#include <algorithm>
+#include <cassert>
+#include <type_traits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 int Set::find_hit(uint32_t tag) {
   for (size_t i = 0; i < valid_count; i++)
     if (slots[i].tag == tag) return static_cast<int>(i);
@@ -37,29 +45,315 @@ void Set::update_lru(uint32_t reference) {
   }
 }
 
-Cache::Cache(CacheConfig config) : config(config) {
-  this->sets.resize(config.num_sets, Set(config.num_blocks));
+void Set::touch(size_t slot_index, bool is_lru, uint64_t next_use) {
+  if (is_lru) {
+    // increment access order that is smaller than the current hit
+    update_lru(slots[slot_index].access_order);
+    slots[slot_index].access_order = 0;
+  }
+}
+
+void Set::fill(size_t slot_index, uint32_t tag, bool is_lru,
+               uint64_t next_use) {
+  if (is_lru) {
+    update_lru(slots.size());  // increment all slots
+    slots[slot_index] = {tag, false, 0};
+  } else {
+    mark_insertion_fifo(slot_index);
+    slots[slot_index].tag = tag;
+    slots[slot_index].dirty = false;
+  }
+}
+
+// Remove a block, moving the last valid slot into its place
+void Set::invalidate(size_t slot_index) {
+  uint32_t order = slots[slot_index].access_order;
+  valid_count--;
+  slots[slot_index] = slots[valid_count];
+  slots[valid_count] = {0, false, 0, 0};
+  // close the gap in the LRU ranks (keeps the FIFO order too)
+  for (size_t i = 0; i < valid_count; i++) {
+    if (slots[i].access_order > order) slots[i].access_order--;
+  }
+}
+
+IndexedSet::IndexedSet(size_t size)
+    : slots(size), links(size + 1), valid_count(0), filled_count(0) {
+  links[head()] = {head(), head()};
+  slot_of.reserve(size);
+}
+
+int IndexedSet::find_victim_slot(bool is_lru) {
+  if (valid_count < slots.size()) return valid_count++;
+  return links[head()].prev;  // least recently used, or first inserted
+}
+
+void IndexedSet::fill(size_t slot_index, uint32_t tag, bool is_lru,
+                      uint64_t next_use) {
+  if (slot_index < filled_count) {  // evict the old block
+    slot_of.erase(slots[slot_index].tag);
+    unlink(slot_index);
+  } else {
+    filled_count++;
+  }
+  slot_of[tag] = slot_index;
+  push_front(slot_index);
+  slots[slot_index].tag = tag;
+  slots[slot_index].dirty = false;
+}
+
+// Remove a block, moving the last valid slot into its place
+void IndexedSet::invalidate(size_t slot_index) {
+  slot_of.erase(slots[slot_index].tag);
+  unlink(slot_index);
+  size_t last = filled_count - 1;
+  if (slot_index != last) {
+    slots[slot_index] = slots[last];
+    slot_of[slots[slot_index].tag] = slot_index;
+    links[slot_index] = links[last];
+    links[links[slot_index].prev].next = slot_index;
+    links[links[slot_index].next].prev = slot_index;
+  }
+  slots[last] = {0, false, 0, 0};
+  filled_count--;
+  valid_count--;
+}
+
+// Tags of a FlatSet are compared in chunks of this many
+static const size_t FLAT_CHUNK = 16;
+
+FlatSets::FlatSets(size_t num_sets, size_t ways)
+    : ways(ways),
+      stride((ways + FLAT_CHUNK - 1) / FLAT_CHUNK * FLAT_CHUNK),
+      tags(num_sets * stride),
+      ages(num_sets * stride),
+      dirty((num_sets * stride + 63) / 64),
+      valid_counts(num_sets) {}
+
+#if defined(__x86_64__)
+/*
+ * Find the first of count tags equal to tag, comparing 16 and then 8 at a
+ * time, so up to 7 tags past count are compared too.
+ */
+__attribute__((target("avx2"))) static size_t find_tag_avx2(
+    const uint32_t *tags, size_t count, uint32_t tag) {
+  __m256i key = _mm256_set1_epi32(static_cast<int>(tag));
+  size_t end = (count + 7) / 8 * 8;
+  size_t i = 0;
+  for (; i + 16 <= end; i += 16) {
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i));
+    __m256i high =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i + 8));
+    unsigned mask =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(low, key))) |
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(high, key)))
+            << 8;
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  for (; i < end; i += 8) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i));
+    unsigned mask = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, key)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return end;
+}
+
+// Checked once: the Makefile does not build for AVX2 machines only
+static const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+int FlatSet::find_hit(uint32_t tag) const {
+  const uint32_t *tags = &sets->tags[base];
+  size_t count = *valid_count;
+#if defined(__x86_64__)
+  if (HAS_AVX2) {
+    // the padding and invalid slots may match too, so check the index
+    size_t i = find_tag_avx2(tags, count, tag);
+    return i < count ? static_cast<int>(i) : -1;
+  }
+#endif
+  for (size_t i = 0; i < count; i++)
+    if (tags[i] == tag) return static_cast<int>(i);
+  return -1;
+}
+
+int FlatSet::find_victim_slot(bool is_lru) {
+  if (*valid_count < sets->ways) return (*valid_count)++;
+  // the oldest block is the one with the largest age
+  const uint16_t *ages = &sets->ages[base];
+  uint16_t oldest = static_cast<uint16_t>(sets->ways - 1);
+  size_t i = 0;
+  while (ages[i] != oldest) i++;
+  return static_cast<int>(i);
+}
+
+void FlatSet::touch(size_t slot_index, bool is_lru, uint64_t next_use) {
+  if (!is_lru) return;
+  uint16_t *ages = &sets->ages[base];
+  uint16_t age = ages[slot_index];
+  for (size_t i = 0; i < *valid_count; i++) ages[i] += ages[i] < age;
+  ages[slot_index] = 0;
+}
+
+void FlatSet::fill(size_t slot_index, uint32_t tag, bool is_lru,
+                   uint64_t next_use) {
+  // the new block is the most recently used, and the last inserted
+  uint16_t *ages = &sets->ages[base];
+  for (size_t i = 0; i < *valid_count; i++) ages[i]++;
+  ages[slot_index] = 0;
+  sets->tags[base + slot_index] = tag;
+  (*this)[slot_index].dirty = false;
+}
+
+// Remove a block, moving the last valid slot into its place
+void FlatSet::invalidate(size_t slot_index) {
+  uint16_t *ages = &sets->ages[base];
+  uint16_t age = ages[slot_index];
+  size_t last = --*valid_count;
+  sets->tags[base + slot_index] = sets->tags[base + last];
+  ages[slot_index] = ages[last];
+  (*this)[slot_index].dirty = bool((*this)[last].dirty);
+  sets->tags[base + last] = 0;
+  ages[last] = 0;
+  (*this)[last].dirty = false;
+  for (size_t i = 0; i < last; i++) ages[i] -= ages[i] > age;
+}
+
+void print_stats(const CacheStats &stats) {
+  std::cout << "Total loads: " << stats.total_loads << std::endl;
+  std::cout << "Total stores: " << stats.total_stores << std::endl;
+  std::cout << "Load hits: " << stats.load_hits << std::endl;
+  std::cout << "Load misses: " << stats.load_misses << std::endl;
+  std::cout << "Store hits: " << stats.store_hits << std::endl;
+  std::cout << "Store misses: " << stats.store_misses << std::endl;
+  std::cout << "Total cycles: " << stats.total_cycles << std::endl;
+}
+
+void add_stats(CacheStats &total, const CacheStats &stats) {
+  total.total_loads += stats.total_loads;
+  total.total_stores += stats.total_stores;
+  total.load_hits += stats.load_hits;
+  total.load_misses += stats.load_misses;
+  total.store_hits += stats.store_hits;
+  total.store_misses += stats.store_misses;
+  total.total_cycles += stats.total_cycles;
+  total.invalidations += stats.invalidations;
+  total.coherence_misses += stats.coherence_misses;
+  total.transfers += stats.transfers;
+  total.bus_transactions += stats.bus_transactions;
+  total.bus_bytes += stats.bus_bytes;
+  total.prefetches += stats.prefetches;
+  total.useful_prefetches += stats.useful_prefetches;
+  total.late_prefetches += stats.late_prefetches;
+  total.useless_prefetches += stats.useless_prefetches;
+}
+
+// Associativities from which SetLayout::Auto uses FlatSets and IndexedSet.
+// IndexedSet alone took over from 32 ways, but the SIMD scan of FlatSets
+// beats its hash map up to 64 ways, so it now starts at 128.
+static const uint32_t FLAT_MIN_BLOCKS = 8;
+static const uint32_t INDEXED_MIN_BLOCKS = 128;
+
+// Largest associativity of SetLayout::Flat, whose ages are 16-bit
+static const uint32_t FLAT_MAX_BLOCKS = 65536;
+
+// Make the sets of a policy other than LRU and FIFO, each seeded by its
+// index in the whole cache
+template <class P>
+static std::vector<PolicySet<P>> make_policy_sets(const CacheConfig &config) {
+  std::vector<PolicySet<P>> sets;
+  sets.reserve(config.num_sets);
+  for (uint32_t i = 0; i < config.num_sets; i++)
+    sets.emplace_back(config.num_blocks, config.first_set + i);
+  return sets;
+}
+
+Cache::Cache(CacheConfig config) : config(config), next_uses(nullptr) {
+  if (this->config.policy == Policy::Default)
+    this->config.policy = config.is_lru ? Policy::Lru : Policy::Fifo;
+  this->config.is_lru = this->config.policy == Policy::Lru;
+  bool lru_or_fifo = this->config.policy == Policy::Lru ||
+                     this->config.policy == Policy::Fifo;
+  if (!lru_or_fifo) {
+    this->config.layout = SetLayout::Linear;  // PolicySet
+  } else if (this->config.layout == SetLayout::Flat &&
+             config.num_blocks > FLAT_MAX_BLOCKS) {
+    this->config.layout = SetLayout::Linear;
+  } else if (this->config.layout == SetLayout::Auto) {
+    this->config.layout = config.num_blocks >= INDEXED_MIN_BLOCKS
+                              ? SetLayout::Indexed
+                          : config.num_blocks >= FLAT_MIN_BLOCKS
+                              ? SetLayout::Flat
+                              : SetLayout::Linear;
+  }
+
+  switch (this->config.policy) {
+    case Policy::TreePlru:
+      policy_sets = make_policy_sets<TreePlru>(config);
+      break;
+    case Policy::Srrip:
+      policy_sets = make_policy_sets<Srrip>(config);
+      break;
+    case Policy::Brrip:
+      policy_sets = make_policy_sets<Brrip>(config);
+      break;
+    case Policy::Lfu:
+      policy_sets = make_policy_sets<Lfu>(config);
+      break;
+    case Policy::Random:
+      policy_sets = make_policy_sets<RandomPolicy>(config);
+      break;
+    case Policy::Opt:
+      policy_sets = make_policy_sets<Opt>(config);
+      break;
+    default:
+      if (this->config.layout == SetLayout::Indexed)
+        this->indexed_sets.resize(config.num_sets,
+                                  IndexedSet(config.num_blocks));
+      else if (this->config.layout == SetLayout::Flat)
+        this->flat_sets = FlatSets(config.num_sets, config.num_blocks);
+      else
+        this->sets.resize(config.num_sets, Set(config.num_blocks));
+  }
   this->stats = {0, 0, 0, 0, 0, 0, 0};
 }
 
+// Call f with the set of an index, in whichever layout and policy the
+// cache uses; f is instantiated for each kind of set
+template <class F>
+auto Cache::with_set(size_t index, F f) {
+  if (!sets.empty()) return f(sets[index]);
+  if (!indexed_sets.empty()) return f(indexed_sets[index]);
+  if (!flat_sets.empty()) {
+    FlatSet set = flat_sets[index];
+    return f(set);
+  }
+  return std::visit([&](auto &policy_sets) { return f(policy_sets[index]); },
+                    policy_sets);
+}
+
 void Cache::load(uint32_t address) {
-  this->stats.total_loads++;
   // find index for set, tag
   uint32_t tag = get_tag(address);
-  size_t index = get_index(address);
+  uint64_t next_use = this->next_use();
+  with_set(get_index(address),
+           [&](auto &set) { load_set(set, tag, next_use); });
 
-  Set &set = sets[index];
+  //!
+  // debug_print(*this);
+}
+
+template <class S>
+void Cache::load_set(S &set, uint32_t tag, uint64_t next_use) {
+  this->stats.total_loads++;
   int slot_index = set.find_hit(tag);
 
   if (slot_index != -1) {  // hit!!!!
     stats.load_hits++;
     stats.total_cycles++;  // hit takes 1 cycle
-    if (config.is_lru){
-      // increment access order that is smaller than the current hit
-      uint32_t old_order = set[slot_index].access_order;
-      set.update_lru(old_order);
-      set[slot_index].access_order = 0;
-    }
+    set.touch(slot_index, config.is_lru, next_use);
 
   } else {  // if miss, load in memory and set valid = 1, increase all counters
     this->stats.load_misses++;
@@ -70,31 +364,27 @@ void Cache::load(uint32_t address) {
       // dump occupied, memory access takes 100 cycles per 4 bytes
       this->stats.total_cycles += 100ULL * config.block_size / 4;
     }
-    if (config.is_lru){
-      set.update_lru(config.num_blocks);  // increment all slots
-      set[slot_index] = {tag, false, 0};
-    } else {
-      set.mark_insertion_fifo(slot_index);
-      set[slot_index].tag = tag;
-      set[slot_index].dirty = false;
-    }
-
+    set.fill(slot_index, tag, config.is_lru, next_use);
 
     // load from ram and then cache
     this->stats.total_cycles += 1 + 100ULL * config.block_size / 4;
   }
-
-  //!
-  // debug_print(*this);
 }
 
 void Cache::save(uint32_t address) {
-  this->stats.total_stores++;
   // find index for set, tag
   uint32_t tag = get_tag(address);
-  size_t index = get_index(address);
+  uint64_t next_use = this->next_use();
+  with_set(get_index(address),
+           [&](auto &set) { save_set(set, tag, next_use); });
 
-  Set &set = this->sets[index];
+  //!
+  // debug_print(*this);
+}
+
+template <class S>
+void Cache::save_set(S &set, uint32_t tag, uint64_t next_use) {
+  this->stats.total_stores++;
   int slot_index = set.find_hit(tag);
 
   if (slot_index != -1) {  // hit!!!!
@@ -108,12 +398,7 @@ void Cache::save(uint32_t address) {
       set[slot_index].dirty = true;
       this->stats.total_cycles++;  // write to cache only
     }
-
-    // increment access order that is smaller than the current hit
-    if (config.is_lru){
-      set.update_lru(set[slot_index].access_order);
-      set[slot_index].access_order = 0;
-    }
+    set.touch(slot_index, config.is_lru, next_use);
 
   } else {
     stats.store_misses++;
@@ -130,17 +415,8 @@ void Cache::save(uint32_t address) {
       // write occupied to ram
       this->stats.total_cycles += 100 * config.block_size / 4;
     }
-    if (config.is_lru){
-      set.update_lru(config.num_blocks);  // increment all slots
-      set[slot_index] = {tag, false, 0};
-    } else {
-      set.mark_insertion_fifo(slot_index);
-      set[slot_index].tag = tag;
-      set[slot_index].dirty = false; 
-    }
     // load from ram
-    set[slot_index].tag = tag;
-    set[slot_index].dirty = false;
+    set.fill(slot_index, tag, config.is_lru, next_use);
     this->stats.total_cycles += 100 * config.block_size / 4;
 
     if (config.write_through) {
@@ -151,7 +427,136 @@ void Cache::save(uint32_t address) {
       this->stats.total_cycles += 1;  // write to cache only
     }
   }
+}
 
-  //!
-  // debug_print(*this);
-}
\ No newline at end of file
+bool Cache::contains(uint32_t address) {
+  uint32_t tag = get_tag(address);
+  return with_set(get_index(address),
+                  [&](auto &set) { return set.find_hit(tag) != -1; });
+}
+
+bool Cache::probe(uint32_t address, bool make_dirty) {
+  uint32_t tag = get_tag(address);
+  return with_set(get_index(address), [&](auto &set) {
+    int slot_index = set.find_hit(tag);
+    if (slot_index == -1) return false;
+    set.touch(slot_index, config.is_lru, NEVER);
+    if (make_dirty) set[slot_index].dirty = true;
+    return true;
+  });
+}
+
+Eviction Cache::fill(uint32_t address, bool dirty) {
+  uint32_t tag = get_tag(address);
+  size_t index = get_index(address);
+  return with_set(index, [&](auto &set) {
+    Eviction eviction = {false, 0, false};
+    bool full = set.get_valid_count() == int(config.num_blocks);
+    int slot_index = set.find_victim_slot(config.is_lru);
+    if (full) {
+      uint32_t block = set[slot_index].tag * config.num_sets + index;
+      eviction = {true, block * config.block_size, set[slot_index].dirty};
+    }
+    set.fill(slot_index, tag, config.is_lru, NEVER);
+    set[slot_index].dirty = dirty;
+    return eviction;
+  });
+}
+
+bool Cache::remove(uint32_t address, bool &dirty) {
+  uint32_t tag = get_tag(address);
+  return with_set(get_index(address), [&](auto &set) {
+    int slot_index = set.find_hit(tag);
+    if (slot_index == -1) return false;
+    dirty = set[slot_index].dirty;
+    set.invalidate(slot_index);
+    return true;
+  });
+}
+
+Slot *Cache::lookup(uint32_t address, bool touch) {
+  uint32_t tag = get_tag(address);
+  return with_set(get_index(address), [&](auto &set) -> Slot * {
+    int slot_index = set.find_hit(tag);
+    if (slot_index == -1) return nullptr;
+    if (touch) set.touch(slot_index, config.is_lru, NEVER);
+    // FlatSets have no Slot to point to (MulticoreCache does not use them)
+    if constexpr (std::is_same_v<std::decay_t<decltype(set)>, FlatSet>) {
+      assert(!"lookup is not supported by SetLayout::Flat");
+      return nullptr;
+    } else
+      return &set[slot_index];
+  });
+}
+
+// Marks a time slot whose block has been used again since
+static const uint32_t EMPTY = UINT32_MAX;
+
+// Smallest number of time slots of a set
+static const uint32_t MIN_SLOTS = 16;
+
+StackDistance::StackDistance(uint32_t num_sets, uint32_t block_size,
+                             uint32_t max_ways)
+    : num_sets(num_sets),
+      block_size(block_size),
+      max_ways(max_ways),
+      stacks(num_sets),
+      distances(max_ways, 0),
+      accesses(0) {}
+
+// Renumber the time slots of the blocks of a set from 0, keeping their
+// order, with room for at least as many new ones
+void StackDistance::compact(SetStack &stack) {
+  std::vector<uint32_t> blocks;
+  blocks.reserve(stack.live);
+  for (uint32_t block : stack.blocks)
+    if (block != EMPTY) blocks.push_back(block);
+
+  size_t size = std::max<size_t>(MIN_SLOTS, 2 * blocks.size());
+  stack.tree.assign(size + 1, 0);
+  for (size_t i = 1; i <= size; i++) {
+    if (i <= blocks.size()) {
+      last_slot[blocks[i - 1]] = i - 1;
+      stack.tree[i] += 1;
+    }
+    // linear time construction: add each node to its parent
+    size_t parent = i + (i & -i);
+    if (parent <= size) stack.tree[parent] += stack.tree[i];
+  }
+  stack.blocks.swap(blocks);
+}
+
+void StackDistance::access(uint32_t address) {
+  uint32_t block = address / block_size;
+  SetStack &stack = stacks[block % num_sets];
+  accesses++;
+
+  auto [it, first_use] = last_slot.try_emplace(block, 0);
+  if (!first_use) {
+    uint32_t slot = it->second;
+    // blocks used after the slot: the live ones minus those up to it
+    uint32_t before = 0;
+    for (size_t i = slot + 1; i > 0; i -= i & -i) before += stack.tree[i];
+    uint32_t distance = stack.live - before;
+    if (distance < max_ways) distances[distance]++;
+
+    for (size_t i = slot + 1; i < stack.tree.size(); i += i & -i)
+      stack.tree[i]--;
+    stack.blocks[slot] = EMPTY;
+    stack.live--;
+  }
+
+  if (stack.blocks.size() + 1 >= stack.tree.size()) compact(stack);
+  uint32_t slot = stack.blocks.size();
+  stack.blocks.push_back(block);
+  for (size_t i = slot + 1; i < stack.tree.size(); i += i & -i)
+    stack.tree[i]++;
+  stack.live++;
+  it->second = slot;
+}
+
+uint64_t StackDistance::get_misses(uint32_t ways) const {
+  uint64_t hits = 0;
+  for (uint32_t d = 0; d < ways && d < max_ways; d++) hits += distances[d];
+  return accesses - hits;
+}
@@ -2,9 +2,21 @@
 #define CACHE_H
 
 #include <cstdint>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 
 #include "debug.h"
+#include "policy.h"
+
+// MESI/MOESI state of a valid block in a multicore simulation (see
+// coherence.h); a block that isn't in the cache is invalid
+enum class BlockState : uint8_t {
+  Exclusive,  // the only copy, clean
+  Shared,     // one of several copies, clean unless another is Owned
+  Modified,   // the only copy, dirty
+  Owned,      // dirty, and others may have Shared copies (MOESI)
+};
 
 // Actual slot that mocks cache
 struct Slot {
@@ -12,6 +24,7 @@ struct Slot {
   bool dirty;
   uint32_t access_order;  // 0 = frequently used
   uint64_t insertion_time;
+  BlockState state = BlockState::Exclusive;  // unused by a single core
 };
 
 // Each set of slots
@@ -22,7 +35,7 @@ class Set {
   uint64_t fifo_counter;  
 
  public:
-  Set(size_t size) : slots(size), valid_count(0) {}
+  Set(size_t size) : slots(size), valid_count(0), fifo_counter(0) {}
   int find_hit(uint32_t tag);
   int find_victim_slot(bool is_lru);
   void update_lru(uint32_t reference);
@@ -30,11 +43,189 @@ class Set {
     slots[slot_index].access_order = fifo_counter;
     fifo_counter++;
   }
+  void touch(size_t slot_index, bool is_lru, uint64_t next_use);
+  void fill(size_t slot_index, uint32_t tag, bool is_lru, uint64_t next_use);
+  void invalidate(size_t slot_index);
+  int get_valid_count() const { return valid_count; }
+  Slot& operator[](size_t index) { return this->slots[index]; }
+  const Slot& operator[](size_t index) const { return this->slots[index]; }
+};
+
+// Set with O(1) hit, miss and eviction for highly associative caches:
+// a tag-to-slot hash map for lookups and a doubly linked list (threaded
+// through the slot numbers) in recency order for LRU, or in insertion
+// order for FIFO. Like Set, it keeps the valid slots at the head.
+class IndexedSet {
+ private:
+  struct Link {
+    uint32_t prev;
+    uint32_t next;
+  };
+
+  std::vector<Slot> slots;
+  std::vector<Link> links;  // links[slots.size()] is the list head
+  std::unordered_map<uint32_t, uint32_t> slot_of;  // tag -> slot
+  size_t valid_count;
+  size_t filled_count;  // slots in slot_of and the list
+
+  uint32_t head() const { return static_cast<uint32_t>(slots.size()); }
+  void unlink(uint32_t slot_index) {
+    links[links[slot_index].prev].next = links[slot_index].next;
+    links[links[slot_index].next].prev = links[slot_index].prev;
+  }
+  void push_front(uint32_t slot_index) {
+    links[slot_index] = {head(), links[head()].next};
+    links[links[head()].next].prev = slot_index;
+    links[head()].next = slot_index;
+  }
+
+ public:
+  IndexedSet(size_t size);
+  int find_hit(uint32_t tag) const {
+    auto it = slot_of.find(tag);
+    return it == slot_of.end() ? -1 : static_cast<int>(it->second);
+  }
+  int find_victim_slot(bool is_lru);
+  void touch(size_t slot_index, bool is_lru, uint64_t next_use) {
+    if (is_lru) {
+      unlink(slot_index);
+      push_front(slot_index);
+    }
+  }
+  void fill(size_t slot_index, uint32_t tag, bool is_lru, uint64_t next_use);
+  void invalidate(size_t slot_index);
+  int get_valid_count() const { return valid_count; }
+  Slot& operator[](size_t index) { return this->slots[index]; }
+  const Slot& operator[](size_t index) const { return this->slots[index]; }
+};
+
+// Set with one of the replacement policies of policy.h. Like Set, it
+// keeps the valid slots at the head and scans them for hits.
+template <class P>
+class PolicySet {
+ private:
+  std::vector<Slot> slots;
+  size_t valid_count;
+  P policy;
+
+ public:
+  PolicySet(size_t size, uint64_t seed)
+      : slots(size), valid_count(0), policy(size, seed) {}
+  int find_hit(uint32_t tag) const {
+    for (size_t i = 0; i < valid_count; i++)
+      if (slots[i].tag == tag) return static_cast<int>(i);
+    return -1;
+  }
+  int find_victim_slot(bool is_lru) {
+    if (valid_count < slots.size()) return valid_count++;
+    return policy.victim();
+  }
+  void touch(size_t slot_index, bool is_lru, uint64_t next_use) {
+    policy.touch(slot_index, next_use);
+  }
+  void fill(size_t slot_index, uint32_t tag, bool is_lru, uint64_t next_use) {
+    slots[slot_index].tag = tag;
+    slots[slot_index].dirty = false;
+    policy.insert(slot_index, next_use);
+  }
+  // Remove a block, moving the last valid slot into its place
+  void invalidate(size_t slot_index) {
+    valid_count--;
+    slots[slot_index] = slots[valid_count];
+    slots[valid_count] = {0, false, 0, 0};
+    if (slot_index != valid_count) policy.move(valid_count, slot_index);
+  }
   int get_valid_count() const { return valid_count; }
   Slot& operator[](size_t index) { return this->slots[index]; }
   const Slot& operator[](size_t index) const { return this->slots[index]; }
 };
 
+// The dirty bit of a block in FlatSets' bitmap, usable like a bool
+class DirtyBit {
+ private:
+  uint64_t* word;
+  uint64_t mask;
+
+ public:
+  DirtyBit(uint64_t* word, unsigned bit) : word(word), mask(1ULL << bit) {}
+  operator bool() const { return (*word & mask) != 0; }
+  DirtyBit& operator=(bool dirty) {
+    *word = dirty ? *word | mask : *word & ~mask;
+    return *this;
+  }
+};
+
+// A block of a FlatSet, standing in for a Slot
+struct FlatSlot {
+  uint32_t tag;
+  DirtyBit dirty;
+};
+
+class FlatSet;
+
+// All sets of a cache in flat arrays instead of a vector per set: the
+// tags of each set are contiguous (padded to a multiple of 16), so a hit
+// is found by comparing 8 or 16 tags at once with AVX2; the dirty bits
+// are a bitmap, and the ages are 16-bit counters. A set's ages are a
+// permutation of 0 to its valid count - 1: the LRU rank, or for FIFO
+// the number of blocks filled since, so the victim is always the block
+// whose age is the associativity - 1. LRU and FIFO only, with up to
+// 65536 ways.
+class FlatSets {
+ private:
+  size_t ways;
+  size_t stride;  // tags and ages per set
+  std::vector<uint32_t> tags;
+  std::vector<uint16_t> ages;
+  std::vector<uint64_t> dirty;         // bit set * stride + way
+  std::vector<uint32_t> valid_counts;  // per set
+
+  friend class FlatSet;
+
+ public:
+  FlatSets() : ways(0), stride(0) {}
+  FlatSets(size_t num_sets, size_t ways);
+  bool empty() const { return valid_counts.empty(); }
+  FlatSet operator[](size_t index) const;
+};
+
+// View of one set of FlatSets, with the interface of Set
+class FlatSet {
+ private:
+  FlatSets* sets;
+  size_t base;  // of the set's tags and ages
+  uint32_t* valid_count;
+
+ public:
+  FlatSet(FlatSets* sets, size_t index)
+      : sets(sets),
+        base(index * sets->stride),
+        valid_count(&sets->valid_counts[index]) {}
+  int find_hit(uint32_t tag) const;
+  int find_victim_slot(bool is_lru);
+  void touch(size_t slot_index, bool is_lru, uint64_t next_use);
+  void fill(size_t slot_index, uint32_t tag, bool is_lru, uint64_t next_use);
+  void invalidate(size_t slot_index);
+  int get_valid_count() const { return *valid_count; }
+  FlatSlot operator[](size_t index) const {
+    size_t bit = base + index;
+    return {sets->tags[bit], DirtyBit(&sets->dirty[bit / 64], bit % 64)};
+  }
+};
+
+inline FlatSet FlatSets::operator[](size_t index) const {
+  // a view can change the sets, but a const one is only used for reading
+  return FlatSet(const_cast<FlatSets*>(this), index);
+}
+
+// How the slots of each set are stored and searched
+enum class SetLayout {
+  Auto,     // Linear, Flat or Indexed as the associativity grows
+  Linear,   // Set (or PolicySet): linear scans, fastest for small sets
+  Indexed,  // IndexedSet: hash map and recency list, LRU and FIFO only
+  Flat,     // FlatSets: SIMD tag compares, LRU and FIFO only
+};
+
 // Cache configuration from command args
 struct CacheConfig {
   uint32_t num_sets;
@@ -43,25 +234,67 @@ struct CacheConfig {
   bool write_allocate;  // 0 is no-write-allocate, 1 is write-allocate
   bool write_through;   // 0 is write-back, 1 is write-through
   bool is_lru;          // 0 is FIFO, 1 is LRU
+  SetLayout layout = SetLayout::Auto;
+  Policy policy = Policy::Default;  // overrides is_lru unless Default
+  uint32_t first_set = 0;  // of a larger cache, when simulating part of it
 };
 
 // Cache stats struct
 struct CacheStats {
-  uint32_t total_loads;
-  uint32_t total_stores;
-  uint32_t load_hits;
-  uint32_t load_misses;
-  uint32_t store_hits;
-  uint32_t store_misses;
+  uint64_t total_loads;
+  uint64_t total_stores;
+  uint64_t load_hits;
+  uint64_t load_misses;
+  uint64_t store_hits;
+  uint64_t store_misses;
   uint64_t total_cycles;
+
+  // multicore coherence only (see coherence.h)
+  uint64_t invalidations;     // blocks invalidated by other cores' writes
+  uint64_t coherence_misses;  // misses on blocks lost to invalidations
+  uint64_t transfers;         // blocks supplied by another core's cache
+  uint64_t bus_transactions;  // bus requests and write-backs issued
+  uint64_t bus_bytes;         // data moved over the bus for them
+
+  // prefetching only (see prefetch.h)
+  uint64_t prefetches;          // blocks requested by the prefetcher
+  uint64_t useful_prefetches;   // used after they arrived
+  uint64_t late_prefetches;     // used before they arrived
+  uint64_t useless_prefetches;  // evicted or dropped unused
 };
 
+// A block evicted from a cache
+struct Eviction {
+  bool valid;        // whether a block was evicted
+  uint32_t address;  // of the first byte of the block
+  bool dirty;
+};
+
+/*
+ * Print the stats in the format of csim's output.
+ */
+void print_stats(const CacheStats &stats);
+
+/*
+ * Add the counts of stats to total.
+ */
+void add_stats(CacheStats &total, const CacheStats &stats);
+
 // Cache class
 class Cache {
  private:
   std::vector<Set> sets;
+  std::vector<IndexedSet> indexed_sets;  // used instead for SetLayout::Indexed
+  FlatSets flat_sets;                    // used instead for SetLayout::Flat
+  // used instead for the policies other than LRU and FIFO
+  std::variant<std::vector<PolicySet<TreePlru>>, std::vector<PolicySet<Srrip>>,
+               std::vector<PolicySet<Brrip>>, std::vector<PolicySet<Lfu>>,
+               std::vector<PolicySet<RandomPolicy>>,
+               std::vector<PolicySet<Opt>>>
+      policy_sets;
   CacheStats stats;
   CacheConfig config;  // store config
+  const std::vector<uint64_t>* next_uses;  // of each access, for Opt
 
   // helper functions
   uint32_t get_tag(uint32_t address) const {
@@ -70,14 +303,74 @@ class Cache {
   size_t get_index(uint32_t address) const {
     return (address / config.block_size) % config.num_sets;
   }
+  template <class F>
+  auto with_set(size_t index, F f);
+  template <class S>
+  void load_set(S& set, uint32_t tag, uint64_t next_use);
+  template <class S>
+  void save_set(S& set, uint32_t tag, uint64_t next_use);
+  uint64_t next_use() const {
+    if (next_uses == nullptr) return NEVER;
+    return (*next_uses)[stats.total_loads + stats.total_stores];
+  }
 
  public:
   Cache(CacheConfig config);    // prepare cache as defined in the config
   void load(uint32_t address);  // load address 'l'
   void save(uint32_t address);  // save address 's'
   CacheStats get_stats() const { return this->stats; }
+  SetLayout get_layout() const { return config.layout; }
+  Policy get_policy() const { return config.policy; }
+  const CacheConfig& get_config() const { return config; }
+
+  // Give Policy::Opt the next use of each access of the trace to be
+  // simulated (from compute_next_uses), which must outlive the cache
+  void set_next_uses(const std::vector<uint64_t>* next_uses) {
+    this->next_uses = next_uses;
+  }
+
+  // Block operations for building other models (e.g. CacheHierarchy) on
+  // top of the cache; they don't update the stats, nor know next uses.
+  bool contains(uint32_t address);                // without using it
+  bool probe(uint32_t address, bool make_dirty);  // hit: mark as used
+  Eviction fill(uint32_t address, bool dirty);    // block must be absent
+  bool remove(uint32_t address, bool& dirty);     // invalidate if present
+  Slot* lookup(uint32_t address, bool touch);     // nullptr if absent
 
   friend void debug_print(const Cache& c);
 };
 
+// Mattson stack-distance analysis of LRU caches with a number of sets
+// and a block size. The distance of an access is the number of distinct
+// blocks of its set used since the last access to its block, so the
+// access hits in every such (write-allocate) LRU cache with more ways
+// than that. Each set keeps a Fenwick tree over its access times with a
+// 1 at the last use of each block, making an access O(log n) for n
+// distinct blocks; the times are renumbered when the tree fills up.
+class StackDistance {
+ private:
+  struct SetStack {
+    std::vector<uint32_t> tree;    // Fenwick tree over time slots
+    std::vector<uint32_t> blocks;  // block last used at each slot, or EMPTY
+    uint32_t live = 0;             // blocks with a 1 in the tree
+  };
+
+  uint32_t num_sets;
+  uint32_t block_size;
+  uint32_t max_ways;
+  std::vector<SetStack> stacks;
+  std::unordered_map<uint32_t, uint32_t> last_slot;  // block -> time slot
+  std::vector<uint64_t> distances;  // accesses by distance below max_ways
+  uint64_t accesses;
+
+  void compact(SetStack &stack);
+
+ public:
+  StackDistance(uint32_t num_sets, uint32_t block_size, uint32_t max_ways);
+  void access(uint32_t address);
+  uint32_t get_num_sets() const { return num_sets; }
+  uint64_t get_accesses() const { return accesses; }
+  uint64_t get_misses(uint32_t ways) const;  // for ways <= max_ways
+};
+
 #endif
@@ -0,0 +1,155 @@
+#include "coherence.h"
+
+#include <cstdint>
+#include <cstring>
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+bool parse_core_trace_line(const char *begin, const char *end,
+                           CoreAccess &access) {
+  // split the line into its four fields
+  const char *fields[4], *field_ends[4];
+  const char *p = begin;
+  for (int i = 0; i < 4; i++) {
+    while (p < end && is_space(*p)) p++;
+    if (p == end) return false;
+    fields[i] = p;
+    while (p < end && !is_space(*p)) p++;
+    field_ends[i] = p;
+  }
+  while (p < end && is_space(*p)) p++;
+  if (p != end) return false;
+
+  // the operation and the address, as a trace line of their own
+  size_t address_length = field_ends[1] - fields[1];
+  char text[16];
+  if (field_ends[0] - fields[0] != 1 || address_length > sizeof(text) - 2)
+    return false;
+  text[0] = *fields[0];
+  text[1] = ' ';
+  std::memcpy(text + 2, fields[1], address_length);
+  if (!parse_trace_line(text, text + 2 + address_length, access.access))
+    return false;
+
+  access.core = 0;
+  for (const char *digit = fields[3]; digit < field_ends[3]; digit++) {
+    if (*digit < '0' || *digit > '9' || access.core > SIZE_MAX / 10 - 1)
+      return false;
+    access.core = access.core * 10 + (*digit - '0');
+  }
+  return true;
+}
+
+MulticoreCache::MulticoreCache(const CacheConfig &config, size_t num_cores,
+                               Protocol protocol)
+    : protocol(protocol), config(config), stats(num_cores), lost(num_cores) {
+  // the coherence states are kept in Slots, which FlatSets do not have,
+  // and which Auto would pick for some associativities
+  CacheConfig core_config = config;
+  if (core_config.layout != SetLayout::Indexed)
+    core_config.layout = SetLayout::Linear;
+  for (size_t i = 0; i < num_cores; i++) caches.emplace_back(core_config);
+  for (CacheStats &core_stats : stats) core_stats = {};
+}
+
+void MulticoreCache::load(size_t core, uint32_t address) {
+  CacheStats &core_stats = stats[core];
+  core_stats.total_loads++;
+  if (caches[core].lookup(address, true) != nullptr) {
+    core_stats.load_hits++;
+    core_stats.total_cycles++;
+    return;
+  }
+  core_stats.load_misses++;
+  miss(core, address, false);
+}
+
+void MulticoreCache::save(size_t core, uint32_t address) {
+  CacheStats &core_stats = stats[core];
+  core_stats.total_stores++;
+  Slot *slot = caches[core].lookup(address, true);
+  if (slot == nullptr) {
+    core_stats.store_misses++;
+    miss(core, address, true);
+    return;
+  }
+
+  core_stats.store_hits++;
+  core_stats.total_cycles++;
+  if (slot->state == BlockState::Shared || slot->state == BlockState::Owned) {
+    // BusUpgr: the data is already here, only the other copies go
+    core_stats.bus_transactions++;
+    core_stats.total_cycles++;
+    invalidate_others(core, address);
+  }
+  slot->state = BlockState::Modified;  // silently from Exclusive
+  slot->dirty = true;
+}
+
+/*
+ * Bring a block into a core's cache over the bus, after a load miss
+ * (BusRd) or a store miss (BusRdX).
+ */
+void MulticoreCache::miss(size_t core, uint32_t address, bool is_store) {
+  CacheStats &core_stats = stats[core];
+  uint32_t block = block_address(address);
+  if (lost[core].erase(block)) core_stats.coherence_misses++;
+  core_stats.bus_transactions++;
+
+  // snoop the other caches
+  bool supplied = false;  // by a dirty copy
+  bool shared = false;    // another copy remains
+  for (size_t other = 0; other < caches.size(); other++) {
+    if (other == core) continue;
+    Slot *slot = caches[other].lookup(address, false);
+    if (slot == nullptr) continue;
+    supplied = supplied || slot->dirty;
+    if (is_store) continue;  // invalidated below
+    shared = true;
+    if (slot->state == BlockState::Modified &&
+        protocol == Protocol::Moesi) {
+      slot->state = BlockState::Owned;  // keeps supplying the block
+    } else if (slot->state == BlockState::Modified) {
+      slot->state = BlockState::Shared;  // memory is updated as it goes
+      slot->dirty = false;
+      core_stats.bus_bytes += config.block_size;
+    } else if (slot->state == BlockState::Exclusive) {
+      slot->state = BlockState::Shared;
+    }
+  }
+  if (is_store) invalidate_others(core, address);
+
+  uint64_t words = config.block_size / 4;
+  core_stats.bus_bytes += config.block_size;
+  if (supplied) {
+    core_stats.transfers++;
+    core_stats.total_cycles += 1 + words;
+  } else {
+    core_stats.total_cycles += 1 + 100 * words;
+  }
+
+  Eviction eviction = caches[core].fill(address, is_store);
+  if (eviction.valid && eviction.dirty) {
+    core_stats.bus_transactions++;
+    core_stats.bus_bytes += config.block_size;
+    core_stats.total_cycles += 100 * words;
+  }
+  Slot *slot = caches[core].lookup(address, false);
+  if (is_store)
+    slot->state = BlockState::Modified;
+  else
+    slot->state = shared ? BlockState::Shared : BlockState::Exclusive;
+}
+
+/*
+ * Remove the other cores' copies of a block before a core writes it.
+ */
+void MulticoreCache::invalidate_others(size_t core, uint32_t address) {
+  for (size_t other = 0; other < caches.size(); other++) {
+    bool dirty;
+    if (other != core && caches[other].remove(address, dirty)) {
+      stats[other].invalidations++;
+      lost[other].insert(block_address(address));
+    }
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include <istream>
+#include <unordered_set>
+#include <vector>
+
+#include "cache.h"
+#include "trace.h"
+
+// Cache coherence protocol of a multicore simulation
+enum class Protocol {
+  Mesi,
+  Moesi,  // adds Owned: a dirty block can be shared without writing it back
+};
+
+// One access of a multicore trace
+struct CoreAccess {
+  size_t core;
+  MemAccess access;
+};
+
+/*
+ * Parse a multicore text trace line: a trace line whose fourth field is
+ * the core making the access ("s 0x1fffff50 4 1").
+ */
+bool parse_core_trace_line(const char *begin, const char *end,
+                           CoreAccess &access);
+
+// Private write-allocate write-back caches of several cores, kept
+// coherent by snooping a shared bus. Each access is a complete bus
+// transaction: a load miss reads the block (BusRd), a store miss reads
+// it for ownership (BusRdX) and a store hit on a shared block
+// invalidates the other copies (BusUpgr). A dirty copy in another cache
+// supplies the block; otherwise it comes from memory.
+//
+// Cycles: a hit takes 1 cycle and an upgrade 1 more; a miss takes 1 plus
+// 100 per 4 bytes from memory or 1 per 4 bytes from another cache, and
+// writing back a dirty victim 100 per 4 bytes.
+class MulticoreCache {
+ private:
+  Protocol protocol;
+  CacheConfig config;
+  std::vector<Cache> caches;
+  std::vector<CacheStats> stats;
+  std::vector<std::unordered_set<uint32_t>> lost;  // blocks invalidated
+
+  uint32_t block_address(uint32_t address) const {
+    return address / config.block_size * config.block_size;
+  }
+  void miss(size_t core, uint32_t address, bool is_store);
+  void invalidate_others(size_t core, uint32_t address);
+
+ public:
+  MulticoreCache(const CacheConfig &config, size_t num_cores,
+                 Protocol protocol);
+  void load(size_t core, uint32_t address);
+  void save(size_t core, uint32_t address);
+  size_t get_num_cores() const { return caches.size(); }
+  const CacheStats &get_stats(size_t core) const { return stats[core]; }
+};
+
+#endif
@@ -11,28 +11,41 @@ std::string i_to_binarystr(uint32_t x, size_t size) {
   return bit_str;
 }
 
-void debug_print(const Cache &c) {
-  std::cout << std::string(80, '-') << std::endl;
-  std::cout << "Index ";
-  std::cout << std::string(19, ' ') << "Tag" << std::string(19, ' ');
-  std::cout << "Dirty " << std::endl;
-
-  size_t tag_bits = 32 - log2(c.config.num_sets) - log2(c.config.block_size);
+template <class Sets>
+static void print_sets(const Sets &sets, const CacheConfig &config) {
+  size_t tag_bits = 32 - log2(config.num_sets) - log2(config.block_size);
 
-  for (uint32_t i = 0; i < c.config.num_sets; i++) {
-    if (c.sets[i].get_valid_count() == 0) continue;
+  for (uint32_t i = 0; i < config.num_sets; i++) {
+    if (sets[i].get_valid_count() == 0) continue;
 
     std::cout << std::left << std::setw(5) << i;
 
-    for (uint32_t j = 0; j < c.config.num_blocks; j++) {
-      std::string tag_str = i_to_binarystr(c.sets[i][j].tag, tag_bits);
+    for (uint32_t j = 0; j < config.num_blocks; j++) {
+      std::string tag_str = i_to_binarystr(sets[i][j].tag, tag_bits);
 
       if (j != 0) std::cout << std::string(5, ' ');
       std::cout << " " << std::right << std::setw(40) << tag_str;
-      std::cout << " " << std::right << std::setw(5) << c.sets[i][j].dirty;
+      std::cout << " " << std::right << std::setw(5) << sets[i][j].dirty;
       std::cout << std::endl;
     }
   }
+}
+
+void debug_print(const Cache &c) {
+  std::cout << std::string(80, '-') << std::endl;
+  std::cout << "Index ";
+  std::cout << std::string(19, ' ') << "Tag" << std::string(19, ' ');
+  std::cout << "Dirty " << std::endl;
+
+  if (!c.sets.empty())
+    print_sets(c.sets, c.config);
+  else if (!c.indexed_sets.empty())
+    print_sets(c.indexed_sets, c.config);
+  else if (!c.flat_sets.empty())
+    print_sets(c.flat_sets, c.config);
+  else
+    std::visit([&](const auto &sets) { print_sets(sets, c.config); },
+               c.policy_sets);
 
   std::cout << std::string(80, '-') << std::endl << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include "hierarchy.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "args.h"
+
+bool read_hierarchy_file(const std::string &path, HierarchyConfig &config) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Error: Cannot open hierarchy file " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); line_number++) {
+    std::istringstream words(line);
+    std::vector<std::string> args;
+    std::string word;
+    while (words >> word) args.push_back(word);
+    if (args.empty() || args[0][0] == '#') continue;
+
+    bool valid = false;
+    if (args[0] == "inclusion" && args.size() == 2) {
+      valid = true;
+      if (args[1] == "inclusive")
+        config.inclusion = Inclusion::Inclusive;
+      else if (args[1] == "exclusive")
+        config.inclusion = Inclusion::Exclusive;
+      else if (args[1] == "nine")
+        config.inclusion = Inclusion::Nine;
+      else
+        valid = false;
+    } else if (args[0] == "memory" && args.size() == 2) {
+      config.memory_latency = std::atoi(args[1].c_str());
+      valid = config.memory_latency > 0;
+    } else if (args[0] == "level" && args.size() >= 3) {
+      LevelConfig level;
+      level.name = args[1];
+      level.latency = std::atoi(args[2].c_str());
+      // the rest are the arguments of csim
+      args.erase(args.begin(), args.begin() + 2);
+      args[0] = "csim";
+      // opt would need the next uses of the accesses reaching the level
+      valid = level.latency > 0 &&
+              parse_args(args.size(), args, level.cache) &&
+              level.cache.policy != Policy::Opt;
+      config.levels.push_back(level);
+    }
+    if (!valid) {
+      std::cerr << "Error: Invalid hierarchy setting on line " << line_number
+                << " of " << path << std::endl;
+      return false;
+    }
+  }
+
+  if (config.levels.empty()) {
+    std::cerr << "Error: No cache levels in " << path << std::endl;
+    return false;
+  }
+  for (const LevelConfig &level : config.levels) {
+    if (level.cache.block_size != config.levels[0].cache.block_size) {
+      std::cerr << "Error: All levels must have the same block size"
+                << std::endl;
+      return false;
+    }
+    if (config.inclusion == Inclusion::Exclusive &&
+        (!level.cache.write_allocate || level.cache.write_through)) {
+      std::cerr << "Error: Exclusive levels must be write-allocate and "
+                   "write-back"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+CacheHierarchy::CacheHierarchy(const HierarchyConfig &config)
+    : config(config),
+      stats(config.levels.size()),
+      memory_reads(0),
+      memory_writes(0),
+      total_cycles(0) {
+  for (const LevelConfig &level : config.levels)
+    levels.emplace_back(level.cache);
+  for (LevelStats &level_stats : stats) level_stats = {};
+}
+
+/*
+ * Read a block into a level from the levels below (or memory), as for a
+ * load miss of the level above. Returns whether the block that moves up
+ * is dirty, which is only possible in an exclusive hierarchy.
+ */
+bool CacheHierarchy::fetch(size_t level, uint32_t address) {
+  if (is_memory(level)) {
+    memory_reads++;
+    total_cycles += 1ULL * config.memory_latency *
+                    config.levels[0].cache.block_size / 4;
+    return false;
+  }
+
+  CacheStats &level_stats = stats[level].cache;
+  level_stats.total_loads++;
+  level_stats.total_cycles += config.levels[level].latency;
+  total_cycles += config.levels[level].latency;
+
+  if (levels[level].probe(address, false)) {
+    level_stats.load_hits++;
+    bool dirty = false;
+    // an exclusive hierarchy moves the block up to the first level
+    if (config.inclusion == Inclusion::Exclusive && level > 0)
+      levels[level].remove(address, dirty);
+    return dirty;
+  }
+
+  level_stats.load_misses++;
+  bool dirty = fetch(level + 1, address);
+  if (config.inclusion != Inclusion::Exclusive || level == 0) {
+    fill(level, address, dirty);
+    return false;
+  }
+  return dirty;  // passes through this level on its way up
+}
+
+/*
+ * Insert a block into a level, and deal with the block it evicts.
+ */
+void CacheHierarchy::fill(size_t level, uint32_t address, bool dirty) {
+  Eviction eviction = levels[level].fill(address, dirty);
+  if (!eviction.valid) return;
+
+  if (config.inclusion == Inclusion::Inclusive) {
+    // back-invalidate the copies above, whose changes go down with it
+    for (size_t above = 0; above < level; above++) {
+      bool above_dirty;
+      if (levels[above].remove(eviction.address, above_dirty)) {
+        stats[above].invalidations++;
+        eviction.dirty = eviction.dirty || above_dirty;
+      }
+    }
+  }
+
+  if (config.inclusion == Inclusion::Exclusive) {
+    // victims move down a level, so the levels below act as victim caches
+    if (!is_memory(level + 1)) {
+      if (eviction.dirty) stats[level].writebacks++;
+      total_cycles += config.levels[level + 1].latency;
+      stats[level + 1].cache.total_cycles += config.levels[level + 1].latency;
+      fill(level + 1, eviction.address, eviction.dirty);
+      return;
+    }
+  }
+
+  if (eviction.dirty) {
+    stats[level].writebacks++;
+    write_back(level + 1, eviction.address);
+  }
+}
+
+/*
+ * Write a dirty block evicted from the level above into a level.
+ */
+void CacheHierarchy::write_back(size_t level, uint32_t address) {
+  if (is_memory(level)) {
+    memory_writes++;
+    total_cycles += 1ULL * config.memory_latency *
+                    config.levels[0].cache.block_size / 4;
+    return;
+  }
+  stats[level].cache.total_cycles += config.levels[level].latency;
+  total_cycles += config.levels[level].latency;
+
+  const CacheConfig &cache = config.levels[level].cache;
+  if (levels[level].probe(address, !cache.write_through)) {
+    if (cache.write_through) write_back(level + 1, address);
+  } else if (cache.write_through) {
+    write_back(level + 1, address);
+  } else {
+    fill(level, address, true);  // a level below a non-inclusive one
+  }
+}
+
+/*
+ * Store a word into a level, from the CPU or a write-through level above.
+ */
+void CacheHierarchy::store(size_t level, uint32_t address) {
+  if (is_memory(level)) {
+    memory_writes++;
+    total_cycles += config.memory_latency;
+    return;
+  }
+
+  const CacheConfig &cache = config.levels[level].cache;
+  CacheStats &level_stats = stats[level].cache;
+  level_stats.total_stores++;
+  level_stats.total_cycles += config.levels[level].latency;
+  total_cycles += config.levels[level].latency;
+
+  if (levels[level].probe(address, !cache.write_through)) {
+    level_stats.store_hits++;
+    if (cache.write_through) store(level + 1, address);
+    return;
+  }
+
+  level_stats.store_misses++;
+  if (!cache.write_allocate) {
+    store(level + 1, address);
+    return;
+  }
+  bool dirty = fetch(level + 1, address);
+  if (config.inclusion != Inclusion::Exclusive || level == 0)
+    fill(level, address, dirty || !cache.write_through);
+  if (cache.write_through) store(level + 1, address);
+}
+
+void CacheHierarchy::load(uint32_t address) { fetch(0, address); }
+
+void CacheHierarchy::save(uint32_t address) { store(0, address); }
@@ -0,0 +1,76 @@
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include <string>
+#include <vector>
+
+#include "cache.h"
+
+// Which levels of a hierarchy may hold the same block
+enum class Inclusion {
+  Nine,       // non-inclusive non-exclusive: no constraint
+  Inclusive,  // every block of a level is also in the levels below it
+  Exclusive,  // a block is in at most one level
+};
+
+// One level of a hierarchy
+struct LevelConfig {
+  std::string name;
+  uint32_t latency;  // cycles per access, hit or miss
+  CacheConfig cache;
+};
+
+// Hierarchy configuration from a hierarchy file
+struct HierarchyConfig {
+  std::vector<LevelConfig> levels;  // from the level closest to the CPU
+  Inclusion inclusion = Inclusion::Nine;
+  uint32_t memory_latency = 100;  // cycles per 4 bytes
+};
+
+// Stats of one level of a hierarchy
+struct LevelStats {
+  CacheStats cache;        // accesses reaching the level; cycles spent in it
+  uint64_t writebacks;     // dirty blocks written to the level below
+  uint64_t invalidations;  // blocks removed to keep the levels inclusive
+};
+
+/*
+ * Read a hierarchy file. Each line is one of
+ *   inclusion <inclusive|exclusive|nine>
+ *   memory <cycles per 4 bytes>
+ *   level <name> <latency> <csim arguments>
+ * with the levels listed from the one closest to the CPU. Blank lines
+ * and lines starting with # are skipped.
+ */
+bool read_hierarchy_file(const std::string &path, HierarchyConfig &config);
+
+// Cache levels in front of memory. Every level access costs the level's
+// latency; reading or writing a block in memory costs memory_latency per
+// 4 bytes, and a write-through store of a word costs memory_latency.
+// Dirty blocks evicted from a level are written to the level below.
+class CacheHierarchy {
+ private:
+  HierarchyConfig config;
+  std::vector<Cache> levels;
+  std::vector<LevelStats> stats;
+  uint64_t memory_reads;
+  uint64_t memory_writes;
+  uint64_t total_cycles;
+
+  bool is_memory(size_t level) const { return level == levels.size(); }
+  bool fetch(size_t level, uint32_t address);
+  void fill(size_t level, uint32_t address, bool dirty);
+  void write_back(size_t level, uint32_t address);
+  void store(size_t level, uint32_t address);
+
+ public:
+  CacheHierarchy(const HierarchyConfig &config);
+  void load(uint32_t address);
+  void save(uint32_t address);
+  const std::vector<LevelStats> &get_level_stats() const { return stats; }
+  uint64_t get_memory_reads() const { return memory_reads; }
+  uint64_t get_memory_writes() const { return memory_writes; }
+  uint64_t get_total_cycles() const { return total_cycles; }
+};
+
+#endif
@@ -1,37 +1,313 @@
+#include <unistd.h>
+
+#include <algorithm>
 #include <iostream>
 
 #include "args.h"
 #include "cache.h"
+#include "coherence.h"
+#include "hierarchy.h"
+#include "partition.h"
+#include "prefetch.h"
+#include "sweep.h"
+#include "trace.h"
 
-int main(int argc, char **argv) {
-  // parse args
+/*
+ * Simulate every configuration of a sweep file in one pass over the
+ * trace.
+ */
+int main_sweep(const std::vector<std::string> &args, TraceReader &trace) {
+  std::string sweep_path;
+  unsigned num_threads;
+  if (!parse_sweep_args(args.size(), args, sweep_path, num_threads)) return 1;
+  std::vector<SweepEntry> entries;
+  if (!read_sweep_file(sweep_path, entries)) return 1;
+
+  std::vector<CacheConfig> configs;
+  for (const SweepEntry &entry : entries) configs.push_back(entry.config);
+  std::vector<CacheStats> stats;
+  if (!run_sweep(configs, trace, num_threads, stats)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (i != 0) std::cout << std::endl;
+    std::cout << entries[i].name << std::endl;
+    print_stats(stats[i]);
+  }
+  return 0;
+}
+
+/*
+ * Print the LRU miss-ratio curves of every set count from one pass over
+ * the trace, as CSV.
+ */
+int main_stack_distance(const std::vector<std::string> &args,
+                        TraceReader &trace) {
+  StackDistanceArgs options;
+  if (!parse_stack_distance_args(args.size(), args, options)) return 1;
+
+  std::vector<StackDistance> analyses;
+  for (uint32_t sets : options.set_counts)
+    analyses.emplace_back(sets, options.block_size, options.max_ways);
+  bool ok = run_batches(analyses.size(), trace, options.num_threads,
+                        [&](size_t i, const MemAccess *batch, size_t count) {
+                          for (size_t j = 0; j < count; j++)
+                            analyses[i].access(batch[j].address);
+                        });
+  if (!ok) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  std::cout << "sets,ways,accesses,misses,miss_ratio" << std::endl;
+  for (const StackDistance &analysis : analyses) {
+    for (uint32_t ways = 1; ways <= options.max_ways; ways *= 2) {
+      uint64_t accesses = analysis.get_accesses();
+      uint64_t misses = analysis.get_misses(ways);
+      std::cout << analysis.get_num_sets() << "," << ways << "," << accesses
+                << "," << misses << ","
+                << (accesses ? double(misses) / accesses : 0.0) << std::endl;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Simulate the cache hierarchy of a hierarchy file, and print the stats
+ * of every level.
+ */
+int main_hierarchy(const std::vector<std::string> &args, TraceReader &trace) {
+  if (args.size() != 2) {
+    std::cerr << "Error: --hierarchy=<file> takes no other arguments"
+              << std::endl;
+    return 1;
+  }
+  HierarchyConfig config;
+  if (!read_hierarchy_file(args[1].substr(12), config)) return 1;
+
+  CacheHierarchy hierarchy(config);
+  if (!simulate_trace(hierarchy, trace)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  const std::vector<LevelStats> &stats = hierarchy.get_level_stats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    std::cout << config.levels[i].name << std::endl;
+    print_stats(stats[i].cache);
+    std::cout << "Writebacks: " << stats[i].writebacks << std::endl;
+    if (config.inclusion == Inclusion::Inclusive)
+      std::cout << "Back-invalidations: " << stats[i].invalidations
+                << std::endl;
+    std::cout << std::endl;
+  }
+  std::cout << "Memory reads: " << hierarchy.get_memory_reads() << std::endl;
+  std::cout << "Memory writes: " << hierarchy.get_memory_writes() << std::endl;
+  std::cout << "Total cycles: " << hierarchy.get_total_cycles() << std::endl;
+  return 0;
+}
+
+/*
+ * Simulate the accesses of a multicore text trace, whose lines end with
+ * the core making the access, as they are read.
+ */
+static bool run_core_trace(TraceReader &trace, MulticoreCache &cores) {
+  const char *begin, *end;
+  while (trace.read_line(begin, end)) {
+    if (std::all_of(begin, end, [](char c) { return c == ' ' || c == '\t'; }))
+      continue;  // blank line
+    CoreAccess access;
+    if (!parse_core_trace_line(begin, end, access) ||
+        access.core >= cores.get_num_cores()) {
+      std::cerr << "Error: Invalid trace line " << trace.line_number()
+                << std::endl;
+      return false;
+    }
+    if (access.access.is_store) {
+      cores.save(access.core, access.access.address);
+    } else {
+      cores.load(access.core, access.access.address);
+    }
+  }
+  if (trace.failed()) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Simulate coherent private caches of several cores, fed either by one
+ * trace naming the core of each access or by a trace per core, whose
+ * accesses are interleaved one at a time.
+ */
+int main_coherence(const std::vector<std::string> &args) {
+  CoherenceArgs options;
+  if (!parse_coherence_args(args.size(), args, options)) return 1;
+  MulticoreCache cores(options.config, options.num_cores, options.protocol);
+
+  if (options.trace_paths.empty()) {
+    TraceReader trace;
+    if (!trace.open(STDIN_FILENO)) {
+      std::cerr << "Error: " << trace.error() << std::endl;
+      return 1;
+    }
+    if (!run_core_trace(trace, cores)) return 1;
+  } else {
+    size_t n = options.num_cores;
+    std::vector<TraceReader> traces(n);
+    std::vector<std::vector<MemAccess>> batches(n);
+    std::vector<size_t> next(n, 0), count(n, 0);
+    for (size_t core = 0; core < n; core++) {
+      if (!traces[core].open(options.trace_paths[core])) {
+        std::cerr << "Error: " << traces[core].error() << std::endl;
+        return 1;
+      }
+      batches[core].resize(TRACE_BATCH);
+    }
+    for (bool active = true; active;) {
+      active = false;
+      for (size_t core = 0; core < n; core++) {
+        if (next[core] == count[core]) {
+          count[core] = traces[core].read(batches[core].data(), TRACE_BATCH);
+          next[core] = 0;
+          if (traces[core].failed()) {
+            std::cerr << "Error: " << options.trace_paths[core] << ": "
+                      << traces[core].error() << std::endl;
+            return 1;
+          }
+          if (count[core] == 0) continue;  // finished
+        }
+        const MemAccess &access = batches[core][next[core]++];
+        if (access.is_store) {
+          cores.save(core, access.address);
+        } else {
+          cores.load(core, access.address);
+        }
+        active = true;
+      }
+    }
+  }
+
+  for (size_t core = 0; core < options.num_cores; core++) {
+    const CacheStats &stats = cores.get_stats(core);
+    if (core != 0) std::cout << std::endl;
+    std::cout << "Core " << core << std::endl;
+    print_stats(stats);
+    std::cout << "Invalidations: " << stats.invalidations << std::endl;
+    std::cout << "Coherence misses: " << stats.coherence_misses << std::endl;
+    std::cout << "Cache-to-cache transfers: " << stats.transfers << std::endl;
+    std::cout << "Bus transactions: " << stats.bus_transactions << std::endl;
+    std::cout << "Bus bytes: " << stats.bus_bytes << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * Simulate one configuration with its sets divided among threads.
+ */
+int main_partition(const std::vector<std::string> &args, TraceReader &trace) {
   CacheConfig config;
+  unsigned num_threads;
+  if (!parse_partition_args(args.size(), args, config, num_threads)) return 1;
+  CacheStats stats;
+  if (!run_partitioned(config, trace, num_threads, stats)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+  print_stats(stats);
+  return 0;
+}
+
+/*
+ * Simulate one configuration with a prefetcher, and print how useful its
+ * prefetches were.
+ */
+int main_prefetch(const std::vector<std::string> &args, TraceReader &trace) {
+  CacheConfig config;
+  Prefetcher prefetcher;
+  if (!parse_prefetch_args(args.size(), args, config, prefetcher)) return 1;
+
+  PrefetchingCache cache(config, prefetcher);
+  if (!simulate_trace(cache, trace)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  const CacheStats &stats = cache.get_stats();
+  print_stats(stats);
+  std::cout << "Prefetches: " << stats.prefetches << std::endl;
+  std::cout << "Useful prefetches: " << stats.useful_prefetches << std::endl;
+  std::cout << "Late prefetches: " << stats.late_prefetches << std::endl;
+  std::cout << "Useless prefetches: " << stats.useless_prefetches << std::endl;
+  return 0;
+}
+
+/*
+ * Simulate Belady's optimal policy, which needs the next use of every
+ * access, so the whole trace is read first.
+ */
+int main_opt(Cache &cache, TraceReader &trace) {
+  std::vector<MemAccess> accesses;
+  std::vector<MemAccess> batch(TRACE_BATCH);
+  size_t count;
+  while ((count = trace.read(batch.data(), batch.size())) > 0)
+    accesses.insert(accesses.end(), batch.begin(), batch.begin() + count);
+  if (trace.failed()) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  std::vector<uint64_t> next_uses =
+      compute_next_uses(accesses, cache.get_config().block_size);
+  cache.set_next_uses(&next_uses);
+  simulate(cache, accesses.data(), accesses.size());
+
+  print_stats(cache.get_stats());
+  return 0;
+}
+
+int main(int argc, char **argv) {
   std::vector<std::string> args(argc);
   for (int i = 0; i < argc; i++) args[i] = argv[i];
-  if (!parse_args(argc, args, config)) return 1;  // error termination
+  bool sweep = argc > 1 && args[1].compare(0, 8, "--sweep=") == 0;
+  bool stack_distance =
+      argc > 1 && args[1].compare(0, 17, "--stack-distance=") == 0;
+  bool hierarchy = argc > 1 && args[1].compare(0, 12, "--hierarchy=") == 0;
+  bool partition = argc > 1 && args[1].compare(0, 10, "--threads=") == 0;
+  bool prefetch = argc > 1 && args[1].compare(0, 11, "--prefetch=") == 0;
+  if (argc > 1 && args[1].compare(0, 12, "--coherence=") == 0)
+    return main_coherence(args);  // reads its own traces
 
-  Cache cache(config);
+  // parse args
+  CacheConfig config;
+  if (!sweep && !stack_distance && !hierarchy && !partition && !prefetch &&
+      !parse_args(argc, args, config))
+    return 1;  // error termination
 
-  std::string line;
-  while (std::getline(std::cin, line)) {
-    std::string address_str = line.substr(2, 10);
-    uint32_t address = std::stoul(address_str, nullptr, 16);
-    if (line[0] == 'l') {
-      cache.load(address);
-    } else {
-      cache.save(address);
-    }
+  // text or binary trace from standard input
+  TraceReader trace;
+  if (!trace.open(STDIN_FILENO)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
   }
+  if (sweep) return main_sweep(args, trace);
+  if (stack_distance) return main_stack_distance(args, trace);
+  if (hierarchy) return main_hierarchy(args, trace);
+  if (partition) return main_partition(args, trace);
+  if (prefetch) return main_prefetch(args, trace);
+
+  Cache cache(config);
+  if (cache.get_policy() == Policy::Opt) return main_opt(cache, trace);
 
-  CacheStats stats = cache.get_stats();
+  if (!simulate_trace(cache, trace)) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
 
-  std::cout << "Total loads: " << stats.total_loads << std::endl;
-  std::cout << "Total stores: " << stats.total_stores << std::endl;
-  std::cout << "Load hits: " << stats.load_hits << std::endl;
-  std::cout << "Load misses: " << stats.load_misses << std::endl;
-  std::cout << "Store hits: " << stats.store_hits << std::endl;
-  std::cout << "Store misses: " << stats.store_misses << std::endl;
-  std::cout << "Total cycles: " << stats.total_cycles << std::endl;
+  print_stats(cache.get_stats());
 
   return 0;
 }
@@ -0,0 +1,125 @@
+#include "partition.h"
+
+#include <memory>
+#include <thread>
+
+// Accesses in each worker's ring, and in each hand-over to it
+static const size_t RING_CAPACITY = 1 << 16;
+static const size_t RING_CHUNK = 1 << 10;
+
+SpscRing::SpscRing(size_t capacity)
+    : slots(capacity),
+      mask(capacity - 1),
+      head(0),
+      tail(0),
+      closed(false),
+      producer_head(0),
+      consumer_tail(0) {}
+
+size_t SpscRing::push(const MemAccess *in, size_t count) {
+  size_t t = tail.load(std::memory_order_relaxed);
+  if (t + count - producer_head > slots.size())
+    producer_head = head.load(std::memory_order_acquire);
+  size_t space = slots.size() - (t - producer_head);
+  size_t n = count < space ? count : space;
+  for (size_t i = 0; i < n; i++) slots[(t + i) & mask] = in[i];
+  tail.store(t + n, std::memory_order_release);
+  return n;
+}
+
+size_t SpscRing::pop(MemAccess *out, size_t max) {
+  size_t h = head.load(std::memory_order_relaxed);
+  if (consumer_tail == h) consumer_tail = tail.load(std::memory_order_acquire);
+  size_t available = consumer_tail - h;
+  size_t n = max < available ? max : available;
+  for (size_t i = 0; i < n; i++) out[i] = slots[(h + i) & mask];
+  head.store(h + n, std::memory_order_release);
+  return n;
+}
+
+static void partition_worker(SpscRing &ring, Cache &cache) {
+  std::vector<MemAccess> chunk(RING_CHUNK);
+  for (;;) {
+    size_t n = ring.pop(chunk.data(), chunk.size());
+    if (n > 0) {
+      simulate(cache, chunk.data(), n);
+    } else if (ring.is_closed()) {
+      // everything pushed before closing is visible now
+      while ((n = ring.pop(chunk.data(), chunk.size())) > 0)
+        simulate(cache, chunk.data(), n);
+      return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Hand a chunk to a worker, waiting while its ring is full
+static void send(SpscRing &ring, std::vector<MemAccess> &chunk) {
+  const MemAccess *next = chunk.data();
+  size_t left = chunk.size();
+  while (left > 0) {
+    size_t n = ring.push(next, left);
+    if (n == 0) std::this_thread::yield();
+    next += n;
+    left -= n;
+  }
+  chunk.clear();
+}
+
+bool run_partitioned(const CacheConfig &config, TraceReader &trace,
+                     unsigned num_threads, CacheStats &stats) {
+  unsigned num_workers = 1;
+  while (num_workers * 2 <= num_threads && num_workers * 2 <= config.num_sets)
+    num_workers *= 2;
+
+  // each worker simulates a cache of its own sets, on addresses
+  // renumbered to index them from 0 with the same tags
+  uint32_t worker_sets = config.num_sets / num_workers;
+  CacheConfig worker_config = config;
+  worker_config.num_sets = worker_sets;
+  std::vector<Cache> caches;
+  for (unsigned w = 0; w < num_workers; w++) {
+    worker_config.first_set = w * worker_sets;
+    caches.emplace_back(worker_config);
+  }
+
+  std::vector<MemAccess> batch(TRACE_BATCH);
+  size_t count;
+  if (num_workers == 1) {
+    while ((count = trace.read(batch.data(), batch.size())) > 0)
+      simulate(caches[0], batch.data(), count);
+  } else {
+    std::vector<std::unique_ptr<SpscRing>> rings;
+    std::vector<std::vector<MemAccess>> chunks(num_workers);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < num_workers; w++) {
+      rings.push_back(std::make_unique<SpscRing>(RING_CAPACITY));
+      chunks[w].reserve(RING_CHUNK);
+      workers.emplace_back(partition_worker, std::ref(*rings[w]),
+                           std::ref(caches[w]));
+    }
+
+    while ((count = trace.read(batch.data(), batch.size())) > 0) {
+      for (size_t i = 0; i < count; i++) {
+        uint32_t block = batch[i].address / config.block_size;
+        uint32_t index = block % config.num_sets;
+        uint32_t tag = block / config.num_sets;
+        unsigned w = index / worker_sets;
+        uint32_t local_block = tag * worker_sets + index % worker_sets;
+        chunks[w].push_back(
+            {local_block * config.block_size, batch[i].is_store});
+        if (chunks[w].size() == RING_CHUNK) send(*rings[w], chunks[w]);
+      }
+    }
+    for (unsigned w = 0; w < num_workers; w++) {
+      send(*rings[w], chunks[w]);
+      rings[w]->close();
+    }
+    for (std::thread &worker : workers) worker.join();
+  }
+
+  stats = {};
+  for (const Cache &cache : caches) add_stats(stats, cache.get_stats());
+  return !trace.failed();
+}
@@ -0,0 +1,42 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <atomic>
+#include <vector>
+
+#include "cache.h"
+#include "trace.h"
+
+// Lock-free ring of accesses from one producer thread to one consumer
+// thread. Each side keeps a copy of the other's position and reloads it
+// only when the copy says the ring is full (or empty), so the shared
+// cache lines move as rarely as possible.
+class SpscRing {
+ private:
+  std::vector<MemAccess> slots;  // capacity is a power of 2
+  size_t mask;
+  alignas(64) std::atomic<size_t> head;  // next slot to read
+  alignas(64) std::atomic<size_t> tail;  // next slot to write
+  std::atomic<bool> closed;
+  alignas(64) size_t producer_head;  // producer's copy of head
+  alignas(64) size_t consumer_tail;  // consumer's copy of tail
+
+ public:
+  SpscRing(size_t capacity);
+  size_t push(const MemAccess *in, size_t count);  // returns how many fit
+  void close() { closed.store(true, std::memory_order_release); }
+  size_t pop(MemAccess *out, size_t max);  // 0 when empty
+  bool is_closed() const { return closed.load(std::memory_order_acquire); }
+};
+
+/*
+ * Simulate one configuration with its sets divided among up to
+ * num_threads worker threads (a power of 2 that divides the sets). The
+ * calling thread decodes the trace and sends each access through a ring
+ * to the worker owning its set; since sets are independent, the merged
+ * stats are exactly those of a sequential run. Not for Policy::Opt.
+ */
+bool run_partitioned(const CacheConfig &config, TraceReader &trace,
+                     unsigned num_threads, CacheStats &stats);
+
+#endif
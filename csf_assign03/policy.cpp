@@ -0,0 +1,15 @@
+#include "policy.h"
+
+#include <unordered_map>
+
+std::vector<uint64_t> compute_next_uses(const std::vector<MemAccess> &trace,
+                                        uint32_t block_size) {
+  std::vector<uint64_t> next_uses(trace.size());
+  std::unordered_map<uint32_t, uint64_t> next_access;  // block -> index
+  for (size_t i = trace.size(); i-- > 0;) {
+    auto [it, first] = next_access.try_emplace(trace[i].address / block_size, i);
+    next_uses[i] = first ? NEVER : it->second;
+    it->second = i;
+  }
+  return next_uses;
+}
@@ -0,0 +1,195 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "trace.h"
+
+// Replacement policy of a cache
+enum class Policy {
+  Default,   // Lru or Fifo, from CacheConfig::is_lru
+  Lru,       // least recently used
+  Fifo,      // first in, first out
+  TreePlru,  // tree pseudo-LRU
+  Srrip,     // static re-reference interval prediction
+  Brrip,     // bimodal re-reference interval prediction
+  Lfu,       // least frequently used, least recently used among equals
+  Random,
+  Opt,       // Belady's optimal policy, which needs the future of the trace
+};
+
+// Next use of a block that is never used again
+const uint64_t NEVER = UINT64_MAX;
+
+/*
+ * Compute, for each access of a trace, the index of the next access to
+ * the same block (or NEVER), which Policy::Opt uses to pick victims.
+ */
+std::vector<uint64_t> compute_next_uses(const std::vector<MemAccess> &trace,
+                                        uint32_t block_size);
+
+// The replacement policies other than LRU and FIFO (which Set and
+// IndexedSet implement themselves). Each keeps the state of one set and
+// is a template argument of PolicySet, so their calls are resolved at
+// compile time. A policy provides
+//   P(size_t ways, uint64_t seed)
+//   void touch(size_t way, uint64_t next_use)   a hit on a way
+//   void insert(size_t way, uint64_t next_use)  a block filled into a way
+//   size_t victim()                             the way to evict, when all
+//                                               of them hold blocks
+//   void move(size_t from, size_t to)           a block moved to another way
+// where next_use is the time of the next access to the block (see
+// compute_next_uses), known only to Opt.
+
+// xorshift64 generator, so runs are reproducible
+class Xorshift {
+ private:
+  uint64_t state;
+
+ public:
+  Xorshift(uint64_t seed) : state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+  uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+};
+
+// A binary tree over the ways (which are a power of 2) whose nodes point
+// away from the most recently used half; the victim is found by
+// following them from the root
+class TreePlru {
+ private:
+  std::vector<uint8_t> nodes;  // nodes[1] is the root, node i has children
+                               // 2i and 2i+1, and leaf ways + w is way w
+  size_t ways;
+
+ public:
+  TreePlru(size_t ways, uint64_t seed) : nodes(ways), ways(ways) {}
+  void touch(size_t way, uint64_t next_use) {
+    for (size_t node = way + ways; node > 1; node /= 2)
+      nodes[node / 2] = !(node & 1);  // point to the sibling
+  }
+  void insert(size_t way, uint64_t next_use) { touch(way, next_use); }
+  size_t victim() const {
+    size_t node = 1;
+    while (node < ways) node = 2 * node + nodes[node];
+    return node - ways;
+  }
+  void move(size_t from, size_t to) {}
+};
+
+// 2-bit re-reference prediction values: a hit predicts a near
+// re-reference (0), and the victim is the first block predicted to be
+// re-referenced in the distant future (3), after aging all of them until
+// one is
+class Rrip {
+ private:
+  std::vector<uint8_t> rrpv;
+
+ protected:
+  static constexpr uint8_t DISTANT = 3;
+  void set(size_t way, uint8_t value) { rrpv[way] = value; }
+
+ public:
+  Rrip(size_t ways) : rrpv(ways, DISTANT) {}
+  void touch(size_t way, uint64_t next_use) { rrpv[way] = 0; }
+  size_t victim() {
+    uint8_t oldest = 0;
+    for (uint8_t value : rrpv) oldest = value > oldest ? value : oldest;
+    size_t victim = 0;
+    for (size_t i = 0; i < rrpv.size(); i++) {
+      rrpv[i] += DISTANT - oldest;
+      if (rrpv[i] == DISTANT && rrpv[victim] != DISTANT) victim = i;
+    }
+    return victim;
+  }
+  void move(size_t from, size_t to) { rrpv[to] = rrpv[from]; }
+};
+
+// SRRIP inserts blocks with a long re-reference interval (2), so blocks
+// used only once are evicted before those that were hit
+class Srrip : public Rrip {
+ public:
+  Srrip(size_t ways, uint64_t seed) : Rrip(ways) {}
+  void insert(size_t way, uint64_t next_use) { set(way, DISTANT - 1); }
+};
+
+// BRRIP inserts most blocks with a distant re-reference interval, and
+// one in 32 with a long one, which resists scans larger than the cache
+class Brrip : public Rrip {
+ private:
+  Xorshift random;
+
+ public:
+  Brrip(size_t ways, uint64_t seed) : Rrip(ways), random(seed) {}
+  void insert(size_t way, uint64_t next_use) {
+    set(way, random.next() % 32 == 0 ? DISTANT - 1 : DISTANT);
+  }
+};
+
+// Use counts, with the time of the last use to break ties
+class Lfu {
+ private:
+  struct Use {
+    uint64_t count;
+    uint64_t last;
+  };
+  std::vector<Use> uses;
+  uint64_t now;
+
+ public:
+  Lfu(size_t ways, uint64_t seed) : uses(ways), now(0) {}
+  void touch(size_t way, uint64_t next_use) {
+    uses[way].count++;
+    uses[way].last = now++;
+  }
+  void insert(size_t way, uint64_t next_use) { uses[way] = {1, now++}; }
+  size_t victim() const {
+    size_t victim = 0;
+    for (size_t i = 1; i < uses.size(); i++) {
+      if (uses[i].count < uses[victim].count ||
+          (uses[i].count == uses[victim].count &&
+           uses[i].last < uses[victim].last))
+        victim = i;
+    }
+    return victim;
+  }
+  void move(size_t from, size_t to) { uses[to] = uses[from]; }
+};
+
+class RandomPolicy {
+ private:
+  Xorshift random;
+  size_t ways;
+
+ public:
+  RandomPolicy(size_t ways, uint64_t seed) : random(seed), ways(ways) {}
+  void touch(size_t way, uint64_t next_use) {}
+  void insert(size_t way, uint64_t next_use) {}
+  size_t victim() { return random.next() % ways; }
+  void move(size_t from, size_t to) {}
+};
+
+// Evicts the block used again furthest in the future
+class Opt {
+ private:
+  std::vector<uint64_t> next_uses;
+
+ public:
+  Opt(size_t ways, uint64_t seed) : next_uses(ways) {}
+  void touch(size_t way, uint64_t next_use) { next_uses[way] = next_use; }
+  void insert(size_t way, uint64_t next_use) { next_uses[way] = next_use; }
+  size_t victim() const {
+    size_t victim = 0;
+    for (size_t i = 1; i < next_uses.size(); i++)
+      if (next_uses[i] > next_uses[victim]) victim = i;
+    return victim;
+  }
+  void move(size_t from, size_t to) { next_uses[to] = next_uses[from]; }
+};
+
+#endif
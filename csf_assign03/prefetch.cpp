@@ -0,0 +1,215 @@
+#include "prefetch.h"
+
+// Entries of the stride prefetcher's table, indexed by region
+static const size_t STRIDE_ENTRIES = 64;
+
+// Bytes of a stride prefetcher region; prefetches don't leave it
+static const uint64_t STRIDE_REGION = 4096;
+
+// Blocks the stride prefetcher requests ahead
+static const int64_t STRIDE_DEGREE = 2;
+
+static const size_t STREAM_BUFFERS = 4;
+static const size_t STREAM_DEPTH = 4;
+
+PrefetchingCache::PrefetchingCache(const CacheConfig &config,
+                                   Prefetcher prefetcher)
+    : config(config),
+      prefetcher(prefetcher),
+      cache(config),
+      block_cycles(100ULL * config.block_size / 4),
+      strides(STRIDE_ENTRIES, {false, 0, 0, 0, 0}),
+      streams(STREAM_BUFFERS, {{}, 0}),
+      now(0) {
+  stats = {};
+}
+
+/*
+ * Count the use of a block if a prefetch brought it into the cache,
+ * waiting for it if it has not arrived yet. Returns whether it did.
+ */
+bool PrefetchingCache::use_prefetch(uint32_t block) {
+  auto it = prefetched.find(block);
+  if (it == prefetched.end()) return false;
+  if (it->second > stats.total_cycles) {
+    stats.late_prefetches++;
+    stats.total_cycles = it->second;
+  } else {
+    stats.useful_prefetches++;
+  }
+  prefetched.erase(it);
+  return true;
+}
+
+/*
+ * Fill a block missed by a load or store into the cache.
+ */
+void PrefetchingCache::demand_fill(uint32_t block, bool dirty) {
+  evicted(cache.fill(block * config.block_size, dirty));
+}
+
+/*
+ * Write back the block evicted by a fill if it is dirty, and count it as
+ * useless if it was prefetched and never used.
+ */
+void PrefetchingCache::evicted(const Eviction &eviction) {
+  if (!eviction.valid) return;
+  if (eviction.dirty) stats.total_cycles += block_cycles;
+  if (prefetched.erase(eviction.address / config.block_size))
+    stats.useless_prefetches++;
+}
+
+/*
+ * Fill a block into the cache ahead of its use, unless it is there
+ * already or outside the address space.
+ */
+void PrefetchingCache::prefetch(int64_t block) {
+  if (block < 0 || block > UINT32_MAX / config.block_size) return;
+  uint32_t address = block * config.block_size;
+  if (cache.contains(address)) return;
+  stats.prefetches++;
+  evicted(cache.fill(address, false));
+  prefetched[block] = stats.total_cycles + block_cycles;
+}
+
+/*
+ * Move a block missed by a load from the head of a stream buffer into the
+ * cache, and extend the buffer by a block not in the cache. Returns
+ * whether one had it.
+ */
+bool PrefetchingCache::stream_hit(uint32_t block) {
+  for (StreamBuffer &stream : streams) {
+    if (stream.blocks.empty() || stream.blocks.front().block != block)
+      continue;
+    if (stream.blocks.front().ready > stats.total_cycles) {
+      stats.late_prefetches++;
+      stats.total_cycles = stream.blocks.front().ready;
+    } else {
+      stats.useful_prefetches++;
+    }
+    stream.blocks.pop_front();
+    demand_fill(block, false);
+
+    // the next block that isn't in the cache, looking a buffer ahead
+    uint64_t last = stream.blocks.empty() ? block : stream.blocks.back().block;
+    for (uint64_t next = last + 1;
+         next <= last + STREAM_DEPTH && next <= UINT32_MAX / config.block_size;
+         next++) {
+      if (cache.contains(next * config.block_size)) continue;
+      stats.prefetches++;
+      stream.blocks.push_back(
+          {uint32_t(next), stats.total_cycles + block_cycles});
+      break;
+    }
+    stream.last_use = now;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Let the prefetcher see a load of a block: whether it missed, and
+ * whether it was the first use of a prefetched block.
+ */
+void PrefetchingCache::train(uint32_t block, bool miss, bool used_prefetch) {
+  switch (prefetcher) {
+    case Prefetcher::None:
+      break;
+
+    case Prefetcher::NextLine:
+      if (miss || used_prefetch) prefetch(int64_t(block) + 1);
+      break;
+
+    case Prefetcher::Stride: {
+      uint32_t region = uint64_t(block) * config.block_size / STRIDE_REGION;
+      StrideEntry &entry = strides[region % STRIDE_ENTRIES];
+      if (!entry.valid || entry.region != region) {
+        entry = {true, region, block, 0, 0};
+        break;
+      }
+      int64_t stride = int64_t(block) - entry.last_block;
+      if (stride == 0) break;
+      if (stride == entry.stride) {
+        entry.confidence += entry.confidence < 3;
+      } else {
+        entry.stride = stride;
+        entry.confidence = 0;
+      }
+      entry.last_block = block;
+      if (entry.confidence == 0) break;
+      for (int64_t i = 1; i <= STRIDE_DEGREE; i++) {
+        int64_t target = int64_t(block) + i * stride;
+        if (target < 0 ||
+            uint64_t(target) * config.block_size / STRIDE_REGION != region)
+          break;
+        prefetch(target);
+      }
+      break;
+    }
+
+    case Prefetcher::Stream:
+      if (miss) {  // restart the least recently used buffer
+        StreamBuffer *oldest = &streams[0];
+        for (StreamBuffer &stream : streams)
+          if (stream.last_use < oldest->last_use) oldest = &stream;
+        stats.useless_prefetches += oldest->blocks.size();
+        oldest->blocks.clear();
+        for (uint64_t next = block + 1ULL;
+             next <= block + STREAM_DEPTH &&
+             next <= UINT32_MAX / config.block_size;
+             next++) {
+          if (cache.contains(next * config.block_size)) continue;
+          stats.prefetches++;
+          oldest->blocks.push_back(
+              {uint32_t(next), stats.total_cycles + block_cycles});
+        }
+        oldest->last_use = now;
+      }
+      break;
+  }
+}
+
+void PrefetchingCache::load(uint32_t address) {
+  uint32_t block = address / config.block_size;
+  now++;
+  stats.total_loads++;
+  if (cache.probe(address, false)) {
+    stats.load_hits++;
+    bool used_prefetch = use_prefetch(block);
+    stats.total_cycles++;
+    train(block, false, used_prefetch);
+  } else if (prefetcher == Prefetcher::Stream && stream_hit(block)) {
+    stats.load_hits++;
+    stats.total_cycles++;
+  } else {
+    stats.load_misses++;
+    demand_fill(block, false);
+    stats.total_cycles += 1 + block_cycles;
+    train(block, true, false);
+  }
+}
+
+void PrefetchingCache::save(uint32_t address) {
+  uint32_t block = address / config.block_size;
+  now++;
+  stats.total_stores++;
+  if (cache.probe(address, !config.write_through)) {
+    stats.store_hits++;
+    use_prefetch(block);
+    if (config.write_through) {
+      stats.total_cycles += 100;  // write to memory directly
+      if (config.write_allocate) stats.total_cycles++;
+    } else {
+      stats.total_cycles++;  // write to cache only
+    }
+    return;
+  }
+
+  stats.store_misses++;
+  if (!config.write_allocate) {
+    stats.total_cycles += 100;  // write to memory directly
+    return;
+  }
+  demand_fill(block, !config.write_through);
+  stats.total_cycles += block_cycles + (config.write_through ? 101 : 1);
+}
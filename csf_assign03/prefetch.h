@@ -0,0 +1,76 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+
+// Hardware prefetcher in front of a cache
+enum class Prefetcher {
+  None,
+  NextLine,  // the next block, after a miss or the first use of a prefetch
+  Stride,    // blocks ahead of a repeated stride within a 4 KiB region
+  Stream,    // buffers of the blocks following misses, beside the cache
+};
+
+// A cache whose loads train a prefetcher. Prefetches are issued in the
+// background: they take no cycles themselves, but a block arrives 100
+// cycles per 4 bytes after it was requested, and a load that needs it
+// earlier waits for the rest (a late prefetch). A dirty block evicted by
+// a prefetch is still written back, 100 cycles per 4 bytes.
+//
+// Next-line and stride prefetches are filled into the cache. The stream
+// prefetcher keeps its blocks in 4 FIFO buffers of 4 blocks instead: a
+// load that misses the cache but finds its block at the head of a buffer
+// moves it into the cache, as a hit, and the buffer fetches one more;
+// any other load miss restarts the least recently used buffer after it.
+// Blocks already in the cache are never fetched into a buffer.
+//
+// The cycles and hit and miss counts are otherwise those of Cache.
+class PrefetchingCache {
+ private:
+  // A block requested by a prefetch and not used yet
+  struct Prefetch {
+    uint32_t block;
+    uint64_t ready;  // cycle at which it arrives
+  };
+  // What the stride prefetcher knows about a region
+  struct StrideEntry {
+    bool valid;
+    uint32_t region;
+    uint32_t last_block;
+    int64_t stride;       // in blocks
+    unsigned confidence;  // times the stride repeated, up to 3
+  };
+  struct StreamBuffer {
+    std::deque<Prefetch> blocks;
+    uint64_t last_use;
+  };
+
+  CacheConfig config;
+  Prefetcher prefetcher;
+  Cache cache;
+  CacheStats stats;
+  uint64_t block_cycles;  // to read or write a block in memory
+  std::unordered_map<uint32_t, uint64_t> prefetched;  // block: ready cycle
+  std::vector<StrideEntry> strides;                   // by region
+  std::vector<StreamBuffer> streams;
+  uint64_t now;  // accesses so far, to find the least recent buffer
+
+  bool use_prefetch(uint32_t block);
+  void demand_fill(uint32_t block, bool dirty);
+  void evicted(const Eviction &eviction);
+  void prefetch(int64_t block);
+  bool stream_hit(uint32_t block);
+  void train(uint32_t block, bool miss, bool used_prefetch);
+
+ public:
+  PrefetchingCache(const CacheConfig &config, Prefetcher prefetcher);
+  void load(uint32_t address);
+  void save(uint32_t address);
+  const CacheStats &get_stats() const { return stats; }
+};
+
+#endif
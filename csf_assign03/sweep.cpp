@@ -0,0 +1,155 @@
+#include "sweep.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "args.h"
+
+// Number of accesses each thread simulates per cache before moving to
+// the next cache, large enough to amortize the synchronization
+static const size_t SWEEP_BATCH = 1 << 16;
+
+bool read_sweep_file(const std::string &path,
+                     std::vector<SweepEntry> &entries) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Error: Cannot open sweep file " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); line_number++) {
+    std::istringstream words(line);
+    std::vector<std::string> args = {"csim"};
+    std::string word;
+    while (words >> word) args.push_back(word);
+    if (args.size() == 1 || args[1][0] == '#') continue;
+
+    SweepEntry entry;
+    entry.name = line.substr(0, line.find_last_not_of(" \t\r") + 1);
+    // opt needs the next uses of the whole trace before it starts
+    if (!parse_args(args.size(), args, entry.config) ||
+        entry.config.policy == Policy::Opt) {
+      std::cerr << "Error: Invalid configuration on line " << line_number
+                << " of " << path << std::endl;
+      return false;
+    }
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+// Fill a batch, stopping short only at the end of the trace
+static size_t read_batch(TraceReader &trace, std::vector<MemAccess> &batch) {
+  size_t count = 0, n;
+  while (count < batch.size() &&
+         (n = trace.read(batch.data() + count, batch.size() - count)) > 0)
+    count += n;
+  return count;
+}
+
+// Batches handed from the thread reading the trace to the workers
+struct SweepBatches {
+  std::mutex mutex;
+  std::condition_variable ready;     // a new batch, or the end
+  std::condition_variable finished;  // every worker is done with it
+  uint64_t generation = 0;
+  const MemAccess *batch = nullptr;
+  size_t count = 0;
+  unsigned pending = 0;
+  bool done = false;
+};
+
+// Simulate items worker, worker + num_workers, ... over every batch
+static void sweep_worker(
+    SweepBatches &batches, size_t num_items, unsigned worker,
+    unsigned num_workers,
+    const std::function<void(size_t, const MemAccess *, size_t)> &simulate) {
+  uint64_t seen = 0;
+  for (;;) {
+    const MemAccess *batch;
+    size_t count;
+    {
+      std::unique_lock<std::mutex> lock(batches.mutex);
+      batches.ready.wait(lock, [&] { return batches.generation != seen; });
+      seen = batches.generation;
+      if (batches.done) return;
+      batch = batches.batch;
+      count = batches.count;
+    }
+    for (size_t i = worker; i < num_items; i += num_workers)
+      simulate(i, batch, count);
+
+    std::lock_guard<std::mutex> lock(batches.mutex);
+    if (--batches.pending == 0) batches.finished.notify_one();
+  }
+}
+
+bool run_batches(
+    size_t num_items, TraceReader &trace, unsigned num_threads,
+    const std::function<void(size_t, const MemAccess *, size_t)> &simulate) {
+  if (num_threads > num_items) num_threads = num_items;
+  if (num_threads == 0) num_threads = 1;
+
+  // the next batch is decoded while the workers simulate the current one
+  std::vector<MemAccess> buffers[2] = {std::vector<MemAccess>(SWEEP_BATCH),
+                                       std::vector<MemAccess>(SWEEP_BATCH)};
+  int current = 0;
+  size_t count = read_batch(trace, buffers[current]);
+
+  if (num_threads == 1) {
+    while (count > 0) {
+      for (size_t i = 0; i < num_items; i++)
+        simulate(i, buffers[current].data(), count);
+      count = read_batch(trace, buffers[current]);
+    }
+    return !trace.failed();
+  }
+
+  SweepBatches batches;
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < num_threads; t++)
+    workers.emplace_back(sweep_worker, std::ref(batches), num_items, t,
+                         num_threads, std::cref(simulate));
+
+  while (count > 0) {
+    {
+      std::lock_guard<std::mutex> lock(batches.mutex);
+      batches.batch = buffers[current].data();
+      batches.count = count;
+      batches.pending = num_threads;
+      batches.generation++;
+    }
+    batches.ready.notify_all();
+
+    current ^= 1;
+    count = read_batch(trace, buffers[current]);
+
+    std::unique_lock<std::mutex> lock(batches.mutex);
+    batches.finished.wait(lock, [&] { return batches.pending == 0; });
+  }
+  {
+    std::lock_guard<std::mutex> lock(batches.mutex);
+    batches.done = true;
+    batches.generation++;
+  }
+  batches.ready.notify_all();
+  for (std::thread &worker : workers) worker.join();
+  return !trace.failed();
+}
+
+bool run_sweep(const std::vector<CacheConfig> &configs, TraceReader &trace,
+               unsigned num_threads, std::vector<CacheStats> &stats) {
+  std::vector<Cache> caches(configs.begin(), configs.end());
+  bool ok = run_batches(
+      caches.size(), trace, num_threads,
+      [&](size_t i, const MemAccess *batch, size_t count) {
+        simulate(caches[i], batch, count);
+      });
+
+  stats.clear();
+  for (const Cache &cache : caches) stats.push_back(cache.get_stats());
+  return ok;
+}
@@ -0,0 +1,41 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "trace.h"
+
+// One configuration of a sweep, named by its line in the sweep file
+struct SweepEntry {
+  std::string name;
+  CacheConfig config;
+};
+
+/*
+ * Read the configurations of a sweep file: one per line, written as the
+ * arguments of csim. Blank lines and lines starting with # are skipped.
+ */
+bool read_sweep_file(const std::string &path, std::vector<SweepEntry> &entries);
+
+/*
+ * Read a trace in batches and call simulate(i, batch, count) with every
+ * batch for each i in [0, num_items). The items are divided among up to
+ * num_threads threads, which process a batch while the next one is
+ * decoded; the calls for one item are made in trace order.
+ */
+bool run_batches(
+    size_t num_items, TraceReader &trace, unsigned num_threads,
+    const std::function<void(size_t, const MemAccess *, size_t)> &simulate);
+
+/*
+ * Simulate every configuration in one pass over a trace, with the caches
+ * divided among up to num_threads threads. stats receives the results
+ * in the order of the configurations.
+ */
+bool run_sweep(const std::vector<CacheConfig> &configs, TraceReader &trace,
+               unsigned num_threads, std::vector<CacheStats> &stats);
+
+#endif
@@ -11,6 +11,12 @@
 
 #include "args.h"
 #include "cache.h"
+#include "coherence.h"
+#include "hierarchy.h"
+#include "partition.h"
+#include "prefetch.h"
+#include "sweep.h"
+#include "trace.h"
 
 #define ASSERT(condition)                                             \
   do {                                                                \
@@ -124,12 +130,26 @@ void init_test() {
             << std::endl
             << std::endl;
 }
-void cleanup_test() { unlink("./output.txt"); }
+void cleanup_test() {
+  unlink("./output.txt");
+  unlink("./trace_test.bin");
+  unlink("./sweep_test.txt");
+  unlink("./hierarchy_test.txt");
+}
 
 void test_is_power_of_2();   // test power check
 void test_args_correct();    // test args success
 void test_args_incorrect();  // test args failed
 void test_config(bool write_allocate, bool write_through, bool is_lru);
+void test_set_layouts();     // test Set, IndexedSet and FlatSets agree
+void test_trace_formats();   // test trace parsing and conversion
+void test_sweep();           // test simulating many configs in one pass
+void test_stack_distance();  // test miss curves match LRU simulation
+void test_hierarchy();       // test multi-level caches
+void test_policies();        // test the other replacement policies
+void test_coherence();       // test MESI/MOESI multicore caches
+void test_partition();       // test simulating sets on several threads
+void test_prefetch();        // test the prefetchers and their stats
 
 int main(void) {
   init_test();
@@ -143,6 +163,15 @@ int main(void) {
   test_config(1, 1, 0);  // write-allocate + write-through + fifo
   test_config(1, 0, 1);  // write-allocate + write-back + lru
   test_config(1, 0, 0);  // write-allocate + write-back + fifo
+  test_set_layouts();
+  test_trace_formats();
+  test_sweep();
+  test_stack_distance();
+  test_hierarchy();
+  test_policies();
+  test_coherence();
+  test_partition();
+  test_prefetch();
 
   cleanup_test();
 
@@ -239,12 +268,19 @@ void test_args_incorrect() {
   ASSERT(
       "Usage: ./csim <sets> <blocks> <blocksize> "
       "<write-allocate|no-write-allocate> <write-through|write-back> "
-      "<lru|fifo>\n" == oss.str());
+      "<lru|fifo|plru|srrip|brrip|lfu|random|opt>\n" == oss.str());
   oss.str("");
 
   ASSERT(!parse_args(7, argv1, config));  // wrong num_blocks
   ASSERT("Error: Sets, blocks, and block size must be powers of 2\n" ==
          oss.str());
+  oss.str("");
+
+  std::vector<std::string> argv2 = {"./csim",         "1",          "1", "4",
+                                    "write-allocate", "write-back", "lru",
+                                    "--layout=sorted"};
+  ASSERT(!parse_args(8, argv2, config));  // unknown option
+  ASSERT("Error: Invalid option --layout=sorted\n" == oss.str());
   std::cerr.rdbuf(original_cerr);  // reset
 }
 
@@ -284,3 +320,716 @@ void test_config(bool write_allocate, bool write_through, bool is_lru) {
             << std::string(25, '-') << std::endl
             << std::endl;
 }
+
+bool stats_equal(const CacheStats& a, const CacheStats& b) {
+  return a.total_loads == b.total_loads && a.total_stores == b.total_stores &&
+         a.load_hits == b.load_hits && a.load_misses == b.load_misses &&
+         a.store_hits == b.store_hits && a.store_misses == b.store_misses &&
+         a.total_cycles == b.total_cycles;
+}
+
+// test Set, IndexedSet and FlatSets agree
+void test_set_layouts() {
+  std::vector<std::string> argv = {"./csim",         "1",          "1", "4",
+                                   "write-allocate", "write-back", "lru",
+                                   "--layout=indexed"};
+  CacheConfig config;
+  ASSERT(parse_args(8, argv, config));
+  ASSERT(config.layout == SetLayout::Indexed);
+  argv[7] = "--layout=linear";
+  ASSERT(parse_args(8, argv, config));
+  ASSERT(config.layout == SetLayout::Linear);
+  argv[7] = "--layout=flat";
+  ASSERT(parse_args(8, argv, config));
+  ASSERT(config.layout == SetLayout::Flat);
+  ASSERT(parse_args(7, argv, config));
+  ASSERT(config.layout == SetLayout::Auto);
+  ASSERT(Cache({1, 4, 16, true, false, true}).get_layout() ==
+         SetLayout::Linear);
+  ASSERT(Cache({1, 16, 16, true, false, true}).get_layout() ==
+         SetLayout::Flat);
+  ASSERT(Cache({1, 4096, 16, true, false, true}).get_layout() ==
+         SetLayout::Indexed);
+
+  // a random mix of loads and stores, with some reuse to get hits
+  std::vector<std::pair<bool, uint32_t>> accesses;
+  srand(42);
+  for (int i = 0; i < 200000; i++) {
+    uint32_t address = (rand() % 4096) * 16;
+    if (rand() % 4 == 0) address += (rand() % 64) << 20;
+    accesses.push_back({rand() % 3 == 0, address});
+  }
+
+  uint32_t geometries[][3] = {{1, 256, 16}, {16, 64, 32}, {64, 8, 16}};
+  bool write_policies[][2] = {{false, true}, {true, true}, {true, false}};
+  for (auto& geometry : geometries) {
+    for (auto& write_policy : write_policies) {
+      for (bool is_lru : {true, false}) {
+        CacheConfig config = {geometry[0],     geometry[1],     geometry[2],
+                              write_policy[0], write_policy[1], is_lru};
+        config.layout = SetLayout::Linear;
+        Cache linear(config);
+        config.layout = SetLayout::Indexed;
+        Cache indexed(config);
+        config.layout = SetLayout::Flat;
+        Cache flat(config);
+        for (auto [is_store, address] : accesses) {
+          if (is_store) {
+            linear.save(address);
+            indexed.save(address);
+            flat.save(address);
+          } else {
+            linear.load(address);
+            indexed.load(address);
+            flat.load(address);
+          }
+        }
+        ASSERT(linear.get_stats().load_hits > 0);
+        ASSERT(stats_equal(linear.get_stats(), indexed.get_stats()));
+        ASSERT(stats_equal(linear.get_stats(), flat.get_stats()));
+
+        // invalidating blocks must keep the replacement order too
+        for (size_t i = 0; i < accesses.size(); i += 8) {
+          bool linear_dirty = false, indexed_dirty = false, flat_dirty = false;
+          bool removed = linear.remove(accesses[i].second, linear_dirty);
+          ASSERT(indexed.remove(accesses[i].second, indexed_dirty) == removed);
+          ASSERT(flat.remove(accesses[i].second, flat_dirty) == removed);
+          ASSERT(indexed_dirty == linear_dirty && flat_dirty == linear_dirty);
+        }
+        for (auto [is_store, address] : accesses) {
+          linear.load(address);
+          indexed.load(address);
+          flat.load(address);
+        }
+        ASSERT(stats_equal(linear.get_stats(), indexed.get_stats()));
+        ASSERT(stats_equal(linear.get_stats(), flat.get_stats()));
+      }
+    }
+  }
+}
+
+bool parse_line(std::string line, MemAccess& access) {
+  return parse_trace_line(line.data(), line.data() + line.size(), access);
+}
+
+bool parse_core_line(std::string line, CoreAccess& access) {
+  return parse_core_trace_line(line.data(), line.data() + line.size(),
+                               access);
+}
+
+// read a whole trace file in batches of batch_size
+std::vector<MemAccess> read_trace(std::string path, size_t batch_size,
+                                  bool& failed) {
+  TraceReader trace;
+  std::vector<MemAccess> result;
+  failed = !trace.open(path);
+  std::vector<MemAccess> batch(batch_size);
+  size_t count;
+  while ((count = trace.read(batch.data(), batch.size())) > 0)
+    result.insert(result.end(), batch.begin(), batch.begin() + count);
+  failed = failed || trace.failed();
+  return result;
+}
+
+// test trace parsing and conversion
+void test_trace_formats() {
+  MemAccess access;
+  ASSERT(parse_line("l 0x1fffff50 5", access));
+  ASSERT(access.address == 0x1fffff50 && !access.is_store);
+  ASSERT(parse_line("s 0xDEADBEEF 4", access));
+  ASSERT(access.address == 0xDEADBEEF && access.is_store);
+  ASSERT(parse_line("l 0X0aBc 1", access));
+  ASSERT(access.address == 0xabc);
+  ASSERT(parse_line("s 0x12345678", access));
+  ASSERT(access.address == 0x12345678);
+  ASSERT(!parse_line("x 0x10 1", access));
+  ASSERT(!parse_line("l 0xzz 1", access));
+  ASSERT(!parse_line("l 0x1234567g 1", access));
+  ASSERT(!parse_line("l 0x123456789 1", access));
+  ASSERT(!parse_line("l 0x1fffff50x 4 1", access));
+  ASSERT(!parse_line("l 0x1234567g", access));
+  ASSERT(!parse_line("l 0x", access));
+
+  // text, with blank lines and no final newline
+  std::ofstream("./trace_test.bin")
+      << "l 0x00000010 4\n\ns 0xffffffff 4\r\nl 0x20 1";
+  bool failed;
+  std::vector<MemAccess> accesses = read_trace("./trace_test.bin", 2, failed);
+  ASSERT(!failed && accesses.size() == 3);
+  ASSERT(accesses[0].address == 0x10 && !accesses[0].is_store);
+  ASSERT(accesses[1].address == 0xffffffff && accesses[1].is_store);
+  ASSERT(accesses[2].address == 0x20 && !accesses[2].is_store);
+  std::ofstream("./trace_test.bin") << "l 0x10 4\nl 0x20\nbad line\n";
+  accesses = read_trace("./trace_test.bin", 10, failed);
+  ASSERT(failed && accesses.size() == 2);
+
+  // binary round trips, with a partial last block and batches that
+  // split blocks
+  std::vector<MemAccess> expected;
+  srand(7);
+  for (int i = 0; i < 1000 + 37; i++) {
+    uint32_t address = rand() % 3 ? 0x10000000 + i * 4 : rand();
+    expected.push_back({address, rand() % 3 == 0});
+  }
+  for (bool delta : {false, true}) {
+    TraceWriter writer;
+    ASSERT(writer.open("./trace_test.bin", delta));
+    for (const MemAccess& a : expected) writer.write(a);
+    ASSERT(writer.close());
+    for (size_t batch_size : {7, 64, 4096}) {
+      accesses = read_trace("./trace_test.bin", batch_size, failed);
+      ASSERT(!failed && accesses.size() == expected.size());
+      for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT(accesses[i].address == expected[i].address);
+        ASSERT(accesses[i].is_store == expected[i].is_store);
+      }
+    }
+
+    // truncated
+    truncate("./trace_test.bin", sizeof(TraceHeader) + 100);
+    accesses = read_trace("./trace_test.bin", 4096, failed);
+    ASSERT(failed && accesses.size() < expected.size());
+  }
+}
+
+// test simulating many configs in one pass
+void test_sweep() {
+  std::ofstream("./sweep_test.txt")
+      << "# sets blocks size\n"
+         "256 4 16 write-allocate write-back lru\n"
+         "\n"
+         "1 64 16 write-allocate write-through fifo --layout=indexed\n"
+         "16 8 64 no-write-allocate write-through lru\n"
+         "1024 1 4 write-allocate write-back fifo\n";
+  std::vector<SweepEntry> entries;
+  ASSERT(read_sweep_file("./sweep_test.txt", entries));
+  ASSERT(entries.size() == 4);
+  ASSERT(entries[0].name == "256 4 16 write-allocate write-back lru");
+  ASSERT(entries[1].config.layout == SetLayout::Indexed);
+  ASSERT(entries[2].config.num_blocks == 8 && !entries[2].config.write_allocate);
+
+  // more accesses than a batch, so that batches are handed over
+  std::vector<MemAccess> accesses;
+  srand(11);
+  TraceWriter writer;
+  ASSERT(writer.open("./trace_test.bin", true));
+  for (int i = 0; i < 150000; i++) {
+    MemAccess access = {uint32_t(rand() % 8192) * 8, rand() % 3 == 0};
+    accesses.push_back(access);
+    writer.write(access);
+  }
+  ASSERT(writer.close());
+
+  std::vector<CacheConfig> configs;
+  for (const SweepEntry& entry : entries) configs.push_back(entry.config);
+  for (unsigned num_threads : {1, 3, 8}) {
+    TraceReader trace;
+    ASSERT(trace.open("./trace_test.bin"));
+    std::vector<CacheStats> stats;
+    ASSERT(run_sweep(configs, trace, num_threads, stats));
+    ASSERT(stats.size() == configs.size());
+    for (size_t i = 0; i < configs.size(); i++) {
+      Cache cache(configs[i]);
+      for (const MemAccess& access : accesses) {
+        if (access.is_store)
+          cache.save(access.address);
+        else
+          cache.load(access.address);
+      }
+      ASSERT(stats_equal(cache.get_stats(), stats[i]));
+    }
+  }
+
+  std::ostringstream oss;
+  std::streambuf* original_cerr = std::cerr.rdbuf();
+  std::cerr.rdbuf(oss.rdbuf());  // redirect output
+  std::ofstream("./sweep_test.txt") << "256 4 16 write-allocate write-back\n";
+  entries.clear();
+  ASSERT(!read_sweep_file("./sweep_test.txt", entries));
+  ASSERT(oss.str().find("Error: Invalid configuration on line 1") !=
+         std::string::npos);
+  std::cerr.rdbuf(original_cerr);  // reset
+}
+
+// test miss curves match LRU simulation
+void test_stack_distance() {
+  StackDistanceArgs args;
+  std::vector<std::string> argv = {"./csim", "--stack-distance=32",
+                                   "--sets=1,8,64", "--max-ways=16"};
+  ASSERT(parse_stack_distance_args(4, argv, args));
+  ASSERT(args.block_size == 32 && args.max_ways == 16);
+  ASSERT(args.set_counts == std::vector<uint32_t>({1, 8, 64}));
+  ASSERT(parse_stack_distance_args(2, argv, args));
+  ASSERT(args.set_counts.size() == 11 && args.set_counts[10] == 1024);
+
+  std::ostringstream oss;
+  std::streambuf* original_cerr = std::cerr.rdbuf();
+  std::cerr.rdbuf(oss.rdbuf());  // redirect output
+  argv[2] = "--sets=1,6";
+  ASSERT(!parse_stack_distance_args(3, argv, args));
+  std::cerr.rdbuf(original_cerr);  // reset
+
+  // enough distinct blocks for the time slots to be renumbered often
+  std::vector<MemAccess> accesses;
+  srand(5);
+  for (int i = 0; i < 100000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 300 : rand() % 5000;
+    accesses.push_back({block * 32 + rand() % 32, rand() % 3 == 0});
+  }
+
+  for (uint32_t sets : {1, 8, 64}) {
+    StackDistance analysis(sets, 32, 16);
+    for (const MemAccess& access : accesses) analysis.access(access.address);
+    ASSERT(analysis.get_accesses() == accesses.size());
+    for (uint32_t ways = 1; ways <= 16; ways *= 2) {
+      Cache cache({sets, ways, 32, true, false, true});
+      for (const MemAccess& access : accesses) {
+        if (access.is_store)
+          cache.save(access.address);
+        else
+          cache.load(access.address);
+      }
+      CacheStats stats = cache.get_stats();
+      ASSERT(analysis.get_misses(ways) ==
+             stats.load_misses + stats.store_misses);
+    }
+  }
+}
+
+// run accesses through a hierarchy
+void run_hierarchy(CacheHierarchy& hierarchy,
+                   const std::vector<MemAccess>& accesses) {
+  for (const MemAccess& access : accesses) {
+    if (access.is_store)
+      hierarchy.save(access.address);
+    else
+      hierarchy.load(access.address);
+  }
+}
+
+// test multi-level caches
+void test_hierarchy() {
+  std::vector<MemAccess> accesses;
+  srand(7);
+  for (int i = 0; i < 50000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 200 : rand() % 3000;
+    accesses.push_back({block * 16 + rand() % 16, rand() % 3 == 0});
+  }
+
+  // one level with a latency of 1 is the plain cache
+  for (bool write_through : {false, true}) {
+    for (bool is_lru : {false, true}) {
+      CacheConfig config = {16, 4, 16, true, write_through, is_lru};
+      HierarchyConfig hierarchy_config;
+      hierarchy_config.levels.push_back({"L1", 1, config});
+      CacheHierarchy hierarchy(hierarchy_config);
+      run_hierarchy(hierarchy, accesses);
+      Cache cache(config);
+      for (const MemAccess& access : accesses) {
+        if (access.is_store)
+          cache.save(access.address);
+        else
+          cache.load(access.address);
+      }
+      // the level's own cycles leave out memory
+      CacheStats stats = hierarchy.get_level_stats()[0].cache;
+      ASSERT(stats.total_cycles == stats.total_loads + stats.total_stores);
+      stats.total_cycles = hierarchy.get_total_cycles();
+      ASSERT(stats_equal(stats, cache.get_stats()));
+      ASSERT(hierarchy.get_memory_reads() ==
+             stats.load_misses + stats.store_misses);
+    }
+  }
+
+  std::ofstream("./hierarchy_test.txt")
+      << "# two levels\n"
+      << "inclusion inclusive\n"
+      << "memory 50\n"
+      << "level L1 1 16 4 16 write-allocate write-back lru\n"
+      << "level L2 4 16 4 16 write-allocate write-back lru\n";
+  HierarchyConfig config;
+  ASSERT(read_hierarchy_file("./hierarchy_test.txt", config));
+  ASSERT(config.levels.size() == 2 && config.memory_latency == 50);
+  ASSERT(config.inclusion == Inclusion::Inclusive);
+  ASSERT(config.levels[1].name == "L2" && config.levels[1].latency == 4);
+
+  // an inclusive L2 as big as L1 holds exactly the same blocks, so
+  // everything missing in L1 misses in L2 too
+  CacheHierarchy inclusive(config);
+  run_hierarchy(inclusive, accesses);
+  const std::vector<LevelStats>& stats = inclusive.get_level_stats();
+  ASSERT(stats[1].cache.total_loads ==
+         stats[0].cache.load_misses + stats[0].cache.store_misses);
+  ASSERT(stats[1].cache.load_hits == 0);
+  ASSERT(inclusive.get_memory_reads() == stats[1].cache.load_misses);
+
+  ASSERT(stats[0].invalidations > 0);
+
+  // L1 is the same without back-invalidations, and an exclusive L2 holds
+  // L1's victims instead of copies of L1's blocks
+  config.inclusion = Inclusion::Nine;
+  CacheHierarchy nine(config);
+  run_hierarchy(nine, accesses);
+  config.inclusion = Inclusion::Exclusive;
+  CacheHierarchy exclusive(config);
+  run_hierarchy(exclusive, accesses);
+  const std::vector<LevelStats>& nine_stats = nine.get_level_stats();
+  const std::vector<LevelStats>& exclusive_stats =
+      exclusive.get_level_stats();
+  ASSERT(stats_equal(exclusive_stats[0].cache, nine_stats[0].cache));
+  ASSERT(exclusive.get_memory_reads() < nine.get_memory_reads());
+  ASSERT(nine.get_memory_reads() < inclusive.get_memory_reads());
+
+  // a dirty block moving up from L3 through L2 stays dirty: A is stored,
+  // pushed down to L3 by B and C, loaded again and finally evicted
+  HierarchyConfig three;
+  three.inclusion = Inclusion::Exclusive;
+  for (const char* name : {"L1", "L2", "L3"})
+    three.levels.push_back({name, 1, {1, 1, 16, true, false, true}});
+  CacheHierarchy chain(three);
+  run_hierarchy(chain, {{0, true}, {16, false}, {32, false}, {0, false},
+                        {48, false}, {64, false}, {80, false}, {96, false}});
+  ASSERT(chain.get_memory_writes() == 1);
+
+  std::ostringstream oss;
+  std::streambuf* original_cerr = std::cerr.rdbuf();
+  std::cerr.rdbuf(oss.rdbuf());  // redirect output
+  std::ofstream("./hierarchy_test.txt")
+      << "level L1 1 16 4 16 write-allocate write-back lru\n"
+      << "level L2 4 16 4 64 write-allocate write-back lru\n";
+  config = HierarchyConfig();
+  ASSERT(!read_hierarchy_file("./hierarchy_test.txt", config));
+  ASSERT(oss.str().find("Error: All levels must have the same block size") !=
+         std::string::npos);
+  std::ofstream("./hierarchy_test.txt") << "level L1 0 16 4 16\n";
+  config = HierarchyConfig();
+  ASSERT(!read_hierarchy_file("./hierarchy_test.txt", config));
+  ASSERT(oss.str().find("Error: Invalid hierarchy setting on line 1") !=
+         std::string::npos);
+  std::cerr.rdbuf(original_cerr);  // reset
+}
+
+// misses of a cache over accesses, feeding opt their next uses
+uint64_t count_misses(CacheConfig config,
+                      const std::vector<MemAccess>& accesses) {
+  std::vector<uint64_t> next_uses =
+      compute_next_uses(accesses, config.block_size);
+  Cache cache(config);
+  cache.set_next_uses(&next_uses);
+  for (const MemAccess& access : accesses) {
+    if (access.is_store)
+      cache.save(access.address);
+    else
+      cache.load(access.address);
+  }
+  CacheStats stats = cache.get_stats();
+  return stats.load_misses + stats.store_misses;
+}
+
+// test the other replacement policies
+void test_policies() {
+  std::vector<std::string> argv = {"./csim",         "1",          "4", "4",
+                                   "write-allocate", "write-back", "plru"};
+  CacheConfig config;
+  ASSERT(parse_args(7, argv, config));
+  ASSERT(config.policy == Policy::TreePlru && !config.is_lru);
+  argv[6] = "lru";
+  ASSERT(parse_args(7, argv, config));
+  ASSERT(config.policy == Policy::Lru && config.is_lru);
+  ASSERT(Cache({1, 64, 16, true, false, false, SetLayout::Auto, Policy::Lfu})
+             .get_layout() == SetLayout::Linear);
+
+  std::ostringstream oss;
+  std::streambuf* original_cerr = std::cerr.rdbuf();
+  std::cerr.rdbuf(oss.rdbuf());  // redirect output
+  argv[6] = "mru";
+  ASSERT(!parse_args(7, argv, config));
+  argv[6] = "srrip";
+  argv.push_back("--layout=indexed");
+  ASSERT(!parse_args(8, argv, config));
+  std::cerr.rdbuf(original_cerr);  // reset
+  ASSERT(oss.str() ==
+         "Error: Invalid replacement policy\n"
+         "Error: The indexed layout supports only lru and fifo\n");
+
+  // the textbook reference string with 3 frames
+  std::vector<MemAccess> textbook;
+  for (uint32_t block : {7, 0, 1, 2, 0, 3, 0, 4, 2, 3, 0, 3, 2, 1, 2, 0, 1, 7,
+                         0, 1})
+    textbook.push_back({block * 16, false});
+  CacheConfig frames = {1, 3, 16, true, false, true};
+  frames.policy = Policy::Opt;
+  ASSERT(count_misses(frames, textbook) == 9);
+  frames.policy = Policy::Lru;
+  ASSERT(count_misses(frames, textbook) == 12);
+  frames.policy = Policy::Fifo;
+  ASSERT(count_misses(frames, textbook) == 15);
+
+  std::vector<MemAccess> accesses;
+  srand(11);
+  for (int i = 0; i < 50000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 100 : rand() % 2000;
+    accesses.push_back({block * 16 + rand() % 16, rand() % 3 == 0});
+  }
+
+  Policy policies[] = {Policy::Lru,   Policy::Fifo, Policy::TreePlru,
+                       Policy::Srrip, Policy::Brrip, Policy::Lfu,
+                       Policy::Random};
+  uint32_t geometries[][2] = {{1, 64}, {16, 4}, {4, 2}, {64, 1}};
+  for (auto& geometry : geometries) {
+    CacheConfig config = {geometry[0], geometry[1], 16, true, false, true};
+    config.policy = Policy::Opt;
+    uint64_t opt = count_misses(config, accesses);
+    config.policy = Policy::Lru;
+    uint64_t lru = count_misses(config, accesses);
+    for (Policy policy : policies) {
+      // nothing beats opt, and every policy is LRU with one way
+      config.policy = policy;
+      uint64_t misses = count_misses(config, accesses);
+      ASSERT(misses >= opt);
+      if (geometry[1] == 1) ASSERT(misses == lru);
+      // tree PLRU is LRU with two ways
+      if (policy == Policy::TreePlru && geometry[1] == 2)
+        ASSERT(misses == lru);
+      // random is reproducible
+      if (policy == Policy::Random)
+        ASSERT(misses == count_misses(config, accesses));
+    }
+    ASSERT(opt < lru || geometry[1] == 1);
+  }
+}
+
+// test MESI/MOESI multicore caches
+void test_coherence() {
+  CoreAccess access;
+  ASSERT(parse_core_line("s 0x1fffff50 4 3", access));
+  ASSERT(access.core == 3 && access.access.is_store &&
+         access.access.address == 0x1fffff50);
+  ASSERT(parse_core_line("  l\t0x10 4 12\r", access));
+  ASSERT(access.core == 12 && access.access.address == 0x10);
+  ASSERT(!parse_core_line("l 0x1fffff50 4", access));
+  ASSERT(!parse_core_line("l 0x1fffff50 4 -1", access));
+  ASSERT(!parse_core_line("l 0x1fffff50 4 1 2", access));
+  ASSERT(!parse_core_line("x 0x1fffff50 4 1", access));
+
+  CoherenceArgs args;
+  std::vector<std::string> argv = {
+      "./csim",         "--coherence=moesi", "--cores=4", "16", "4", "16",
+      "write-allocate", "write-back",        "lru"};
+  ASSERT(parse_coherence_args(9, argv, args));
+  ASSERT(args.protocol == Protocol::Moesi && args.num_cores == 4);
+  ASSERT(args.trace_paths.empty() && args.config.num_sets == 16);
+  argv[2] = "--traces=a.trace,b.trace";
+  ASSERT(parse_coherence_args(9, argv, args));
+  ASSERT(args.num_cores == 2 && args.trace_paths[1] == "b.trace");
+  std::ostringstream oss;
+  std::streambuf* original_cerr = std::cerr.rdbuf();
+  std::cerr.rdbuf(oss.rdbuf());  // redirect output
+  argv[7] = "write-through";
+  ASSERT(!parse_coherence_args(9, argv, args));
+  argv[7] = "write-back";
+  argv.insert(argv.begin() + 3, "--cores=3");  // a core without a trace
+  ASSERT(!parse_coherence_args(10, argv, args));
+  ASSERT(oss.str().find("Error: --cores must match the number of") !=
+         std::string::npos);
+  std::cerr.rdbuf(original_cerr);  // reset
+
+  // one core is the plain cache
+  std::vector<MemAccess> accesses;
+  srand(13);
+  for (int i = 0; i < 50000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 200 : rand() % 3000;
+    accesses.push_back({block * 16 + rand() % 16, rand() % 3 == 0});
+  }
+  // (from 8 ways, Auto would pick a layout without coherence states)
+  for (uint32_t ways : {4, 8, 16}) {
+    CacheConfig config = {16, ways, 16, true, false, true};
+    MulticoreCache single(config, 1, Protocol::Mesi);
+    Cache cache(config);
+    for (const MemAccess& access : accesses) {
+      if (access.is_store) {
+        single.save(0, access.address);
+        cache.save(access.address);
+      } else {
+        single.load(0, access.address);
+        cache.load(access.address);
+      }
+    }
+    ASSERT(single.get_stats(0).load_hits > 0);
+    ASSERT(stats_equal(single.get_stats(0), cache.get_stats()));
+    ASSERT(single.get_stats(0).invalidations == 0);
+  }
+
+  CacheConfig config = {16, 8, 16, true, false, true};
+
+  for (Protocol protocol : {Protocol::Mesi, Protocol::Moesi}) {
+    // false sharing: two cores write different words of one block
+    MulticoreCache cores(config, 2, protocol);
+    for (int i = 0; i < 100; i++) {
+      cores.save(0, 0x1000);
+      cores.save(1, 0x1004);
+    }
+    for (size_t core = 0; core < 2; core++) {
+      const CacheStats& stats = cores.get_stats(core);
+      ASSERT(stats.store_misses == 100 && stats.store_hits == 0);
+      ASSERT(stats.coherence_misses == 99);
+    }
+    ASSERT(cores.get_stats(0).invalidations == 100);
+    ASSERT(cores.get_stats(1).transfers == 100);
+
+    // producer and consumer: MOESI keeps the dirty block out of memory
+    MulticoreCache shared(config, 2, protocol);
+    shared.save(0, 0x2000);
+    shared.load(1, 0x2000);  // M -> S (MESI, written back) or O (MOESI)
+    shared.load(0, 0x2000);  // hit
+    shared.save(0, 0x2000);  // upgrade
+    shared.load(1, 0x2000);  // coherence miss
+    const CacheStats& producer = shared.get_stats(0);
+    const CacheStats& consumer = shared.get_stats(1);
+    ASSERT(producer.load_hits == 1 && producer.store_hits == 1);
+    ASSERT(producer.bus_transactions == 2 && consumer.invalidations == 1);
+    ASSERT(consumer.load_misses == 2 && consumer.coherence_misses == 1);
+    ASSERT(consumer.transfers == 2);
+    ASSERT(consumer.bus_bytes == (protocol == Protocol::Mesi ? 64u : 32u));
+  }
+}
+
+// test simulating sets on several threads
+void test_partition() {
+  SpscRing ring(8);
+  MemAccess in[10], out[10];
+  for (uint32_t i = 0; i < 10; i++) in[i] = {i, i % 2 == 0};
+  ASSERT(ring.push(in, 10) == 8);
+  ASSERT(ring.pop(out, 3) == 3 && out[2].address == 2 && out[2].is_store);
+  ASSERT(ring.push(in + 8, 2) == 2);
+  // the consumer sees new accesses once it has used up the ones it saw
+  ASSERT(ring.pop(out, 10) == 5 && out[4].address == 7);
+  ASSERT(ring.pop(out, 10) == 2 && out[1].address == 9);
+  ASSERT(ring.pop(out, 10) == 0 && !ring.is_closed());
+
+  std::vector<std::string> argv = {"./csim", "--threads=4", "256", "4", "16",
+                                   "write-allocate", "write-back", "lru"};
+  CacheConfig config;
+  unsigned num_threads;
+  ASSERT(parse_partition_args(8, argv, config, num_threads));
+  ASSERT(num_threads == 4 && config.num_sets == 256 && config.is_lru);
+
+  // more accesses than a ring holds, so that the parser waits for workers
+  std::vector<MemAccess> accesses;
+  srand(17);
+  TraceWriter writer;
+  ASSERT(writer.open("./trace_test.bin", false));
+  for (int i = 0; i < 200000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 2000 : rand() % 100000;
+    accesses.push_back({block * 16 + rand() % 16, rand() % 3 == 0});
+    writer.write(accesses.back());
+  }
+  ASSERT(writer.close());
+
+  CacheConfig configs[] = {
+      {256, 4, 16, true, false, true},
+      {64, 8, 32, false, true, false},
+      {1, 64, 16, true, true, true},
+      {1024, 2, 16, true, false, false, SetLayout::Auto, Policy::Random},
+  };
+  for (const CacheConfig& config : configs) {
+    Cache cache(config);
+    for (const MemAccess& access : accesses) {
+      if (access.is_store)
+        cache.save(access.address);
+      else
+        cache.load(access.address);
+    }
+    for (unsigned threads : {1, 2, 3, 8}) {
+      TraceReader trace;
+      ASSERT(trace.open("./trace_test.bin"));
+      CacheStats stats;
+      ASSERT(run_partitioned(config, trace, threads, stats));
+      ASSERT(stats_equal(stats, cache.get_stats()));
+    }
+  }
+}
+
+// test the prefetchers and their stats
+void test_prefetch() {
+  std::vector<std::string> argv = {"./csim",         "--prefetch=stride",
+                                   "256",            "4",
+                                   "16",             "write-allocate",
+                                   "write-back",     "lru"};
+  CacheConfig config;
+  Prefetcher prefetcher;
+  ASSERT(parse_prefetch_args(8, argv, config, prefetcher));
+  ASSERT(prefetcher == Prefetcher::Stride && config.num_sets == 256);
+  argv[7] = "opt";
+  ASSERT(!parse_prefetch_args(8, argv, config, prefetcher));
+  argv[1] = "--prefetch=markov";
+  ASSERT(!parse_prefetch_args(8, argv, config, prefetcher));
+
+  // without a prefetcher, the same as a plain cache
+  srand(23);
+  std::vector<MemAccess> accesses;
+  for (int i = 0; i < 100000; i++) {
+    uint32_t block = rand() % 4 ? rand() % 2000 : rand() % 100000;
+    accesses.push_back({block * 16 + rand() % 16, rand() % 3 == 0});
+  }
+  CacheConfig configs[] = {
+      {256, 4, 16, true, false, true},
+      {64, 8, 32, false, true, false},
+      {1, 64, 16, true, true, true},
+  };
+  for (const CacheConfig& config : configs) {
+    Cache cache(config);
+    PrefetchingCache prefetching(config, Prefetcher::None);
+    for (const MemAccess& access : accesses) {
+      if (access.is_store) {
+        cache.save(access.address);
+        prefetching.save(access.address);
+      } else {
+        cache.load(access.address);
+        prefetching.load(access.address);
+      }
+    }
+    ASSERT(stats_equal(prefetching.get_stats(), cache.get_stats()));
+    ASSERT(prefetching.get_stats().prefetches == 0);
+  }
+
+  // a stride of 4 blocks is prefetched from its third access, up to the
+  // end of the 4 KiB region
+  CacheConfig large = {64, 16, 16, true, false, true};
+  PrefetchingCache stride(large, Prefetcher::Stride);
+  for (uint32_t address = 0; address < 4096; address += 64)
+    stride.load(address);
+  const CacheStats& stride_stats = stride.get_stats();
+  ASSERT(stride_stats.load_misses == 3);
+  ASSERT(stride_stats.prefetches == 61);
+  ASSERT(stride_stats.useful_prefetches + stride_stats.late_prefetches == 61);
+  ASSERT(stride_stats.useless_prefetches == 0);
+
+  // a sequential scan misses once and then hits in a stream buffer
+  PrefetchingCache stream(large, Prefetcher::Stream);
+  for (uint32_t address = 0; address < 160; address += 16)
+    stream.load(address);
+  const CacheStats& stream_stats = stream.get_stats();
+  ASSERT(stream_stats.load_misses == 1 && stream_stats.load_hits == 9);
+  ASSERT(stream_stats.prefetches == 4 + 9);
+  // 4 blocks ahead is not enough to hide the memory latency from loads a
+  // cycle apart, so every fourth block arrives late
+  ASSERT(stream_stats.late_prefetches == 3);
+  ASSERT(stream_stats.useful_prefetches == 6);
+
+  // a restarted buffer skips blocks already in the cache
+  PrefetchingCache skipping(large, Prefetcher::Stream);
+  skipping.load(32);  // a buffer of blocks 3 to 6
+  skipping.load(0);   // another of blocks 1, 3 and 4
+  ASSERT(skipping.get_stats().prefetches == 4 + 3);
+
+  // in a one-block cache, the next line evicts the block just loaded
+  PrefetchingCache next_line({1, 1, 16, true, false, true},
+                             Prefetcher::NextLine);
+  next_line.load(0);
+  next_line.load(0);
+  const CacheStats& next_line_stats = next_line.get_stats();
+  ASSERT(next_line_stats.load_misses == 2);
+  ASSERT(next_line_stats.prefetches == 2);
+  ASSERT(next_line_stats.useless_prefetches == 1);
+}
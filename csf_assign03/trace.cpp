@@ -0,0 +1,392 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// Initial size of the chunks read from a pipe
+static const size_t CHUNK_SIZE = 1 << 20;
+
+// Longest LEB128 encoding of a delta-encoded access (33 bits)
+static const size_t MAX_VARINT_SIZE = 5;
+
+static const uint64_t BYTES_01 = 0x0101010101010101ULL;
+static const uint64_t BYTES_80 = 0x8080808080808080ULL;
+
+static bool is_hex_digit(char c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+/*
+ * Parse exactly 8 hex digits at once, treating the 8 bytes as the lanes
+ * of a 64-bit word (SWAR). Returns false if any of them isn't a digit.
+ */
+static bool parse_hex8(const char *p, uint32_t &value) {
+  uint64_t x;
+  std::memcpy(&x, p, 8);  // the first digit is the low byte
+  if (x & BYTES_80) return false;
+
+  // with every byte below 0x80, adding 0x80 - c sets the top bit of the
+  // bytes >= c without carrying into the next byte
+  uint64_t lower = x | 0x20 * BYTES_01;
+  uint64_t digit = ((x + (0x80 - '0') * BYTES_01) &
+                    ~(x + (0x80 - '9' - 1) * BYTES_01));
+  uint64_t letter = ((lower + (0x80 - 'a') * BYTES_01) &
+                     ~(lower + (0x80 - 'f' - 1) * BYTES_01));
+  if (((digit | letter) & BYTES_80) != BYTES_80) return false;
+
+  // nibble values: the low 4 bits, plus 9 for letters (bit 6 set)
+  uint64_t v = (x & 0x0F * BYTES_01) + ((x >> 6) & BYTES_01) * 9;
+  // merge pairs of nibbles, then pairs of bytes, then pairs of halves
+  v = ((v << 4) | (v >> 8)) & 0x00FF00FF00FF00FFULL;
+  v = ((v << 8) | (v >> 16)) & 0x0000FFFF0000FFFFULL;
+  v = ((v << 16) | (v >> 32)) & 0xFFFFFFFFULL;
+  value = static_cast<uint32_t>(v);
+  return true;
+}
+
+/*
+ * Parse a text trace line ("l 0x1fffff50 5", without the newline).
+ */
+bool parse_trace_line(const char *begin, const char *end, MemAccess &access) {
+  if (end - begin < 5 || (begin[0] != 'l' && begin[0] != 's') ||
+      begin[1] != ' ' || begin[2] != '0' || (begin[3] | 0x20) != 'x')
+    return false;
+  access.is_store = begin[0] == 's';
+
+  // 8 digits, ending the line or followed by a space like the slow path
+  // requires
+  const char *p = begin + 4;
+  if (end - p >= 8 && (end - p == 8 || p[8] == ' ' || p[8] == '\t') &&
+      parse_hex8(p, access.address))
+    return true;
+
+  // fewer than 8 digits
+  uint32_t value = 0;
+  const char *digits = p;
+  for (; p < end && is_hex_digit(*p); p++) {
+    if (p - digits == 8) return false;  // more than 32 bits
+    value = value * 16 + ((*p & 0x0F) + (*p >> 6) * 9);
+  }
+  if (p == digits || (p < end && *p != ' ' && *p != '\t')) return false;
+  access.address = value;
+  return true;
+}
+
+TraceReader::TraceReader()
+    : fd(-1),
+      owns_fd(false),
+      map(nullptr),
+      map_size(0),
+      cur(nullptr),
+      end(nullptr),
+      at_eof(false),
+      binary(false),
+      flags(0),
+      remaining(0),
+      block_stores(0),
+      block_left(0),
+      prev_address(0),
+      line(0) {}
+
+TraceReader::~TraceReader() {
+  if (map != nullptr) munmap(map, map_size);
+  if (owns_fd) ::close(fd);
+}
+
+bool TraceReader::open(const std::string &path) {
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    error_message = "Cannot open trace " + path;
+    return false;
+  }
+  owns_fd = true;
+  return open(file);
+}
+
+bool TraceReader::open(int fd) {
+  this->fd = fd;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      map = static_cast<char *>(mapped);
+      map_size = st.st_size;
+      madvise(map, map_size, MADV_SEQUENTIAL);
+      cur = map;
+      end = map + map_size;
+      at_eof = true;
+      return start();
+    }
+  }
+  // a pipe (or a file that can't be mapped) is read in chunks
+  buffer.resize(CHUNK_SIZE);
+  cur = end = buffer.data();
+  return start();
+}
+
+/*
+ * Read more of a pipe, keeping the unparsed bytes. Returns false if no
+ * bytes were added, at the end of the input or on an error.
+ */
+bool TraceReader::refill() {
+  if (at_eof) return false;
+  size_t left = end - cur;
+  if (left == buffer.size()) buffer.resize(buffer.size() * 2);
+  std::memmove(buffer.data(), cur, left);
+  cur = buffer.data();
+  end = cur + left;
+
+  for (;;) {
+    ssize_t n = ::read(fd, buffer.data() + left, buffer.size() - left);
+    if (n > 0) {
+      end += n;
+      return true;
+    }
+    if (n == 0) {
+      at_eof = true;
+      return false;
+    }
+    if (errno != EINTR) {
+      error_message = std::string("Cannot read trace: ") + strerror(errno);
+      at_eof = true;
+      return false;
+    }
+  }
+}
+
+/*
+ * Detect the format from the first bytes, and read the binary header.
+ */
+bool TraceReader::start() {
+  while (size_t(end - cur) < sizeof(TraceHeader) && refill()) {
+  }
+  if (failed()) return false;
+  if (size_t(end - cur) < sizeof(TraceHeader) ||
+      std::memcmp(cur, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+    return true;  // text
+
+  TraceHeader header;
+  std::memcpy(&header, cur, sizeof(header));
+  if (header.version != TRACE_VERSION || (header.flags & ~TRACE_DELTA)) {
+    error_message = "Unsupported binary trace version";
+    return false;
+  }
+  cur += sizeof(header);
+  binary = true;
+  flags = header.flags;
+  remaining = header.num_accesses;
+  return true;
+}
+
+/*
+ * Decode up to max accesses. Returns the number decoded, which is 0 at
+ * the end of the trace or if it is invalid (see failed()).
+ */
+size_t TraceReader::read(MemAccess *out, size_t max) {
+  if (failed()) return 0;
+  if (!binary) return read_text(out, max);
+  if (flags & TRACE_DELTA) return read_delta(out, max);
+  return read_plain(out, max);
+}
+
+/*
+ * Get the next line of a text trace as [begin, line_end), without its
+ * newline or a '\r' before it. The line stays valid until the next read.
+ * Returns false at the end of the trace, on an error (see failed()) or
+ * if the trace is binary.
+ */
+bool TraceReader::read_line(const char *&begin, const char *&line_end) {
+  if (failed()) return false;
+  if (binary) {
+    error_message = "Expected a text trace";
+    return false;
+  }
+  const char *nl;
+  while ((nl = static_cast<const char *>(
+              std::memchr(cur, '\n', end - cur))) == nullptr) {
+    if (refill()) continue;
+    if (failed() || cur == end) return false;
+    nl = end;  // last line without a newline
+    break;
+  }
+  line++;
+
+  begin = cur;
+  line_end = nl;
+  if (line_end > begin && line_end[-1] == '\r') line_end--;
+  cur = nl == end ? end : nl + 1;
+  return true;
+}
+
+size_t TraceReader::read_text(MemAccess *out, size_t max) {
+  size_t n = 0;
+  const char *begin, *line_end;
+  while (n < max && read_line(begin, line_end)) {
+    if (line_end == begin) continue;  // skip blank lines
+    if (!parse_trace_line(begin, line_end, out[n])) {
+      error_message = "Invalid trace line " + std::to_string(line);
+      return n;
+    }
+    n++;
+  }
+  return n;
+}
+
+size_t TraceReader::read_plain(MemAccess *out, size_t max) {
+  size_t n = 0;
+  while (n < max && remaining > 0) {
+    if (block_left == 0) {
+      if (size_t(end - cur) < sizeof(uint64_t)) {
+        if (refill()) continue;
+        break;
+      }
+      std::memcpy(&block_stores, cur, sizeof(uint64_t));
+      cur += sizeof(uint64_t);
+      block_left = std::min<uint64_t>(remaining, TRACE_BLOCK);
+    }
+
+    size_t count = std::min<size_t>({block_left, max - n,
+                                     (end - cur) / sizeof(uint32_t)});
+    if (count == 0) {
+      if (refill()) continue;
+      break;
+    }
+    for (size_t i = 0; i < count; i++) {
+      std::memcpy(&out[n + i].address, cur + i * sizeof(uint32_t),
+                  sizeof(uint32_t));
+      out[n + i].is_store = (block_stores >> i) & 1;
+    }
+    block_stores = count < 64 ? block_stores >> count : 0;
+    cur += count * sizeof(uint32_t);
+    n += count;
+    block_left -= count;
+    remaining -= count;
+  }
+  if (n < max && remaining > 0 && !failed())
+    error_message = "Truncated binary trace";
+  return n;
+}
+
+size_t TraceReader::read_delta(MemAccess *out, size_t max) {
+  size_t n = 0;
+  while (n < max && remaining > 0) {
+    if (size_t(end - cur) < MAX_VARINT_SIZE && refill()) continue;
+
+    // decode as many complete varints as are buffered
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(cur);
+    const unsigned char *stop = reinterpret_cast<const unsigned char *>(end);
+    size_t decoded = n;
+    while (decoded < max && decoded - n < remaining) {
+      const unsigned char *q = p;
+      uint64_t value = 0;
+      int shift = 0;
+      while (q < stop && (*q & 0x80) && shift < 28) {
+        value |= uint64_t(*q++ & 0x7F) << shift;
+        shift += 7;
+      }
+      if (q == stop) break;  // incomplete
+      if (*q & 0x80) {
+        error_message = "Invalid binary trace";
+        return decoded;
+      }
+      value |= uint64_t(*q++) << shift;
+      p = q;
+
+      uint32_t zigzag = static_cast<uint32_t>(value >> 1);
+      uint32_t delta = (zigzag >> 1) ^ -(zigzag & 1);
+      prev_address += delta;
+      out[decoded].address = prev_address;
+      out[decoded].is_store = value & 1;
+      decoded++;
+    }
+    remaining -= decoded - n;
+    cur = reinterpret_cast<const char *>(p);
+    if (decoded == n) {  // nothing complete, and nothing more to read
+      if (!failed()) error_message = "Truncated binary trace";
+      return n;
+    }
+    n = decoded;
+  }
+  return n;
+}
+
+bool TraceWriter::open(const std::string &path, bool delta) {
+  this->delta = delta;
+  num_accesses = 0;
+  prev_address = 0;
+  block.clear();
+  bytes.clear();
+  out.open(path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+
+  TraceHeader header = {};  // the count is written by close()
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  return bool(out);
+}
+
+void TraceWriter::write(const MemAccess &access) {
+  num_accesses++;
+  if (!delta) {
+    block.push_back(access);
+    if (block.size() == TRACE_BLOCK) flush_block();
+    return;
+  }
+
+  uint32_t diff = access.address - prev_address;
+  prev_address = access.address;
+  uint32_t zigzag = (diff << 1) ^ -(diff >> 31);
+  uint64_t value = (uint64_t(zigzag) << 1) | access.is_store;
+  while (value >= 0x80) {
+    bytes.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back(static_cast<char>(value));
+  if (bytes.size() >= CHUNK_SIZE) {
+    out.write(bytes.data(), bytes.size());
+    bytes.clear();
+  }
+}
+
+void TraceWriter::flush_block() {
+  uint64_t stores = 0;
+  for (size_t i = 0; i < block.size(); i++)
+    stores |= uint64_t(block[i].is_store) << i;
+  const char *p = reinterpret_cast<const char *>(&stores);
+  bytes.insert(bytes.end(), p, p + sizeof(stores));
+  for (const MemAccess &access : block) {
+    p = reinterpret_cast<const char *>(&access.address);
+    bytes.insert(bytes.end(), p, p + sizeof(access.address));
+  }
+  block.clear();
+  if (bytes.size() >= CHUNK_SIZE) {
+    out.write(bytes.data(), bytes.size());
+    bytes.clear();
+  }
+}
+
+/*
+ * Write the pending accesses and the header. Returns false if the file
+ * couldn't be written.
+ */
+bool TraceWriter::close() {
+  if (!block.empty()) flush_block();
+  if (!bytes.empty()) out.write(bytes.data(), bytes.size());
+  bytes.clear();
+
+  TraceHeader header;
+  std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.flags = delta ? TRACE_DELTA : 0;
+  header.reserved = 0;
+  header.num_accesses = num_accesses;
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+  return !out.fail();
+}
@@ -0,0 +1,139 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// One memory reference of a trace
+struct MemAccess {
+  uint32_t address;
+  bool is_store;
+};
+
+// Binary trace format (see trace_convert), with integers in the byte
+// order of the host that wrote it (traces aren't portable between
+// hosts of different byte order):
+//   header: TraceHeader
+//   plain:  blocks of up to 64 accesses, each a uint64_t bitmap of which
+//           accesses are stores (bit i for access i) followed by the
+//           uint32_t addresses
+//   delta:  one LEB128 varint per access, holding the zigzag encoded
+//           difference to the previous address (starting from 0)
+//           shifted left by one, with the store bit as bit 0
+const char TRACE_MAGIC[4] = {'C', 'S', 'T', 'B'};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_DELTA = 1;  // flag for delta-encoded addresses
+const uint32_t TRACE_BLOCK = 64;
+
+// Number of accesses to decode from a trace at a time
+const size_t TRACE_BATCH = 4096;
+
+struct TraceHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t num_accesses;
+};
+
+/*
+ * Parse a text trace line ("l 0x1fffff50 5", without the newline).
+ */
+bool parse_trace_line(const char *begin, const char *end, MemAccess &access);
+
+// Reads text or binary traces in batches, without allocating per
+// access. Regular files are mapped into memory; pipes are read in
+// chunks.
+class TraceReader {
+ private:
+  int fd;
+  bool owns_fd;
+  char *map;                 // mapping of a regular file, or nullptr
+  size_t map_size;
+  std::vector<char> buffer;  // chunk read from a pipe
+  const char *cur;           // unparsed bytes are [cur, end)
+  const char *end;
+  bool at_eof;
+
+  bool binary;
+  uint32_t flags;
+  uint64_t remaining;      // accesses left in a binary trace
+  uint64_t block_stores;   // store bits of the rest of the plain block
+  uint32_t block_left;     // accesses left in the current plain block
+  uint32_t prev_address;   // of a delta-encoded trace
+  uint64_t line;           // of a text trace
+  std::string error_message;
+
+  bool refill();
+  bool start();
+  size_t read_text(MemAccess *out, size_t max);
+  size_t read_plain(MemAccess *out, size_t max);
+  size_t read_delta(MemAccess *out, size_t max);
+
+ public:
+  TraceReader();
+  ~TraceReader();
+  TraceReader(const TraceReader &) = delete;
+  TraceReader &operator=(const TraceReader &) = delete;
+
+  bool open(int fd);                    // e.g. standard input
+  bool open(const std::string &path);
+  size_t read(MemAccess *out, size_t max);  // 0 at the end or on error
+  bool read_line(const char *&begin, const char *&line_end);
+  uint64_t line_number() const { return line; }  // of the last line read
+  bool is_binary() const { return binary; }
+  bool failed() const { return !error_message.empty(); }
+  const std::string &error() const { return error_message; }
+};
+
+/*
+ * Run a batch of accesses through a cache, or anything else with load
+ * and save.
+ */
+template <class C>
+void simulate(C &cache, const MemAccess *batch, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (batch[i].is_store) {
+      cache.save(batch[i].address);
+    } else {
+      cache.load(batch[i].address);
+    }
+  }
+}
+
+/*
+ * Run the rest of a trace through a cache. Returns whether the trace was
+ * read without errors.
+ */
+template <class C>
+bool simulate_trace(C &cache, TraceReader &trace) {
+  std::vector<MemAccess> batch(TRACE_BATCH);
+  size_t count;
+  while ((count = trace.read(batch.data(), batch.size())) > 0)
+    simulate(cache, batch.data(), count);
+  return !trace.failed();
+}
+
+// Writes binary traces. The file must be seekable, since the number of
+// accesses in the header is filled in by close().
+class TraceWriter {
+ private:
+  std::ofstream out;
+  bool delta;
+  uint64_t num_accesses;
+  uint32_t prev_address;
+  std::vector<MemAccess> block;  // pending accesses of a plain block
+  std::vector<char> bytes;       // pending output
+
+  void flush_block();
+
+ public:
+  TraceWriter() : delta(false), num_accesses(0), prev_address(0) {}
+  bool open(const std::string &path, bool delta);
+  void write(const MemAccess &access);
+  bool close();
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+
+#include "trace.h"
+
+// Convert a text or binary trace (from a file or standard input) into
+// the binary trace format, optionally delta-encoded, or back to text.
+
+int main(int argc, char **argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::string format = "plain";
+  if (!args.empty() && args[0].compare(0, 9, "--format=") == 0) {
+    format = args[0].substr(9);
+    args.erase(args.begin());
+  }
+  if (args.size() != 2 ||
+      (format != "plain" && format != "delta" && format != "text")) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--format=plain|delta|text] <input trace|-> <output trace>"
+              << std::endl;
+    return 1;
+  }
+
+  TraceReader trace;
+  bool ok = args[0] == "-" ? trace.open(STDIN_FILENO) : trace.open(args[0]);
+  if (!ok) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+
+  TraceWriter writer;
+  FILE *text = nullptr;
+  if (format == "text") {
+    text = fopen(args[1].c_str(), "w");
+    ok = text != nullptr;
+  } else {
+    ok = writer.open(args[1], format == "delta");
+  }
+  if (!ok) {
+    std::cerr << "Error: Cannot write " << args[1] << std::endl;
+    return 1;
+  }
+
+  std::vector<MemAccess> batch(TRACE_BATCH);
+  uint64_t total = 0;
+  size_t count;
+  while ((count = trace.read(batch.data(), batch.size())) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (text != nullptr) {
+        // the access size isn't stored in binary traces
+        fprintf(text, "%c 0x%08x 0\n", batch[i].is_store ? 's' : 'l',
+                batch[i].address);
+      } else {
+        writer.write(batch[i]);
+      }
+    }
+    total += count;
+  }
+  ok = text != nullptr ? fclose(text) == 0 : writer.close();
+  if (trace.failed()) {
+    std::cerr << "Error: " << trace.error() << std::endl;
+    return 1;
+  }
+  if (!ok) {
+    std::cerr << "Error: Cannot write " << args[1] << std::endl;
+    return 1;
+  }
+  std::cerr << "Converted " << total << " accesses" << std::endl;
+  return 0;
+}